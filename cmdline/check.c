@@ -25,12 +25,29 @@
 #include "state.h"
 #include "parity.h"
 #include "handle.h"
+#include "io.h"
 #include "raid/raid.h"
 #include "raid/combo.h"
 
 /****************************************************************************/
 /* check */
 
+/*
+ * Access to the file flags shared with the io threads.
+ *
+ * The io threads read the flags, and set FILE_IS_MISSING, while
+ * the main thread changes them, so in check they are accessed atomically.
+ */
+static inline int check_flag_has(const struct snapraid_file* file, unsigned mask)
+{
+	return (__atomic_load_n(&file->flag, __ATOMIC_RELAXED) & mask) == mask;
+}
+
+static inline void check_flag_set(struct snapraid_file* file, unsigned mask)
+{
+	__atomic_fetch_or(&file->flag, mask, __ATOMIC_RELAXED);
+}
+
 /**
  * A block that failed the hash check, or that was deleted.
  */
@@ -60,7 +77,6 @@ struct failed_struct {
 	struct snapraid_disk* disk; /**< The failed disk. */
 	struct snapraid_file* file; /**< The failed file. 0 for DELETED block. */
 	block_off_t file_pos; /**< Offset inside the file */
-	struct snapraid_handle* handle; /**< The handle containing the failed block, or 0 for a DELETED block */
 };
 
 /**
@@ -593,6 +609,9 @@ static int repair(struct snapraid_state* state, int rehash, unsigned pos, unsign
  * This works with the assumption to always process the whole files to
  * fix. This assumption is not always correct, and in such case we have to
  * skip the whole postprocessing. And example, is when fixing only bad blocks.
+ *
+ * When fixing, it's called by the data writer of each disk, passing
+ * only its own handle.
  */
 static int file_post(struct snapraid_state* state, int fix, unsigned i, struct snapraid_handle* handle, unsigned diskmax)
 {
@@ -639,8 +658,8 @@ static int file_post(struct snapraid_state* state, int fix, unsigned i, struct s
 		}
 
 		/* if the file is excluded, we have nothing to adjust as the file is never written */
-		if (file_flag_has(file, FILE_IS_EXCLUDED)
-			|| (state->opt.syncedonly && file_flag_has(file, FILE_IS_UNSYNCED))) {
+		if (check_flag_has(file, FILE_IS_EXCLUDED)
+			|| (state->opt.syncedonly && check_flag_has(file, FILE_IS_UNSYNCED))) {
 			/* nothing to do, but close the file */
 			goto close_and_continue;
 		}
@@ -649,10 +668,10 @@ static int file_post(struct snapraid_state* state, int fix, unsigned i, struct s
 		if (fix) {
 			/* mark that we finished with this file */
 			/* to identify later any NOT finished ones */
-			file_flag_set(file, FILE_IS_FINISHED);
+			check_flag_set(file, FILE_IS_FINISHED);
 
 			/* if the file is damaged, meaning that a fix failed */
-			if (file_flag_has(file, FILE_IS_DAMAGED)) {
+			if (check_flag_has(file, FILE_IS_DAMAGED)) {
 				/* rename it to .unrecoverable */
 				char path_to[PATH_MAX];
 
@@ -687,7 +706,7 @@ static int file_post(struct snapraid_state* state, int fix, unsigned i, struct s
 			}
 
 			/* if the file is not fixed, meaning that it is untouched */
-			if (!file_flag_has(file, FILE_IS_FIXED)) {
+			if (!check_flag_has(file, FILE_IS_FIXED)) {
 				/* nothing to do, but close the file */
 				goto close_and_continue;
 			}
@@ -744,7 +763,7 @@ static int file_post(struct snapraid_state* state, int fix, unsigned i, struct s
 				if (ret == -1) {
 					/* LCOV_EXCL_START */
 					/* mark the file as damaged */
-					file_flag_set(file, FILE_IS_DAMAGED);
+					check_flag_set(file, FILE_IS_DAMAGED);
 					log_fatal("WARNING! Without a working data disk, it isn't possible to fix errors on it.\n");
 					return -1;
 					/* LCOV_EXCL_STOP */
@@ -755,7 +774,7 @@ static int file_post(struct snapraid_state* state, int fix, unsigned i, struct s
 		} else {
 			/* we are not fixing, but only checking */
 			/* print just the final status */
-			if (file_flag_has(file, FILE_IS_DAMAGED)) {
+			if (check_flag_has(file, FILE_IS_DAMAGED)) {
 				if (state->opt.auditonly) {
 					log_tag("status:damaged:%s:%s\n", disk->name, esc_tag(file->sub, esc_buffer));
 					msg_info("damaged %s\n", fmt_term(disk, file->sub, esc_buffer));
@@ -763,7 +782,7 @@ static int file_post(struct snapraid_state* state, int fix, unsigned i, struct s
 					log_tag("status:unrecoverable:%s:%s\n", disk->name, esc_tag(file->sub, esc_buffer));
 					msg_info("unrecoverable %s\n", fmt_term(disk, file->sub, esc_buffer));
 				}
-			} else if (file_flag_has(file, FILE_IS_FIXED)) {
+			} else if (check_flag_has(file, FILE_IS_FIXED)) {
 				log_tag("status:recoverable:%s:%s\n", disk->name, esc_tag(file->sub, esc_buffer));
 				msg_info("recoverable %s\n", fmt_term(disk, file->sub, esc_buffer));
 			} else {
@@ -779,7 +798,10 @@ close_and_continue:
 		/* if the opened file is the correct one, close it */
 		/* in case of excluded and fragmented files it's possible */
 		/* that the opened file is not the current one */
-		if (handle[j].file == file) {
+		/* when only checking, the handles are owned by the reading threads */
+		/* that close the files when switching to the next one */
+		/* when fixing, the handle is the one of the data writer */
+		if (fix && handle[j].file == file) {
 			/* ensure to close the file just after finishing with it */
 			/* to avoid to keep it open without any possible use */
 			ret = handle_close(&handle[j]);
@@ -796,11 +818,39 @@ close_and_continue:
 	return 0;
 }
 
+/**
+ * Check plan to use.
+ */
+struct snapraid_plan {
+	struct snapraid_state* state;
+	int fix; /**< If we are fixing. */
+	unsigned handle_max;
+	struct snapraid_handle* handle_map;
+	struct snapraid_parity_handle** parity_ptr; /**< Accessible parities, or 0. */
+};
+
+/**
+ * Comparison function for sorting by index.
+ */
+static int failed_compare_by_index(const void* void_a, const void* void_b)
+{
+	const struct failed_struct* a = void_a;
+	const struct failed_struct* b = void_b;
+
+	if (a->index < b->index)
+		return -1;
+	if (a->index > b->index)
+		return 1;
+	return 0;
+}
+
 /**
  * Check if we have to process the specified block index ::i.
  */
-static int block_is_enabled(struct snapraid_state* state, block_off_t i, struct snapraid_handle* handle, unsigned diskmax)
+static int block_is_enabled(void* void_plan, block_off_t i)
 {
+	struct snapraid_plan* plan = void_plan;
+	struct snapraid_state* state = plan->state;
 	snapraid_info info;
 	unsigned j;
 	unsigned l;
@@ -825,20 +875,21 @@ static int block_is_enabled(struct snapraid_state* state, block_off_t i, struct
 	}
 
 	/* otherwise include only used blocks */
-	for (j = 0; j < diskmax; ++j) {
+	for (j = 0; j < plan->handle_max; ++j) {
 		struct snapraid_block* block;
+		struct snapraid_disk* disk = plan->handle_map[j].disk;
 
 		/* if no disk, nothing to check */
-		if (!handle[j].disk)
+		if (!disk)
 			continue;
 
-		block = fs_par2block_find(handle[j].disk, i);
+		block = fs_par2block_find(disk, i);
 
 		/* try to recover all files, even the ones without hash */
 		/* because in some cases we can recover also them */
 		if (block_has_file(block)) {
-			struct snapraid_file* file = fs_par2file_get(handle[j].disk, i, 0);
-			if (!file_flag_has(file, FILE_IS_EXCLUDED)) { /* only if the file is not filtered out */
+			struct snapraid_file* file = fs_par2file_get(disk, i, 0);
+			if (!check_flag_has(file, FILE_IS_EXCLUDED)) { /* only if the file is not filtered out */
 				return 1;
 			}
 		}
@@ -847,14 +898,341 @@ static int block_is_enabled(struct snapraid_state* state, block_off_t i, struct
 	return 0;
 }
 
-static int state_check_process(struct snapraid_state* state, int fix, struct snapraid_parity_handle** parity, block_off_t blockstart, block_off_t blockmax)
+/**
+ * Read a data block.
+ *
+ * The file flags are changed by the main thread while this function runs
+ * in the io threads, so they are accessed only with the atomic
+ * check_flag_*() functions. The files failed to open are marked here
+ * with FILE_IS_MISSING.
+ * When fixing, the files are created, but they are written only by
+ * check_data_writer(), using a different handle.
+ */
+static void check_data_reader(struct snapraid_worker* worker, struct snapraid_task* task)
 {
+	struct snapraid_io* io = worker->io;
+	struct snapraid_state* state = io->state;
+	struct snapraid_plan* plan = io->block_arg;
+	struct snapraid_handle* handle = worker->handle;
+	struct snapraid_disk* disk = handle->disk;
+	block_off_t blockcur = task->position;
+	unsigned char* buffer = task->buffer;
+	struct snapraid_file* file;
+	int ret;
+	char esc_buffer[ESC_MAX];
+
+	/* if the disk position is not used */
+	if (!disk) {
+		/* use an empty block */
+		memset(buffer, 0, state->block_size);
+		task->state = TASK_STATE_DONE;
+		return;
+	}
+
+	/* get the block */
+	task->block = fs_par2block_find(disk, blockcur);
+
+	/* if the block has no file, meaning that it's EMPTY or DELETED */
+	if (!block_has_file(task->block)) {
+		/* use an empty block */
+		memset(buffer, 0, state->block_size);
+		task->state = TASK_STATE_DONE;
+		return;
+	}
+
+	/* get the file of this block */
+	file = fs_par2file_get(disk, blockcur, &task->file_pos);
+	task->file = file;
+
+	/* if we are only hashing, we can skip excluded files and don't even read them */
+	if (state->opt.auditonly && check_flag_has(file, FILE_IS_EXCLUDED)) {
+		/* use an empty block */
+		/* in true, this is unnecessary, because we are not checking any parity */
+		/* but we keep it for completeness */
+		memset(buffer, 0, state->block_size);
+		task->state = TASK_STATE_DONE;
+		return;
+	}
+
+	/* if the file is closed or different than the current one */
+	if (handle->file == 0 || handle->file != file) {
+		/* close the old one, if any */
+		ret = handle_close(handle);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			log_tag("error:%u:%s:%s: Close error. %s\n", blockcur, disk->name, esc_tag(handle->file->sub, esc_buffer), strerror(errno));
+			log_fatal("DANGER! Unexpected close error in a data disk.\n");
+			log_fatal("Stopping at block %u\n", blockcur);
+			task->state = TASK_STATE_ERROR;
+			return;
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* if fixing, and the file is not excluded, we must open for writing */
+		if (plan->fix && !check_flag_has(file, FILE_IS_EXCLUDED)) {
+			/* if fixing, create the file, open for writing and resize if required */
+			ret = handle_create(handle, file, state->file_mode);
+			if (ret == -1) {
+				/* LCOV_EXCL_START */
+				if (errno == EACCES) {
+					log_fatal("WARNING! Please give write permission to the file.\n");
+				} else {
+					log_fatal("DANGER! Without a working data disk, it isn't possible to fix errors on it.\n");
+				}
+				log_fatal("Stopping at block %u\n", blockcur);
+				task->state = TASK_STATE_ERROR;
+				return;
+				/* LCOV_EXCL_STOP */
+			}
+
+			/* check if the file was just created */
+			if (handle->created != 0) {
+				/* if fragmented, it may be reopened, so remember that the file */
+				/* was originally missing */
+				check_flag_set(file, FILE_IS_CREATED);
+			}
+		} else {
+			/* open the file only for reading */
+			if (!check_flag_has(file, FILE_IS_MISSING))
+				ret = handle_open(handle, file, state->file_mode,
+					log_error, state->opt.expected_missing ? log_expected : 0);
+			else
+				ret = -1; /* if the file is missing, we cannot open it */
+			if (ret == -1) {
+				log_tag("error:%u:%s:%s: Open error at position %u\n", blockcur, disk->name, esc_tag(file->sub, esc_buffer), task->file_pos);
+
+				/* mark the file as missing, to avoid to retry to open it again */
+				/* note that this can be done only if we are not fixing it */
+				/* otherwise, it could be recreated */
+				check_flag_set(file, FILE_IS_MISSING);
+
+				task->state = TASK_STATE_ERROR_CONTINUE;
+				return;
+			}
+		}
+
+		/* store the path of the opened file */
+		pathcpy(task->path, sizeof(task->path), handle->path);
+
+		/* check if the file is changed */
+		if (handle->st.st_size != file->size
+			|| handle->st.st_mtime != file->mtime_sec
+			|| STAT_NSEC(&handle->st) != file->mtime_nsec
+		        /* don't check the inode to support file-system without persistent inodes */
+		) {
+			task->is_timestamp_different = 1;
+		}
+
+		/* check if the file is larger */
+		if (handle->st.st_size > file->size) {
+			task->is_size_larger = 1;
+		}
+	}
+
+	/* read from the file, and compute the hash of the block */
+	task->read_size = io_handle_read_hash(worker, task,
+		log_error, state->opt.expected_missing ? log_expected : 0);
+	if (task->read_size == -1) {
+		log_tag("error:%u:%s:%s: Read error at position %u\n", blockcur, disk->name, esc_tag(file->sub, esc_buffer), task->file_pos);
+		task->state = TASK_STATE_IOERROR_CONTINUE;
+		return;
+	}
+
+	task->state = TASK_STATE_DONE;
+}
+
+/**
+ * Read a parity block.
+ */
+static void check_parity_reader(struct snapraid_worker* worker, struct snapraid_task* task)
+{
+	struct snapraid_io* io = worker->io;
+	struct snapraid_state* state = io->state;
+	struct snapraid_plan* plan = io->block_arg;
+	struct snapraid_parity_handle* parity_handle = worker->parity_handle;
+	unsigned level = parity_handle->level;
+	block_off_t blockcur = task->position;
+	unsigned char* buffer = task->buffer;
+	int ret;
+
+	/* if the parity is not accessible, there is nothing to read */
+	if (!plan->parity_ptr[level]) {
+		task->state = TASK_STATE_EMPTY;
+		return;
+	}
+
+	/* read the parity */
+	ret = parity_read(parity_handle, blockcur, buffer, state->block_size, log_error);
+	if (ret == -1) {
+		log_tag("parity_error:%u:%s: Read error\n", blockcur, lev_config_name(level));
+		task->state = TASK_STATE_ERROR_CONTINUE;
+		return;
+	}
+
+	task->state = TASK_STATE_DONE;
+}
+
+/**
+ * Write a recovered data block, and post process the files.
+ *
+ * It runs in the io threads, after the main thread completed the position,
+ * and it does all the changes at the data disk in the order the main thread
+ * used them when the io was in mono thread mode: the post process of the
+ * skipped positions, the truncate, the write of the recovered block, and
+ * the post process of the position.
+ */
+static void check_data_writer(struct snapraid_worker* worker, struct snapraid_task* task)
+{
+	struct snapraid_io* io = worker->io;
+	struct snapraid_state* state = io->state;
+	struct snapraid_handle* handle = worker->handle;
+	struct snapraid_disk* disk = handle->disk;
+	struct snapraid_file* file = task->file;
+	block_off_t blockcur = task->position;
+	block_off_t i;
+	int ret;
+	char esc_buffer[ESC_MAX];
+
+	/* post process the files of the skipped positions */
+	for (i = task->position_start; i < blockcur && i < io->block_max; ++i) {
+		ret = file_post(state, 1, i, handle, 1);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			log_fatal("Stopping at block %u\n", i);
+			task->state = TASK_STATE_ERROR;
+			return;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	/* if we reached the end */
+	if (blockcur >= io->block_max) {
+		task->state = TASK_STATE_DONE;
+		return;
+	}
+
+	/* if there is something to write, and the file is closed or different than the current one */
+	if ((task->is_truncate || task->is_write) && handle->file != file) {
+		/* close the old one, if any */
+		ret = handle_close(handle);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			log_tag("error:%u:%s:%s: Close error. %s\n", blockcur, disk->name, esc_tag(handle->file->sub, esc_buffer), strerror(errno));
+			log_fatal("DANGER! Unexpected close error in a data disk.\n");
+			log_fatal("Stopping at block %u\n", blockcur);
+			task->state = TASK_STATE_ERROR;
+			return;
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* open the file for writing, usually already created by the reader */
+		ret = handle_create(handle, file, state->file_mode);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			if (errno == EACCES) {
+				log_fatal("WARNING! Please give write permission to the file.\n");
+			} else {
+				log_fatal("DANGER! Without a working data disk, it isn't possible to fix errors on it.\n");
+			}
+			log_fatal("Stopping at block %u\n", blockcur);
+			task->state = TASK_STATE_ERROR;
+			return;
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* if fragmented, the file may be renamed and created again */
+		if (handle->created != 0)
+			check_flag_set(file, FILE_IS_CREATED);
+	}
+
+	if (task->is_truncate) {
+		ret = handle_truncate(handle, file);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			log_fatal("DANGER! Unexpected truncate error in a data disk, it isn't possible to fix.\n");
+			log_fatal("Stopping at block %u\n", blockcur);
+			task->state = TASK_STATE_ERROR;
+			return;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	if (task->is_write) {
+		ret = handle_write(handle, task->file_pos, task->buffer, state->block_size);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			/* mark the file as damaged */
+			check_flag_set(file, FILE_IS_DAMAGED);
+
+			if (errno == EACCES) {
+				log_fatal("WARNING! Please give write permission to the file.\n");
+			} else {
+				/* we do not use DANGER because it could be ENOSPC which is not always correctly reported */
+				log_fatal("WARNING! Without a working data disk, it isn't possible to fix errors on it.\n");
+			}
+			log_fatal("Stopping at block %u\n", blockcur);
+			task->state = TASK_STATE_ERROR;
+			return;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	/* post process the files of the position */
+	ret = file_post(state, 1, blockcur, handle, 1);
+	if (ret == -1) {
+		/* LCOV_EXCL_START */
+		log_fatal("Stopping at block %u\n", blockcur);
+		task->state = TASK_STATE_ERROR;
+		return;
+		/* LCOV_EXCL_STOP */
+	}
+
+	task->state = TASK_STATE_DONE;
+}
+
+/**
+ * Complete the writes of the data writers at the current position.
+ *
+ * \return 0 on success, or -1 if a data writer failed.
+ */
+static int check_data_write(struct snapraid_state* state, struct snapraid_io* io, block_off_t blockcur, struct snapraid_handle* handle, unsigned diskmax, unsigned* waiting_map, unsigned* waiting_mac)
+{
+	int writer_error[IO_WRITER_ERROR_MAX];
+	unsigned j;
+
+	/* until now is misc */
+	state_usage_misc(state);
+
+	for (j = 0; j < diskmax; ++j) {
+		unsigned diskcur;
+
+		io_data_write(io, &diskcur, waiting_map, waiting_mac);
+
+		/* until now is disk */
+		state_usage_disk(state, handle, waiting_map, *waiting_mac);
+	}
+
+	io_write_next(io, blockcur, 0, writer_error);
+
+	/* the data writers stop only with errors already reported */
+	if (writer_error[TASK_STATE_ERROR - IO_WRITER_ERROR_BASE] != 0)
+		return -1;
+
+	return 0;
+}
+
+static int state_check_process(struct snapraid_state* state, int fix, struct snapraid_parity_handle* parity_handle, struct snapraid_parity_handle** parity, block_off_t blockstart, block_off_t blockmax)
+{
+	struct snapraid_io io;
+	struct snapraid_plan plan;
 	struct snapraid_handle* handle;
+	struct snapraid_handle* write_handle;
 	unsigned diskmax;
 	block_off_t i;
+	block_off_t blockcur;
 	unsigned j;
-	void* buffer_alloc;
-	void** buffer;
+	void* zero_alloc;
+	void* buffer_zero;
 	unsigned buffermax;
 	int ret;
 	data_off_t countsize;
@@ -866,63 +1244,111 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 	struct failed_struct* failed;
 	unsigned* failed_map;
 	unsigned l;
+	unsigned* waiting_map;
+	unsigned waiting_mac;
+	int io_stopped;
 	char esc_buffer[ESC_MAX];
 	char esc_buffer_alt[ESC_MAX];
 
 	handle = handle_mapping(state, &diskmax);
 
-	/* we need 1 * data + 2 * parity + 1 * zero */
-	buffermax = diskmax + 2 * state->level + 1;
+	/* when fixing, the data writers use their own handles */
+	write_handle = fix ? handle_mapping(state, &diskmax) : 0;
+
+	/* we need 1 * data + 2 * parity, and 1 * data to write if fixing */
+	buffermax = diskmax + 2 * state->level;
+	if (fix)
+		buffermax += diskmax;
 
-	buffer = malloc_nofail_vector_align(diskmax, buffermax, state->block_size, &buffer_alloc);
-	if (!state->opt.skip_self)
-		mtest_vector(buffermax, state->block_size, buffer);
+	/* initialize the io threads */
+	/* when fixing, the recovered blocks are written by the data writers */
+	/* that also close, rename and set the time of the files */
+	io_init(&io, state, state->opt.io_cache, buffermax, check_data_reader, fix ? check_data_writer : 0, handle, write_handle, diskmax, check_parity_reader, 0, parity_handle, state->opt.auditonly ? 0 : state->level);
 
-	/* fill up the zero buffer */
-	memset(buffer[buffermax - 1], 0, state->block_size);
-	raid_zero(buffer[buffermax - 1]);
+	/* allocate and fill the zero buffer */
+	buffer_zero = malloc_nofail_align(state->block_size, &zero_alloc);
+	memset(buffer_zero, 0, state->block_size);
+	raid_zero(buffer_zero);
 
 	failed = malloc_nofail(diskmax * sizeof(struct failed_struct));
 	failed_map = malloc_nofail(diskmax * sizeof(unsigned));
 
+	/* possibly waiting disks */
+	waiting_mac = diskmax > RAID_PARITY_MAX ? diskmax : RAID_PARITY_MAX;
+	waiting_map = malloc_nofail(waiting_mac * sizeof(unsigned));
+
 	error = 0;
 	unrecoverable_error = 0;
 	recovered_error = 0;
 
-	/* first count the number of blocks to process */
-	countmax = 0;
-	for (i = blockstart; i < blockmax; ++i) {
-		if (!block_is_enabled(state, i, handle, diskmax))
-			continue;
-		++countmax;
-	}
+	/* first select the blocks to process */
+	plan.state = state;
+	plan.fix = fix;
+	plan.handle_max = diskmax;
+	plan.handle_map = handle;
+	plan.parity_ptr = parity;
+	countmax = io_position_map(&io, blockstart, blockmax, &block_is_enabled, &plan);
+
+	/* drop until now */
+	state_usage_waste(state);
 
 	/* check all the blocks in files */
 	countsize = 0;
 	countpos = 0;
+
+	/* start all the worker threads */
+	io_start(&io, blockstart, blockmax, &block_is_enabled, &plan);
+	io_stopped = 0;
+
+	/* next position to post process */
+	i = blockstart;
+
 	state_progress_begin(state, blockstart, blockmax, countmax);
-	for (i = blockstart; i < blockmax; ++i) {
+	while (1) {
 		unsigned failed_count;
 		int valid_parity;
 		int used_parity;
 		snapraid_info info;
 		int rehash;
+		void** buffer;
 
-		if (!block_is_enabled(state, i, handle, diskmax)) {
-			/* post process the files */
-			ret = file_post(state, fix, i, handle, diskmax);
-			if (ret == -1) {
+		/* go to the next block */
+		blockcur = io_read_next(&io, &buffer);
+
+		if (fix) {
+			/* start the writes, the data writers also post process the files of the skipped blocks */
+			io_write_preset(&io, blockcur, 0);
+			for (j = 0; j < diskmax; ++j)
+				io_write_task(&io, j)->position_start = i;
+		} else {
+			/* post process the files of the skipped blocks */
+			while (i < blockcur && i < blockmax) {
+				ret = file_post(state, fix, i, handle, diskmax);
+				if (ret == -1) {
+					/* LCOV_EXCL_START */
+					log_fatal("Stopping at block %u\n", i);
+					++unrecoverable_error;
+					goto bail;
+					/* LCOV_EXCL_STOP */
+				}
+				++i;
+			}
+		}
+
+		if (blockcur >= blockmax) {
+			/* complete the post process of the skipped blocks */
+			if (fix && check_data_write(state, &io, blockcur, handle, diskmax, waiting_map, &waiting_mac) != 0) {
 				/* LCOV_EXCL_START */
-				log_fatal("Stopping at block %u\n", i);
 				++unrecoverable_error;
 				goto bail;
 				/* LCOV_EXCL_STOP */
 			}
-
-			/* and now continue with the next block */
-			continue;
+			break;
 		}
 
+		/* until now is scheduling */
+		state_usage_sched(state);
+
 		/* If we have valid parity, and it makes sense to check its content. */
 		/* If we already know that the parity is invalid, we just read the file */
 		/* but we don't report parity errors */
@@ -937,36 +1363,47 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 		failed_count = 0;
 
 		/* get block specific info */
-		info = info_get(&state->infoarr, i);
+		info = info_get(&state->infoarr, blockcur);
 
 		/* if we have to use the old hash */
 		rehash = info_get_rehash(info);
 
 		/* for each disk, process the block */
 		for (j = 0; j < diskmax; ++j) {
+			struct snapraid_task* task;
 			int read_size;
-			unsigned char hash[HASH_MAX];
 			struct snapraid_disk* disk;
 			struct snapraid_block* block;
 			struct snapraid_file* file;
 			block_off_t file_pos;
 			unsigned block_state;
+			unsigned diskcur;
+
+			/* until now is misc */
+			state_usage_misc(state);
+
+			/* get the next task */
+			task = io_data_read(&io, &diskcur, waiting_map, &waiting_mac);
+
+			/* until now is disk */
+			state_usage_disk(state, handle, waiting_map, waiting_mac);
+
+			/* get the task results */
+			disk = task->disk;
+			block = task->block;
+			file = task->file;
+			file_pos = task->file_pos;
+			read_size = task->read_size;
 
 			/* if the disk position is not used */
-			disk = handle[j].disk;
-			if (!disk) {
-				/* use an empty block */
-				memset(buffer[j], 0, state->block_size);
+			if (!disk)
 				continue;
-			}
 
 			/* if the disk block is not used */
-			block = fs_par2block_find(disk, i);
-			if (block == BLOCK_NULL) {
-				/* use an empty block */
-				memset(buffer[j], 0, state->block_size);
+			if (block == BLOCK_NULL)
 				continue;
-			}
+
+			state_usage_file(state, disk, file);
 
 			/* get the state of the block */
 			block_state = block_state_get(block);
@@ -981,19 +1418,15 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 
 			/* if the block is DELETED */
 			if (block_state == BLOCK_STATE_DELETED) {
-				/* use an empty block */
-				memset(buffer[j], 0, state->block_size);
-
 				/* store it in the failed set, because potentially */
 				/* the parity may be still computed with the previous content */
 				failed[failed_count].is_bad = 0; /* note that is_bad==0 <=> file==0 */
 				failed[failed_count].is_outofdate = 0;
-				failed[failed_count].index = j;
+				failed[failed_count].index = diskcur;
 				failed[failed_count].block = block;
 				failed[failed_count].disk = disk;
 				failed[failed_count].file = 0;
 				failed[failed_count].file_pos = 0;
-				failed[failed_count].handle = 0;
 				++failed_count;
 				continue;
 			}
@@ -1001,122 +1434,45 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 			/* here we are sure that the parity is used by a file */
 			used_parity = 1;
 
-			/* get the file of this block */
-			file = fs_par2file_get(disk, i, &file_pos);
-
 			/* if we are only hashing, we can skip excluded files and don't even read them */
-			if (state->opt.auditonly && file_flag_has(file, FILE_IS_EXCLUDED)) {
-				/* use an empty block */
-				/* in true, this is unnecessary, because we are not checking any parity */
-				/* but we keep it for completeness */
-				memset(buffer[j], 0, state->block_size);
+			if (state->opt.auditonly && check_flag_has(file, FILE_IS_EXCLUDED))
 				continue;
-			}
 
-			/* if the file is closed or different than the current one */
-			if (handle[j].file == 0 || handle[j].file != file) {
-				/* close the old one, if any */
-				ret = handle_close(&handle[j]);
-				if (ret == -1) {
-					/* LCOV_EXCL_START */
-					log_tag("error:%u:%s:%s: Close error. %s\n", i, disk->name, esc_tag(handle[j].file->sub, esc_buffer), strerror(errno));
-					log_fatal("DANGER! Unexpected close error in a data disk.\n");
-					log_fatal("Stopping at block %u\n", i);
-					++unrecoverable_error;
-					goto bail;
-					/* LCOV_EXCL_STOP */
-				}
-
-				/* if fixing, and the file is not excluded, we must open for writing */
-				if (fix && !file_flag_has(file, FILE_IS_EXCLUDED)) {
-					/* if fixing, create the file, open for writing and resize if required */
-					ret = handle_create(&handle[j], file, state->file_mode);
-					if (ret == -1) {
-						/* LCOV_EXCL_START */
-						if (errno == EACCES) {
-							log_fatal("WARNING! Please give write permission to the file.\n");
-						} else {
-							log_fatal("DANGER! Without a working data disk, it isn't possible to fix errors on it.\n");
-						}
-						log_fatal("Stopping at block %u\n", i);
-						++unrecoverable_error;
-						goto bail;
-						/* LCOV_EXCL_STOP */
-					}
-
-					/* check if the file was just created */
-					if (handle[j].created != 0) {
-						/* if fragmented, it may be reopened, so remember that the file */
-						/* was originally missing */
-						file_flag_set(file, FILE_IS_CREATED);
-					}
-				} else {
-					/* open the file only for reading */
-					if (!file_flag_has(file, FILE_IS_MISSING))
-						ret = handle_open(&handle[j], file, state->file_mode,
-							log_error, state->opt.expected_missing ? log_expected : 0);
-					else
-						ret = -1; /* if the file is missing, we cannot open it */
-					if (ret == -1) {
-						/* save the failed block for the check/fix */
-						failed[failed_count].is_bad = 1;
-						failed[failed_count].is_outofdate = 0;
-						failed[failed_count].index = j;
-						failed[failed_count].block = block;
-						failed[failed_count].disk = disk;
-						failed[failed_count].file = file;
-						failed[failed_count].file_pos = file_pos;
-						failed[failed_count].handle = &handle[j];
-						++failed_count;
-
-						log_tag("error:%u:%s:%s: Open error at position %u\n", i, disk->name, esc_tag(file->sub, esc_buffer), file_pos);
-						++error;
-
-						/* mark the file as missing, to avoid to retry to open it again */
-						/* note that this can be done only if we are not fixing it */
-						/* otherwise, it could be recreated */
-						file_flag_set(file, FILE_IS_MISSING);
-						continue;
-					}
-				}
-
-				/* if it's the first open, and not excluded */
-				if (!file_flag_has(file, FILE_IS_OPENED)
-					&& !file_flag_has(file, FILE_IS_EXCLUDED)) {
+			/* handle error conditions */
+			if (task->state == TASK_STATE_ERROR) {
+				/* LCOV_EXCL_START */
+				++unrecoverable_error;
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
 
-					/* check if the file is changed */
-					if (handle[j].st.st_size != file->size
-						|| handle[j].st.st_mtime != file->mtime_sec
-						|| STAT_NSEC(&handle[j].st) != file->mtime_nsec
-					        /* don't check the inode to support file-system without persistent inodes */
-					) {
-						/* report that the file is not synced */
-						file_flag_set(file, FILE_IS_UNSYNCED);
-					}
+			/* if it's the first open, and not excluded */
+			if (!check_flag_has(file, FILE_IS_OPENED)
+				&& !check_flag_has(file, FILE_IS_EXCLUDED)
+				&& task->state != TASK_STATE_ERROR_CONTINUE
+			) {
+				/* if the file is changed */
+				if (task->is_timestamp_different) {
+					/* report that the file is not synced */
+					check_flag_set(file, FILE_IS_UNSYNCED);
 				}
 
-				/* if it's the first open, and not excluded and larger */
-				if (!file_flag_has(file, FILE_IS_OPENED)
-					&& !file_flag_has(file, FILE_IS_EXCLUDED)
-					&& !(state->opt.syncedonly && file_flag_has(file, FILE_IS_UNSYNCED))
-					&& handle[j].st.st_size > file->size
+				/* if the file is larger */
+				if (task->is_size_larger
+					&& !(state->opt.syncedonly && check_flag_has(file, FILE_IS_UNSYNCED))
 				) {
-					log_error("File '%s' is larger than expected.\n", handle[j].path);
-					log_tag("error:%u:%s:%s: Size error\n", i, disk->name, esc_tag(file->sub, esc_buffer));
+					log_error("File '%s' is larger than expected.\n", task->path);
+					log_tag("error:%u:%s:%s: Size error\n", blockcur, disk->name, esc_tag(file->sub, esc_buffer));
 					++error;
 
 					if (fix) {
-						ret = handle_truncate(&handle[j], file);
-						if (ret == -1) {
-							/* LCOV_EXCL_START */
-							log_fatal("DANGER! Unexpected truncate error in a data disk, it isn't possible to fix.\n");
-							log_fatal("Stopping at block %u\n", i);
-							++unrecoverable_error;
-							goto bail;
-							/* LCOV_EXCL_STOP */
-						}
+						struct snapraid_task* write_task = io_write_task(&io, diskcur);
 
-						log_tag("fixed:%u:%s:%s: Fixed size\n", i, disk->name, esc_tag(file->sub, esc_buffer));
+						/* truncate it in the data writer */
+						write_task->file = file;
+						write_task->is_truncate = 1;
+
+						log_tag("fixed:%u:%s:%s: Fixed size\n", blockcur, disk->name, esc_tag(file->sub, esc_buffer));
 						++recovered_error;
 					}
 				}
@@ -1124,28 +1480,31 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 				/* mark the file as opened at least one time */
 				/* this is used to avoid to check the unsynced and size */
 				/* more than one time, in case the file is reopened later */
-				file_flag_set(file, FILE_IS_OPENED);
+				check_flag_set(file, FILE_IS_OPENED);
 			}
 
-			/* read from the file */
-			read_size = handle_read(&handle[j], file_pos, buffer[j], state->block_size,
-				log_error, state->opt.expected_missing ? log_expected : 0);
-			if (read_size == -1) {
+			if (task->state == TASK_STATE_ERROR_CONTINUE
+				|| task->state == TASK_STATE_IOERROR_CONTINUE
+			) {
 				/* save the failed block for the check/fix */
-				failed[failed_count].is_bad = 1; /* it's bad because we cannot read it */
+				failed[failed_count].is_bad = 1; /* it's bad because we cannot open or read it */
 				failed[failed_count].is_outofdate = 0;
-				failed[failed_count].index = j;
+				failed[failed_count].index = diskcur;
 				failed[failed_count].block = block;
 				failed[failed_count].disk = disk;
 				failed[failed_count].file = file;
 				failed[failed_count].file_pos = file_pos;
-				failed[failed_count].handle = &handle[j];
 				++failed_count;
 
-				log_tag("error:%u:%s:%s: Read error at position %u\n", i, disk->name, esc_tag(file->sub, esc_buffer), file_pos);
 				++error;
 				continue;
 			}
+			if (task->state != TASK_STATE_DONE) {
+				/* LCOV_EXCL_START */
+				log_fatal("Internal inconsistency in task state\n");
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
 
 			countsize += read_size;
 
@@ -1157,41 +1516,32 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 				/* if we don't have a hash, we always assume the first read of the block correct. */
 				failed[failed_count].is_bad = 0; /* we assume the CHG block correct */
 				failed[failed_count].is_outofdate = 0;
-				failed[failed_count].index = j;
+				failed[failed_count].index = diskcur;
 				failed[failed_count].block = block;
 				failed[failed_count].disk = disk;
 				failed[failed_count].file = file;
 				failed[failed_count].file_pos = file_pos;
-				failed[failed_count].handle = &handle[j];
 				++failed_count;
 				continue;
 			}
 
 			assert(block_state == BLOCK_STATE_BLK || block_state == BLOCK_STATE_REP);
 
-			/* compute the hash of the block just read */
-			if (rehash) {
-				memhash(state->prevhash, state->prevhashseed, hash, buffer[j], read_size);
-			} else {
-				memhash(state->hash, state->hashseed, hash, buffer[j], read_size);
-			}
-
-			/* compare the hash */
-			if (memcmp(hash, block->hash, BLOCK_HASH_SIZE) != 0) {
-				unsigned diff = memdiff(hash, block->hash, BLOCK_HASH_SIZE);
+			/* compare the hash already computed by the worker thread */
+			if (memcmp(task->hash, block->hash, BLOCK_HASH_SIZE) != 0) {
+				unsigned diff = memdiff(task->hash, block->hash, BLOCK_HASH_SIZE);
 
 				/* save the failed block for the check/fix */
 				failed[failed_count].is_bad = 1; /* it's bad because the hash doesn't match */
 				failed[failed_count].is_outofdate = 0;
-				failed[failed_count].index = j;
+				failed[failed_count].index = diskcur;
 				failed[failed_count].block = block;
 				failed[failed_count].disk = disk;
 				failed[failed_count].file = file;
 				failed[failed_count].file_pos = file_pos;
-				failed[failed_count].handle = &handle[j];
 				++failed_count;
 
-				log_tag("error:%u:%s:%s: Data error at position %u, diff bits %u/%u\n", i, disk->name, esc_tag(file->sub, esc_buffer), file_pos, diff, BLOCK_HASH_SIZE * 8);
+				log_tag("error:%u:%s:%s: Data error at position %u, diff bits %u/%u\n", blockcur, disk->name, esc_tag(file->sub, esc_buffer), file_pos, diff, BLOCK_HASH_SIZE * 8);
 				++error;
 				continue;
 			}
@@ -1202,21 +1552,24 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 			if (block_state == BLOCK_STATE_REP) {
 				failed[failed_count].is_bad = 0; /* it's not bad */
 				failed[failed_count].is_outofdate = 0;
-				failed[failed_count].index = j;
+				failed[failed_count].index = diskcur;
 				failed[failed_count].block = block;
 				failed[failed_count].disk = disk;
 				failed[failed_count].file = file;
 				failed[failed_count].file_pos = file_pos;
-				failed[failed_count].handle = &handle[j];
 				++failed_count;
 				continue;
 			}
 		}
 
+		/* sort the failed vector */
+		/* because with threads it may be in any order */
+		/* but RAID requires the indexes to be sorted */
+		qsort(failed, failed_count, sizeof(failed[0]), failed_compare_by_index);
+
 		/* now read and check the parity if requested */
 		if (!state->opt.auditonly) {
 			void* buffer_recov[LEV_MAX];
-			void* buffer_zero;
 
 			/* buffers for parity read and not computed */
 			for (l = 0; l < state->level; ++l)
@@ -1224,26 +1577,39 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 			for (; l < LEV_MAX; ++l)
 				buffer_recov[l] = 0;
 
-			/* the zero buffer is the last one */
-			buffer_zero = buffer[buffermax - 1];
+			/* until now is misc */
+			state_usage_misc(state);
 
 			/* read the parity */
 			for (l = 0; l < state->level; ++l) {
-				if (parity[l]) {
-					ret = parity_read(parity[l], i, buffer_recov[l], state->block_size, log_error);
-					if (ret == -1) {
-						buffer_recov[l] = 0; /* no parity to use */
+				struct snapraid_task* task;
+				unsigned levcur;
 
-						log_tag("parity_error:%u:%s: Read error\n", i, lev_config_name(l));
-						++error;
-					}
-				} else {
-					buffer_recov[l] = 0;
+				task = io_parity_read(&io, &levcur, waiting_map, &waiting_mac);
+
+				/* until now is parity */
+				state_usage_parity(state, waiting_map, waiting_mac);
+
+				/* if the parity is not accessible */
+				if (task->state == TASK_STATE_EMPTY) {
+					buffer_recov[levcur] = 0; /* no parity to use */
+					continue;
+				}
+
+				/* handle error conditions */
+				if (task->state != TASK_STATE_DONE) {
+					buffer_recov[levcur] = 0; /* no parity to use */
+					++error;
+					continue;
 				}
 			}
 
 			/* try all the recovering strategies */
-			ret = repair(state, rehash, i, diskmax, failed, failed_map, failed_count, buffer, buffer_recov, buffer_zero);
+			ret = repair(state, rehash, blockcur, diskmax, failed, failed_map, failed_count, buffer, buffer_recov, buffer_zero);
+
+			/* until now is raid */
+			state_usage_raid(state);
+
 			if (ret != 0) {
 				/* increment the number of errors */
 				if (ret > 0)
@@ -1253,13 +1619,13 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 				/* print a list of all the errors in files */
 				for (j = 0; j < failed_count; ++j) {
 					if (failed[j].is_bad)
-						log_tag("unrecoverable:%u:%s:%s: Unrecoverable error at position %u\n", i, failed[j].disk->name, esc_tag(failed[j].file->sub, esc_buffer), failed[j].file_pos);
+						log_tag("unrecoverable:%u:%s:%s: Unrecoverable error at position %u\n", blockcur, failed[j].disk->name, esc_tag(failed[j].file->sub, esc_buffer), failed[j].file_pos);
 				}
 
 				/* keep track of damaged files */
 				for (j = 0; j < failed_count; ++j) {
 					if (failed[j].is_bad)
-						file_flag_set(failed[j].file, FILE_IS_DAMAGED);
+						check_flag_set(failed[j].file, FILE_IS_DAMAGED);
 				}
 			} else {
 				/* now counts partial recovers */
@@ -1271,7 +1637,7 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 				for (j = 0; j < failed_count; ++j) {
 					if (failed[j].is_bad && failed[j].is_outofdate) {
 						++partial_recover_error;
-						log_tag("unrecoverable:%u:%s:%s: Unrecoverable unsynced error at position %u\n", i, failed[j].disk->name, esc_tag(failed[j].file->sub, esc_buffer), failed[j].file_pos);
+						log_tag("unrecoverable:%u:%s:%s: Unrecoverable unsynced error at position %u\n", blockcur, failed[j].disk->name, esc_tag(failed[j].file->sub, esc_buffer), failed[j].file_pos);
 					}
 				}
 				if (partial_recover_error != 0) {
@@ -1297,7 +1663,7 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 							/* mark that the read parity is wrong, setting ptr to 0 */
 							buffer_recov[l] = 0;
 
-							log_tag("parity_error:%u:%s: Data error, diff bits %u/%u\n", i, lev_config_name(l), diff, state->block_size * 8);
+							log_tag("parity_error:%u:%s: Data error, diff bits %u/%u\n", blockcur, lev_config_name(l), diff, state->block_size * 8);
 							++error;
 						}
 					}
@@ -1307,45 +1673,37 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 				if (fix) {
 					/* update the fixed files */
 					for (j = 0; j < failed_count; ++j) {
+						struct snapraid_task* write_task;
+
 						/* nothing to do if it doesn't need recovering */
 						if (!failed[j].is_bad)
 							continue;
 
 						/* do not fix if the file is excluded */
-						if (file_flag_has(failed[j].file, FILE_IS_EXCLUDED)
-							|| (state->opt.syncedonly && file_flag_has(failed[j].file, FILE_IS_UNSYNCED)))
+						if (check_flag_has(failed[j].file, FILE_IS_EXCLUDED)
+							|| (state->opt.syncedonly && check_flag_has(failed[j].file, FILE_IS_UNSYNCED)))
 							continue;
 
-						ret = handle_write(failed[j].handle, failed[j].file_pos, buffer[failed[j].index], state->block_size);
-						if (ret == -1) {
-							/* LCOV_EXCL_START */
-							/* mark the file as damaged */
-							file_flag_set(failed[j].file, FILE_IS_DAMAGED);
-
-							if (errno == EACCES) {
-								log_fatal("WARNING! Please give write permission to the file.\n");
-							} else {
-								/* we do not use DANGER because it could be ENOSPC which is not always correctly reported */
-								log_fatal("WARNING! Without a working data disk, it isn't possible to fix errors on it.\n");
-							}
-							log_fatal("Stopping at block %u\n", i);
-							++unrecoverable_error;
-							goto bail;
-							/* LCOV_EXCL_STOP */
-						}
+						/* write it in the data writer, copying the block */
+						/* because the read buffers are reused after this position */
+						write_task = io_write_task(&io, failed[j].index);
+						memcpy(write_task->buffer, buffer[failed[j].index], state->block_size);
+						write_task->file = failed[j].file;
+						write_task->file_pos = failed[j].file_pos;
+						write_task->is_write = 1;
 
 						/* if we are not sure that the recovered content is uptodate */
 						if (failed[j].is_outofdate) {
 							/* mark the file as damaged */
-							file_flag_set(failed[j].file, FILE_IS_DAMAGED);
+							check_flag_set(failed[j].file, FILE_IS_DAMAGED);
 							continue;
 						}
 
 						/* mark the file as containing some fixes */
 						/* note that it could be also marked as damaged in other iterations */
-						file_flag_set(failed[j].file, FILE_IS_FIXED);
+						check_flag_set(failed[j].file, FILE_IS_FIXED);
 
-						log_tag("fixed:%u:%s:%s: Fixed data error at position %u\n", i, failed[j].disk->name, esc_tag(failed[j].file->sub, esc_buffer), failed[j].file_pos);
+						log_tag("fixed:%u:%s:%s: Fixed data error at position %u\n", blockcur, failed[j].disk->name, esc_tag(failed[j].file->sub, esc_buffer), failed[j].file_pos);
 						++recovered_error;
 					}
 
@@ -1369,18 +1727,18 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 							        /* and the parity is not excluded */
 								&& !state->parity[l].is_excluded_by_filter
 							) {
-								ret = parity_write(parity[l], i, buffer[diskmax + l], state->block_size);
+								ret = parity_write(parity[l], blockcur, buffer[diskmax + l], state->block_size);
 								if (ret == -1) {
 									/* LCOV_EXCL_START */
 									/* we do not use DANGER because it could be ENOSPC which is not always correctly reported */
 									log_fatal("WARNING! Without a working %s disk, it isn't possible to fix errors on it.\n", lev_name(l));
-									log_fatal("Stopping at block %u\n", i);
+									log_fatal("Stopping at block %u\n", blockcur);
 									++unrecoverable_error;
 									goto bail;
 									/* LCOV_EXCL_STOP */
 								}
 
-								log_tag("parity_fixed:%u:%s: Fixed data error\n", i, lev_config_name(l));
+								log_tag("parity_fixed:%u:%s: Fixed data error\n", blockcur, lev_config_name(l));
 								++recovered_error;
 							}
 						}
@@ -1390,7 +1748,7 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 					/* meaning that we could fix this file if we try */
 					for (j = 0; j < failed_count; ++j) {
 						if (failed[j].is_bad) {
-							file_flag_set(failed[j].file, FILE_IS_FIXED);
+							check_flag_set(failed[j].file, FILE_IS_FIXED);
 						}
 					}
 				}
@@ -1400,32 +1758,66 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 			/* to report that the file is damaged, and we don't know if we can fix it */
 			for (j = 0; j < failed_count; ++j) {
 				if (failed[j].is_bad) {
-					file_flag_set(failed[j].file, FILE_IS_DAMAGED);
+					check_flag_set(failed[j].file, FILE_IS_DAMAGED);
 				}
 			}
 		}
 
-		/* post process the files */
-		ret = file_post(state, fix, i, handle, diskmax);
-		if (ret == -1) {
-			/* LCOV_EXCL_START */
-			log_fatal("Stopping at block %u\n", i);
-			++unrecoverable_error;
-			goto bail;
-			/* LCOV_EXCL_STOP */
+		if (fix) {
+			/* write the recovered blocks, and post process the files */
+			ret = check_data_write(state, &io, blockcur, handle, diskmax, waiting_map, &waiting_mac);
+			if (ret == -1) {
+				/* LCOV_EXCL_START */
+				++unrecoverable_error;
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
+		} else {
+			/* until now is misc */
+			state_usage_misc(state);
+
+			/* post process the files */
+			ret = file_post(state, fix, blockcur, handle, diskmax);
+			if (ret == -1) {
+				/* LCOV_EXCL_START */
+				log_fatal("Stopping at block %u\n", blockcur);
+				++unrecoverable_error;
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
 		}
 
+		/* next position to post process */
+		i = blockcur + 1;
+
 		/* count the number of processed block */
 		++countpos;
 
 		/* progress */
-		if (state_progress(state, 0, i, countpos, countmax, countsize)) {
+		if (state_progress(state, &io, blockcur, countpos, countmax, countsize)) {
 			/* LCOV_EXCL_START */
 			break;
 			/* LCOV_EXCL_STOP */
 		}
 	}
 
+	/* stop all the worker threads, as they are no more needed */
+	/* waiting for the data writers to complete */
+	io_stop(&io);
+	io_stopped = 1;
+
+	state_progress_end(state, countpos, countmax, countsize);
+
+	state_usage_print(state);
+
+	/* the latest writes are completed only at the stop */
+	if (fix && io.writer_error[TASK_STATE_ERROR - IO_WRITER_ERROR_BASE] != 0) {
+		/* LCOV_EXCL_START */
+		++unrecoverable_error;
+		goto bail;
+		/* LCOV_EXCL_STOP */
+	}
+
 	/* for each disk, recover empty files, symlinks and empty dirs */
 	for (i = 0; i < diskmax; ++i) {
 		tommy_node* node;
@@ -1452,7 +1844,7 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 			}
 
 			/* if excluded continue to the next one */
-			if (file_flag_has(file, FILE_IS_EXCLUDED)) {
+			if (check_flag_has(file, FILE_IS_EXCLUDED)) {
 				continue;
 			}
 
@@ -1784,9 +2176,11 @@ static int state_check_process(struct snapraid_state* state, int fix, struct sna
 		}
 	}
 
-	state_progress_end(state, countpos, countmax, countsize);
-
 bail:
+	/* stop all the worker threads, if not already done */
+	if (!io_stopped)
+		io_stop(&io);
+
 	/* close all the files left open */
 	for (j = 0; j < diskmax; ++j) {
 		struct snapraid_file* file = handle[j].file;
@@ -1800,6 +2194,18 @@ bail:
 			/* continue, as we are already exiting */
 			/* LCOV_EXCL_STOP */
 		}
+		if (write_handle) {
+			file = write_handle[j].file;
+			ret = handle_close(&write_handle[j]);
+			if (ret == -1) {
+				/* LCOV_EXCL_START */
+				log_tag("error:%u:%s:%s: Close error. %s\n", blockmax, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
+				log_fatal("DANGER! Unexpected close error in a data disk.\n");
+				++unrecoverable_error;
+				/* continue, as we are already exiting */
+				/* LCOV_EXCL_STOP */
+			}
+		}
 	}
 
 	/* remove all the files created from scratch that have not finished the processing */
@@ -1824,13 +2230,13 @@ bail:
 				node = node->next; /* next node */
 
 				/* if the file was not created, meaning that it was already existing */
-				if (!file_flag_has(file, FILE_IS_CREATED)) {
+				if (!check_flag_has(file, FILE_IS_CREATED)) {
 					/* nothing to do */
 					continue;
 				}
 
 				/* if processing was finished */
-				if (file_flag_has(file, FILE_IS_FINISHED)) {
+				if (check_flag_has(file, FILE_IS_FINISHED)) {
 					/* nothing to do */
 					continue;
 				}
@@ -1907,8 +2313,10 @@ bail:
 	free(failed);
 	free(failed_map);
 	free(handle);
-	free(buffer_alloc);
-	free(buffer);
+	free(write_handle);
+	free(zero_alloc);
+	free(waiting_map);
+	io_done(&io);
 
 	/* fail if some error are present after the run */
 	if (fix) {
@@ -1962,6 +2370,10 @@ int state_check(struct snapraid_state* state, int fix, block_off_t blockstart, b
 		blockmax = blockstart + blockcount;
 	}
 
+	/* the level is used by the reading threads also for not accessible parities */
+	for (l = 0; l < state->level; ++l)
+		parity[l].level = l;
+
 	if (fix) {
 		/* if fixing, create the file and open for writing */
 		/* if it fails, we cannot continue */
@@ -2018,7 +2430,7 @@ int state_check(struct snapraid_state* state, int fix, block_off_t blockstart, b
 
 	/* skip degenerated cases of empty parity, or skipping all */
 	if (blockstart < blockmax) {
-		ret = state_check_process(state, fix, parity_ptr, blockstart, blockmax);
+		ret = state_check_process(state, fix, parity, parity_ptr, blockstart, blockmax);
 		if (ret == -1) {
 			/* LCOV_EXCL_START */
 			++error;
@@ -118,7 +118,7 @@ static void dry_data_reader(struct snapraid_worker* worker, struct snapraid_task
 		return;
 	}
 
-	task->read_size = handle_read(handle, task->file_pos, buffer, state->block_size, log_error, 0);
+	task->read_size = io_handle_read(worker, task, log_error, 0);
 	if (task->read_size == -1) {
 		if (errno == EIO) {
 			log_tag("error:%u:%s:%s: Read EIO error at position %u. %s\n", blockcur, disk->name, esc_tag(task->file->sub, esc_buffer), task->file_pos, strerror(errno));
@@ -191,7 +191,7 @@ static int state_dry_process(struct snapraid_state* state, struct snapraid_parit
 	buffermax = diskmax + 2 * state->level;
 
 	/* initialize the io threads */
-	io_init(&io, state, state->opt.io_cache, buffermax, dry_data_reader, handle, diskmax, dry_parity_reader, 0, parity_handle, state->level);
+	io_init(&io, state, state->opt.io_cache, buffermax, dry_data_reader, 0, handle, 0, diskmax, dry_parity_reader, 0, parity_handle, state->level);
 
 	/* possibly waiting disks */
 	waiting_mac = diskmax > RAID_PARITY_MAX ? diskmax : RAID_PARITY_MAX;
@@ -26,6 +26,189 @@
 
 int BLOCK_HASH_SIZE = HASH_MAX;
 
+/****************************************************************************/
+/* block store */
+
+/**
+ * Size of each memory mapped chunk of the block store.
+ */
+#define BLOCK_STORE_CHUNK (64 * 1024 * 1024)
+
+/**
+ * Memory mapped file used to store the blocks of the files.
+ *
+ * The block vectors are allocated sequentially in chunks mapped from
+ * a temporary file, and they are never freed until the end.
+ * In this way the block states and hashes, that are most of the memory used,
+ * are kept in the OS page cache, and not in the process memory.
+ */
+struct block_chunk {
+	void* ptr; /**< Mapped memory. */
+	size_t size; /**< Size of the mapping. */
+	tommy_node node;
+};
+
+struct block_store {
+	int active; /**< If the store is used. */
+	int f; /**< Handle of the file. */
+	char path[PATH_MAX]; /**< Path of the file. */
+	data_off_t size; /**< Size of the file. */
+	tommy_list chunklist; /**< Mapped chunks. */
+	unsigned char* ptr; /**< Free space in the last chunk. */
+	size_t free; /**< Free size in the last chunk. */
+#if HAVE_PTHREAD
+	pthread_mutex_t mutex; /**< Allocations can be done by concurrent scan threads. */
+#endif
+};
+
+static struct block_store STORE;
+
+int block_store_init(const char* path)
+{
+#if HAVE_MMAP
+	pathcpy(STORE.path, sizeof(STORE.path), path);
+
+	STORE.f = open(path, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0600);
+	if (STORE.f == -1)
+		return -1;
+
+	/* the file is only temporary, remove it immediately if possible */
+	remove(path);
+
+	STORE.size = 0;
+	tommy_list_init(&STORE.chunklist);
+	STORE.ptr = 0;
+	STORE.free = 0;
+#if HAVE_PTHREAD
+	thread_mutex_init(&STORE.mutex, 0);
+#endif
+	STORE.active = 1;
+	return 0;
+#else
+	(void)path;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+void block_store_done(void)
+{
+#if HAVE_MMAP
+	tommy_node* i;
+
+	if (!STORE.active)
+		return;
+
+	i = tommy_list_head(&STORE.chunklist);
+	while (i) {
+		struct block_chunk* chunk = i->data;
+		i = i->next;
+		munmap(chunk->ptr, chunk->size);
+		free(chunk);
+	}
+
+	close(STORE.f);
+	STORE.active = 0;
+
+	/* remove it, if the early remove was not possible */
+	remove(STORE.path);
+#if HAVE_PTHREAD
+	thread_mutex_destroy(&STORE.mutex);
+#endif
+#endif
+}
+
+size_t block_store_size(void)
+{
+	if (!STORE.active)
+		return 0;
+
+	return STORE.size;
+}
+
+#if HAVE_MMAP
+/**
+ * Allocate a new chunk in the block store.
+ */
+static void block_store_grow(size_t size)
+{
+	struct block_chunk* chunk;
+	void* ptr;
+
+	if (size < BLOCK_STORE_CHUNK)
+		size = BLOCK_STORE_CHUNK;
+
+	/* round up at the chunk size, to keep the mmap() offset page aligned */
+	size = (size + BLOCK_STORE_CHUNK - 1) / BLOCK_STORE_CHUNK * BLOCK_STORE_CHUNK;
+
+	if (ftruncate(STORE.f, STORE.size + size) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error growing the hash file '%s' to %" PRIu64 " bytes. %s.\n", STORE.path, (uint64_t)(STORE.size + size), strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, STORE.f, STORE.size);
+	if (ptr == MAP_FAILED) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error mapping the hash file '%s'. %s.\n", STORE.path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	chunk = malloc_nofail(sizeof(struct block_chunk));
+	chunk->ptr = ptr;
+	chunk->size = size;
+	tommy_list_insert_tail(&STORE.chunklist, &chunk->node, chunk);
+
+	STORE.size += size;
+	STORE.ptr = ptr;
+	STORE.free = size;
+}
+#endif
+
+/**
+ * Allocate a vector of blocks.
+ */
+static struct snapraid_block* block_vec_alloc(block_off_t count)
+{
+#if HAVE_MMAP
+	if (STORE.active) {
+		size_t size = count * block_sizeof();
+		void* ptr;
+
+#if HAVE_PTHREAD
+		thread_mutex_lock(&STORE.mutex);
+#endif
+		if (size > STORE.free)
+			block_store_grow(size);
+
+		ptr = STORE.ptr;
+		STORE.ptr += size;
+		STORE.free -= size;
+#if HAVE_PTHREAD
+		thread_mutex_unlock(&STORE.mutex);
+#endif
+
+		return ptr;
+	}
+#endif
+
+	return malloc_nofail(count * block_sizeof());
+}
+
+/**
+ * Free a vector of blocks.
+ */
+static void block_vec_free(struct snapraid_block* blockvec)
+{
+	/* space in the store is released only at the end */
+	if (STORE.active)
+		return;
+
+	free(blockvec);
+}
+
 struct snapraid_content* content_alloc(const char* path, uint64_t dev)
 {
 	struct snapraid_content* content;
@@ -358,26 +541,24 @@ int filter_content(tommy_list* contentlist, const char* path)
 		pathprint(tmp, sizeof(tmp), "%s.lock", content->content);
 		if (pathcmp(tmp, path) == 0)
 			return -1;
+
+		/* exclude also the ".journal" file */
+		pathprint(tmp, sizeof(tmp), "%s.journal", content->content);
+		if (pathcmp(tmp, path) == 0)
+			return -1;
 	}
 
 	return 0;
 }
 
-struct snapraid_file* file_alloc(unsigned block_size, const char* sub, data_off_t size, uint64_t mtime_sec, int mtime_nsec, uint64_t inode, uint64_t physical)
+struct snapraid_file* file_alloc(struct snapraid_arena* arena, unsigned block_size, const char* sub, data_off_t size, uint64_t mtime_sec, int mtime_nsec, uint64_t inode, uint64_t physical)
 {
 	struct snapraid_file* file;
 	block_off_t i;
 
-	file = malloc_nofail(sizeof(struct snapraid_file));
-	file->sub = strdup_nofail(sub);
-	file->size = size;
-	file->blockmax = (size + block_size - 1) / block_size;
-	file->mtime_sec = mtime_sec;
-	file->mtime_nsec = mtime_nsec;
-	file->inode = inode;
+	file = file_alloc_noblock(arena, block_size, sub, size, mtime_sec, mtime_nsec, inode);
 	file->physical = physical;
-	file->flag = 0;
-	file->blockvec = malloc_nofail(file->blockmax * block_sizeof());
+	file->blockvec = block_vec_alloc(file->blockmax);
 
 	for (i = 0; i < file->blockmax; ++i) {
 		struct snapraid_block* block = file_block(file, i);
@@ -388,6 +569,30 @@ struct snapraid_file* file_alloc(unsigned block_size, const char* sub, data_off_
 	return file;
 }
 
+struct snapraid_file* file_alloc_noblock(struct snapraid_arena* arena, unsigned block_size, const char* sub, data_off_t size, uint64_t mtime_sec, int mtime_nsec, uint64_t inode)
+{
+	struct snapraid_file* file;
+
+	if (arena) {
+		file = arena_alloc(arena, sizeof(struct snapraid_file));
+		file->sub = arena_strdup(arena, sub);
+		file->flag = FILE_IS_ARENA;
+	} else {
+		file = malloc_nofail(sizeof(struct snapraid_file));
+		file->sub = strdup_nofail(sub);
+		file->flag = 0;
+	}
+	file->size = size;
+	file->blockmax = (size + block_size - 1) / block_size;
+	file->mtime_sec = mtime_sec;
+	file->mtime_nsec = mtime_nsec;
+	file->inode = inode;
+	file->physical = 0;
+	file->blockvec = 0;
+
+	return file;
+}
+
 struct snapraid_file* file_dup(struct snapraid_file* copy)
 {
 	struct snapraid_file* file;
@@ -401,8 +606,8 @@ struct snapraid_file* file_dup(struct snapraid_file* copy)
 	file->mtime_nsec = copy->mtime_nsec;
 	file->inode = copy->inode;
 	file->physical = copy->physical;
-	file->flag = copy->flag;
-	file->blockvec = malloc_nofail(file->blockmax * block_sizeof());
+	file->flag = copy->flag & ~(FILE_IS_BLOCK_ARENA | FILE_IS_ARENA);
+	file->blockvec = block_vec_alloc(file->blockmax);
 
 	for (i = 0; i < file->blockmax; ++i) {
 		struct snapraid_block* block = file_block(file, i);
@@ -416,15 +621,27 @@ struct snapraid_file* file_dup(struct snapraid_file* copy)
 
 void file_free(struct snapraid_file* file)
 {
+	if (!file_flag_has(file, FILE_IS_BLOCK_ARENA))
+		block_vec_free(file->blockvec);
+	file->blockvec = 0;
+
+	/* in the arena, the memory is released with the disk */
+	if (file_flag_has(file, FILE_IS_ARENA))
+		return;
+
 	free(file->sub);
 	file->sub = 0;
-	free(file->blockvec);
-	file->blockvec = 0;
 	free(file);
 }
 
-void file_rename(struct snapraid_file* file, const char* sub)
+void file_rename(struct snapraid_disk* disk, struct snapraid_file* file, const char* sub)
 {
+	if (file_flag_has(file, FILE_IS_ARENA)) {
+		/* the old path is released with the arena */
+		file->sub = arena_strdup(&disk->arena, sub);
+		return;
+	}
+
 	free(file->sub);
 	file->sub = strdup_nofail(sub);
 }
@@ -676,20 +893,43 @@ int extent_file_compare(const void* void_a, const void* void_b)
 	return 0;
 }
 
-struct snapraid_link* link_alloc(const char* sub, const char* linkto, unsigned link_flag)
+struct snapraid_link* link_alloc(struct snapraid_arena* arena, const char* sub, const char* linkto, unsigned link_flag)
 {
 	struct snapraid_link* slink;
 
-	slink = malloc_nofail(sizeof(struct snapraid_link));
-	slink->sub = strdup_nofail(sub);
-	slink->linkto = strdup_nofail(linkto);
-	slink->flag = link_flag;
+	if (arena) {
+		slink = arena_alloc(arena, sizeof(struct snapraid_link));
+		slink->sub = arena_strdup(arena, sub);
+		slink->linkto = arena_strdup(arena, linkto);
+		slink->flag = link_flag | FILE_IS_ARENA;
+	} else {
+		slink = malloc_nofail(sizeof(struct snapraid_link));
+		slink->sub = strdup_nofail(sub);
+		slink->linkto = strdup_nofail(linkto);
+		slink->flag = link_flag;
+	}
 
 	return slink;
 }
 
+void link_retarget(struct snapraid_disk* disk, struct snapraid_link* slink, const char* linkto)
+{
+	if (link_flag_has(slink, FILE_IS_ARENA)) {
+		/* the old target is released with the arena */
+		slink->linkto = arena_strdup(&disk->arena, linkto);
+		return;
+	}
+
+	free(slink->linkto);
+	slink->linkto = strdup_nofail(linkto);
+}
+
 void link_free(struct snapraid_link* slink)
 {
+	/* in the arena, the memory is released with the disk */
+	if (link_flag_has(slink, FILE_IS_ARENA))
+		return;
+
 	free(slink->sub);
 	free(slink->linkto);
 	free(slink);
@@ -711,19 +951,29 @@ int link_alpha_compare(const void* void_a, const void* void_b)
 	return strcmp(slink_a->sub, slink_b->sub);
 }
 
-struct snapraid_dir* dir_alloc(const char* sub)
+struct snapraid_dir* dir_alloc(struct snapraid_arena* arena, const char* sub)
 {
 	struct snapraid_dir* dir;
 
-	dir = malloc_nofail(sizeof(struct snapraid_dir));
-	dir->sub = strdup_nofail(sub);
-	dir->flag = 0;
+	if (arena) {
+		dir = arena_alloc(arena, sizeof(struct snapraid_dir));
+		dir->sub = arena_strdup(arena, sub);
+		dir->flag = FILE_IS_ARENA;
+	} else {
+		dir = malloc_nofail(sizeof(struct snapraid_dir));
+		dir->sub = strdup_nofail(sub);
+		dir->flag = 0;
+	}
 
 	return dir;
 }
 
 void dir_free(struct snapraid_dir* dir)
 {
+	/* in the arena, the memory is released with the disk */
+	if (dir_flag_has(dir, FILE_IS_ARENA))
+		return;
+
 	free(dir->sub);
 	free(dir);
 }
@@ -756,6 +1006,9 @@ struct snapraid_disk* disk_alloc(const char* name, const char* dir, uint64_t dev
 	disk->device = dev;
 	disk->tick = 0;
 	disk->cached_blocks = 0;
+	disk->cached_depth = 0;
+	disk->depth_sum = 0;
+	disk->depth_count = 0;
 	disk->progress_file = 0;
 	disk->total_blocks = 0;
 	disk->free_blocks = 0;
@@ -780,6 +1033,11 @@ struct snapraid_disk* disk_alloc(const char* name, const char* dir, uint64_t dev
 	tommy_tree_init(&disk->fs_parity, extent_parity_compare);
 	tommy_tree_init(&disk->fs_file, extent_file_compare);
 	disk->fs_last = 0;
+	disk->fs_index = 0;
+	disk->fs_index_count = 0;
+	disk->fs_index_begin = POS_NULL;
+	disk->fs_arena = 0;
+	arena_init(&disk->arena);
 
 	return disk;
 }
@@ -796,6 +1054,9 @@ void disk_free(struct snapraid_disk* disk)
 	tommy_hashdyn_done(&disk->linkset);
 	tommy_list_foreach(&disk->dirlist, (tommy_foreach_func*)dir_free);
 	tommy_hashdyn_done(&disk->dirset);
+	free(disk->fs_index);
+	free(disk->fs_arena);
+	arena_done(&disk->arena);
 
 #if HAVE_PTHREAD
 	thread_mutex_destroy(&disk->fs_mutex);
@@ -1197,11 +1458,141 @@ static struct snapraid_extent* fs_file2extent_get_unlock(struct snapraid_disk* d
 	return extent;
 }
 
+/**
+ * Insert the extent in the flat index.
+ */
+static void fs_index_insert(void* void_arg, void* void_extent)
+{
+	struct snapraid_disk* disk = void_arg;
+	struct snapraid_extent* extent = void_extent;
+	struct snapraid_index* entry = &disk->fs_index[disk->fs_index_count++];
+
+	entry->file = extent->file;
+	entry->parity_pos = extent->parity_pos;
+	entry->file_pos = extent->file_pos;
+	entry->count = extent->count;
+}
+
+void fs_index_build(struct snapraid_disk* disk)
+{
+	free(disk->fs_index);
+
+	disk->fs_index = malloc_nofail(tommy_tree_count(&disk->fs_parity) * sizeof(struct snapraid_index) + 1);
+	disk->fs_index_count = 0;
+
+	/* the tree is visited in order, so the index is sorted by parity position */
+	tommy_tree_foreach_arg(&disk->fs_parity, fs_index_insert, disk);
+
+	disk->fs_index_begin = 0;
+}
+
+struct fs_arena_context {
+	unsigned char* ptr; /**< Next free space in the arena. */
+};
+
+static void fs_arena_insert(void* void_arg, void* void_extent)
+{
+	struct fs_arena_context* arg = void_arg;
+	struct snapraid_extent* extent = void_extent;
+	struct snapraid_file* file = extent->file;
+	size_t size;
+
+	/* if already placed at a previous extent */
+	if (file_flag_has(file, FILE_IS_BLOCK_ARENA))
+		return;
+
+	size = file->blockmax * block_sizeof();
+	memcpy(arg->ptr, file->blockvec, size);
+	block_vec_free(file->blockvec);
+	file->blockvec = (struct snapraid_block*)arg->ptr;
+	file_flag_set(file, FILE_IS_BLOCK_ARENA);
+
+	arg->ptr += size;
+}
+
+void fs_arena_build(struct snapraid_disk* disk)
+{
+	struct fs_arena_context arg;
+	tommy_node* i;
+	size_t size;
+
+	/* the blocks in the store are already allocated sequentially, and never freed */
+	if (STORE.active || disk->fs_arena)
+		return;
+
+	size = 0;
+	for (i = disk->filelist; i != 0; i = i->next) {
+		struct snapraid_file* file = i->data;
+		size += file->blockmax * block_sizeof();
+	}
+	for (i = disk->deletedlist; i != 0; i = i->next) {
+		struct snapraid_file* file = i->data;
+		size += file->blockmax * block_sizeof();
+	}
+
+	if (size == 0)
+		return;
+
+	disk->fs_arena = malloc_nofail(size);
+
+	/* the tree is visited in order, so the files are placed by parity position */
+	arg.ptr = disk->fs_arena;
+	tommy_tree_foreach_arg(&disk->fs_parity, fs_arena_insert, &arg);
+}
+
+/**
+ * Search the extent at the specified parity position in the flat index.
+ * It doesn't need the lock, as the index is never changed after it's built.
+ * \return If not found return 0
+ */
+static struct snapraid_index* fs_par2index_get(struct snapraid_disk* disk, block_off_t parity_pos)
+{
+	struct snapraid_index* index = disk->fs_index;
+	block_off_t lo = 0;
+	block_off_t hi = disk->fs_index_count;
+
+	while (lo < hi) {
+		block_off_t mid = lo + (hi - lo) / 2;
+
+		if (parity_pos < index[mid].parity_pos)
+			hi = mid;
+		else if (parity_pos >= index[mid].parity_pos + index[mid].count)
+			lo = mid + 1;
+		else
+			return &index[mid];
+	}
+
+	return 0;
+}
+
+/**
+ * Mark the parity position as changed, excluding it from the flat index.
+ */
+static inline void fs_index_change_unlock(struct snapraid_disk* disk, block_off_t parity_pos)
+{
+	/* atomic, as the io threads read it without the lock */
+	if (parity_pos >= disk->fs_index_begin)
+		__atomic_store_n(&disk->fs_index_begin, parity_pos + 1, __ATOMIC_RELAXED);
+}
+
 struct snapraid_file* fs_par2file_find(struct snapraid_disk* disk, block_off_t parity_pos, block_off_t* file_pos)
 {
 	struct snapraid_extent* extent;
 	struct snapraid_file* file;
 
+	/* positions not changed after building the index can be searched without the lock */
+	if (parity_pos >= __atomic_load_n(&disk->fs_index_begin, __ATOMIC_RELAXED)) {
+		struct snapraid_index* entry = fs_par2index_get(disk, parity_pos);
+
+		if (!entry)
+			return 0;
+
+		if (file_pos)
+			*file_pos = entry->file_pos + (parity_pos - entry->parity_pos);
+
+		return entry->file;
+	}
+
 	fs_lock(disk);
 
 	extent = fs_par2extent_get_unlock(disk, &disk->fs_last, parity_pos);
@@ -1247,6 +1638,8 @@ void fs_allocate(struct snapraid_disk* disk, block_off_t parity_pos, struct snap
 
 	fs_lock(disk);
 
+	fs_index_change_unlock(disk, parity_pos);
+
 	if (file_pos > 0) {
 		/* search an existing extent for the previous file_pos */
 		extent = fs_file2extent_get_unlock(disk, &disk->fs_last, file, file_pos - 1);
@@ -1306,6 +1699,8 @@ void fs_deallocate(struct snapraid_disk* disk, block_off_t parity_pos)
 		/* LCOV_EXCL_STOP */
 	}
 
+	fs_index_change_unlock(disk, parity_pos);
+
 	/* if it's the only block of the extent, delete it */
 	if (extent->count == 1) {
 		/* remove from the trees */
@@ -263,6 +263,18 @@ struct snapraid_block {
 #define FILE_IS_JUNCTION 0x8000 /**< If it's a junction for Windows. Not yet supported. */
 #define FILE_IS_LINK_MASK 0xF000 /**< Mask for link type. */
 
+/**
+ * The blocks of the file are in the block arena of the disk.
+ * They are not allocated separately, and they are freed with the disk.
+ */
+#define FILE_IS_BLOCK_ARENA 0x10000
+
+/**
+ * The file, link or dir, with its paths, is in the arena of the disk.
+ * It's not allocated separately, and it's freed with the disk.
+ */
+#define FILE_IS_ARENA 0x20000
+
 /**
  * File.
  */
@@ -323,6 +335,19 @@ struct snapraid_extent {
 	tommy_tree_node file_node; /**< Tree sorter by <file,file_pos>. */
 };
 
+/**
+ * Entry of the flat index of extents.
+ *
+ * It's a plain copy of an extent, and it remains valid even if the
+ * original extent is later changed or freed.
+ */
+struct snapraid_index {
+	struct snapraid_file* file; /**< File containing this extent. */
+	block_off_t parity_pos; /**< Parity position. */
+	block_off_t file_pos; /**< Position in the file. */
+	block_off_t count; /**< Number of sequential blocks in the file and parity. */
+};
+
 /**
  * Disk.
  */
@@ -339,6 +364,9 @@ struct snapraid_disk {
 	uint64_t tick; /**< Usage time. */
 	uint64_t progress_tick[PROGRESS_MAX]; /**< Last ticks of progress. */
 	unsigned cached_blocks; /**< Number of IO blocks cached. */
+	unsigned cached_depth; /**< Max number of IO blocks to cache. */
+	uint64_t depth_sum; /**< Sum of the read-ahead depths chosen at every adaptation. */
+	unsigned depth_count; /**< Number of adaptations in ::depth_sum. */
 	struct snapraid_file* progress_file; /**< File in progress. */
 
 	/**
@@ -383,6 +411,44 @@ struct snapraid_disk {
 	 */
 	struct snapraid_extent* fs_last;
 
+	/**
+	 * Flat index of the extents sorted by <parity_pos>.
+	 *
+	 * It's a snapshot of ::fs_parity searched without taking the lock,
+	 * and used by the io threads of sync, scrub and check.
+	 *
+	 * The index is not updated when the extents change. Instead
+	 * ::fs_index_begin is moved after the changed position, and only the
+	 * positions starting from it are searched in the index, as all of
+	 * them still have the same mapping of when the index was built.
+	 * The others go back at searching ::fs_parity with the lock.
+	 *
+	 * ::fs_index_begin is changed with the lock, but the io threads read
+	 * it without, so the changes and the reads without the lock are atomic.
+	 */
+	struct snapraid_index* fs_index;
+	block_off_t fs_index_count;
+	block_off_t fs_index_begin;
+
+	/**
+	 * Blocks of the files laid out in order of parity position.
+	 *
+	 * It's built after reading the content file, placing each file
+	 * at its first parity position, in a way that visiting the
+	 * positions in order reads the blocks sequentially.
+	 * The files allocated after are not in the arena.
+	 * 0 if not used.
+	 */
+	unsigned char* fs_arena;
+
+	/**
+	 * Arena of the files, links and dirs read from the content file, with their paths.
+	 *
+	 * It's used only by the thread decoding the disk, and then by the
+	 * thread scanning it.
+	 */
+	struct snapraid_arena arena;
+
 	/**
 	 * List of all the snapraid_file for the disk.
 	 */
@@ -470,6 +536,9 @@ struct snapraid_parity {
 	uint64_t tick; /**< Usage time. */
 	uint64_t progress_tick[PROGRESS_MAX]; /**< Last cpu ticks of progress. */
 	unsigned cached_blocks; /**< Number of IO blocks cached. */
+	unsigned cached_depth; /**< Max number of IO blocks to cache. */
+	uint64_t depth_sum; /**< Sum of the read-ahead depths chosen at every adaptation. */
+	unsigned depth_count; /**< Number of adaptations in ::depth_sum. */
 };
 
 /**
@@ -635,6 +704,25 @@ static inline void hash_zero_set(unsigned char* hash)
 	memset(hash, 0xFF, BLOCK_HASH_SIZE);
 }
 
+/**
+ * Store the blocks of all the files in a memory mapped file,
+ * instead of the process memory.
+ * It must be called before allocating any file.
+ * \param path Temporary file to use. It's removed at the end.
+ * \return 0 on success, or -1 on error with errno set.
+ */
+int block_store_init(const char* path);
+
+/**
+ * Release the memory mapped file.
+ */
+void block_store_done(void);
+
+/**
+ * Size of the memory mapped file, or 0 if not used.
+ */
+size_t block_store_size(void);
+
 /**
  * Allocated space for block.
  */
@@ -745,8 +833,15 @@ static inline void file_flag_clear(struct snapraid_file* file, unsigned mask)
 
 /**
  * Allocate a file.
+ * If ::arena is not 0, the file and its path are allocated in it.
  */
-struct snapraid_file* file_alloc(unsigned block_size, const char* sub, data_off_t size, uint64_t mtime_sec, int mtime_nsec, uint64_t inode, uint64_t physical);
+struct snapraid_file* file_alloc(struct snapraid_arena* arena, unsigned block_size, const char* sub, data_off_t size, uint64_t mtime_sec, int mtime_nsec, uint64_t inode, uint64_t physical);
+
+/**
+ * Allocate a file without its blocks.
+ * Used when only the file names and attributes are needed.
+ */
+struct snapraid_file* file_alloc_noblock(struct snapraid_arena* arena, unsigned block_size, const char* sub, data_off_t size, uint64_t mtime_sec, int mtime_nsec, uint64_t inode);
 
 /**
  * Duplicate a file.
@@ -759,9 +854,9 @@ struct snapraid_file* file_dup(struct snapraid_file* copy);
 void file_free(struct snapraid_file* file);
 
 /**
- * Rename a file.
+ * Rename a file of the specified disk.
  */
-void file_rename(struct snapraid_file* file, const char* sub);
+void file_rename(struct snapraid_disk* disk, struct snapraid_file* file, const char* sub);
 
 /**
  * Copy a file.
@@ -901,8 +996,14 @@ static inline unsigned link_flag_get(struct snapraid_link* slink, unsigned mask)
 
 /**
  * Allocate a link.
+ * If ::arena is not 0, the link and its paths are allocated in it.
+ */
+struct snapraid_link* link_alloc(struct snapraid_arena* arena, const char* name, const char* slink, unsigned link_flag);
+
+/**
+ * Change the target of a link of the specified disk.
  */
-struct snapraid_link* link_alloc(const char* name, const char* slink, unsigned link_flag);
+void link_retarget(struct snapraid_disk* disk, struct snapraid_link* slink, const char* linkto);
 
 /**
  * Deallocate a link.
@@ -944,8 +1045,9 @@ static inline void dir_flag_clear(struct snapraid_dir* dir, unsigned mask)
 
 /**
  * Allocate a dir.
+ * If ::arena is not 0, the dir and its path are allocated in it.
  */
-struct snapraid_dir* dir_alloc(const char* name);
+struct snapraid_dir* dir_alloc(struct snapraid_arena* arena, const char* name);
 
 /**
  * Deallocate a dir.
@@ -1019,6 +1121,18 @@ void fs_deallocate(struct snapraid_disk* disk, block_off_t pos);
  */
 struct snapraid_block* fs_file2block_get(struct snapraid_file* file, block_off_t file_pos);
 
+/**
+ * Build the flat index of the extents for lock-free searches.
+ * It must be called when no other thread is accessing the disk.
+ */
+void fs_index_build(struct snapraid_disk* disk);
+
+/**
+ * Move the blocks of all the files of the disk in a single arena ordered by parity position.
+ * It's not done if the blocks are in the hash file store.
+ */
+void fs_arena_build(struct snapraid_disk* disk);
+
 /**
  * Get the file position from the parity position.
  * Return 0 if no file is using it.
@@ -293,6 +293,61 @@ int handle_read(struct snapraid_handle* handle, block_off_t file_pos, unsigned c
 	return read_size;
 }
 
+int handle_readv(struct snapraid_handle* handle, block_off_t file_pos, unsigned char** block_map, unsigned block_max, unsigned block_size, int* size_map)
+{
+#if HAVE_PREADV
+	struct iovec iov[HANDLE_READV_MAX];
+	ssize_t read_ret;
+	data_off_t offset;
+	unsigned read_size;
+	unsigned i;
+	int ret;
+
+	assert(block_max <= HANDLE_READV_MAX);
+
+	offset = file_pos * (data_off_t)block_size;
+
+	/* all the blocks must have valid data */
+	if (block_max == 0 || offset + (block_max - 1) * (data_off_t)block_size >= handle->valid_size)
+		return -1;
+
+	read_size = 0;
+	for (i = 0; i < block_max; ++i) {
+		size_map[i] = file_block_size(handle->file, file_pos + i, block_size);
+		read_size += size_map[i];
+
+		/* read the full blocks to support O_DIRECT */
+		iov[i].iov_base = block_map[i];
+		iov[i].iov_len = block_size;
+	}
+
+	read_ret = preadv(handle->f, iov, block_max, offset);
+	if (read_ret < 0 || (size_t)read_ret < read_size)
+		return -1;
+
+	/* pad with 0 */
+	for (i = 0; i < block_max; ++i) {
+		if ((unsigned)size_map[i] < block_size)
+			memset(block_map[i] + size_map[i], 0, block_size - size_map[i]);
+	}
+
+	ret = advise_read(&handle->advise, handle->f, offset, block_max * (data_off_t)block_size);
+	if (ret != 0)
+		return -1;
+
+	return 0;
+#else
+	(void)handle;
+	(void)file_pos;
+	(void)block_map;
+	(void)block_max;
+	(void)block_size;
+	(void)size_map;
+
+	return -1;
+#endif
+}
+
 int handle_write(struct snapraid_handle* handle, block_off_t file_pos, unsigned char* block_buffer, unsigned block_size)
 {
 	ssize_t write_ret;
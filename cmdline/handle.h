@@ -67,6 +67,22 @@ int handle_close(struct snapraid_handle* handle);
  */
 int handle_read(struct snapraid_handle* handle, block_off_t file_pos, unsigned char* block_buffer, unsigned block_size, fptr* out, fptr* out_missing);
 
+/**
+ * Max number of blocks read by handle_readv().
+ */
+#define HANDLE_READV_MAX 32
+
+/**
+ * Read consecutive blocks from a file with a single read.
+ * Each block is read in its own buffer, and if shorter, it's padded with 0.
+ * On error nothing is reported, and the blocks should be read again with
+ * handle_read() to get the error message.
+ * \param block_map Vector of ::block_max buffers where to read the blocks.
+ * \param size_map Vector of ::block_max sizes where to return the size read of each block.
+ * \return 0 on success, -1 on error or if not supported.
+ */
+int handle_readv(struct snapraid_handle* handle, block_off_t file_pos, unsigned char** block_map, unsigned block_max, unsigned block_size, int* size_map);
+
 /**
  * Write a block to a file.
  */
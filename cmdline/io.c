@@ -18,6 +18,7 @@
 #include "portable.h"
 
 #include "io.h"
+#include "raid/raid.h"
 
 /**
  * Get the next block position to process.
@@ -27,8 +28,34 @@ static block_off_t io_position_next(struct snapraid_io* io)
 	block_off_t blockcur;
 
 	/* get the next position */
-	while (io->block_next < io->block_max && !io->block_is_enabled(io->block_arg, io->block_next))
-		++io->block_next;
+	if (io->block_map) {
+		while (io->block_next < io->block_max) {
+			block_off_t bit;
+			unsigned char mask;
+
+			/* positions outside the map are never processed */
+			if (io->block_next < io->block_map_start || io->block_next >= io->block_map_max) {
+				io->block_next = io->block_max;
+				break;
+			}
+
+			bit = io->block_next - io->block_map_start;
+			mask = io->block_map[bit / 8] >> (bit % 8);
+			if (mask & 1)
+				break;
+
+			/* skip all the disabled positions in the same byte */
+			if (mask == 0)
+				io->block_next += 8 - bit % 8;
+			else
+				++io->block_next;
+		}
+		if (io->block_next > io->block_max)
+			io->block_next = io->block_max;
+	} else {
+		while (io->block_next < io->block_max && !io->block_is_enabled(io->block_arg, io->block_next))
+			++io->block_next;
+	}
 
 	blockcur = io->block_next;
 
@@ -67,6 +94,9 @@ static void io_reader_sched(struct snapraid_io* io, int task_index, block_off_t
 		task->file_pos = 0;
 		task->read_size = 0;
 		task->is_timestamp_different = 0;
+		task->is_size_larger = 0;
+		task->tick_hash = 0;
+		task->preload_file = 0;
 	}
 }
 
@@ -92,6 +122,10 @@ static void io_writer_sched(struct snapraid_io* io, int task_index, block_off_t
 		task->file_pos = 0;
 		task->read_size = 0;
 		task->is_timestamp_different = 0;
+		task->is_size_larger = 0;
+		task->is_write = 0;
+		task->is_truncate = 0;
+		task->position_start = blockcur;
 	}
 }
 
@@ -117,6 +151,10 @@ static void io_writer_sched_empty(struct snapraid_io* io, int task_index, block_
 		task->file_pos = 0;
 		task->read_size = 0;
 		task->is_timestamp_different = 0;
+		task->is_size_larger = 0;
+		task->is_write = 0;
+		task->is_truncate = 0;
+		task->position_start = blockcur;
 	}
 }
 
@@ -169,8 +207,10 @@ static void io_write_next_mono(struct snapraid_io* io, block_off_t blockcur, int
 	(void)skip;
 
 	/* report errors */
-	for (i = 0; i < IO_WRITER_ERROR_MAX; ++i)
+	for (i = 0; i < IO_WRITER_ERROR_MAX; ++i) {
 		writer_error[i] = io->writer_error[i];
+		io->writer_error[i] = 0;
+	}
 }
 
 static void io_refresh_mono(struct snapraid_io* io)
@@ -228,12 +268,18 @@ static void io_parity_write_mono(struct snapraid_io* io, unsigned* pos, unsigned
 	worker = &io->writer_map[i];
 	task = &worker->task_map[0];
 
-	io->writer_error[i] = 0;
-
 	/* do the work */
-	if (task->state != TASK_STATE_EMPTY)
+	if (task->state != TASK_STATE_EMPTY) {
+		int error_index;
+
 		worker->func(worker, task);
 
+		/* counts the number of errors */
+		error_index = task->state - IO_WRITER_ERROR_BASE;
+		if (error_index >= 0 && error_index < IO_WRITER_ERROR_MAX)
+			++io->writer_error[error_index];
+	}
+
 	/* return the position */
 	*pos = i;
 
@@ -264,6 +310,80 @@ static void io_stop_mono(struct snapraid_io* io)
 /* disable multithread if pthread is not present */
 #if HAVE_PTHREAD
 
+/**
+ * Take a buffer from the pool for a task of a reader.
+ *
+ * It must be called with the io mutex locked.
+ * Return 0 if no buffer is available.
+ */
+static int io_buffer_take_unlock(struct snapraid_io* io, struct snapraid_worker* worker, unsigned index)
+{
+	struct snapraid_task* task = &worker->task_map[index];
+
+	/* nothing to do if the task doesn't need a buffer, or it already has it */
+	if (task->state != TASK_STATE_READY || task->buffer != 0)
+		return 1;
+
+	if (index == io->reader_index) {
+		/* the IO is waiting for this position, and its buffer is reserved */
+		assert(io->pool_reserve != 0);
+		--io->pool_reserve;
+	} else if (io->pool_free <= io->pool_reserve) {
+		/* don't use the reserved buffers for the read-ahead */
+		return 0;
+	}
+
+	assert(io->pool_free != 0);
+
+	task->buffer = io->pool_map[--io->pool_free];
+
+	/* set it also in the vector used by the caller */
+	io->buffer_map[index][worker->buffer_skew + (worker - io->reader_map)] = task->buffer;
+
+	return 1;
+}
+
+/**
+ * Return to the pool the buffers of all the readers at the specified position.
+ *
+ * It must be called with the io mutex locked.
+ */
+static void io_buffer_release_unlock(struct snapraid_io* io, unsigned index)
+{
+	unsigned i;
+
+	for (i = 0; i < io->reader_max; ++i) {
+		void** entry = &io->buffer_map[index][io->reader_map[i].buffer_skew + i];
+
+		if (*entry != 0) {
+			io->pool_map[io->pool_free++] = *entry;
+			*entry = 0;
+		}
+	}
+}
+
+/**
+ * Take the buffers for the tasks following the one in progress.
+ *
+ * Return the number of tasks, including the one in progress, that have a buffer.
+ */
+static unsigned io_buffer_take_ahead(struct snapraid_worker* worker, unsigned count)
+{
+	struct snapraid_io* io = worker->io;
+	unsigned i;
+
+	thread_mutex_lock(&io->io_mutex);
+
+	for (i = 1; i < count; ++i) {
+		if (!io_buffer_take_unlock(io, worker, (worker->index + i) % io->io_max))
+			break;
+	}
+
+	thread_mutex_unlock(&io->io_mutex);
+
+	return i;
+}
+
 /**
  * Get the next task to work on for a reader.
  *
@@ -278,6 +398,7 @@ static struct snapraid_task* io_reader_step(struct snapraid_worker* worker)
 
 	while (1) {
 		unsigned next_index;
+		unsigned distance;
 
 		/* check if the worker has to exit */
 		/* even if there is work to do */
@@ -289,8 +410,14 @@ static struct snapraid_task* io_reader_step(struct snapraid_worker* worker)
 		/* get the next pending task */
 		next_index = (worker->index + 1) % io->io_max;
 
+		/* distance of the next task from the one used by the IO */
+		/* it's 0 if the queue of pending tasks is empty */
+		distance = (next_index + io->io_max - io->reader_index) % io->io_max;
+
 		/* if the queue of pending tasks is not empty */
-		if (next_index != io->reader_index) {
+		/* and the next task is inside the read-ahead depth */
+		/* and there is a buffer for it */
+		if (distance != 0 && distance <= worker->depth && io_buffer_take_unlock(io, worker, next_index)) {
 			struct snapraid_task* task;
 
 			/* the index that the IO may be waiting for */
@@ -303,6 +430,9 @@ static struct snapraid_task* io_reader_step(struct snapraid_worker* worker)
 			worker->index = next_index;
 			task = &worker->task_map[worker->index];
 
+			/* the tasks scheduled after the new one, inside the read-ahead depth */
+			worker->ahead = worker->depth - distance;
+
 			/* if the just completed task is at this index */
 			if (done_index == waiting_index) {
 				/* notify the IO that a new read is complete */
@@ -315,11 +445,78 @@ static struct snapraid_task* io_reader_step(struct snapraid_worker* worker)
 			return task;
 		}
 
+		/* if the IO is waiting for the task just completed, notify it */
+		/* before waiting, as it's the IO that frees the buffers */
+		if (worker->index == io->reader_index)
+			thread_cond_signal(&io->read_done);
+
 		/* otherwise wait for a read_sched event */
 		thread_cond_wait(&io->read_sched, &io->io_mutex);
 	}
 }
 
+/**
+ * Adapt the read-ahead depth of the readers.
+ *
+ * The readers that the IO had to wait for in the last period double
+ * their depth, and the others reduce it by one.
+ *
+ * The depth is increased only inside the budget of the pool, using
+ * the buffers left free by the readers that reduce it.
+ */
+static void io_depth_adapt(struct snapraid_io* io)
+{
+	unsigned depth_max = io->io_max - 1;
+	unsigned used;
+	unsigned i;
+
+	/* first reduce the depth of the readers the IO didn't wait for */
+	used = 0;
+	for (i = 0; i < io->reader_max; ++i) {
+		struct snapraid_worker* worker = &io->reader_map[i];
+
+		if (worker->waited == 0 && worker->depth > IO_DEPTH_MIN)
+			--worker->depth;
+
+		/* the buffers used by the read-ahead, and the one used by the IO */
+		used += worker->depth + 1;
+	}
+
+	/* then increase the depth of the others with the buffers left */
+	for (i = 0; i < io->reader_max; ++i) {
+		struct snapraid_worker* worker = &io->reader_map[i];
+		struct snapraid_disk* disk;
+		struct snapraid_parity* parity;
+
+		if (worker->waited != 0) {
+			unsigned depth = worker->depth * 2;
+
+			if (depth > depth_max)
+				depth = depth_max;
+			if (depth - worker->depth > io->pool_max - used)
+				depth = worker->depth + (io->pool_max - used);
+
+			used += depth - worker->depth;
+			worker->depth = depth;
+		}
+
+		worker->waited = 0;
+
+		/* collect the depth for the usage report */
+		if (worker->parity_handle) {
+			parity = &io->state->parity[worker->parity_handle->level];
+			parity->depth_sum += worker->depth;
+			++parity->depth_count;
+		} else {
+			disk = worker->handle->disk;
+			if (disk) {
+				disk->depth_sum += worker->depth;
+				++disk->depth_count;
+			}
+		}
+	}
+}
+
 /**
  * Get the next task to work on for a writer.
  *
@@ -406,15 +603,34 @@ static block_off_t io_read_next_thread(struct snapraid_io* io, void*** buffer)
 	/* the synchronization is protected by the io mutex */
 	thread_mutex_lock(&io->io_mutex);
 
+	/* the caller is done with the buffers of the previous position */
+	io_buffer_release_unlock(io, io->reader_index);
+
 	/* schedule the next read */
 	io_reader_sched(io, io->reader_index, blockcur_schedule);
 
 	/* set the index for the tasks to return to the caller */
 	io->reader_index = (io->reader_index + 1) % io->io_max;
 
+	/* reserve the buffers still needed for the position to return */
+	io->pool_reserve = 0;
+	for (i = 0; i < io->reader_max; ++i) {
+		struct snapraid_task* task = &io->reader_map[i].task_map[io->reader_index];
+
+		if (task->state == TASK_STATE_READY && task->buffer == 0)
+			++io->pool_reserve;
+	}
+	assert(io->pool_reserve <= io->pool_free);
+
 	/* get the position to operate at high level from one task */
 	blockcur_caller = io->reader_map[0].task_map[io->reader_index].position;
 
+	/* adapt the read-ahead depth at every period */
+	if (++io->depth_period >= io->io_max) {
+		io->depth_period = 0;
+		io_depth_adapt(io);
+	}
+
 	/* set the buffer to use */
 	*buffer = io->buffer_map[io->reader_index];
 
@@ -426,15 +642,25 @@ static block_off_t io_read_next_thread(struct snapraid_io* io, void*** buffer)
 
 static void io_write_preset_thread(struct snapraid_io* io, block_off_t blockcur, int skip)
 {
-	(void)io;
-	(void)blockcur;
-	(void)skip;
+	/* the writers never work at the index of the IO */
+	/* so the tasks can be setup without locking */
+	/* and they are started only by io_write_next() */
+	if (skip) {
+		/* skip the next write */
+		io_writer_sched_empty(io, io->writer_index, blockcur);
+	} else {
+		/* schedule the next write */
+		io_writer_sched(io, io->writer_index, blockcur);
+	}
 }
 
 static void io_write_next_thread(struct snapraid_io* io, block_off_t blockcur, int skip, int* writer_error)
 {
 	unsigned i;
 
+	(void)blockcur;
+	(void)skip;
+
 	/* ensure that all parity was written */
 	assert(io->writer_list[0] == io->writer_max);
 
@@ -451,14 +677,6 @@ static void io_write_next_thread(struct snapraid_io* io, block_off_t blockcur, i
 		io->writer_error[i] = 0;
 	}
 
-	if (skip) {
-		/* skip the next write */
-		io_writer_sched_empty(io, io->writer_index, blockcur);
-	} else {
-		/* schedule the next write */
-		io_writer_sched(io, io->writer_index, blockcur);
-	}
-
 	/* at this point the writers must be in sync with the readers */
 	assert(io->writer_index == io->reader_index);
 
@@ -489,10 +707,13 @@ static void io_refresh_thread(struct snapraid_io* io)
 			end += io->io_max;
 		cached = end - begin;
 
-		if (worker->parity_handle)
+		if (worker->parity_handle) {
 			io->state->parity[worker->parity_handle->level].cached_blocks = cached;
-		else
+			io->state->parity[worker->parity_handle->level].cached_depth = worker->depth;
+		} else if (worker->handle->disk) {
 			worker->handle->disk->cached_blocks = cached;
+			worker->handle->disk->cached_depth = worker->depth;
+		}
 	}
 
 	/* for all writers, count the number of written blocks */
@@ -501,6 +722,10 @@ static void io_refresh_thread(struct snapraid_io* io)
 		unsigned begin, end, cached;
 		struct snapraid_worker* worker = &io->writer_map[i];
 
+		/* the data writers don't change the read stats of the disks */
+		if (!worker->parity_handle)
+			continue;
+
 		/* the first block written */
 		begin = io->writer_index + 1;
 		/* the block in writing */
@@ -510,6 +735,7 @@ static void io_refresh_thread(struct snapraid_io* io)
 		cached = end - begin;
 
 		io->state->parity[worker->parity_handle->level].cached_blocks = cached;
+		io->state->parity[worker->parity_handle->level].cached_depth = io->io_max - 1;
 	}
 
 	thread_mutex_unlock(&io->io_mutex);
@@ -564,6 +790,10 @@ static struct snapraid_task* io_task_read_thread(struct snapraid_io* io, unsigne
 
 					task = &worker->task_map[io->reader_index];
 
+					/* count that the IO had to wait for this worker */
+					if (waiting_cycle != 0)
+						++worker->waited;
+
 					thread_mutex_unlock(&io->io_mutex);
 
 					/* mark the worker as processed */
@@ -767,11 +997,17 @@ static void io_start_thread(struct snapraid_io* io,
 	io->done = 0;
 	io->reader_index = io->io_max - 1;
 	io->writer_index = 0;
+	io->depth_period = 0;
 
 	/* clear writer errors */
 	for (i = 0; i < IO_WRITER_ERROR_MAX; ++i)
 		io->writer_error[i] = 0;
 
+	/* return all the buffers to the pool */
+	for (i = 0; i < io->io_max; ++i)
+		io_buffer_release_unlock(io, i);
+	io->pool_reserve = 0;
+
 	/* setup the initial read pending tasks, except the latest one, */
 	/* the latest will be initialized at the fist io_read_next() call */
 	for (i = 0; i < io->io_max - 1; ++i) {
@@ -780,6 +1016,13 @@ static void io_start_thread(struct snapraid_io* io,
 		io_reader_sched(io, i, blockcur);
 	}
 
+	/* the first task is started without waiting, so give it the buffer now */
+	for (i = 0; i < io->reader_max; ++i) {
+		int ret = io_buffer_take_unlock(io, &io->reader_map[i], 0);
+		assert(ret != 0);
+		(void)ret;
+	}
+
 	/* setup the lists of workers to process */
 	io->reader_list[0] = io->reader_max;
 	for (i = 0; i <= io->writer_max; ++i)
@@ -790,6 +1033,11 @@ static void io_start_thread(struct snapraid_io* io,
 		struct snapraid_worker* worker = &io->reader_map[i];
 
 		worker->index = 0;
+		worker->ahead = 0;
+
+		/* start with the same share of the pool for all */
+		worker->depth = io->pool_max / io->reader_max - 1;
+		worker->waited = 0;
 
 		thread_create(&worker->thread, 0, io_reader_thread, worker);
 	}
@@ -838,6 +1086,192 @@ static void io_stop_thread(struct snapraid_io* io)
 	}
 }
 
+
+/**
+ * Compute or check a slice of the parity in progress.
+ *
+ * \return The mask of the parity levels not matching in the slice.
+ */
+static int io_gen_slice(struct snapraid_io* io, unsigned index, unsigned* diff)
+{
+	void* v[RAID_DATA_MAX + RAID_PARITY_MAX];
+	void* p[RAID_PARITY_MAX];
+	size_t offset;
+	size_t size;
+	int i;
+
+	for (i = 0; i < io->gen_np; ++i)
+		diff[i] = 0;
+
+	offset = index * io->gen_slice;
+	if (offset >= io->gen_size)
+		return 0;
+	size = io->gen_size - offset;
+	if (size > io->gen_slice)
+		size = io->gen_slice;
+
+	if (!io->gen_p) {
+		for (i = 0; i < io->gen_nd + io->gen_np; ++i)
+			v[i] = (unsigned char*)io->gen_v[i] + offset;
+
+		raid_gen(io->gen_nd, io->gen_np, size, v);
+		return 0;
+	}
+
+	for (i = 0; i < io->gen_nd; ++i)
+		v[i] = (unsigned char*)io->gen_v[i] + offset;
+	for (i = 0; i < io->gen_np; ++i)
+		p[i] = io->gen_p[i] ? (unsigned char*)io->gen_p[i] + offset : 0;
+
+	return raid_syndrome(io->gen_nd, io->gen_np, size, v, p, diff, io->gen_map[index].scratch);
+}
+
+static void* io_gen_thread(void* arg)
+{
+	struct snapraid_gen* gen = arg;
+	struct snapraid_io* io = gen->io;
+
+	thread_mutex_lock(&io->gen_mutex);
+
+	while (1) {
+		unsigned diff[LEV_MAX];
+		int mask;
+		int l;
+
+		/* wait for a new parity computation */
+		while (!io->gen_done && gen->seq == io->gen_seq)
+			thread_cond_wait(&io->gen_sched, &io->gen_mutex);
+
+		if (io->gen_done)
+			break;
+
+		gen->seq = io->gen_seq;
+
+		thread_mutex_unlock(&io->gen_mutex);
+
+		mask = io_gen_slice(io, gen->index, diff);
+
+		thread_mutex_lock(&io->gen_mutex);
+
+		io->gen_mask |= mask;
+		for (l = 0; l < io->gen_np; ++l)
+			io->gen_diff[l] += diff[l];
+
+		/* the last one completing signals the caller */
+		if (--io->gen_pending == 0)
+			thread_cond_signal(&io->gen_end);
+	}
+
+	thread_mutex_unlock(&io->gen_mutex);
+
+	return 0;
+}
+
+static void io_gen_start(struct snapraid_io* io)
+{
+	unsigned i;
+
+	thread_mutex_init(&io->gen_mutex, 0);
+	thread_cond_init(&io->gen_sched, 0);
+	thread_cond_init(&io->gen_end, 0);
+
+	io->gen_seq = 0;
+	io->gen_done = 0;
+
+	/* the slice 0 is computed by the caller */
+	for (i = 1; i < io->gen_max; ++i) {
+		struct snapraid_gen* gen = &io->gen_map[i];
+
+		gen->io = io;
+		gen->index = i;
+		gen->seq = 0;
+
+		thread_create(&gen->thread, 0, io_gen_thread, gen);
+	}
+
+	io->gen_started = 1;
+
+	msg_verbose("Using %u threads for the parity computation.\n", io->gen_max);
+}
+
+static void io_gen_stop(struct snapraid_io* io)
+{
+	unsigned i;
+
+	thread_mutex_lock(&io->gen_mutex);
+
+	/* mark that we are stopping */
+	io->gen_done = 1;
+
+	/* signal all the threads to recognize the new state */
+	thread_cond_broadcast(&io->gen_sched);
+
+	thread_mutex_unlock(&io->gen_mutex);
+
+	/* wait for all generators to terminate */
+	for (i = 1; i < io->gen_max; ++i) {
+		struct snapraid_gen* gen = &io->gen_map[i];
+		void* retval;
+
+		/* wait for thread termination */
+		thread_join(gen->thread, &retval);
+	}
+
+	thread_mutex_destroy(&io->gen_mutex);
+	thread_cond_destroy(&io->gen_sched);
+	thread_cond_destroy(&io->gen_end);
+
+	io->gen_started = 0;
+}
+
+static int io_gen_thread_run(struct snapraid_io* io, int nd, int np, size_t size, void** v, void** p, unsigned* diff)
+{
+	int mask;
+	int l;
+
+	if (!io->gen_started)
+		io_gen_start(io);
+
+	thread_mutex_lock(&io->gen_mutex);
+
+	io->gen_nd = nd;
+	io->gen_np = np;
+	io->gen_size = size;
+	io->gen_v = v;
+	io->gen_p = p;
+	io->gen_mask = 0;
+	for (l = 0; l < np; ++l)
+		io->gen_diff[l] = 0;
+	io->gen_pending = io->gen_max - 1;
+
+	/* split the block in slices aligned at the cache line */
+	io->gen_slice = (size + io->gen_max - 1) / io->gen_max;
+	io->gen_slice = (io->gen_slice + 63) & ~(size_t)63;
+
+	/* schedule the new computation */
+	++io->gen_seq;
+
+	thread_cond_broadcast(&io->gen_sched);
+
+	thread_mutex_unlock(&io->gen_mutex);
+
+	/* compute the first slice */
+	mask = io_gen_slice(io, 0, diff);
+
+	thread_mutex_lock(&io->gen_mutex);
+
+	/* wait for the other slices */
+	while (io->gen_pending != 0)
+		thread_cond_wait(&io->gen_end, &io->gen_mutex);
+
+	mask |= io->gen_mask;
+	for (l = 0; l < np; ++l)
+		diff[l] += io->gen_diff[l];
+
+	thread_mutex_unlock(&io->gen_mutex);
+
+	return mask;
+}
 #endif
 
 /*****************************************************************************/
@@ -846,15 +1280,22 @@ static void io_stop_thread(struct snapraid_io* io)
 void io_init(struct snapraid_io* io, struct snapraid_state* state,
 	unsigned io_cache, unsigned buffer_max,
 	void (*data_reader)(struct snapraid_worker*, struct snapraid_task*),
-	struct snapraid_handle* handle_map, unsigned handle_max,
+	void (*data_writer)(struct snapraid_worker*, struct snapraid_task*),
+	struct snapraid_handle* handle_map, struct snapraid_handle* write_handle_map, unsigned handle_max,
 	void (*parity_reader)(struct snapraid_worker*, struct snapraid_task*),
 	void (*parity_writer)(struct snapraid_worker*, struct snapraid_task*),
 	struct snapraid_parity_handle* parity_handle_map, unsigned parity_handle_max)
 {
 	unsigned i;
-	size_t allocated;
+	unsigned data_write_max;
+	unsigned block_per_reader;
+	unsigned fixed_max;
+	unsigned block_max;
+	unsigned block;
+	unsigned char* pooled;
 
 	io->state = state;
+	io->block_map = 0;
 
 #if HAVE_PTHREAD
 	if (io_cache == 0) {
@@ -877,26 +1318,40 @@ void io_init(struct snapraid_io* io, struct snapraid_state* state,
 
 	assert(io->io_max == 1 || (io->io_max >= IO_MIN && io->io_max <= IO_MAX));
 
-	io->buffer_max = buffer_max;
-	allocated = 0;
-	for (i = 0; i < io->io_max; ++i) {
-		if (state->file_mode != ADVISE_DIRECT)
-			io->buffer_map[i] = malloc_nofail_vector_align(handle_max, buffer_max, state->block_size, &io->buffer_alloc_map[i]);
-		else
-			io->buffer_map[i] = malloc_nofail_vector_direct(handle_max, buffer_max, state->block_size, &io->buffer_alloc_map[i]);
-		if (!state->opt.skip_self)
-			mtest_vector(io->buffer_max, state->block_size, io->buffer_map[i]);
-		allocated += state->block_size * buffer_max;
+	io->gen_max = 1;
+	io->gen_started = 0;
+#if HAVE_PTHREAD
+	if (io->io_max > 1) {
+		if (state->opt.io_gen != 0) {
+			io->gen_max = state->opt.io_gen;
+		} else {
+			/* use all the processors, but only if each slice has enough data to process */
+			io->gen_max = cpu_count();
+			while (io->gen_max > 1 && (size_t)handle_max * state->block_size / io->gen_max < IO_GEN_DATA_MIN)
+				--io->gen_max;
+		}
+		if (io->gen_max > IO_GEN_MAX)
+			io->gen_max = IO_GEN_MAX;
 	}
+#endif
+
+	/* allocate the scratch buffers once, as the generators run for all the blocks */
+	for (i = 0; i < io->gen_max; ++i)
+		io->gen_map[i].scratch = malloc_nofail_align(RAID_SCRATCH_SIZE, &io->gen_map[i].scratch_alloc);
 
-	msg_progress("Using %u MiB of memory for %u cached blocks.\n", (unsigned)(allocated / MEBI), io->io_max);
+	io->buffer_max = buffer_max;
+
+	/* the data and parity writers cannot be used together */
+	assert(!data_writer || !parity_writer);
+
+	data_write_max = data_writer ? handle_max : 0;
 
 	if (parity_writer) {
 		io->reader_max = handle_max;
 		io->writer_max = parity_handle_max;
 	} else {
 		io->reader_max = handle_max + parity_handle_max;
-		io->writer_max = 0;
+		io->writer_max = data_write_max;
 	}
 
 	io->reader_map = malloc_nofail(sizeof(struct snapraid_worker) * io->reader_max);
@@ -913,6 +1368,9 @@ void io_init(struct snapraid_io* io, struct snapraid_state* state,
 		struct snapraid_worker* worker = &io->reader_map[i];
 
 		worker->io = io;
+		worker->ahead = 0;
+		worker->depth = io->io_max - 1;
+		worker->waited = 0;
 
 		if (i < handle_max) {
 			/* it's a data read */
@@ -920,6 +1378,10 @@ void io_init(struct snapraid_io* io, struct snapraid_state* state,
 			worker->parity_handle = 0;
 			worker->func = data_reader;
 
+			/* allow the worker to search the disk extents without locking */
+			if (worker->handle->disk)
+				fs_index_build(worker->handle->disk);
+
 			/* data read is put in lower buffer index */
 			worker->buffer_skew = 0;
 		} else {
@@ -928,8 +1390,9 @@ void io_init(struct snapraid_io* io, struct snapraid_state* state,
 			worker->parity_handle = &parity_handle_map[i - handle_max];
 			worker->func = parity_reader;
 
-			/* parity read is put after data and computed parity */
-			worker->buffer_skew = parity_handle_max;
+			/* parity read is put after data and computed parity if any, */
+			/* and before the data to write if any */
+			worker->buffer_skew = buffer_max - data_write_max - handle_max - parity_handle_max;
 		}
 	}
 
@@ -937,16 +1400,87 @@ void io_init(struct snapraid_io* io, struct snapraid_state* state,
 		struct snapraid_worker* worker = &io->writer_map[i];
 
 		worker->io = io;
+		worker->ahead = 0;
+		worker->depth = io->io_max - 1;
+		worker->waited = 0;
+
+		if (data_writer) {
+			/* it's a data write */
+			worker->handle = &write_handle_map[i];
+			worker->parity_handle = 0;
+			worker->func = data_writer;
 
-		/* it's a parity write */
-		worker->handle = 0;
-		worker->parity_handle = &parity_handle_map[i];
-		worker->func = parity_writer;
+			/* data to write is put at the end */
+			worker->buffer_skew = buffer_max - handle_max;
+		} else {
+			/* it's a parity write */
+			worker->handle = 0;
+			worker->parity_handle = &parity_handle_map[i];
+			worker->func = parity_writer;
 
-		/* parity to write is put after data */
-		worker->buffer_skew = handle_max;
+			/* parity to write is put after data */
+			worker->buffer_skew = handle_max;
+		}
 	}
 
+	/* with threads, the buffers of the readers are in the pool */
+	/* without them, all the buffers are fixed */
+	if (io->io_max > 1) {
+		/* the budget, but at least the min depth for all the readers, and at most the full ring */
+		block_per_reader = io->io_max / IO_BUDGET_DIV;
+		if (block_per_reader < IO_DEPTH_MIN + 1)
+			block_per_reader = IO_DEPTH_MIN + 1;
+		if (block_per_reader > io->io_max)
+			block_per_reader = io->io_max;
+		io->pool_max = io->reader_max * block_per_reader;
+		fixed_max = buffer_max - io->reader_max;
+	} else {
+		io->pool_max = 0;
+		fixed_max = buffer_max;
+	}
+
+	block_max = io->io_max * fixed_max + io->pool_max;
+	if (state->file_mode != ADVISE_DIRECT)
+		io->buffer_block = malloc_nofail_vector_align(handle_max, block_max, state->block_size, &io->buffer_alloc);
+	else
+		io->buffer_block = malloc_nofail_vector_direct(handle_max, block_max, state->block_size, &io->buffer_alloc);
+	if (!state->opt.skip_self)
+		mtest_vector(block_max, state->block_size, io->buffer_block);
+
+	/* the pool takes the first buffers */
+	io->pool_map = malloc_nofail(io->pool_max * sizeof(void*));
+	for (i = 0; i < io->pool_max; ++i)
+		io->pool_map[i] = io->buffer_block[i];
+	io->pool_free = io->pool_max;
+	io->pool_reserve = 0;
+
+	/* mark the buffers of the readers, taken from the pool */
+	pooled = malloc_nofail(buffer_max);
+	memset(pooled, 0, buffer_max);
+	if (io->pool_max != 0) {
+		for (i = 0; i < io->reader_max; ++i)
+			pooled[io->reader_map[i].buffer_skew + i] = 1;
+	}
+
+	/* the fixed buffers follow the pool */
+	block = io->pool_max;
+	for (i = 0; i < io->io_max; ++i) {
+		unsigned j;
+
+		io->buffer_map[i] = malloc_nofail(buffer_max * sizeof(void*));
+		for (j = 0; j < buffer_max; ++j) {
+			if (pooled[j])
+				io->buffer_map[i][j] = 0;
+			else
+				io->buffer_map[i][j] = io->buffer_block[block++];
+		}
+	}
+	assert(block == block_max);
+
+	free(pooled);
+
+	msg_progress("Using %u MiB of memory for %u cached blocks.\n", (unsigned)(block_max * (size_t)state->block_size / MEBI), io->io_max);
+
 #if HAVE_PTHREAD
 	if (io->io_max > 1) {
 		io_read_next = io_read_next_thread;
@@ -956,6 +1490,7 @@ void io_init(struct snapraid_io* io, struct snapraid_state* state,
 		io_data_read = io_data_read_thread;
 		io_parity_read = io_parity_read_thread;
 		io_parity_write = io_parity_write_thread;
+		io_data_write = io_parity_write_thread;
 		io_start = io_start_thread;
 		io_stop = io_stop_thread;
 
@@ -974,6 +1509,7 @@ void io_init(struct snapraid_io* io, struct snapraid_state* state,
 		io_data_read = io_data_read_mono;
 		io_parity_read = io_parity_read_mono;
 		io_parity_write = io_parity_write_mono;
+		io_data_write = io_parity_write_mono;
 		io_start = io_start_mono;
 		io_stop = io_stop_mono;
 	}
@@ -983,17 +1519,22 @@ void io_done(struct snapraid_io* io)
 {
 	unsigned i;
 
-	for (i = 0; i < io->io_max; ++i) {
+	for (i = 0; i < io->io_max; ++i)
 		free(io->buffer_map[i]);
-		free(io->buffer_alloc_map[i]);
-	}
+	free(io->buffer_block);
+	free(io->buffer_alloc);
+	free(io->pool_map);
 
 	free(io->reader_map);
 	free(io->reader_list);
 	free(io->writer_map);
 	free(io->writer_list);
+	free(io->block_map);
 
 #if HAVE_PTHREAD
+	if (io->gen_started)
+		io_gen_stop(io);
+
 	if (io->io_max > 1) {
 		thread_mutex_destroy(&io->io_mutex);
 		thread_cond_destroy(&io->read_done);
@@ -1002,5 +1543,223 @@ void io_done(struct snapraid_io* io)
 		thread_cond_destroy(&io->write_sched);
 	}
 #endif
+
+	/* after stopping the generators using them */
+	for (i = 0; i < io->gen_max; ++i)
+		free(io->gen_map[i].scratch_alloc);
+}
+
+struct snapraid_task* io_write_task(struct snapraid_io* io, unsigned index)
+{
+	/* in mono thread mode, the ::writer_index is the worker index */
+	/* and all the tasks are at index 0 */
+	if (io->io_max == 1)
+		return &io->writer_map[index].task_map[0];
+
+	return &io->writer_map[index].task_map[io->writer_index];
+}
+
+block_off_t io_position_map(struct snapraid_io* io,
+	block_off_t blockstart, block_off_t blockmax,
+	int (*block_is_enabled)(void* arg, block_off_t), void* blockarg)
+{
+	block_off_t blockcur;
+	block_off_t count;
+	size_t size;
+
+	free(io->block_map);
+
+	size = (blockmax - blockstart) / 8 + 1;
+	io->block_map = malloc_nofail(size);
+	io->block_map_start = blockstart;
+	io->block_map_max = blockmax;
+	memset(io->block_map, 0, size);
+
+	count = 0;
+	for (blockcur = blockstart; blockcur < blockmax; ++blockcur) {
+		block_off_t bit;
+
+		if (!block_is_enabled(blockarg, blockcur))
+			continue;
+
+		bit = blockcur - blockstart;
+		io->block_map[bit / 8] |= 1 << (bit % 8);
+		++count;
+	}
+
+	return count;
+}
+
+void io_raid_gen(struct snapraid_io* io, int nd, int np, size_t size, void** v)
+{
+#if HAVE_PTHREAD
+	if (io->gen_max > 1) {
+		unsigned diff[LEV_MAX];
+
+		io_gen_thread_run(io, nd, np, size, v, 0, diff);
+		return;
+	}
+#endif
+
+	raid_gen(nd, np, size, v);
+}
+
+int io_raid_syndrome(struct snapraid_io* io, int nd, int np, size_t size, void** v, void** p, unsigned* diff)
+{
+#if HAVE_PTHREAD
+	if (io->gen_max > 1)
+		return io_gen_thread_run(io, nd, np, size, v, p, diff);
+#endif
+
+	return raid_syndrome(nd, np, size, v, p, diff, io->gen_map[0].scratch);
+}
+
+void io_raid_gen_delta(struct snapraid_io* io, int nr, int* id, int nd, int np, size_t size, void** v)
+{
+	raid_gen_delta(nr, id, nd, np, size, v, io->gen_map[0].scratch);
+}
+
+/**
+ * Compute the hashes of the data read by the tasks.
+ *
+ * The blocks of the same size are hashed all together with memhash_multi().
+ */
+static void io_hash(struct snapraid_io* io, struct snapraid_task** task_map, int* size_map, unsigned count)
+{
+	struct snapraid_state* state = io->state;
+	unsigned char* src_map[HANDLE_READV_MAX];
+	unsigned char* hash_map[HANDLE_READV_MAX];
+	unsigned char* prev_src_map[HANDLE_READV_MAX];
+	unsigned char* prev_hash_map[HANDLE_READV_MAX];
+	unsigned char* rehash_map[HANDLE_READV_MAX];
+	unsigned hash_count;
+	unsigned prev_count;
+	unsigned i;
+	uint64_t start;
+
+	start = tick();
+
+	hash_count = 0;
+	prev_count = 0;
+	for (i = 0; i < count; ++i) {
+		struct snapraid_task* task = task_map[i];
+
+		/* note that the info at this position is changed only after the task is processed */
+		if (info_get_rehash(info_get(&state->infoarr, task->position))) {
+			if (size_map[i] == (int)state->block_size) {
+				prev_src_map[prev_count] = task->buffer;
+				prev_hash_map[prev_count] = task->hash;
+				rehash_map[prev_count] = task->rehash;
+				++prev_count;
+			} else {
+				memhash(state->prevhash, state->prevhashseed, task->hash, task->buffer, size_map[i]);
+				memhash(state->hash, state->hashseed, task->rehash, task->buffer, size_map[i]);
+			}
+		} else {
+			if (size_map[i] == (int)state->block_size) {
+				src_map[hash_count] = task->buffer;
+				hash_map[hash_count] = task->hash;
+				++hash_count;
+			} else {
+				memhash(state->hash, state->hashseed, task->hash, task->buffer, size_map[i]);
+			}
+		}
+	}
+
+	if (hash_count != 0)
+		memhash_multi(state->hash, state->hashseed, hash_map, src_map, hash_count, state->block_size);
+
+	if (prev_count != 0) {
+		memhash_multi(state->prevhash, state->prevhashseed, prev_hash_map, prev_src_map, prev_count, state->block_size);
+		memhash_multi(state->hash, state->hashseed, rehash_map, prev_src_map, prev_count, state->block_size);
+	}
+
+	/* split the time in all the tasks hashed together */
+	start = (tick() - start) / count;
+	for (i = 0; i < count; ++i)
+		task_map[i]->tick_hash = start;
+}
+
+static int io_handle_read_batch(struct snapraid_worker* worker, struct snapraid_task* task, int hash, fptr* out, fptr* out_missing)
+{
+	struct snapraid_io* io = worker->io;
+	struct snapraid_handle* handle = worker->handle;
+	unsigned block_size = io->state->block_size;
+	struct snapraid_task* task_map[HANDLE_READV_MAX];
+	unsigned char* buffer_map[HANDLE_READV_MAX];
+	int size_map[HANDLE_READV_MAX];
+	unsigned count;
+	unsigned limit;
+	unsigned i;
+
+	/* if the data was already read, and hashed, with a previous task */
+	if (task->preload_file != 0 && task->preload_file == task->file && task->preload_pos == task->file_pos)
+		return task->preload_size;
+
+	/* the task in progress must be the current one */
+	limit = worker->ahead + 1;
+	if (limit > HANDLE_READV_MAX)
+		limit = HANDLE_READV_MAX;
+
+	/* collect the next tasks reading the next blocks of the same file */
+	task_map[0] = task;
+	buffer_map[0] = task->buffer;
+	count = 1;
+	while (count < limit) {
+		struct snapraid_task* next = &worker->task_map[(worker->index + count) % io->io_max];
+		struct snapraid_file* file;
+		block_off_t file_pos;
+
+		if (next->state != TASK_STATE_READY || next->position != task->position + count)
+			break;
+
+		file = fs_par2file_find(handle->disk, next->position, &file_pos);
+		if (file != task->file || file_pos != task->file_pos + count)
+			break;
+
+		task_map[count] = next;
+		++count;
+	}
+
+#if HAVE_PTHREAD
+	/* the next tasks are not started yet, and they may not have a buffer */
+	if (count > 1)
+		count = io_buffer_take_ahead(worker, count);
+#endif
+
+	for (i = 1; i < count; ++i)
+		buffer_map[i] = task_map[i]->buffer;
+
+	if (count > 1 && handle_readv(handle, task->file_pos, buffer_map, count, block_size, size_map) == 0) {
+		/* the data of the next tasks is now ready */
+		for (i = 1; i < count; ++i) {
+			task_map[i]->preload_file = task->file;
+			task_map[i]->preload_pos = task->file_pos + i;
+			task_map[i]->preload_size = size_map[i];
+		}
+
+		if (hash)
+			io_hash(io, task_map, size_map, count);
+
+		return size_map[0];
+	}
+
+	/* read only the single block, also to report any error */
+	size_map[0] = handle_read(handle, task->file_pos, task->buffer, block_size, out, out_missing);
+
+	if (hash && size_map[0] != -1)
+		io_hash(io, task_map, size_map, 1);
+
+	return size_map[0];
+}
+
+int io_handle_read(struct snapraid_worker* worker, struct snapraid_task* task, fptr* out, fptr* out_missing)
+{
+	return io_handle_read_batch(worker, task, 0, out, out_missing);
+}
+
+int io_handle_read_hash(struct snapraid_worker* worker, struct snapraid_task* task, fptr* out, fptr* out_missing)
+{
+	return io_handle_read_batch(worker, task, 1, out, out_missing);
 }
 
@@ -42,6 +42,39 @@
 #define IO_MIN 3 /* required by writers, readers can work also with 2 */
 #define IO_MAX 128
 
+/**
+ * Min read-ahead depth of a reader.
+ *
+ * The depth of each reader is adapted at runtime between this value
+ * and the number of read-ahead buffers.
+ */
+#define IO_DEPTH_MIN 2
+
+/**
+ * Read-ahead memory budget.
+ *
+ * The buffers of the readers are a pool shared by all of them, with
+ * in average a buffer every IO_BUDGET_DIV positions of the ring for each
+ * reader. The readers the IO has to wait for get a deeper read-ahead,
+ * using the buffers left free by the faster ones.
+ */
+#define IO_BUDGET_DIV 2
+
+/**
+ * Max number of slices of the parity computed in parallel.
+ */
+#define IO_GEN_MAX 8
+
+/**
+ * Min amount of data that each parity slice has to process.
+ *
+ * The parity computation of each slice has a fixed cost of thread
+ * synchronization, and it has to be large enough to pay it.
+ * With the default block size of 256 KiB it means to use a thread
+ * every four data disks.
+ */
+#define IO_GEN_DATA_MIN (1024 * 1024)
+
 /**
  * State of the task.
  */
@@ -78,6 +111,39 @@ struct snapraid_task {
 	block_off_t file_pos;
 	int read_size; /**< Size of the data read. */
 	int is_timestamp_different; /**< Report if file has a changed timestamp. */
+	int is_size_larger; /**< Report if file is larger than expected. */
+
+	/**
+	 * Hash of the data read.
+	 *
+	 * Computed by the worker thread to offload the main thread,
+	 * calling io_handle_read_hash().
+	 * If the block position requires a rehash, ::hash is computed with
+	 * the previous hash kind, and ::rehash with the new one.
+	 */
+	unsigned char hash[HASH_MAX];
+	unsigned char rehash[HASH_MAX];
+	uint64_t tick_hash; /**< Time used by the worker to compute the hash. */
+
+	/**
+	 * Data already read in ::buffer by a previous task.
+	 *
+	 * Set by io_handle_read() when reading consecutive blocks of the same
+	 * file with a single read.
+	 */
+	struct snapraid_file* preload_file; /**< File of the data, or 0 if nothing was read. */
+	block_off_t preload_pos; /**< Position in the file of the data. */
+	int preload_size; /**< Size of the data read. */
+
+	/**
+	 * Work of a data writer.
+	 *
+	 * Set by the caller in the task returned by io_write_task(),
+	 * after io_write_preset() and before io_data_write().
+	 */
+	int is_write; /**< Write ::buffer in ::file at ::file_pos. */
+	int is_truncate; /**< Truncate ::file at its expected size. */
+	block_off_t position_start; /**< First position of the range of the skipped positions before ::position. */
 };
 
 /**
@@ -99,6 +165,8 @@ struct snapraid_worker {
 	 * Handle to data or parity.
 	 *
 	 * Only one of the two is valid, the other is 0.
+	 * The data writers have their own handles, different than the ones
+	 * of the data readers of the same disks.
 	 */
 	struct snapraid_handle* handle; /**< Handle at the file on the disk. */
 	struct snapraid_parity_handle* parity_handle; /**< Handle at the parity on the disk. */
@@ -117,12 +185,68 @@ struct snapraid_worker {
 	 */
 	unsigned index;
 
+	/**
+	 * Number of tasks already scheduled after the one in progress.
+	 *
+	 * It's updated every time the worker gets a new task.
+	 */
+	unsigned ahead;
+
+	/**
+	 * Read-ahead depth.
+	 *
+	 * Max distance of the task in progress from the one used by the IO.
+	 * It's between IO_DEPTH_MIN and ::io_max - 1, and it's increased
+	 * for the readers that the IO has to wait for, and decreased for the
+	 * others, to keep the buffers filled only where they are needed.
+	 *
+	 * The sum of the buffers needed by all the readers, that is the depth
+	 * plus the one used by the IO, never exceeds the ::pool_max budget.
+	 */
+	unsigned depth;
+
+	/**
+	 * Number of times the IO waited for this reader in the current period.
+	 */
+	unsigned waited;
+
 	/**
 	 * Which buffer base index should be used for destination.
 	 */
 	unsigned buffer_skew;
 };
 
+/**
+ * Parity generator.
+ *
+ * This represents a thread designated to compute a slice of the parity.
+ */
+struct snapraid_gen {
+#if HAVE_PTHREAD
+	pthread_t thread; /**< Thread context for the generator. */
+#endif
+
+	struct snapraid_io* io; /**< Parent pointer. */
+
+	unsigned index; /**< Index of the slice to compute. */
+
+	/**
+	 * Scratch buffer of RAID_SCRATCH_SIZE bytes for raid_syndrome() and raid_gen_delta().
+	 *
+	 * The one of the generator 0 is used by the caller.
+	 */
+	void* scratch;
+	void* scratch_alloc; /**< Allocated scratch buffer. */
+
+	/**
+	 * Sequence number of the last parity computation done.
+	 *
+	 * When it's different than the ::gen_seq of the IO, there is a new
+	 * parity computation to do.
+	 */
+	unsigned seq;
+};
+
 /**
  * Number of error kind for writers.
  */
@@ -220,14 +344,43 @@ struct snapraid_io {
 	int (*block_is_enabled)(void* arg, block_off_t);
 	void* block_arg;
 
+	/**
+	 * Bitmap of the positions to process, starting from ::block_start.
+	 * If not 0, it's used instead of calling ::block_is_enabled.
+	 */
+	unsigned char* block_map;
+	block_off_t block_map_start;
+	block_off_t block_map_max;
+
 	/**
 	 * Buffers for data.
 	 *
-	 * A pool of buffers used to store the data read.
+	 * A vector of ::buffer_max buffers for every position of the ring.
+	 *
+	 * With threads, the buffers of the readers are taken from the pool
+	 * only when the reader starts the task, and they are 0 otherwise.
+	 * The other buffers, like the ones of the parity to write, are fixed.
 	 */
 	unsigned buffer_max; /**< Number of buffers. */
-	void* buffer_alloc_map[IO_MAX]; /**< Allocation map for buffers. */
 	void** buffer_map[IO_MAX]; /**< Buffers for data. */
+	void** buffer_block; /**< All the allocated buffers. */
+	void* buffer_alloc; /**< Allocation of all the buffers. */
+
+	/**
+	 * Pool of the buffers of the readers.
+	 *
+	 * It's the memory budget of the read-ahead. A reader takes a buffer
+	 * from the pool for every task it starts, and the buffers return to the
+	 * pool when the IO is done with the position.
+	 *
+	 * The buffers for the position the IO is waiting for are always
+	 * reserved, to ensure that the readers cannot use all of them for
+	 * the read-ahead, and block the IO.
+	 */
+	unsigned pool_max; /**< Number of buffers in the pool. */
+	void** pool_map; /**< Stack of the free buffers. */
+	unsigned pool_free; /**< Number of free buffers in the stack. */
+	unsigned pool_reserve; /**< Number of buffers reserved for the position the IO is waiting for. */
 
 	/**
 	 * Workers.
@@ -287,8 +440,75 @@ struct snapraid_io {
 
 	/**
 	 * Counts the error happening in the writers.
+	 *
+	 * After io_stop(), it contains the errors of the writes
+	 * not yet reported by io_write_next().
 	 */
 	int writer_error[IO_WRITER_ERROR_MAX];
+
+	/**
+	 * Number of positions processed in the current period
+	 * of adaptation of the read-ahead depth.
+	 */
+	unsigned depth_period;
+
+	/**
+	 * Number of slices of the parity computed in parallel.
+	 *
+	 * The block is split in ::gen_max slices aligned at the cache line.
+	 * The first slice is computed by the caller, and the others by
+	 * the ::gen_max - 1 threads in ::gen_map.
+	 *
+	 * If equal to 1, the parity is computed by the caller without any thread.
+	 */
+	unsigned gen_max;
+
+	/**
+	 * Generators.
+	 *
+	 * They are started at the first parity computation, as not all the
+	 * commands need to compute the parity.
+	 */
+	struct snapraid_gen gen_map[IO_GEN_MAX];
+	int gen_started; /**< If the generator threads are started. */
+
+#if HAVE_PTHREAD
+	/**
+	 * Mutex used to protect the synchronization
+	 * between the io and the generators.
+	 */
+	pthread_mutex_t gen_mutex;
+
+	/**
+	 * Condition for a new parity computation scheduled.
+	 *
+	 * The generators wait on this condition when they are waiting for
+	 * a new parity computation.
+	 */
+	pthread_cond_t gen_sched;
+
+	/**
+	 * Condition for a parity computation completed.
+	 *
+	 * The last generator completing its slice signals this condition.
+	 */
+	pthread_cond_t gen_end;
+#endif
+
+	/**
+	 * The parity computation in progress.
+	 */
+	unsigned gen_seq; /**< Sequence number of the computation. */
+	unsigned gen_pending; /**< Number of generators still working on it. */
+	int gen_nd; /**< Number of data blocks. */
+	int gen_np; /**< Number of parity blocks. */
+	size_t gen_size; /**< Size of the blocks. */
+	size_t gen_slice; /**< Size of each slice. Multiple of 64. */
+	void** gen_v; /**< Data and parity blocks like in raid_gen(), or only data blocks like in raid_syndrome(). */
+	void** gen_p; /**< Parity blocks to check like in raid_syndrome(), or 0 to just compute the parity. */
+	int gen_mask; /**< Mask of the parity levels not matching. */
+	unsigned gen_diff[LEV_MAX]; /**< Number of bits not matching for each parity level. */
+	int gen_done; /**< Exit condition for the generators. */
 };
 
 /**
@@ -296,11 +516,14 @@ struct snapraid_io {
  *
  * \param io_cache The number of IO buffers for read-ahead and write-behind. 0 for default.
  * \param buffer_max The number of data/parity buffers to allocate.
+ * \param data_writer If not 0, a writer for each data disk, using the handles in ::write_handle_map.
+ *   Their buffers are the last ::handle_max ones. It cannot be used with ::parity_writer.
  */
 void io_init(struct snapraid_io* io, struct snapraid_state* state,
 	unsigned io_cache, unsigned buffer_max,
 	void (*data_reader)(struct snapraid_worker*, struct snapraid_task*),
-	struct snapraid_handle* handle_map, unsigned handle_max,
+	void (*data_writer)(struct snapraid_worker*, struct snapraid_task*),
+	struct snapraid_handle* handle_map, struct snapraid_handle* write_handle_map, unsigned handle_max,
 	void (*parity_reader)(struct snapraid_worker*, struct snapraid_task*),
 	void (*parity_writer)(struct snapraid_worker*, struct snapraid_task*),
 	struct snapraid_parity_handle* parity_handle_map, unsigned parity_handle_max);
@@ -310,6 +533,49 @@ void io_init(struct snapraid_io* io, struct snapraid_state* state,
  */
 void io_done(struct snapraid_io* io);
 
+/**
+ * Compute the parity like raid_gen().
+ *
+ * In thread mode, the parity is computed in parallel in slices
+ * of the blocks, using the ::gen_max generators.
+ *
+ * The hashes of the data blocks are not computed here, but by the readers
+ * with io_handle_read_hash() just after the read, when the data is still
+ * in the cache. A hash goes through the whole block in order, and it
+ * cannot be split in the slices computed in parallel by the generators.
+ */
+void io_raid_gen(struct snapraid_io* io, int nd, int np, size_t size, void** v);
+
+/**
+ * Check the parity like raid_syndrome().
+ *
+ * In thread mode, the parity is checked in parallel in slices
+ * of the blocks, using the ::gen_max generators.
+ *
+ * \return The mask of the parity levels not matching.
+ */
+int io_raid_syndrome(struct snapraid_io* io, int nd, int np, size_t size, void** v, void** p, unsigned* diff);
+
+/**
+ * Update the parity like raid_gen_delta().
+ *
+ * The parity is updated by the caller, using its scratch buffer.
+ */
+void io_raid_gen_delta(struct snapraid_io* io, int nr, int* id, int nd, int np, size_t size, void** v);
+
+/**
+ * Select the positions to process in the next io_start().
+ *
+ * The block_is_enabled() function is called only once for all the positions,
+ * and the result is stored in a bitmap, that allows to skip quickly
+ * the positions not to process.
+ *
+ * \return The number of positions to process.
+ */
+block_off_t io_position_map(struct snapraid_io* io,
+	block_off_t blockstart, block_off_t blockmax,
+	int (*block_is_enabled)(void* arg, block_off_t), void* blockarg);
+
 /**
  * Start all the worker threads.
  */
@@ -366,11 +632,34 @@ struct snapraid_task* (*io_parity_read)(struct snapraid_io* io, unsigned* levcur
  */
 void (*io_parity_write)(struct snapraid_io* io, unsigned* levcur, unsigned* waiting_map, unsigned* waiting_mac);
 
+/**
+ * Write of a data block.
+ *
+ * Like io_parity_write(), but for the data writers.
+ * It must be called exactly ::handle_max times.
+ *
+ * \param io InputOutput context.
+ * \param diskcur The position of the data block in the ::handle_map vector.
+ */
+void (*io_data_write)(struct snapraid_io* io, unsigned* diskcur, unsigned* waiting_map, unsigned* waiting_mac);
+
+/**
+ * Get the task of a writer for the write position.
+ *
+ * The caller can change the task after io_write_preset(),
+ * and before io_data_write() or io_parity_write().
+ *
+ * \param io InputOutput context.
+ * \param index The position of the writer.
+ * \return The task to write.
+ */
+struct snapraid_task* io_write_task(struct snapraid_io* io, unsigned index);
+
 /**
  * Preset the write position.
  *
  * This call starts the write process.
- * It must be called before io_parity_write().
+ * It must be called before io_parity_write() and io_data_write().
  *
  * \param io InputOutput context.
  * \param blockcur The parity position to write.
@@ -382,7 +671,7 @@ void (*io_write_preset)(struct snapraid_io* io, block_off_t blockcur, int skip);
  * Next write position.
  *
  * This call ends the write process.
- * It must be called after io_parity_write().
+ * It must be called after io_parity_write() and io_data_write().
  *
  * \param io InputOutput context.
  * \param blockcur The parity position to write.
@@ -391,6 +680,27 @@ void (*io_write_preset)(struct snapraid_io* io, block_off_t blockcur, int skip);
  */
 void (*io_write_next)(struct snapraid_io* io, block_off_t blockcur, int skip, int* writer_error);
 
+/**
+ * Read the data block of a task, from the file opened in the worker handle.
+ *
+ * Like handle_read(), but if the next scheduled tasks of the same worker
+ * need the next blocks of the same file, they are all read with a single
+ * read. Their data is then returned directly when the worker reaches them.
+ *
+ * It must be called only by data readers, after setting ::file and ::file_pos
+ * of the task, and opening the file.
+ */
+int io_handle_read(struct snapraid_worker* worker, struct snapraid_task* task, fptr* out, fptr* out_missing);
+
+/**
+ * Read the data block of a task, and compute its hash.
+ *
+ * Like io_handle_read(), but it also computes the ::hash and ::rehash of
+ * the task. The blocks read together are also hashed together with
+ * memhash_multi(), that on some CPUs processes more blocks at the same time.
+ */
+int io_handle_read_hash(struct snapraid_worker* worker, struct snapraid_task* task, fptr* out, fptr* out_missing);
+
 /**
  * Refresh the number of cached blocks for all data and parity disks.
  */
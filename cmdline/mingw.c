@@ -2013,6 +2013,18 @@ size_t windows_direct_size(void)
 	return si.dwPageSize;
 }
 
+unsigned windows_cpu_count(void)
+{
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+
+	if (si.dwNumberOfProcessors < 1)
+		return 1;
+
+	return si.dwNumberOfProcessors;
+}
+
 uint64_t tick(void)
 {
 	LARGE_INTEGER t;
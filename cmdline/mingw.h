@@ -125,6 +125,7 @@
 #undef pwrite
 #define pwrite windows_pwrite
 #define direct_size windows_direct_size
+#define cpu_count windows_cpu_count
 #define HAVE_DIRECT_IO 1
 #define O_DIRECT 0x10000000
 #define O_DSYNC 0x20000000
@@ -382,6 +383,11 @@ ssize_t windows_pwrite(int f, const void* buffer, size_t size, off_t offset);
  */
 size_t windows_direct_size(void);
 
+/**
+ * List cpu_count().
+ */
+unsigned windows_cpu_count(void);
+
 /****************************************************************************/
 /* thread */
 
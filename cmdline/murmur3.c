@@ -75,55 +75,12 @@ uint32_t c2 = 0xab0e9789;
 uint32_t c3 = 0x38b34ae5;
 uint32_t c4 = 0xa1e38b93;
 
-void MurmurHash3_x86_128(const void* data, size_t size, const uint8_t* seed, void* digest)
+/*
+ * Tail and finalization, starting from the state after the body.
+ */
+static inline void MurmurHash3_x86_128_end(uint32_t h1, uint32_t h2, uint32_t h3, uint32_t h4, const uint32_t* blocks, size_t size, void* digest)
 {
-	size_t nblocks;
-	const uint32_t* blocks;
-	const uint32_t* end;
 	size_t size_remainder;
-	uint32_t h1, h2, h3, h4;
-
-	h1 = util_read32(seed + 0);
-	h2 = util_read32(seed + 4);
-	h3 = util_read32(seed + 8);
-	h4 = util_read32(seed + 12);
-
-	nblocks = size / 16;
-	blocks = data;
-	end = blocks + nblocks * 4;
-
-	/* body */
-	while (blocks < end) {
-		uint32_t k1 = blocks[0];
-		uint32_t k2 = blocks[1];
-		uint32_t k3 = blocks[2];
-		uint32_t k4 = blocks[3];
-
-#if WORDS_BIGENDIAN
-		k1 = util_swap32(k1);
-		k2 = util_swap32(k2);
-		k3 = util_swap32(k3);
-		k4 = util_swap32(k4);
-#endif
-
-		k1 *= c1; k1 = util_rotl32(k1, 15); k1 *= c2; h1 ^= k1;
-
-		h1 = util_rotl32(h1, 19); h1 += h2; h1 = h1 * 5 + 0x561ccd1b;
-
-		k2 *= c2; k2 = util_rotl32(k2, 16); k2 *= c3; h2 ^= k2;
-
-		h2 = util_rotl32(h2, 17); h2 += h3; h2 = h2 * 5 + 0x0bcaa747;
-
-		k3 *= c3; k3 = util_rotl32(k3, 17); k3 *= c4; h3 ^= k3;
-
-		h3 = util_rotl32(h3, 15); h3 += h4; h3 = h3 * 5 + 0x96cd1c35;
-
-		k4 *= c4; k4 = util_rotl32(k4, 18); k4 *= c1; h4 ^= k4;
-
-		h4 = util_rotl32(h4, 13); h4 += h1; h4 = h4 * 5 + 0x32ac3b17;
-
-		blocks += 4;
-	}
 
 	/* tail */
 	size_remainder = size & 15;
@@ -182,3 +139,208 @@ void MurmurHash3_x86_128(const void* data, size_t size, const uint8_t* seed, voi
 	util_write32(digest + 12, h4);
 }
 
+void MurmurHash3_x86_128(const void* data, size_t size, const uint8_t* seed, void* digest)
+{
+	size_t nblocks;
+	const uint32_t* blocks;
+	const uint32_t* end;
+	uint32_t h1, h2, h3, h4;
+
+	h1 = util_read32(seed + 0);
+	h2 = util_read32(seed + 4);
+	h3 = util_read32(seed + 8);
+	h4 = util_read32(seed + 12);
+
+	nblocks = size / 16;
+	blocks = data;
+	end = blocks + nblocks * 4;
+
+	/* body */
+	while (blocks < end) {
+		uint32_t k1 = blocks[0];
+		uint32_t k2 = blocks[1];
+		uint32_t k3 = blocks[2];
+		uint32_t k4 = blocks[3];
+
+#if WORDS_BIGENDIAN
+		k1 = util_swap32(k1);
+		k2 = util_swap32(k2);
+		k3 = util_swap32(k3);
+		k4 = util_swap32(k4);
+#endif
+
+		k1 *= c1; k1 = util_rotl32(k1, 15); k1 *= c2; h1 ^= k1;
+
+		h1 = util_rotl32(h1, 19); h1 += h2; h1 = h1 * 5 + 0x561ccd1b;
+
+		k2 *= c2; k2 = util_rotl32(k2, 16); k2 *= c3; h2 ^= k2;
+
+		h2 = util_rotl32(h2, 17); h2 += h3; h2 = h2 * 5 + 0x0bcaa747;
+
+		k3 *= c3; k3 = util_rotl32(k3, 17); k3 *= c4; h3 ^= k3;
+
+		h3 = util_rotl32(h3, 15); h3 += h4; h3 = h3 * 5 + 0x96cd1c35;
+
+		k4 *= c4; k4 = util_rotl32(k4, 18); k4 *= c1; h4 ^= k4;
+
+		h4 = util_rotl32(h4, 13); h4 += h1; h4 = h4 * 5 + 0x32ac3b17;
+
+		blocks += 4;
+	}
+
+	MurmurHash3_x86_128_end(h1, h2, h3, h4, blocks, size, digest);
+}
+
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX2)
+/*
+ * Constants for the AVX2 implementation, repeated for each lane.
+ */
+static const struct murmur3_avx2_const {
+	uint32_t c1[8];
+	uint32_t c2[8];
+	uint32_t c3[8];
+	uint32_t c4[8];
+	uint32_t n1[8];
+	uint32_t n2[8];
+	uint32_t n3[8];
+	uint32_t n4[8];
+} murmur3_avx2_const __aligned(32) = {
+	{ 0x239b961b, 0x239b961b, 0x239b961b, 0x239b961b, 0x239b961b, 0x239b961b, 0x239b961b, 0x239b961b },
+	{ 0xab0e9789, 0xab0e9789, 0xab0e9789, 0xab0e9789, 0xab0e9789, 0xab0e9789, 0xab0e9789, 0xab0e9789 },
+	{ 0x38b34ae5, 0x38b34ae5, 0x38b34ae5, 0x38b34ae5, 0x38b34ae5, 0x38b34ae5, 0x38b34ae5, 0x38b34ae5 },
+	{ 0xa1e38b93, 0xa1e38b93, 0xa1e38b93, 0xa1e38b93, 0xa1e38b93, 0xa1e38b93, 0xa1e38b93, 0xa1e38b93 },
+	{ 0x561ccd1b, 0x561ccd1b, 0x561ccd1b, 0x561ccd1b, 0x561ccd1b, 0x561ccd1b, 0x561ccd1b, 0x561ccd1b },
+	{ 0x0bcaa747, 0x0bcaa747, 0x0bcaa747, 0x0bcaa747, 0x0bcaa747, 0x0bcaa747, 0x0bcaa747, 0x0bcaa747 },
+	{ 0x96cd1c35, 0x96cd1c35, 0x96cd1c35, 0x96cd1c35, 0x96cd1c35, 0x96cd1c35, 0x96cd1c35, 0x96cd1c35 },
+	{ 0x32ac3b17, 0x32ac3b17, 0x32ac3b17, 0x32ac3b17, 0x32ac3b17, 0x32ac3b17, 0x32ac3b17, 0x32ac3b17 },
+};
+
+/*
+ * AVX2 implementation hashing 8 buffers of the same size at the same time.
+ *
+ * Each 32 bits lane of the ymm registers contains the state of a different
+ * buffer, so the result is the same of MurmurHash3_x86_128() for each one.
+ * The body of the 8 buffers is processed together, and the tail and
+ * finalization of each one is done by MurmurHash3_x86_128_end().
+ *
+ * The registers ymm0-ymm3 contain h1-h4, ymm4-ymm7 k1-k4,
+ * and ymm8-ymm15 are used for loading the data.
+ */
+void MurmurHash3_x86_128_avx2x8(const uint8_t** data, size_t size, const uint8_t* seed, uint8_t** digest)
+{
+	uint32_t h[4][8] __aligned(32);
+	size_t nblocks;
+	size_t i;
+	unsigned j;
+
+	nblocks = size / 16;
+
+	raid_avx_begin();
+
+	asm volatile ("vpbroadcastd %0,%%ymm0" : : "m" (seed[0]));
+	asm volatile ("vpbroadcastd %0,%%ymm1" : : "m" (seed[4]));
+	asm volatile ("vpbroadcastd %0,%%ymm2" : : "m" (seed[8]));
+	asm volatile ("vpbroadcastd %0,%%ymm3" : : "m" (seed[12]));
+
+	for (i = 0; i < nblocks * 16; i += 16) {
+		/* load 16 bytes from each buffer, buffers 0-3 in the low lanes, and 4-7 in the high ones */
+		asm volatile ("vmovdqu %0,%%xmm8" : : "m" (data[0][i]));
+		asm volatile ("vinserti128 $1,%0,%%ymm8,%%ymm8" : : "m" (data[4][i]));
+		asm volatile ("vmovdqu %0,%%xmm9" : : "m" (data[1][i]));
+		asm volatile ("vinserti128 $1,%0,%%ymm9,%%ymm9" : : "m" (data[5][i]));
+		asm volatile ("vmovdqu %0,%%xmm10" : : "m" (data[2][i]));
+		asm volatile ("vinserti128 $1,%0,%%ymm10,%%ymm10" : : "m" (data[6][i]));
+		asm volatile ("vmovdqu %0,%%xmm11" : : "m" (data[3][i]));
+		asm volatile ("vinserti128 $1,%0,%%ymm11,%%ymm11" : : "m" (data[7][i]));
+
+		/* transpose, to get k1-k4 of all the buffers */
+		asm volatile ("vpunpckldq %ymm9,%ymm8,%ymm12");
+		asm volatile ("vpunpckhdq %ymm9,%ymm8,%ymm13");
+		asm volatile ("vpunpckldq %ymm11,%ymm10,%ymm14");
+		asm volatile ("vpunpckhdq %ymm11,%ymm10,%ymm15");
+		asm volatile ("vpunpcklqdq %ymm14,%ymm12,%ymm4");
+		asm volatile ("vpunpckhqdq %ymm14,%ymm12,%ymm5");
+		asm volatile ("vpunpcklqdq %ymm15,%ymm13,%ymm6");
+		asm volatile ("vpunpckhqdq %ymm15,%ymm13,%ymm7");
+
+		/* k1 *= c1; k1 = util_rotl32(k1, 15); k1 *= c2; h1 ^= k1; */
+		asm volatile ("vpmulld %0,%%ymm4,%%ymm4" : : "m" (murmur3_avx2_const.c1[0]));
+		asm volatile ("vpslld $15,%ymm4,%ymm8");
+		asm volatile ("vpsrld $17,%ymm4,%ymm4");
+		asm volatile ("vpor %ymm8,%ymm4,%ymm4");
+		asm volatile ("vpmulld %0,%%ymm4,%%ymm4" : : "m" (murmur3_avx2_const.c2[0]));
+		asm volatile ("vpxor %ymm4,%ymm0,%ymm0");
+
+		/* h1 = util_rotl32(h1, 19); h1 += h2; h1 = h1 * 5 + 0x561ccd1b; */
+		asm volatile ("vpslld $19,%ymm0,%ymm8");
+		asm volatile ("vpsrld $13,%ymm0,%ymm0");
+		asm volatile ("vpor %ymm8,%ymm0,%ymm0");
+		asm volatile ("vpaddd %ymm1,%ymm0,%ymm0");
+		asm volatile ("vpslld $2,%ymm0,%ymm8");
+		asm volatile ("vpaddd %ymm8,%ymm0,%ymm0");
+		asm volatile ("vpaddd %0,%%ymm0,%%ymm0" : : "m" (murmur3_avx2_const.n1[0]));
+
+		/* k2 *= c2; k2 = util_rotl32(k2, 16); k2 *= c3; h2 ^= k2; */
+		asm volatile ("vpmulld %0,%%ymm5,%%ymm5" : : "m" (murmur3_avx2_const.c2[0]));
+		asm volatile ("vpslld $16,%ymm5,%ymm8");
+		asm volatile ("vpsrld $16,%ymm5,%ymm5");
+		asm volatile ("vpor %ymm8,%ymm5,%ymm5");
+		asm volatile ("vpmulld %0,%%ymm5,%%ymm5" : : "m" (murmur3_avx2_const.c3[0]));
+		asm volatile ("vpxor %ymm5,%ymm1,%ymm1");
+
+		/* h2 = util_rotl32(h2, 17); h2 += h3; h2 = h2 * 5 + 0x0bcaa747; */
+		asm volatile ("vpslld $17,%ymm1,%ymm8");
+		asm volatile ("vpsrld $15,%ymm1,%ymm1");
+		asm volatile ("vpor %ymm8,%ymm1,%ymm1");
+		asm volatile ("vpaddd %ymm2,%ymm1,%ymm1");
+		asm volatile ("vpslld $2,%ymm1,%ymm8");
+		asm volatile ("vpaddd %ymm8,%ymm1,%ymm1");
+		asm volatile ("vpaddd %0,%%ymm1,%%ymm1" : : "m" (murmur3_avx2_const.n2[0]));
+
+		/* k3 *= c3; k3 = util_rotl32(k3, 17); k3 *= c4; h3 ^= k3; */
+		asm volatile ("vpmulld %0,%%ymm6,%%ymm6" : : "m" (murmur3_avx2_const.c3[0]));
+		asm volatile ("vpslld $17,%ymm6,%ymm8");
+		asm volatile ("vpsrld $15,%ymm6,%ymm6");
+		asm volatile ("vpor %ymm8,%ymm6,%ymm6");
+		asm volatile ("vpmulld %0,%%ymm6,%%ymm6" : : "m" (murmur3_avx2_const.c4[0]));
+		asm volatile ("vpxor %ymm6,%ymm2,%ymm2");
+
+		/* h3 = util_rotl32(h3, 15); h3 += h4; h3 = h3 * 5 + 0x96cd1c35; */
+		asm volatile ("vpslld $15,%ymm2,%ymm8");
+		asm volatile ("vpsrld $17,%ymm2,%ymm2");
+		asm volatile ("vpor %ymm8,%ymm2,%ymm2");
+		asm volatile ("vpaddd %ymm3,%ymm2,%ymm2");
+		asm volatile ("vpslld $2,%ymm2,%ymm8");
+		asm volatile ("vpaddd %ymm8,%ymm2,%ymm2");
+		asm volatile ("vpaddd %0,%%ymm2,%%ymm2" : : "m" (murmur3_avx2_const.n3[0]));
+
+		/* k4 *= c4; k4 = util_rotl32(k4, 18); k4 *= c1; h4 ^= k4; */
+		asm volatile ("vpmulld %0,%%ymm7,%%ymm7" : : "m" (murmur3_avx2_const.c4[0]));
+		asm volatile ("vpslld $18,%ymm7,%ymm8");
+		asm volatile ("vpsrld $14,%ymm7,%ymm7");
+		asm volatile ("vpor %ymm8,%ymm7,%ymm7");
+		asm volatile ("vpmulld %0,%%ymm7,%%ymm7" : : "m" (murmur3_avx2_const.c1[0]));
+		asm volatile ("vpxor %ymm7,%ymm3,%ymm3");
+
+		/* h4 = util_rotl32(h4, 13); h4 += h1; h4 = h4 * 5 + 0x32ac3b17; */
+		asm volatile ("vpslld $13,%ymm3,%ymm8");
+		asm volatile ("vpsrld $19,%ymm3,%ymm3");
+		asm volatile ("vpor %ymm8,%ymm3,%ymm3");
+		asm volatile ("vpaddd %ymm0,%ymm3,%ymm3");
+		asm volatile ("vpslld $2,%ymm3,%ymm8");
+		asm volatile ("vpaddd %ymm8,%ymm3,%ymm3");
+		asm volatile ("vpaddd %0,%%ymm3,%%ymm3" : : "m" (murmur3_avx2_const.n4[0]));
+	}
+
+	asm volatile ("vmovdqa %%ymm0,%0" : "=m" (h[0]));
+	asm volatile ("vmovdqa %%ymm1,%0" : "=m" (h[1]));
+	asm volatile ("vmovdqa %%ymm2,%0" : "=m" (h[2]));
+	asm volatile ("vmovdqa %%ymm3,%0" : "=m" (h[3]));
+
+	raid_avx_end();
+
+	/* tail and finalization of each buffer */
+	for (j = 0; j < 8; ++j)
+		MurmurHash3_x86_128_end(h[0][j], h[1][j], h[2][j], h[3][j], (const uint32_t*)(data[j] + nblocks * 16), size, digest[j]);
+}
+#endif
@@ -121,6 +121,14 @@
 #include <sys/ioctl.h>
 #endif
 
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#if HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #if HAVE_LINUX_FS_H
 #include <linux/fs.h>
 #endif
@@ -92,7 +92,8 @@ void state_rehash(struct snapraid_state* state)
 	state->need_write = 1;
 
 	msg_status("A rehash is now scheduled. It will take place progressively in the next\n");
-	msg_status("'sync' and 'scrub' commands. You can check the rehash progress using the\n");
-	msg_status("'status' command.\n");
+	msg_status("'sync' and 'scrub' commands, or you can complete it with the\n");
+	msg_status("'snapraid -p rehash scrub' command. You can check the rehash progress\n");
+	msg_status("using the 'status' command.\n");
 }
 
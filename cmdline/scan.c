@@ -41,10 +41,67 @@ struct snapraid_scan {
 	tommy_list link_insert_list; /**< Links to insert. */
 	tommy_list dir_insert_list; /**< Dirs to insert. */
 
+	int is_diff; /**< If it's a diff command or a scan. */
+
+	/**
+	 * First dirty position to search for free blocks.
+	 * Like ::first_free_block in the disk, no free dirty block is present before this position.
+	 */
+	block_off_t dirty_free_block;
+
+	/**
+	 * Smallest number of blocks without a run of free dirty positions to contain them.
+	 * The free dirty positions only decrease, so a bigger run cannot be found.
+	 */
+	block_off_t dirty_run_fail;
+
+#if HAVE_PTHREAD
+	/**
+	 * Thread used to scan the disk.
+	 */
+	pthread_t thread;
+
+	/**
+	 * Mutex shared by all the scan threads, or 0 if scanning in the main thread.
+	 *
+	 * It protects the processing of the directory entries found, as the
+	 * copy detection searches in the files of all the disks, and the
+	 * ::state is updated.
+	 * Reading the directories, that is the slow part, is done without it.
+	 */
+	pthread_mutex_t* mutex;
+#endif
+
 	/* nodes for data structures */
 	tommy_node node;
 };
 
+/**
+ * Lock the processing of the directory entries.
+ */
+static void scan_lock(struct snapraid_scan* scan)
+{
+#if HAVE_PTHREAD
+	if (scan->mutex)
+		thread_mutex_lock(scan->mutex);
+#else
+	(void)scan;
+#endif
+}
+
+/**
+ * Unlock the processing of the directory entries.
+ */
+static void scan_unlock(struct snapraid_scan* scan)
+{
+#if HAVE_PTHREAD
+	if (scan->mutex)
+		thread_mutex_unlock(scan->mutex);
+#else
+	(void)scan;
+#endif
+}
+
 /**
  * Remove the specified link from the data set.
  */
@@ -126,8 +183,7 @@ static void scan_link(struct snapraid_scan* scan, int is_diff, const char* sub,
 			}
 
 			/* update it */
-			free(slink->linkto);
-			slink->linkto = strdup_nofail(linkto);
+			link_retarget(disk, slink, linkto);
 			link_flag_let(slink, link_flag, FILE_IS_LINK_MASK);
 		}
 
@@ -146,7 +202,7 @@ static void scan_link(struct snapraid_scan* scan, int is_diff, const char* sub,
 	}
 
 	/* insert it */
-	slink = link_alloc(sub, linkto, link_flag);
+	slink = link_alloc(0, sub, linkto, link_flag);
 
 	/* mark it as present */
 	link_flag_set(slink, FILE_IS_PRESENT);
@@ -155,8 +211,172 @@ static void scan_link(struct snapraid_scan* scan, int is_diff, const char* sub,
 	tommy_list_insert_tail(&scan->link_insert_list, &slink->nodelist, slink);
 }
 
+/**
+ * Search the first run of free positions of the disk that are already dirty,
+ * big enough to contain the specified number of blocks.
+ *
+ * Return 0 if no such run exists.
+ */
+static int scan_dirty_run(struct snapraid_scan* scan, block_off_t count, block_off_t* out)
+{
+	struct snapraid_state* state = scan->state;
+	struct snapraid_disk* disk = scan->disk;
+	block_off_t pos;
+	block_off_t begin;
+	int first;
+
+	if (!state->dirty_map || count == 0)
+		return 0;
+
+	/* if a smaller run was not found, a bigger one cannot be found */
+	if (count >= scan->dirty_run_fail)
+		return 0;
+
+	/* the disks are processed one at time, and the only new dirty positions */
+	/* are the ones allocated in this disk, so the search never goes back */
+	first = 1;
+	pos = scan->dirty_free_block;
+	begin = pos;
+	while (pos < state->dirty_max) {
+		/* skip clean bytes at once */
+		if (pos % 8 == 0 && state->dirty_map[pos / 8] == 0) {
+			pos += 8;
+			begin = pos;
+			continue;
+		}
+
+		if (state_dirty_has(state, pos) && !block_has_file(fs_par2block_find(disk, pos))) {
+			/* the runs too small are skipped, but still searched the next time */
+			if (first) {
+				scan->dirty_free_block = pos;
+				first = 0;
+			}
+
+			if (pos + 1 - begin == count) {
+				*out = begin;
+				return 1;
+			}
+		} else {
+			begin = pos + 1;
+		}
+
+		++pos;
+	}
+
+	if (first)
+		scan->dirty_free_block = pos;
+	scan->dirty_run_fail = count;
+
+	return 0;
+}
+
+/**
+ * Map the dirty positions of all the disks.
+ *
+ * These are the positions with blocks with invalid parity, like new,
+ * changed and deleted ones. The map has space also for all the new
+ * files to insert, and it's kept in the state to be used by sync.
+ *
+ * Only the block states are read sequentially, and the parity position
+ * is searched only for the dirty blocks.
+ */
+static void scan_dirty_init(struct snapraid_state* state, tommy_list* scanlist)
+{
+	tommy_node* i;
+	block_off_t size;
+
+	/* the new blocks never go after the end of the disk plus the new blocks */
+	size = 0;
+	for (i = state->disklist; i != 0; i = i->next) {
+		struct snapraid_disk* disk = i->data;
+		block_off_t disk_size = fs_size(disk);
+		if (size < disk_size)
+			size = disk_size;
+	}
+	for (i = *scanlist; i != 0; i = i->next) {
+		struct snapraid_scan* scan = i->data;
+		tommy_node* j;
+		for (j = scan->file_insert_list; j != 0; j = j->next) {
+			struct snapraid_file* file = j->data;
+			size += file->blockmax;
+		}
+	}
+
+	state_dirty_begin(state, size);
+
+	for (i = state->disklist; i != 0; i = i->next) {
+		struct snapraid_disk* disk = i->data;
+		tommy_node* j;
+
+		/* files with changed blocks */
+		for (j = disk->filelist; j != 0; j = j->next) {
+			struct snapraid_file* file = j->data;
+			block_off_t k;
+
+			for (k = 0; k < file->blockmax; ++k) {
+				if (block_has_invalid_parity(fs_file2block_get(file, k)))
+					state_dirty_mark(state, fs_file2par_get(disk, file, k));
+			}
+		}
+
+		/* deleted blocks */
+		for (j = disk->deletedlist; j != 0; j = j->next) {
+			struct snapraid_file* file = j->data;
+			block_off_t k;
+
+			for (k = 0; k < file->blockmax; ++k) {
+				/* deleted blocks already overwritten have no position */
+				block_off_t pos = fs_file2par_find(disk, file, k);
+				if (pos != POS_NULL)
+					state_dirty_mark(state, pos);
+			}
+		}
+	}
+}
+
+/**
+ * Estimate the number of positions to process in the next sync.
+ *
+ * Like in sync, the dirty positions without any file are not counted,
+ * as there is no parity to update.
+ */
+static block_off_t scan_dirty_count(struct snapraid_state* state)
+{
+	block_off_t pos;
+	block_off_t count;
+
+	count = 0;
+	for (pos = 0; pos < state->dirty_max; ++pos) {
+		tommy_node* i;
+
+		/* skip clean bytes at once */
+		if (pos % 8 == 0 && state->dirty_map[pos / 8] == 0) {
+			pos += 7;
+			continue;
+		}
+
+		if (!state_dirty_has(state, pos))
+			continue;
+
+		for (i = state->disklist; i != 0; i = i->next) {
+			struct snapraid_disk* disk = i->data;
+			if (block_has_file(fs_par2block_find(disk, pos))) {
+				++count;
+				break;
+			}
+		}
+	}
+
+	return count;
+}
+
 /**
  * Insert the specified file in the parity.
+ *
+ * The file is placed in the first run of free positions that the sync
+ * has already to process for other disks, but only if it fits all in it,
+ * to not fragment it. Otherwise the blocks are placed in the first free
+ * positions of the disk.
  */
 static void scan_file_allocate(struct snapraid_scan* scan, struct snapraid_file* file)
 {
@@ -164,20 +384,35 @@ static void scan_file_allocate(struct snapraid_scan* scan, struct snapraid_file*
 	struct snapraid_disk* disk = scan->disk;
 	block_off_t i;
 	block_off_t parity_pos;
+	block_off_t free_pos;
+	block_off_t dirty_pos;
+	int is_dirty;
 
 	/* state changed */
 	state->need_write = 1;
 
+	/* prefer a run of positions already dirty */
+	is_dirty = scan_dirty_run(scan, file->blockmax, &dirty_pos);
+
 	/* allocate the blocks of the file */
-	parity_pos = disk->first_free_block;
+	free_pos = disk->first_free_block;
 	for (i = 0; i < file->blockmax; ++i) {
 		struct snapraid_block* block;
 		struct snapraid_block* over_block;
 		snapraid_info info;
 
-		/* increment the position until the first really free block */
-		while (block_has_file(fs_par2block_find(disk, parity_pos)))
-			++parity_pos;
+		if (is_dirty) {
+			parity_pos = dirty_pos + i;
+		} else {
+			/* increment the position until the first really free block */
+			while (block_has_file(fs_par2block_find(disk, free_pos)))
+				++free_pos;
+
+			parity_pos = free_pos;
+
+			/* set the new free position */
+			disk->first_free_block = free_pos + 1;
+		}
 
 		/* get block we are going to overwrite, if any */
 		over_block = fs_par2block_find(disk, parity_pos);
@@ -242,8 +477,8 @@ static void scan_file_allocate(struct snapraid_scan* scan, struct snapraid_file*
 		/* store in the disk map, after invalidating all the other blocks */
 		fs_allocate(disk, parity_pos, file, i);
 
-		/* set the new free position */
-		disk->first_free_block = parity_pos + 1;
+		/* the position is now going to be processed by sync */
+		state_dirty_mark(state, parity_pos);
 	}
 
 	/* insert in the list of contained files */
@@ -332,16 +567,34 @@ static void scan_file_deallocate(struct snapraid_scan* scan, struct snapraid_fil
 }
 
 static void scan_file_delayed_allocate(struct snapraid_scan* scan, struct snapraid_file* file)
+{
+	/* insert in the delayed list */
+	tommy_list_insert_tail(&scan->file_insert_list, &file->nodelist, file);
+}
+
+/**
+ * Read the physical offsets of the files to insert.
+ *
+ * It's done after scanning the disk, and without the lock, as the
+ * files to insert are used only by the thread scanning the disk.
+ */
+static void scan_file_physical(struct snapraid_scan* scan)
 {
 	struct snapraid_state* state = scan->state;
 	struct snapraid_disk* disk = scan->disk;
+	tommy_node* node;
 
 	/* if we sort for physical offsets we have to read them for new files */
-	if (state->opt.force_order == SORT_PHYSICAL
-		&& file->physical == FILEPHY_UNREAD_OFFSET
-	) {
+	if (state->opt.force_order != SORT_PHYSICAL)
+		return;
+
+	for (node = scan->file_insert_list; node != 0; node = node->next) {
+		struct snapraid_file* file = node->data;
 		char path_next[PATH_MAX];
 
+		if (file->physical != FILEPHY_UNREAD_OFFSET)
+			continue;
+
 		pathprint(path_next, sizeof(path_next), "%s%s", disk->dir, file->sub);
 
 		if (filephy(path_next, file->size, &file->physical) != 0) {
@@ -351,9 +604,6 @@ static void scan_file_delayed_allocate(struct snapraid_scan* scan, struct snapra
 			/* LCOV_EXCL_STOP */
 		}
 	}
-
-	/* insert in the delayed list */
-	tommy_list_insert_tail(&scan->file_insert_list, &file->nodelist, file);
 }
 
 /**
@@ -473,6 +723,7 @@ static void scan_file_refresh(struct snapraid_scan* scan, const char* sub, struc
 	if (st->st_sync == 0) {
 		char path_next[PATH_MAX];
 		struct stat synced_st;
+		int ret;
 
 		pathprint(path_next, sizeof(path_next), "%s%s", disk->dir, sub);
 
@@ -485,7 +736,12 @@ static void scan_file_refresh(struct snapraid_scan* scan, const char* sub, struc
 			physical = 0; /* set the pointer to 0 to read nothing */
 		}
 
-		if (lstat_sync(path_next, &synced_st, physical) != 0) {
+		/* the stat is done without the lock, as only the ::disk */
+		/* of this thread is changed until now, and it's not shared */
+		scan_unlock(scan);
+		ret = lstat_sync(path_next, &synced_st, physical);
+		scan_lock(scan);
+		if (ret != 0) {
 			/* LCOV_EXCL_START */
 			log_fatal("Error in stat file '%s'. %s.\n", path_next, strerror(errno));
 			exit(EXIT_FAILURE);
@@ -722,7 +978,7 @@ static void scan_file(struct snapraid_scan* scan, int is_diff, const char* sub,
 				tommy_hashdyn_remove_existing(&disk->pathset, &file->pathset);
 
 				/* save the new name */
-				file_rename(file, sub);
+				file_rename(disk, file, sub);
 
 				/* reinsert in the name set */
 				tommy_hashdyn_insert(&disk->pathset, &file->pathset, file, file_path_hash(file->sub));
@@ -958,7 +1214,7 @@ static void scan_file(struct snapraid_scan* scan, int is_diff, const char* sub,
 #endif
 
 	/* insert it */
-	file = file_alloc(state->block_size, sub, st->st_size, st->st_mtime, STAT_NSEC(st), st->st_ino, physical);
+	file = file_alloc(0, state->block_size, sub, st->st_size, st->st_mtime, STAT_NSEC(st), st->st_ino, physical);
 
 	/* mark it as present */
 	file_flag_set(file, FILE_IS_PRESENT);
@@ -1097,7 +1353,7 @@ static void scan_emptydir(struct snapraid_scan* scan, const char* sub)
 	}
 
 	/* insert it */
-	dir = dir_alloc(sub);
+	dir = dir_alloc(0, sub);
 
 	/* mark it as present */
 	dir_flag_set(dir, FILE_IS_PRESENT);
@@ -1380,7 +1636,9 @@ static int scan_dir(struct snapraid_scan* scan, int level, int is_diff, const ch
 				}
 #endif
 
+				scan_lock(scan);
 				scan_file(scan, is_diff, sub_next, st, FILEPHY_UNREAD_OFFSET);
+				scan_unlock(scan);
 				processed = 1;
 			} else {
 				msg_verbose("Excluding file '%s' for rule '%s'\n", path_next, filter_type(reason, out, sizeof(out)));
@@ -1410,7 +1668,9 @@ static int scan_dir(struct snapraid_scan* scan, int level, int is_diff, const ch
 				subnew[ret] = 0;
 
 				/* process as a symbolic link */
+				scan_lock(scan);
 				scan_link(scan, is_diff, sub_next, subnew, FILE_IS_SYMLINK);
+				scan_unlock(scan);
 				processed = 1;
 			} else {
 				msg_verbose("Excluding link '%s' for rule '%s'\n", path_next, filter_type(reason, out, sizeof(out)));
@@ -1437,7 +1697,9 @@ static int scan_dir(struct snapraid_scan* scan, int level, int is_diff, const ch
 					pathslash(sub_dir, sizeof(sub_dir));
 					if (scan_dir(scan, level + 1, is_diff, path_next, sub_dir) == 0) {
 						/* scan the directory as empty dir */
+						scan_lock(scan);
 						scan_emptydir(scan, sub_next);
+						scan_unlock(scan);
 					}
 					/* or we processed something internally, or we have added the empty dir */
 					processed = 1;
@@ -1467,14 +1729,36 @@ static int scan_dir(struct snapraid_scan* scan, int level, int is_diff, const ch
 	return processed;
 }
 
+#if HAVE_PTHREAD
+/**
+ * Scan a disk in a separate thread.
+ */
+static void* scan_disk_thread(void* arg)
+{
+	struct snapraid_scan* scan = arg;
+	struct snapraid_disk* disk = scan->disk;
+
+	scan_dir(scan, 0, scan->is_diff, disk->dir, "");
+
+	scan_file_physical(scan);
+
+	return 0;
+}
+#endif
+
 static int state_diffscan(struct snapraid_state* state, int is_diff)
 {
 	tommy_node* i;
 	tommy_node* j;
 	tommy_list scanlist;
+#if HAVE_PTHREAD
+	int use_thread;
+	pthread_mutex_t mutex;
+#endif
 	int done;
 	fptr* msg;
 	struct snapraid_scan total;
+	block_off_t dirty_count;
 	int no_difference;
 	char esc_buffer[ESC_MAX];
 
@@ -1483,6 +1767,11 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 	if (is_diff)
 		msg_progress("Comparing...\n");
 
+#if HAVE_PTHREAD
+	/* scan all the disks at the same time, if there is more than one */
+	use_thread = !state->opt.skip_multi_scan && tommy_list_count(&state->disklist) > 1;
+#endif
+
 	/* first scan all the directory and find new and deleted files */
 	for (i = state->disklist; i != 0; i = i->next) {
 		struct snapraid_disk* disk = i->data;
@@ -1505,12 +1794,15 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 		tommy_list_init(&scan->file_insert_list);
 		tommy_list_init(&scan->link_insert_list);
 		tommy_list_init(&scan->dir_insert_list);
+		scan->is_diff = is_diff;
+		scan->dirty_free_block = 0;
+		scan->dirty_run_fail = POS_NULL;
+#if HAVE_PTHREAD
+		scan->mutex = use_thread ? &mutex : 0;
+#endif
 
 		tommy_list_insert_tail(&scanlist, &scan->node, scan);
 
-		if (!is_diff)
-			msg_progress("Scanning disk %s...\n", disk->name);
-
 		/* check if the disk supports persistent inodes */
 		ret = fsinfo(disk->dir, &has_persistent_inodes, &has_syncronized_hardlinks, 0, 0);
 		if (ret < 0) {
@@ -1549,22 +1841,57 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 			}
 		}
 
+	}
+
+	/* now scan all the directories, possibly starting one thread for each disk */
+	/* the disks are prepared before, because the threads may access */
+	/* the files of the other disks when searching for copies */
+#if HAVE_PTHREAD
+	if (use_thread)
+		thread_mutex_init(&mutex, 0);
+#endif
+	for (i = scanlist; i != 0; i = i->next) {
+		struct snapraid_scan* scan = i->data;
+		struct snapraid_disk* disk = scan->disk;
+
+		if (!is_diff)
+			msg_progress("Scanning disk %s...\n", disk->name);
+
+#if HAVE_PTHREAD
+		if (use_thread) {
+			/* the disk is scanned in its own thread */
+			thread_create(&scan->thread, 0, scan_disk_thread, scan);
+			continue;
+		}
+#endif
+
 		scan_dir(scan, 0, is_diff, disk->dir, "");
+
+		scan_file_physical(scan);
 	}
 
+#if HAVE_PTHREAD
+	/* wait for all the scan threads */
+	if (use_thread) {
+		for (i = scanlist; i != 0; i = i->next) {
+			struct snapraid_scan* scan = i->data;
+
+			thread_join(scan->thread, 0);
+		}
+
+		thread_mutex_destroy(&mutex);
+	}
+#endif
+
 	/* we split the search in two phases because to detect files */
 	/* moved from one disk to another we have to start deletion */
 	/* only when all disks have all the new files found */
 
-	/* now process all the new and deleted files */
+	/* now process all the deleted files */
 	for (i = scanlist; i != 0; i = i->next) {
 		struct snapraid_scan* scan = i->data;
 		struct snapraid_disk* disk = scan->disk;
 		tommy_node* node;
-		unsigned phy_count;
-		unsigned phy_dup;
-		uint64_t phy_last;
-		struct snapraid_file* phy_file_last;
 
 		/* check for removed files */
 		node = disk->filelist;
@@ -1621,6 +1948,24 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 				scan_emptydir_remove(scan, dir);
 			}
 		}
+	}
+
+	/* we split also the deletion and the insertion in two phases */
+	/* because to place the new files in the positions already dirty */
+	/* we need to know all the deleted blocks of all the disks */
+
+	/* map the dirty positions */
+	scan_dirty_init(state, &scanlist);
+
+	/* now process all the new files */
+	for (i = scanlist; i != 0; i = i->next) {
+		struct snapraid_scan* scan = i->data;
+		struct snapraid_disk* disk = scan->disk;
+		tommy_node* node;
+		unsigned phy_count;
+		unsigned phy_dup;
+		uint64_t phy_last;
+		struct snapraid_file* phy_file_last;
 
 		/* sort the files before inserting them */
 		/* we use a stable sort to ensure that if the reported physical offset/inode */
@@ -1869,6 +2214,13 @@ static int state_diffscan(struct snapraid_state* state, int is_diff)
 	msg("%8u moved\n", total.count_move);
 	msg("%8u copied\n", total.count_copy);
 	msg("%8u restored\n", total.count_restore);
+	/* the estimation is computed only if reported, as it searches all the dirty positions */
+	/* in sync, the positions to process are anyway counted by io_position_map() */
+	if (is_diff || msg_level >= MSG_VERBOSE) {
+		dirty_count = scan_dirty_count(state);
+		msg("%8u positions to sync\n", dirty_count);
+		log_tag("summary:sync_positions:%u\n", dirty_count);
+	}
 
 	log_tag("summary:equal:%u\n", total.count_equal);
 	log_tag("summary:added:%u\n", total.count_insert);
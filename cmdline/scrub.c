@@ -78,6 +78,9 @@ static int block_is_enabled(void* void_plan, block_off_t i)
 	case SCRUB_BAD :
 		/* in 'bad' plan, only bad blocks (already reported) */
 		return 0;
+	case SCRUB_REHASH :
+		/* in 'rehash' plan, only blocks still using the previous hash */
+		return info_get_rehash(info);
 	}
 
 	/* if it's too new */
@@ -196,7 +199,9 @@ static void scrub_data_reader(struct snapraid_worker* worker, struct snapraid_ta
 	/* from the last sync, as we are expected to return errors if running */
 	/* in an unsynced array. This is just like the check command. */
 
-	task->read_size = handle_read(handle, task->file_pos, buffer, state->block_size, log_error, 0);
+	/* read the block and compute the hash here, to distribute the load on all the worker threads */
+	/* note that the info at this position is changed only after we have finished */
+	task->read_size = io_handle_read_hash(worker, task, log_error, 0);
 	if (task->read_size == -1) {
 		if (errno == EIO) {
 			log_tag("error:%u:%s:%s: Read EIO error at position %u. %s\n", blockcur, disk->name, esc_tag(task->file->sub, esc_buffer), task->file_pos, strerror(errno));
@@ -275,11 +280,11 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 	/* rehash buffers */
 	rehandle = malloc_nofail_align(diskmax * sizeof(struct snapraid_rehash), &rehandle_alloc);
 
-	/* we need 1 * data + 2 * parity */
-	buffermax = diskmax + 2 * state->level;
+	/* we need 1 * data + 1 * parity, as the parity is checked without computing it in a buffer */
+	buffermax = diskmax + state->level;
 
 	/* initialize the io threads */
-	io_init(&io, state, state->opt.io_cache, buffermax, scrub_data_reader, handle, diskmax, scrub_parity_reader, 0, parity_handle, state->level);
+	io_init(&io, state, state->opt.io_cache, buffermax, scrub_data_reader, 0, handle, 0, diskmax, scrub_parity_reader, 0, parity_handle, state->level);
 
 	/* possibly waiting disks */
 	waiting_mac = diskmax > RAID_PARITY_MAX ? diskmax : RAID_PARITY_MAX;
@@ -289,14 +294,12 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 	silent_error = 0;
 	io_error = 0;
 
-	/* first count the number of blocks to process */
-	countmax = 0;
+	/* track the changed positions to save them in the journal */
+	state_journal_begin(state);
+
+	/* first select the blocks to process */
 	plan->countlast = 0;
-	for (blockcur = blockstart; blockcur < blockmax; ++blockcur) {
-		if (!block_is_enabled(plan, blockcur))
-			continue;
-		++countmax;
-	}
+	countmax = io_position_map(&io, blockstart, blockmax, &block_is_enabled, plan);
 
 	/* compute the autosave size for all disk, even if not read */
 	/* this makes sense because the speed should be almost the same */
@@ -331,6 +334,9 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 		if (blockcur >= blockmax)
 			break;
 
+		/* this position is going to be changed */
+		state_journal_mark(state, blockcur);
+
 		/* until now is scheduling */
 		state_usage_sched(state);
 
@@ -357,7 +363,7 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 		for (j = 0; j < diskmax; ++j) {
 			struct snapraid_task* task;
 			int read_size;
-			unsigned char hash[HASH_MAX];
+			unsigned char* hash;
 			struct snapraid_block* block;
 			int file_is_unsynced;
 			struct snapraid_disk* disk;
@@ -456,20 +462,16 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 
 			countsize += read_size;
 
-			/* now compute the hash */
-			if (rehash) {
-				memhash(state->prevhash, state->prevhashseed, hash, buffer[diskcur], read_size);
+			/* the hash was already computed by the worker thread */
+			hash = task->hash;
+			state_usage_hash_worker(state, task->tick_hash);
 
-				/* compute the new hash, and store it */
+			/* in case of rehash, store also the new hash */
+			if (rehash) {
 				rehandle[diskcur].block = block;
-				memhash(state->hash, state->hashseed, rehandle[diskcur].hash, buffer[diskcur], read_size);
-			} else {
-				memhash(state->hash, state->hashseed, hash, buffer[diskcur], read_size);
+				memcpy(rehandle[diskcur].hash, task->rehash, BLOCK_HASH_SIZE);
 			}
 
-			/* until now is hash */
-			state_usage_hash(state);
-
 			if (block_has_updated_hash(block)) {
 				/* compare the hash */
 				if (memcmp(hash, block->hash, BLOCK_HASH_SIZE) != 0) {
@@ -491,9 +493,9 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 			}
 		}
 
-		/* buffers for parity read and not computed */
+		/* buffers for parity read */
 		for (l = 0; l < state->level; ++l)
-			buffer_recov[l] = buffer[diskmax + state->level + l];
+			buffer_recov[l] = buffer[diskmax + l];
 		for (; l < LEV_MAX; ++l)
 			buffer_recov[l] = 0;
 
@@ -560,13 +562,16 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 		/* if we have read all the data required and it's correct, proceed with the parity check */
 		if (!error_on_this_block && !silent_error_on_this_block && !io_error_on_this_block) {
 
-			/* compute the parity */
-			raid_gen(diskmax, state->level, state->block_size, buffer);
+			unsigned parity_diff[LEV_MAX];
+			int parity_mask;
+
+			/* check the parity read with the data */
+			parity_mask = io_raid_syndrome(&io, diskmax, state->level, state->block_size, buffer, (void**)buffer_recov, parity_diff);
 
-			/* compare the parity */
+			/* report the parity not matching */
 			for (l = 0; l < state->level; ++l) {
-				if (buffer_recov[l] && memcmp(buffer[diskmax + l], buffer_recov[l], state->block_size) != 0) {
-					unsigned diff = memdiff(buffer[diskmax + l], buffer_recov[l], state->block_size);
+				if ((parity_mask & (1 << l)) != 0) {
+					unsigned diff = parity_diff[l];
 
 					log_tag("parity_error:%u:%s: Data error, diff bits %u/%u\n", blockcur, lev_config_name(l), diff, state->block_size * 8);
 
@@ -633,7 +638,10 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 			state_progress_stop(state);
 
 			msg_progress("Autosaving...\n");
-			state_write(state);
+
+			/* save the changes in background, if possible */
+			if (state_checkpoint_async(state, 0, blockcur) != 0)
+				state_checkpoint(state);
 
 			state_progress_restart(state);
 
@@ -646,6 +654,9 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 
 	state_usage_print(state);
 
+	/* wait for the last autosave */
+	state_checkpoint_wait(state);
+
 	if (error || silent_error || io_error) {
 		msg_status("\n");
 		msg_status("%8u file errors\n", error);
@@ -678,6 +689,9 @@ static int state_scrub_process(struct snapraid_state* state, struct snapraid_par
 	log_flush();
 
 bail:
+	/* wait for the last autosave */
+	state_checkpoint_wait(state);
+
 	/* stop all the worker threads */
 	io_stop(&io);
 
@@ -744,7 +758,7 @@ int state_scrub(struct snapraid_state* state, int plan, int olderthan)
 
 	msg_progress("Initializing...\n");
 
-	if ((plan == SCRUB_BAD || plan == SCRUB_NEW || plan == SCRUB_FULL)
+	if ((plan == SCRUB_BAD || plan == SCRUB_NEW || plan == SCRUB_FULL || plan == SCRUB_REHASH)
 		&& olderthan >= 0) {
 		/* LCOV_EXCL_START */
 		log_fatal("You can specify -o, --older-than only with a numeric percentage.\n");
@@ -767,6 +781,8 @@ int state_scrub(struct snapraid_state* state, int plan, int olderthan)
 		ps.plan = SCRUB_NEW;
 	} else if (plan == SCRUB_BAD) {
 		ps.plan = SCRUB_BAD;
+	} else if (plan == SCRUB_REHASH) {
+		ps.plan = SCRUB_REHASH;
 	} else if (state->opt.force_scrub_at) {
 		/* scrub the specified amount of blocks */
 		ps.plan = SCRUB_AUTO;
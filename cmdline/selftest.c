@@ -55,6 +55,11 @@ struct hash_test_vector {
 	unsigned char digest[HASH_MAX];
 };
 
+struct hash_long_test_vector {
+	size_t len;
+	unsigned char digest[HASH_MAX];
+};
+
 /**
  * Test vectors for tommy_hash32
  */
@@ -153,6 +158,28 @@ static struct hash_test_vector TEST_SPOOKY2[] = {
 	{ 0, 0, { 0 } }
 };
 
+/**
+ * Test vectors for XXH3_128
+ */
+static struct hash_test_vector TEST_XXH3[] = {
+#include "xxh3test.c"
+	{ 0, 0, { 0 } }
+};
+
+/**
+ * Test vectors for XXH3_128 with data longer than a block of stripes.
+ * The data is generated with: data[i] = i * 0x4d + (i >> 8)
+ */
+static struct hash_long_test_vector TEST_XXH3_LONG[] = {
+	{ 1024, { 0xb2, 0x35, 0x1d, 0x25, 0x21, 0xd5, 0x0a, 0xbe, 0x5d, 0xb7, 0xa9, 0x23, 0x15, 0xed, 0x88, 0x05 } },
+	{ 1025, { 0x05, 0xba, 0xa2, 0x8d, 0xe4, 0x9a, 0x69, 0x9d, 0xfc, 0xb4, 0xea, 0x19, 0xeb, 0x32, 0x67, 0x6a } },
+	{ 4151, { 0x14, 0xa8, 0x1a, 0x2d, 0x5b, 0x92, 0x20, 0x69, 0xa0, 0x7c, 0x26, 0x81, 0x8e, 0xc8, 0x7f, 0x23 } },
+	{ 65537, { 0xf6, 0xff, 0xeb, 0xb6, 0xfc, 0x18, 0x21, 0x2f, 0x02, 0x73, 0x2e, 0x68, 0x0a, 0x1e, 0x33, 0xab } },
+	{ 0, { 0 } }
+};
+
+#define HASH_LONG_TEST_MAX 65537 /* long tests are never longer than this */
+
 #define HASH_TEST_MAX 512 /* tests are never longer than 512 bytes */
 
 static void test_hash(void)
@@ -249,10 +276,89 @@ static void test_hash(void)
 		}
 	}
 
+	for (i = 0; TEST_XXH3[i].data; ++i) {
+		unsigned char digest[HASH_MAX];
+		memcpy(buffer_aligned, TEST_XXH3[i].data, TEST_XXH3[i].len);
+		memhash(HASH_XXH3, seed_aligned, digest, buffer_aligned, TEST_XXH3[i].len);
+		if (memcmp(digest, TEST_XXH3[i].digest, HASH_MAX) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Failed XXH3 test\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	free(buffer_alloc);
+
+	buffer_aligned = malloc_nofail_align(HASH_LONG_TEST_MAX, &buffer_alloc);
+
+	for (i = 0; i < HASH_LONG_TEST_MAX; ++i)
+		buffer_aligned[i] = i * 0x4d + (i >> 8);
+
+	for (i = 0; TEST_XXH3_LONG[i].len; ++i) {
+		unsigned char digest[HASH_MAX];
+		memhash(HASH_XXH3, seed_aligned, digest, buffer_aligned, TEST_XXH3_LONG[i].len);
+		if (memcmp(digest, TEST_XXH3_LONG[i].digest, HASH_MAX) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Failed XXH3 long test\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
 	free(buffer_alloc);
 	free(seed_alloc);
 }
 
+#define HASH_MULTI_MAX 9 /* one more than the max number of buffers hashed at the same time */
+
+static void test_hash_multi(void)
+{
+	static const size_t size_map[] = { 0, 1, 15, 16, 17, 95, 96, 97, 191, 192, 512, 4096 + 48 + 7 };
+	unsigned char seed[HASH_MAX];
+	unsigned char* src_map[HASH_MULTI_MAX];
+	unsigned char* digest_map[HASH_MULTI_MAX];
+	unsigned char digest[HASH_MULTI_MAX][HASH_MAX];
+	unsigned char expected[HASH_MAX];
+	unsigned char* buffer;
+	void* buffer_alloc;
+	unsigned kind;
+	unsigned i, j, k;
+
+	/* allocate the buffers at different alignments */
+	buffer = malloc_nofail_align(HASH_MULTI_MAX * 8192, &buffer_alloc);
+	for (i = 0; i < HASH_MULTI_MAX; ++i) {
+		src_map[i] = buffer + i * 8192 + i;
+		digest_map[i] = digest[i];
+	}
+
+	for (i = 0; i < HASH_MAX; ++i)
+		seed[i] = i * 0x1f + 0x35;
+	for (i = 0; i < HASH_MULTI_MAX * 8192; ++i)
+		buffer[i] = i * 0x4d + (i >> 8);
+
+	for (kind = HASH_MURMUR3; kind <= HASH_XXH3; ++kind) {
+		for (i = 0; i < sizeof(size_map) / sizeof(size_map[0]); ++i) {
+			/* test all the number of buffers */
+			for (j = 1; j <= HASH_MULTI_MAX; ++j) {
+				memhash_multi(kind, seed, digest_map, src_map, j, size_map[i]);
+
+				for (k = 0; k < j; ++k) {
+					memhash(kind, seed, expected, src_map[k], size_map[i]);
+					if (memcmp(digest[k], expected, HASH_MAX) != 0) {
+						/* LCOV_EXCL_START */
+						log_fatal("Failed multi hash test\n");
+						exit(EXIT_FAILURE);
+						/* LCOV_EXCL_STOP */
+					}
+				}
+			}
+		}
+	}
+
+	free(buffer_alloc);
+}
+
 struct crc_test_vector {
 	const char* data;
 	int len;
@@ -580,6 +686,7 @@ void selftest(void)
 	}
 
 	test_hash();
+	test_hash_multi();
 	test_crc32c();
 	test_tommy();
 	if (raid_selftest() != 0) {
@@ -636,5 +743,29 @@ void selftest(void)
 		exit(EXIT_FAILURE);
 		/* LCOV_EXCL_STOP */
 	}
+	if (raid_test_syndrome(RAID_MODE_VANDERMONDE, 4, 3 * 16 * 1024 + 4096) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed SYNDROME Vandermonde test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+	if (raid_test_syndrome(RAID_MODE_CAUCHY, 4, 3 * 16 * 1024 + 4096) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed SYNDROME Cauchy test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+	if (raid_test_delta(RAID_MODE_VANDERMONDE, 8, 3 * 16 * 1024 + 4096) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed DELTA Vandermonde test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+	if (raid_test_delta(RAID_MODE_CAUCHY, 8, 3 * 16 * 1024 + 4096) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Failed DELTA Cauchy test\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
 }
 
@@ -88,6 +88,11 @@ void memory(void)
 	log_tag("memory:dir:%" PRIu64 "\n", (uint64_t)(sizeof(struct snapraid_dir)));
 
 	msg_progress("Using %u MiB of memory for the file-system.\n", (unsigned)(malloc_counter_get() / MEBI));
+
+	if (block_store_size() != 0) {
+		log_tag("memory:hashfile:%" PRIu64 "\n", (uint64_t)block_store_size());
+		msg_progress("Using %u MiB of hash file for the blocks.\n", (unsigned)(block_store_size() / MEBI));
+	}
 }
 
 void test(int argc, char* argv[])
@@ -300,6 +305,12 @@ void config(char* conf, size_t conf_size, const char* argv0)
 #define OPT_TEST_SKIP_CONTENT_WRITE 302
 #define OPT_TEST_SKIP_SPACE_HOLDER 303
 #define OPT_TEST_FORMAT 304
+#define OPT_TEST_SKIP_MULTI_SCAN 305
+#define OPT_TEST_FORCE_XXH3 307
+#define OPT_TEST_IO_GEN 308
+#define OPT_TEST_FORCE_SYNC_DELTA 309
+#define OPT_TEST_SKIP_BLOCK_ARENA 310
+#define OPT_TEST_FORCE_FULL_LOAD 311
 
 #if HAVE_GETOPT_LONG
 struct option long_options[] = {
@@ -362,6 +373,9 @@ struct option long_options[] = {
 	/* Force Spooky2 hash */
 	{ "test-force-spooky2", 0, 0, OPT_TEST_FORCE_SPOOKY2 },
 
+	/* Force XXH3 hash */
+	{ "test-force-xxh3", 0, 0, OPT_TEST_FORCE_XXH3 },
+
 	/* Skip the use of lock file */
 	{ "test-skip-lock", 0, 0, OPT_TEST_SKIP_LOCK },
 
@@ -425,12 +439,18 @@ struct option long_options[] = {
 	/* Force parity update even if all the data hash is already matching */
 	{ "test-force-parity-update", 0, 0, OPT_TEST_FORCE_PARITY_UPDATE },
 
+	/* Force the parity delta update when possible */
+	{ "test-force-sync-delta", 0, 0, OPT_TEST_FORCE_SYNC_DELTA },
+
 	/* Number of IO buffers */
 	{ "test-io-cache", 1, 0, OPT_TEST_IO_CACHE },
 
 	/* Print IO stats */
 	{ "test-io-stats", 0, 0, OPT_TEST_IO_STATS },
 
+	/* Number of threads for the parity computation */
+	{ "test-io-gen", 1, 0, OPT_TEST_IO_GEN },
+
 	/* Signal condition variable outside the mutex */
 	{ "test-cond-signal-outside", 0, 0, OPT_TEST_COND_SIGNAL_OUTSIDE },
 
@@ -467,6 +487,15 @@ struct option long_options[] = {
 	/* Set the output format */
 	{ "test-fmt", 1, 0, OPT_TEST_FORMAT },
 
+	/* Skip the use of threads to scan the disks */
+	{ "test-skip-multi-scan", 0, 0, OPT_TEST_SKIP_MULTI_SCAN },
+
+	/* Skip the layout of the blocks in parity order */
+	{ "test-skip-block-arena", 0, 0, OPT_TEST_SKIP_BLOCK_ARENA },
+
+	/* Load the full state also in commands that need only a part of it */
+	{ "test-force-full-load", 0, 0, OPT_TEST_FORCE_FULL_LOAD },
+
 	{ 0, 0, 0, 0 }
 };
 #endif
@@ -630,6 +659,8 @@ int main(int argc, char* argv[])
 				plan = SCRUB_NEW;
 			} else if (strcmp(optarg, "full") == 0) {
 				plan = SCRUB_FULL;
+			} else if (strcmp(optarg, "rehash") == 0) {
+				plan = SCRUB_REHASH;
 			} else {
 				plan = strtoul(optarg, &e, 10);
 				if (!e || *e || plan > 100) {
@@ -788,6 +819,9 @@ int main(int argc, char* argv[])
 		case OPT_TEST_FORCE_SPOOKY2 :
 			opt.force_spooky2 = 1;
 			break;
+		case OPT_TEST_FORCE_XXH3 :
+			opt.force_xxh3 = 1;
+			break;
 		case OPT_TEST_SKIP_LOCK :
 			opt.skip_lock = 1;
 			break;
@@ -849,6 +883,9 @@ int main(int argc, char* argv[])
 		case OPT_TEST_FORCE_PARITY_UPDATE :
 			opt.force_parity_update = 1;
 			break;
+		case OPT_TEST_FORCE_SYNC_DELTA :
+			opt.force_sync_delta = 1;
+			break;
 		case OPT_TEST_IO_CACHE :
 			opt.io_cache = atoi(optarg);
 			if (opt.io_cache != 1 && (opt.io_cache < IO_MIN || opt.io_cache > IO_MAX)) {
@@ -861,6 +898,15 @@ int main(int argc, char* argv[])
 		case OPT_TEST_IO_STATS :
 			opt.force_stats = 1;
 			break;
+		case OPT_TEST_IO_GEN :
+			opt.io_gen = atoi(optarg);
+			if (opt.io_gen < 1 || opt.io_gen > IO_GEN_MAX) {
+				/* LCOV_EXCL_START */
+				log_fatal("The parity threads should be between 1 and %u.\n", IO_GEN_MAX);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+			break;
 		case OPT_TEST_COND_SIGNAL_OUTSIDE :
 #if HAVE_PTHREAD
 			thread_cond_signal_outside = 1;
@@ -910,6 +956,15 @@ int main(int argc, char* argv[])
 				/* LCOV_EXCL_STOP */
 			}
 			break;
+		case OPT_TEST_SKIP_MULTI_SCAN :
+			opt.skip_multi_scan = 1;
+			break;
+		case OPT_TEST_SKIP_BLOCK_ARENA :
+			opt.skip_block_arena = 1;
+			break;
+		case OPT_TEST_FORCE_FULL_LOAD :
+			opt.force_full_load = 1;
+			break;
 		default :
 			/* LCOV_EXCL_START */
 			log_fatal("Unknown option '%c'\n", (char)c);
@@ -1173,6 +1228,32 @@ int main(int argc, char* argv[])
 		break;
 	}
 
+	switch (operation) {
+	case OPERATION_LIST :
+	case OPERATION_POOL :
+	case OPERATION_DUP :
+	case OPERATION_STATUS :
+		/* avoid to build the file hash tables used only to compare with the disks */
+		opt.skip_load_set = 1;
+		break;
+	}
+
+	switch (operation) {
+	case OPERATION_LIST :
+	case OPERATION_POOL :
+		/* avoid to load blocks and extents, as only names of files and links are used */
+		opt.skip_load_extent = 1;
+		opt.skip_load_block = 1;
+		break;
+	}
+
+	/* load everything, to compare the result with the partial load */
+	if (opt.force_full_load) {
+		opt.skip_load_set = 0;
+		opt.skip_load_extent = 0;
+		opt.skip_load_block = 0;
+	}
+
 	switch (operation) {
 	case OPERATION_DIFF :
 	case OPERATION_LIST :
@@ -1341,7 +1422,7 @@ int main(int argc, char* argv[])
 		/* save the new state if required */
 		if (!opt.kill_after_sync) {
 			if ((state.need_write || state.opt.force_content_write))
-				state_write(&state);
+				state_checkpoint(&state);
 		} else {
 			log_fatal("WARNING! Skipped state write for --test-kill-after-sync option.\n");
 		}
@@ -1388,7 +1469,7 @@ int main(int argc, char* argv[])
 
 		/* save the new state if required */
 		if (state.need_write || state.opt.force_content_write)
-			state_write(&state);
+			state_checkpoint(&state);
 
 		/* abort if required */
 		if (ret != 0) {
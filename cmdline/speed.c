@@ -83,6 +83,8 @@ void speed(int period)
 	int64_t dt;
 	int i, j;
 	unsigned char digest[HASH_MAX];
+	unsigned char digest_multi[TEST_COUNT][HASH_MAX];
+	unsigned char* digest_map[TEST_COUNT];
 	unsigned char seed[HASH_MAX];
 	int id[RAID_PARITY_MAX];
 	int ip[RAID_PARITY_MAX];
@@ -91,20 +93,34 @@ void speed(int period)
 	int size = TEST_SIZE;
 	int nd = TEST_COUNT;
 	int nv;
+	int np;
+	int l;
 	void *v_alloc;
 	void **v;
+	void *scratch_alloc;
+	void *scratch;
 
-	nv = nd + RAID_PARITY_MAX + 1;
+	nv = nd + RAID_PARITY_MAX * 2 + 1;
 
 	v = malloc_nofail_vector_align(nd, nv, size, &v_alloc);
+	scratch = malloc_nofail_align(RAID_SCRATCH_SIZE, &scratch_alloc);
 
 	/* initialize disks with fixed data */
 	for (i = 0; i < nd; ++i)
 		memset(v[i], i, size);
 
 	/* zero buffer */
-	memset(v[nd + RAID_PARITY_MAX], 0, size);
-	raid_zero(v[nd + RAID_PARITY_MAX]);
+	memset(v[nv - 1], 0, size);
+	raid_zero(v[nv - 1]);
+
+	/* expected parity, like the one read from the parity disks */
+	raid_gen(nd, RAID_PARITY_MAX, size, v);
+	for (i = 0; i < RAID_PARITY_MAX; ++i)
+		memcpy(v[nd + RAID_PARITY_MAX + i], v[nd + i], size);
+
+	/* digests for the multi hash */
+	for (i = 0; i < nd; ++i)
+		digest_map[i] = digest_multi[i];
 
 	/* hash seed */
 	for (i = 0; i < HASH_MAX; ++i)
@@ -130,11 +146,13 @@ void speed(int period)
 
 		raid_cpu_info(vendor, &family, &model);
 
-		printf("CPU %s, family %u, model %u, flags%s%s%s%s%s%s\n", vendor, family, model,
+		printf("CPU %s, family %u, model %u, flags%s%s%s%s%s%s%s%s\n", vendor, family, model,
 			raid_cpu_has_sse2() ? " sse2" : "",
 			raid_cpu_has_ssse3() ? " ssse3" : "",
 			raid_cpu_has_crc32() ? " crc32" : "",
 			raid_cpu_has_avx2() ? " avx2" : "",
+			raid_cpu_has_avx512bw() ? " avx512bw" : "",
+			raid_cpu_has_gfni() ? " gfni" : "",
 			raid_cpu_has_slowmult() ? " slowmult" : "",
 			raid_cpu_has_slowextendedreg() ? " slowext" : ""
 		);
@@ -216,19 +234,22 @@ void speed(int period)
 	printf("%8s", "best");
 	printf("%8s", "murmur3");
 	printf("%8s", "spooky2");
+	printf("%8s", "xxh3");
 	printf("\n");
 
 	printf("%8s", "hash");
 #ifdef CONFIG_X86
 	if (sizeof(void *) == 4 && !raid_cpu_has_slowmult())
 		printf("%8s", "murmur3");
-	else
+	else if (sizeof(void *) == 4)
 		printf("%8s", "spooky2");
+	else
+		printf("%8s", "xxh3");
 #else
 	if (sizeof(void *) == 4)
 		printf("%8s", "murmur3");
 	else
-		printf("%8s", "spooky2");
+		printf("%8s", "xxh3");
 #endif
 	fflush(stdout);
 
@@ -245,6 +266,40 @@ void speed(int period)
 			memhash(HASH_SPOOKY2, seed, digest, v[j], size);
 	} SPEED_STOP
 
+	printf("%8" PRIu64, ds / dt);
+	fflush(stdout);
+
+	SPEED_START {
+		for (j = 0; j < nd; ++j)
+			memhash(HASH_XXH3, seed, digest, v[j], size);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
+	printf("\n");
+
+	/* hashing all the blocks at the same time */
+	printf("%8s", "multi");
+	printf("%8s", "");
+	fflush(stdout);
+
+	SPEED_START {
+		memhash_multi(HASH_MURMUR3, seed, digest_map, (unsigned char**)v, nd, size);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
+	fflush(stdout);
+
+	SPEED_START {
+		memhash_multi(HASH_SPOOKY2, seed, digest_map, (unsigned char**)v, nd, size);
+	} SPEED_STOP
+
+	printf("%8" PRIu64, ds / dt);
+	fflush(stdout);
+
+	SPEED_START {
+		memhash_multi(HASH_XXH3, seed, digest_map, (unsigned char**)v, nd, size);
+	} SPEED_STOP
+
 	printf("%8" PRIu64, ds / dt);
 	printf("\n");
 	printf("\n");
@@ -268,6 +323,10 @@ void speed(int period)
 	printf("%8s", "avx2");
 #ifdef CONFIG_X86_64
 	printf("%8s", "avx2e");
+#endif
+	printf("%8s", "avx512");
+#ifdef CONFIG_X86_64
+	printf("%8s", "gfni");
 #endif
 #endif
 	printf("\n");
@@ -322,6 +381,19 @@ void speed(int period)
 		fflush(stdout);
 	}
 #endif
+#ifdef CONFIG_X86_64
+	printf("%8s", "");
+#endif
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		SPEED_START {
+			raid_gen1_avx512bw(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
+#endif
 #endif
 	printf("\n");
 
@@ -381,6 +453,19 @@ void speed(int period)
 		fflush(stdout);
 	}
 #endif
+#ifdef CONFIG_X86_64
+	printf("%8s", "");
+#endif
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		SPEED_START {
+			raid_gen2_avx512bw(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
+#endif
 #endif
 	printf("\n");
 
@@ -443,6 +528,16 @@ void speed(int period)
 		fflush(stdout);
 	}
 #endif
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		SPEED_START {
+			raid_genz_avx512bw(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
+#endif
 #endif
 #endif
 	printf("\n");
@@ -506,6 +601,26 @@ void speed(int period)
 		fflush(stdout);
 	}
 #endif
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		SPEED_START {
+			raid_gen3_avx512bw(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+	if (raid_cpu_has_gfni()) {
+		SPEED_START {
+			raid_gen3_gfni(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
+#endif
 #endif
 #endif
 	printf("\n");
@@ -571,6 +686,26 @@ void speed(int period)
 		fflush(stdout);
 	}
 #endif
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		SPEED_START {
+			raid_gen4_avx512bw(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+	if (raid_cpu_has_gfni()) {
+		SPEED_START {
+			raid_gen4_gfni(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
+#endif
 #endif
 #endif
 	printf("\n");
@@ -636,6 +771,26 @@ void speed(int period)
 		fflush(stdout);
 	}
 #endif
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		SPEED_START {
+			raid_gen5_avx512bw(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+	if (raid_cpu_has_gfni()) {
+		SPEED_START {
+			raid_gen5_gfni(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
+#endif
 #endif
 #endif
 	printf("\n");
@@ -701,9 +856,60 @@ void speed(int period)
 		fflush(stdout);
 	}
 #endif
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		SPEED_START {
+			raid_gen6_avx512bw(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
 #endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+	if (raid_cpu_has_gfni()) {
+		SPEED_START {
+			raid_gen6_gfni(nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+	}
 #endif
+#endif
+#endif
+	printf("\n");
 	printf("\n");
+
+	/* check table */
+	printf("RAID functions used for checking the parity with 'scrub':\n");
+	printf("%8s", "");
+	printf("%8s", "gen+cmp");
+	printf("%8s", "syndr");
+	printf("\n");
+
+	for (np = 1; np <= RAID_PARITY_MAX; ++np) {
+		printf("%7s%d", "check", np);
+		fflush(stdout);
+
+		/* generate and then compare all the parity */
+		SPEED_START {
+			raid_gen(nd, np, size, v);
+			for (l = 0; l < np; ++l)
+				side_effect += memcmp(v[nd + l], v[nd + RAID_PARITY_MAX + l], size);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		fflush(stdout);
+
+		/* check each slice without storing the computed parity */
+		SPEED_START {
+			side_effect += raid_syndrome(nd, np, size, v, v + nd + RAID_PARITY_MAX, 0, scratch);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+		printf("\n");
+	}
 	printf("\n");
 
 	/* recover table */
@@ -714,6 +920,8 @@ void speed(int period)
 #ifdef CONFIG_X86
 	printf("%8s", "ssse3");
 	printf("%8s", "avx2");
+	printf("%8s", "avx512");
+	printf("%8s", "gfni");
 #endif
 	printf("\n");
 
@@ -753,6 +961,28 @@ void speed(int period)
 		printf("%8" PRIu64, ds / dt);
 	}
 #endif
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				/* +1 to avoid GEN1 optimized case */
+				raid_rec1_avx512bw(1, id, ip + 1, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+	if (raid_cpu_has_gfni()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				/* +1 to avoid GEN1 optimized case */
+				raid_rec1_gfni(1, id, ip + 1, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
 #endif
 	printf("\n");
 
@@ -792,6 +1022,28 @@ void speed(int period)
 		printf("%8" PRIu64, ds / dt);
 	}
 #endif
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				/* +1 to avoid GEN2 optimized case */
+				raid_rec2_avx512bw(2, id, ip + 1, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+	if (raid_cpu_has_gfni()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				/* +1 to avoid GEN2 optimized case */
+				raid_rec2_gfni(2, id, ip + 1, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
 #endif
 	printf("\n");
 
@@ -828,6 +1080,26 @@ void speed(int period)
 		printf("%8" PRIu64, ds / dt);
 	}
 #endif
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				raid_recX_avx512bw(3, id, ip, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+	if (raid_cpu_has_gfni()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				raid_recX_gfni(3, id, ip, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
 #endif
 	printf("\n");
 
@@ -864,6 +1136,26 @@ void speed(int period)
 		printf("%8" PRIu64, ds / dt);
 	}
 #endif
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				raid_recX_avx512bw(4, id, ip, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+	if (raid_cpu_has_gfni()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				raid_recX_gfni(4, id, ip, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
 #endif
 	printf("\n");
 
@@ -900,6 +1192,26 @@ void speed(int period)
 		printf("%8" PRIu64, ds / dt);
 	}
 #endif
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				raid_recX_avx512bw(5, id, ip, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+	if (raid_cpu_has_gfni()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				raid_recX_gfni(5, id, ip, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
 #endif
 	printf("\n");
 
@@ -936,12 +1248,33 @@ void speed(int period)
 		printf("%8" PRIu64, ds / dt);
 	}
 #endif
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				raid_recX_avx512bw(6, id, ip, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+	if (raid_cpu_has_gfni()) {
+		SPEED_START {
+			for (j = 0; j < nd; ++j)
+				raid_recX_gfni(6, id, ip, nd, size, v);
+		} SPEED_STOP
+
+		printf("%8" PRIu64, ds / dt);
+	}
+#endif
 #endif
 	printf("\n");
 	printf("\n");
 
 	printf("If the 'best' expectations are wrong, please report it in the SnapRAID forum\n\n");
 
+	free(scratch_alloc);
 	free(v_alloc);
 	free(v);
 }
@@ -108,15 +108,46 @@
 //
 #define sc_const 0xdeadbeefdeadbeefLL
 
-void SpookyHash128(const void* data, size_t size, const uint8_t* seed, uint8_t* digest)
+/*
+ * Tail and finalization, starting from the state after the body.
+ */
+static inline void SpookyHash128_end(const uint64_t* state, const void* tail, size_t size_remainder, uint8_t* digest)
 {
 	uint64_t h0, h1, h2, h3, h4, h5, h6, h7, h8, h9, h10, h11;
 	uint64_t buf[sc_numVars];
+#if WORDS_BIGENDIAN
+	unsigned i;
+#endif
+
+	h0 = state[0]; h1 = state[1]; h2 = state[2]; h3 = state[3];
+	h4 = state[4]; h5 = state[5]; h6 = state[6]; h7 = state[7];
+	h8 = state[8]; h9 = state[9]; h10 = state[10]; h11 = state[11];
+
+	/* tail */
+	memcpy(buf, tail, size_remainder);
+	memset(((uint8_t*)buf) + size_remainder, 0, sc_blockSize - size_remainder);
+	((uint8_t*)buf)[sc_blockSize - 1] = size_remainder;
+
+	/* finalization */
+#if WORDS_BIGENDIAN
+	for (i = 0; i < sc_numVars; ++i)
+		buf[i] = util_swap64(buf[i]);
+#endif
+	End(buf, h0, h1, h2, h3, h4, h5, h6, h7, h8, h9, h10, h11);
+
+	util_write64(digest + 0, h0);
+	util_write64(digest + 8, h1);
+}
+
+void SpookyHash128(const void* data, size_t size, const uint8_t* seed, uint8_t* digest)
+{
+	uint64_t h0, h1, h2, h3, h4, h5, h6, h7, h8, h9, h10, h11;
+	uint64_t state[sc_numVars];
 	size_t nblocks;
 	const uint64_t* blocks;
 	const uint64_t* end;
-	size_t size_remainder;
 #if WORDS_BIGENDIAN
+	uint64_t buf[sc_numVars];
 	unsigned i;
 #endif
 
@@ -143,20 +174,235 @@ void SpookyHash128(const void* data, size_t size, const uint8_t* seed, uint8_t*
 		blocks += sc_numVars;
 	}
 
-	/* tail */
-	size_remainder = (size - ((const uint8_t*)end - (const uint8_t*)data));
-	memcpy(buf, end, size_remainder);
-	memset(((uint8_t*)buf) + size_remainder, 0, sc_blockSize - size_remainder);
-	((uint8_t*)buf)[sc_blockSize - 1] = size_remainder;
-
-	/* finalization */
-#if WORDS_BIGENDIAN
-	for (i = 0; i < sc_numVars; ++i)
-		buf[i] = util_swap64(buf[i]);
-#endif
-	End(buf, h0, h1, h2, h3, h4, h5, h6, h7, h8, h9, h10, h11);
+	state[0] = h0; state[1] = h1; state[2] = h2; state[3] = h3;
+	state[4] = h4; state[5] = h5; state[6] = h6; state[7] = h7;
+	state[8] = h8; state[9] = h9; state[10] = h10; state[11] = h11;
 
-	util_write64(digest + 0, h0);
-	util_write64(digest + 8, h1);
+	SpookyHash128_end(state, end, size - nblocks * sc_blockSize, digest);
 }
 
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX2)
+/*
+ * Constant for the AVX2 implementation.
+ */
+static const uint64_t spooky2_avx2_const __aligned(8) = sc_const;
+
+/*
+ * AVX2 implementation hashing 4 buffers of the same size at the same time.
+ *
+ * Each 64 bits lane of the ymm registers contains the state of a different
+ * buffer, so the result is the same of SpookyHash128() for each one.
+ * The body of the 4 buffers is processed together, and the tail and
+ * finalization of each one is done by SpookyHash128_end().
+ *
+ * The registers ymm0-ymm11 contain s0-s11, and ymm12-ymm15 are used
+ * to transpose the data, that is stored in ::w with a word of each buffer
+ * in each lane.
+ */
+void SpookyHash128_avx2x4(const uint8_t** data, size_t size, const uint8_t* seed, uint8_t** digest)
+{
+	uint64_t h[sc_numVars][4] __aligned(32);
+	uint64_t w[sc_numVars][4] __aligned(32);
+	uint64_t state[sc_numVars];
+	size_t nblocks;
+	size_t i;
+	unsigned j;
+	unsigned k;
+
+	nblocks = size / sc_blockSize;
+
+	raid_avx_begin();
+
+	/* h0 = h3 = h6 = h9 = seed[0]; h1 = h4 = h7 = h10 = seed[1]; h2 = h5 = h8 = h11 = sc_const; */
+	asm volatile ("vpbroadcastq %0,%%ymm9" : : "m" (seed[0]));
+	asm volatile ("vpbroadcastq %0,%%ymm10" : : "m" (seed[8]));
+	asm volatile ("vpbroadcastq %0,%%ymm11" : : "m" (spooky2_avx2_const));
+	asm volatile ("vmovdqa %ymm9,%ymm0");
+	asm volatile ("vmovdqa %ymm10,%ymm1");
+	asm volatile ("vmovdqa %ymm11,%ymm2");
+	asm volatile ("vmovdqa %ymm9,%ymm3");
+	asm volatile ("vmovdqa %ymm10,%ymm4");
+	asm volatile ("vmovdqa %ymm11,%ymm5");
+	asm volatile ("vmovdqa %ymm9,%ymm6");
+	asm volatile ("vmovdqa %ymm10,%ymm7");
+	asm volatile ("vmovdqa %ymm11,%ymm8");
+
+	for (i = 0; i < nblocks * sc_blockSize; i += sc_blockSize) {
+		/* transpose the words 0-3, buffers 0-3 in the lanes 0-3 */
+		asm volatile ("vmovdqu %0,%%ymm12" : : "m" (data[0][i]));
+		asm volatile ("vpunpckhqdq %0,%%ymm12,%%ymm14" : : "m" (data[1][i]));
+		asm volatile ("vpunpcklqdq %0,%%ymm12,%%ymm12" : : "m" (data[1][i]));
+		asm volatile ("vmovdqu %0,%%ymm13" : : "m" (data[2][i]));
+		asm volatile ("vpunpckhqdq %0,%%ymm13,%%ymm15" : : "m" (data[3][i]));
+		asm volatile ("vpunpcklqdq %0,%%ymm13,%%ymm13" : : "m" (data[3][i]));
+		asm volatile ("vmovdqa %%xmm12,%0" : "=m" (w[0][0]));
+		asm volatile ("vmovdqa %%xmm13,%0" : "=m" (w[0][2]));
+		asm volatile ("vmovdqa %%xmm14,%0" : "=m" (w[1][0]));
+		asm volatile ("vmovdqa %%xmm15,%0" : "=m" (w[1][2]));
+		asm volatile ("vextracti128 $1,%%ymm12,%0" : "=m" (w[2][0]));
+		asm volatile ("vextracti128 $1,%%ymm13,%0" : "=m" (w[2][2]));
+		asm volatile ("vextracti128 $1,%%ymm14,%0" : "=m" (w[3][0]));
+		asm volatile ("vextracti128 $1,%%ymm15,%0" : "=m" (w[3][2]));
+
+		/* transpose the words 4-7 */
+		asm volatile ("vmovdqu %0,%%ymm12" : : "m" (data[0][i + 32]));
+		asm volatile ("vpunpckhqdq %0,%%ymm12,%%ymm14" : : "m" (data[1][i + 32]));
+		asm volatile ("vpunpcklqdq %0,%%ymm12,%%ymm12" : : "m" (data[1][i + 32]));
+		asm volatile ("vmovdqu %0,%%ymm13" : : "m" (data[2][i + 32]));
+		asm volatile ("vpunpckhqdq %0,%%ymm13,%%ymm15" : : "m" (data[3][i + 32]));
+		asm volatile ("vpunpcklqdq %0,%%ymm13,%%ymm13" : : "m" (data[3][i + 32]));
+		asm volatile ("vmovdqa %%xmm12,%0" : "=m" (w[4][0]));
+		asm volatile ("vmovdqa %%xmm13,%0" : "=m" (w[4][2]));
+		asm volatile ("vmovdqa %%xmm14,%0" : "=m" (w[5][0]));
+		asm volatile ("vmovdqa %%xmm15,%0" : "=m" (w[5][2]));
+		asm volatile ("vextracti128 $1,%%ymm12,%0" : "=m" (w[6][0]));
+		asm volatile ("vextracti128 $1,%%ymm13,%0" : "=m" (w[6][2]));
+		asm volatile ("vextracti128 $1,%%ymm14,%0" : "=m" (w[7][0]));
+		asm volatile ("vextracti128 $1,%%ymm15,%0" : "=m" (w[7][2]));
+
+		/* transpose the words 8-11 */
+		asm volatile ("vmovdqu %0,%%ymm12" : : "m" (data[0][i + 64]));
+		asm volatile ("vpunpckhqdq %0,%%ymm12,%%ymm14" : : "m" (data[1][i + 64]));
+		asm volatile ("vpunpcklqdq %0,%%ymm12,%%ymm12" : : "m" (data[1][i + 64]));
+		asm volatile ("vmovdqu %0,%%ymm13" : : "m" (data[2][i + 64]));
+		asm volatile ("vpunpckhqdq %0,%%ymm13,%%ymm15" : : "m" (data[3][i + 64]));
+		asm volatile ("vpunpcklqdq %0,%%ymm13,%%ymm13" : : "m" (data[3][i + 64]));
+		asm volatile ("vmovdqa %%xmm12,%0" : "=m" (w[8][0]));
+		asm volatile ("vmovdqa %%xmm13,%0" : "=m" (w[8][2]));
+		asm volatile ("vmovdqa %%xmm14,%0" : "=m" (w[9][0]));
+		asm volatile ("vmovdqa %%xmm15,%0" : "=m" (w[9][2]));
+		asm volatile ("vextracti128 $1,%%ymm12,%0" : "=m" (w[10][0]));
+		asm volatile ("vextracti128 $1,%%ymm13,%0" : "=m" (w[10][2]));
+		asm volatile ("vextracti128 $1,%%ymm14,%0" : "=m" (w[11][0]));
+		asm volatile ("vextracti128 $1,%%ymm15,%0" : "=m" (w[11][2]));
+
+		/* s0 += data[0]; s2 ^= s10; s11 ^= s0; s0 = util_rotl64(s0, 11); s11 += s1; */
+		asm volatile ("vpaddq %0,%%ymm0,%%ymm0" : : "m" (w[0]));
+		asm volatile ("vpxor %ymm10,%ymm2,%ymm2");
+		asm volatile ("vpxor %ymm0,%ymm11,%ymm11");
+		asm volatile ("vpsllq $11,%ymm0,%ymm12");
+		asm volatile ("vpsrlq $53,%ymm0,%ymm0");
+		asm volatile ("vpor %ymm12,%ymm0,%ymm0");
+		asm volatile ("vpaddq %ymm1,%ymm11,%ymm11");
+
+		/* s1 += data[1]; s3 ^= s11; s0 ^= s1; s1 = util_rotl64(s1, 32); s0 += s2; */
+		asm volatile ("vpaddq %0,%%ymm1,%%ymm1" : : "m" (w[1]));
+		asm volatile ("vpxor %ymm11,%ymm3,%ymm3");
+		asm volatile ("vpxor %ymm1,%ymm0,%ymm0");
+		asm volatile ("vpshufd $0xb1,%ymm1,%ymm1");
+		asm volatile ("vpaddq %ymm2,%ymm0,%ymm0");
+
+		/* s2 += data[2]; s4 ^= s0; s1 ^= s2; s2 = util_rotl64(s2, 43); s1 += s3; */
+		asm volatile ("vpaddq %0,%%ymm2,%%ymm2" : : "m" (w[2]));
+		asm volatile ("vpxor %ymm0,%ymm4,%ymm4");
+		asm volatile ("vpxor %ymm2,%ymm1,%ymm1");
+		asm volatile ("vpsllq $43,%ymm2,%ymm12");
+		asm volatile ("vpsrlq $21,%ymm2,%ymm2");
+		asm volatile ("vpor %ymm12,%ymm2,%ymm2");
+		asm volatile ("vpaddq %ymm3,%ymm1,%ymm1");
+
+		/* s3 += data[3]; s5 ^= s1; s2 ^= s3; s3 = util_rotl64(s3, 31); s2 += s4; */
+		asm volatile ("vpaddq %0,%%ymm3,%%ymm3" : : "m" (w[3]));
+		asm volatile ("vpxor %ymm1,%ymm5,%ymm5");
+		asm volatile ("vpxor %ymm3,%ymm2,%ymm2");
+		asm volatile ("vpsllq $31,%ymm3,%ymm12");
+		asm volatile ("vpsrlq $33,%ymm3,%ymm3");
+		asm volatile ("vpor %ymm12,%ymm3,%ymm3");
+		asm volatile ("vpaddq %ymm4,%ymm2,%ymm2");
+
+		/* s4 += data[4]; s6 ^= s2; s3 ^= s4; s4 = util_rotl64(s4, 17); s3 += s5; */
+		asm volatile ("vpaddq %0,%%ymm4,%%ymm4" : : "m" (w[4]));
+		asm volatile ("vpxor %ymm2,%ymm6,%ymm6");
+		asm volatile ("vpxor %ymm4,%ymm3,%ymm3");
+		asm volatile ("vpsllq $17,%ymm4,%ymm12");
+		asm volatile ("vpsrlq $47,%ymm4,%ymm4");
+		asm volatile ("vpor %ymm12,%ymm4,%ymm4");
+		asm volatile ("vpaddq %ymm5,%ymm3,%ymm3");
+
+		/* s5 += data[5]; s7 ^= s3; s4 ^= s5; s5 = util_rotl64(s5, 28); s4 += s6; */
+		asm volatile ("vpaddq %0,%%ymm5,%%ymm5" : : "m" (w[5]));
+		asm volatile ("vpxor %ymm3,%ymm7,%ymm7");
+		asm volatile ("vpxor %ymm5,%ymm4,%ymm4");
+		asm volatile ("vpsllq $28,%ymm5,%ymm12");
+		asm volatile ("vpsrlq $36,%ymm5,%ymm5");
+		asm volatile ("vpor %ymm12,%ymm5,%ymm5");
+		asm volatile ("vpaddq %ymm6,%ymm4,%ymm4");
+
+		/* s6 += data[6]; s8 ^= s4; s5 ^= s6; s6 = util_rotl64(s6, 39); s5 += s7; */
+		asm volatile ("vpaddq %0,%%ymm6,%%ymm6" : : "m" (w[6]));
+		asm volatile ("vpxor %ymm4,%ymm8,%ymm8");
+		asm volatile ("vpxor %ymm6,%ymm5,%ymm5");
+		asm volatile ("vpsllq $39,%ymm6,%ymm12");
+		asm volatile ("vpsrlq $25,%ymm6,%ymm6");
+		asm volatile ("vpor %ymm12,%ymm6,%ymm6");
+		asm volatile ("vpaddq %ymm7,%ymm5,%ymm5");
+
+		/* s7 += data[7]; s9 ^= s5; s6 ^= s7; s7 = util_rotl64(s7, 57); s6 += s8; */
+		asm volatile ("vpaddq %0,%%ymm7,%%ymm7" : : "m" (w[7]));
+		asm volatile ("vpxor %ymm5,%ymm9,%ymm9");
+		asm volatile ("vpxor %ymm7,%ymm6,%ymm6");
+		asm volatile ("vpsllq $57,%ymm7,%ymm12");
+		asm volatile ("vpsrlq $7,%ymm7,%ymm7");
+		asm volatile ("vpor %ymm12,%ymm7,%ymm7");
+		asm volatile ("vpaddq %ymm8,%ymm6,%ymm6");
+
+		/* s8 += data[8]; s10 ^= s6; s7 ^= s8; s8 = util_rotl64(s8, 55); s7 += s9; */
+		asm volatile ("vpaddq %0,%%ymm8,%%ymm8" : : "m" (w[8]));
+		asm volatile ("vpxor %ymm6,%ymm10,%ymm10");
+		asm volatile ("vpxor %ymm8,%ymm7,%ymm7");
+		asm volatile ("vpsllq $55,%ymm8,%ymm12");
+		asm volatile ("vpsrlq $9,%ymm8,%ymm8");
+		asm volatile ("vpor %ymm12,%ymm8,%ymm8");
+		asm volatile ("vpaddq %ymm9,%ymm7,%ymm7");
+
+		/* s9 += data[9]; s11 ^= s7; s8 ^= s9; s9 = util_rotl64(s9, 54); s8 += s10; */
+		asm volatile ("vpaddq %0,%%ymm9,%%ymm9" : : "m" (w[9]));
+		asm volatile ("vpxor %ymm7,%ymm11,%ymm11");
+		asm volatile ("vpxor %ymm9,%ymm8,%ymm8");
+		asm volatile ("vpsllq $54,%ymm9,%ymm12");
+		asm volatile ("vpsrlq $10,%ymm9,%ymm9");
+		asm volatile ("vpor %ymm12,%ymm9,%ymm9");
+		asm volatile ("vpaddq %ymm10,%ymm8,%ymm8");
+
+		/* s10 += data[10]; s0 ^= s8; s9 ^= s10; s10 = util_rotl64(s10, 22); s9 += s11; */
+		asm volatile ("vpaddq %0,%%ymm10,%%ymm10" : : "m" (w[10]));
+		asm volatile ("vpxor %ymm8,%ymm0,%ymm0");
+		asm volatile ("vpxor %ymm10,%ymm9,%ymm9");
+		asm volatile ("vpsllq $22,%ymm10,%ymm12");
+		asm volatile ("vpsrlq $42,%ymm10,%ymm10");
+		asm volatile ("vpor %ymm12,%ymm10,%ymm10");
+		asm volatile ("vpaddq %ymm11,%ymm9,%ymm9");
+
+		/* s11 += data[11]; s1 ^= s9; s10 ^= s11; s11 = util_rotl64(s11, 46); s10 += s0; */
+		asm volatile ("vpaddq %0,%%ymm11,%%ymm11" : : "m" (w[11]));
+		asm volatile ("vpxor %ymm9,%ymm1,%ymm1");
+		asm volatile ("vpxor %ymm11,%ymm10,%ymm10");
+		asm volatile ("vpsllq $46,%ymm11,%ymm12");
+		asm volatile ("vpsrlq $18,%ymm11,%ymm11");
+		asm volatile ("vpor %ymm12,%ymm11,%ymm11");
+		asm volatile ("vpaddq %ymm0,%ymm10,%ymm10");
+	}
+
+	asm volatile ("vmovdqa %%ymm0,%0" : "=m" (h[0]));
+	asm volatile ("vmovdqa %%ymm1,%0" : "=m" (h[1]));
+	asm volatile ("vmovdqa %%ymm2,%0" : "=m" (h[2]));
+	asm volatile ("vmovdqa %%ymm3,%0" : "=m" (h[3]));
+	asm volatile ("vmovdqa %%ymm4,%0" : "=m" (h[4]));
+	asm volatile ("vmovdqa %%ymm5,%0" : "=m" (h[5]));
+	asm volatile ("vmovdqa %%ymm6,%0" : "=m" (h[6]));
+	asm volatile ("vmovdqa %%ymm7,%0" : "=m" (h[7]));
+	asm volatile ("vmovdqa %%ymm8,%0" : "=m" (h[8]));
+	asm volatile ("vmovdqa %%ymm9,%0" : "=m" (h[9]));
+	asm volatile ("vmovdqa %%ymm10,%0" : "=m" (h[10]));
+	asm volatile ("vmovdqa %%ymm11,%0" : "=m" (h[11]));
+
+	raid_avx_end();
+
+	/* tail and finalization of each buffer */
+	for (j = 0; j < 4; ++j) {
+		for (k = 0; k < sc_numVars; ++k)
+			state[k] = h[k][j];
+		SpookyHash128_end(state, data[j] + nblocks * sc_blockSize, size - nblocks * sc_blockSize, digest[j]);
+	}
+}
+#endif
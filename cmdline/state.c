@@ -143,8 +143,22 @@ void state_init(struct snapraid_state* state)
 	memset(&state->opt, 0, sizeof(state->opt));
 	state->filter_hidden = 0;
 	state->autosave = 0;
+	state->confhash = HASH_UNDEFINED;
 	state->need_write = 0;
 	state->checked_read = 0;
+	state->journal_base = 0;
+	state->journal_content_crc = 0;
+	state->journal_content_size = 0;
+	state->journal_blockmax = 0;
+	state->journal_diskmax = 0;
+	state->journal_size = 0;
+	state->journal_crc = 0;
+	state->journal_count = 0;
+	state->journal_map = 0;
+	state->dirty_map = 0;
+	state->dirty_size = 0;
+	state->dirty_max = 0;
+	state->journal_async = 0;
 	state->block_size = 256 * KIBI; /* default 256 KiB */
 	state->raid_mode = RAID_MODE_CAUCHY;
 	state->file_mode = ADVISE_DEFAULT;
@@ -162,6 +176,9 @@ void state_init(struct snapraid_state* state)
 		state->parity[l].skip_access = 0;
 		state->parity[l].tick = 0;
 		state->parity[l].cached_blocks = 0;
+		state->parity[l].cached_depth = 0;
+		state->parity[l].depth_sum = 0;
+		state->parity[l].depth_count = 0;
 		state->parity[l].is_excluded_by_filter = 0;
 	}
 	state->tick_io = 0;
@@ -173,6 +190,7 @@ void state_init(struct snapraid_state* state)
 	state->share[0] = 0;
 	state->pool[0] = 0;
 	state->pool_device = 0;
+	state->hashfile[0] = 0;
 	state->lockfile[0] = 0;
 	state->level = 1; /* default is the lowest protection */
 	state->clear_past_hash = 0;
@@ -201,6 +219,19 @@ void state_done(struct snapraid_state* state)
 	tommy_hashdyn_done(&state->previmportset);
 	tommy_hashdyn_done(&state->searchset);
 	tommy_arrayblkof_done(&state->infoarr);
+	free(state->journal_map);
+	free(state->dirty_map);
+	block_store_done();
+}
+
+void state_dirty_begin(struct snapraid_state* state, block_off_t size)
+{
+	free(state->dirty_map);
+
+	state->dirty_size = size;
+	state->dirty_max = 0;
+	state->dirty_map = malloc_nofail(size / 8 + 1);
+	memset(state->dirty_map, 0, size / 8 + 1);
 }
 
 /**
@@ -519,6 +550,14 @@ static int validate_smartctl(const char* custom)
 	return 0;
 }
 
+/**
+ * If only a part of the state was loaded from the content file.
+ */
+static int state_load_partial(struct snapraid_state* state)
+{
+	return state->opt.skip_load_set || state->opt.skip_load_extent || state->opt.skip_load_block;
+}
+
 void state_config(struct snapraid_state* state, const char* path, const char* command, struct snapraid_option* opt, tommy_list* filterlist_disk)
 {
 	STREAM* f;
@@ -655,6 +694,27 @@ void state_config(struct snapraid_state* state, const char* path, const char* co
 			}
 
 			BLOCK_HASH_SIZE = hash_size;
+		} else if (strcmp(tag, "hash") == 0) {
+			ret = sgetlasttok(f, buffer, sizeof(buffer));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'hash' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			if (strcmp(buffer, "murmur3") == 0) {
+				state->confhash = HASH_MURMUR3;
+			} else if (strcmp(buffer, "spooky2") == 0) {
+				state->confhash = HASH_SPOOKY2;
+			} else if (strcmp(buffer, "xxh3") == 0) {
+				state->confhash = HASH_XXH3;
+			} else {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'hash' specification '%s' in '%s' at line %u\n", buffer, path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
 		} else if (lev_config_scan(tag, &level, &state->raid_mode) == 0) {
 			char device[PATH_MAX];
 			char* split_map[SPLIT_MAX + 1];
@@ -805,6 +865,42 @@ void state_config(struct snapraid_state* state, const char* path, const char* co
 			}
 
 			state->pool_device = st.st_dev;
+		} else if (strcmp(tag, "hashfile") == 0) {
+			if (*state->hashfile) {
+				/* LCOV_EXCL_START */
+				log_fatal("Multiple 'hashfile' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			ret = sgetlasttok(f, buffer, sizeof(buffer));
+			if (ret < 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Invalid 'hashfile' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			if (!*buffer) {
+				/* LCOV_EXCL_START */
+				log_fatal("Empty 'hashfile' specification in '%s' at line %u\n", path, line);
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			pathimport(state->hashfile, sizeof(state->hashfile), buffer);
+
+			/* from now on all the file blocks are stored in it */
+			if (block_store_init(state->hashfile) != 0) {
+				/* LCOV_EXCL_START */
+				if (errno == ENOSYS) {
+					log_fatal("WARNING! The 'hashfile' option is not supported in this platform. Ignoring it.\n");
+				} else {
+					log_fatal("Error creating the 'hashfile' '%s' specified in '%s' at line %u. %s.\n", state->hashfile, path, line, strerror(errno));
+					exit(EXIT_FAILURE);
+				}
+				/* LCOV_EXCL_STOP */
+			}
 		} else if (strcmp(tag, "content") == 0) {
 			struct snapraid_content* content;
 			char device[PATH_MAX];
@@ -1194,6 +1290,10 @@ void state_config(struct snapraid_state* state, const char* path, const char* co
 		state->besthash = HASH_MURMUR3;
 	} else if (state->opt.force_spooky2) {
 		state->besthash = HASH_SPOOKY2;
+	} else if (state->opt.force_xxh3) {
+		state->besthash = HASH_XXH3;
+	} else if (state->confhash != HASH_UNDEFINED) {
+		state->besthash = state->confhash;
 	} else {
 #ifdef CONFIG_X86
 		if (sizeof(void*) == 4 && !raid_cpu_has_slowmult())
@@ -1693,6 +1793,54 @@ static int fs_is_block_deleted(struct snapraid_disk* disk, block_off_t pos)
 	return block_state_get(block) == BLOCK_STATE_DELETED;
 }
 
+/**
+ * Adjust a block just read from the content file or from the journal.
+ * Return 1 if the block was changed, and then it's different than the stored one.
+ */
+static int block_read_adjust(struct snapraid_state* state, struct snapraid_block* block)
+{
+	int changed = 0;
+
+	/* if the block contains a hash of past data */
+	/* and we are clearing such indeterminate hashes */
+	if (state->clear_past_hash
+		&& block_has_past_hash(block)
+		&& !hash_is_invalid(block->hash)
+	) {
+		/* set the hash value to INVALID */
+		hash_invalid_set(block->hash);
+		changed = 1;
+	}
+
+	/* if we are disabling the copy optimization */
+	/* we want also to clear any already previously stored information */
+	/* in other sync commands */
+	/* note that this is required only in sync, and we detect */
+	/* this using the clear_past_hash flag */
+	if (state->clear_past_hash
+		&& state->opt.force_nocopy
+		&& block_state_get(block) == BLOCK_STATE_REP
+	) {
+		/* set the hash value to INVALID */
+		hash_invalid_set(block->hash);
+		/* convert from REP to CHG block */
+		block_state_set(block, BLOCK_STATE_CHG);
+		changed = 1;
+	}
+
+	/* if we want a full reallocation, marks block as invalid parity */
+	/* note that we do this after the force_nocopy option */
+	/* to avoid to mixup the two things */
+	if (state->opt.force_realloc
+		&& block_state_get(block) == BLOCK_STATE_BLK) {
+		/* convert from BLK to REP */
+		block_state_set(block, BLOCK_STATE_REP);
+		changed = 1;
+	}
+
+	return changed;
+}
+
 /**
  * Flush the file checking the final CRC.
  * We exploit the fact that the CRC is always stored in the last 4 bytes.
@@ -1745,120 +1893,131 @@ static void decoding_error(const char* path, STREAM* f)
 	}
 }
 
-static void state_read_content(struct snapraid_state* state, const char* path, STREAM* f)
+/**
+ * Counters of the entries read from the content file.
+ */
+struct state_read_count {
+	unsigned file;
+	unsigned hardlink;
+	unsigned symlink;
+	unsigned dir;
+	unsigned adjust; /**< Blocks changed after reading them. */
+};
+
+/**
+ * Read a content file entry specific of a disk.
+ *
+ * It changes only the data of the specified disk, and it can be called
+ * concurrently for different disks.
+ */
+static void state_read_entry(struct snapraid_state* state, const char* path, STREAM* f, int c, struct snapraid_disk* disk, block_off_t blockmax, struct state_read_count* count)
 {
-	block_off_t blockmax;
-	unsigned count_file;
-	unsigned count_hardlink;
-	unsigned count_symlink;
-	unsigned count_dir;
-	int crc_checked;
-	char buffer[PATH_MAX];
 	int ret;
-	tommy_array disk_mapping;
-	uint32_t mapping_max;
 
-	blockmax = 0;
-	count_file = 0;
-	count_hardlink = 0;
-	count_symlink = 0;
-	count_dir = 0;
-	crc_checked = 0;
-	mapping_max = 0;
-	tommy_array_init(&disk_mapping);
+	if (c == 'f') {
+		/* file */
+		char sub[PATH_MAX];
+		uint64_t v_size;
+		uint64_t v_mtime_sec;
+		uint32_t v_mtime_nsec;
+		uint64_t v_inode;
+		uint32_t v_idx;
+		struct snapraid_file* file;
+
+		ret = sgetb64(f, &v_size);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-	ret = sread(f, buffer, 12);
-	if (ret < 0) {
-		/* LCOV_EXCL_START */
-		decoding_error(path, f);
-		log_fatal("Invalid header!\n");
-		os_abort();
-		/* LCOV_EXCL_STOP */
-	}
+		if (state->block_size == 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal incosistency due zero blocksize!\n");
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
 
-	/*
-	 * File format versions:
-	 *  - SNAPCNT1/SnapRAID 4.0 First version.
-	 *  - SNAPCNT2/SnapRAID 7.0 Adds entries 'M' and 'P', to add free_blocks support.
-	 *    The previous 'm' entry is now deprecated, but supported for importing.
-	 *    Similarly for text file, we add 'mapping' and 'parity' deprecating 'map'.
-	 *  - SNAPCNT3/SnapRAID 11.0 Adds entry 'y' for hash size.
-	 *  - SNAPCNT3/SnapRAID 11.0 Adds entry 'Q' for multi parity file.
-	 *    The previous 'P' entry is now deprecated, but supported for importing.
-	 */
-	if (memcmp(buffer, "SNAPCNT1\n\3\0\0", 12) != 0
-		&& memcmp(buffer, "SNAPCNT2\n\3\0\0", 12) != 0
-		&& memcmp(buffer, "SNAPCNT3\n\3\0\0", 12) != 0
-	) {
-		/* LCOV_EXCL_START */
-		if (memcmp(buffer, "SNAPCNT", 7) != 0) {
+		/* check for impossible file size to avoid to crash for a too big allocation */
+		if (v_size / state->block_size > blockmax) {
+			/* LCOV_EXCL_START */
 			decoding_error(path, f);
-			log_fatal("Invalid header!\n");
+			log_fatal("Internal inconsistency in file size too big!\n");
 			os_abort();
-		} else {
-			log_fatal("The content file '%s' was generated with a newer version of SnapRAID!\n", path);
-			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
 		}
-		/* LCOV_EXCL_STOP */
-	}
 
-	while (1) {
-		int c;
+		ret = sgetb64(f, &v_mtime_sec);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-		/* read the command */
-		c = sgetc(f);
-		if (c == EOF) {
-			break;
+		ret = sgetb32(f, &v_mtime_nsec);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
 		}
 
-		if (c == 'f') {
-			/* file */
-			char sub[PATH_MAX];
-			uint64_t v_size;
-			uint64_t v_mtime_sec;
-			uint32_t v_mtime_nsec;
-			uint64_t v_inode;
-			uint32_t v_idx;
-			struct snapraid_file* file;
-			struct snapraid_disk* disk;
-			uint32_t mapping;
+		/* STAT_NSEC_INVALID is encoded as 0 */
+		if (v_mtime_nsec == 0)
+			v_mtime_nsec = STAT_NSEC_INVALID;
+		else
+			--v_mtime_nsec;
 
-			ret = sgetb32(f, &mapping);
-			if (ret < 0 || mapping >= mapping_max) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency in mapping index!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-			disk = tommy_array_get(&disk_mapping, mapping);
+		ret = sgetb64(f, &v_inode);
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-			ret = sgetb64(f, &v_size);
-			if (ret < 0) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
+		ret = sgetbs(f, sub, sizeof(sub));
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+		if (!*sub) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency for null file!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-			if (state->block_size == 0) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal incosistency due zero blocksize!\n");
-				exit(EXIT_FAILURE);
-				/* LCOV_EXCL_STOP */
-			}
+		/* allocate the file */
+		if (state->opt.skip_load_block)
+			file = file_alloc_noblock(&disk->arena, state->block_size, sub, v_size, v_mtime_sec, v_mtime_nsec, v_inode);
+		else
+			file = file_alloc(&disk->arena, state->block_size, sub, v_size, v_mtime_sec, v_mtime_nsec, v_inode, 0);
 
-			/* check for impossible file size to avoid to crash for a too big allocation */
-			if (v_size / state->block_size > blockmax) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency in file size too big!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
+		/* insert the file in the file containers */
+		if (!state->opt.skip_load_set) {
+			tommy_hashdyn_insert(&disk->inodeset, &file->nodeset, file, file_inode_hash(file->inode));
+			tommy_hashdyn_insert(&disk->pathset, &file->pathset, file, file_path_hash(file->sub));
+			tommy_hashdyn_insert(&disk->stampset, &file->stampset, file, file_stamp_hash(file->size, file->mtime_sec, file->mtime_nsec));
+		}
+		tommy_list_insert_tail(&disk->filelist, &file->nodelist, file);
 
-			ret = sgetb64(f, &v_mtime_sec);
+		/* read all the blocks */
+		v_idx = 0;
+		while (v_idx < file->blockmax) {
+			block_off_t v_pos;
+			uint32_t v_count;
+
+			/* get the "subcommand */
+			c = sgetc(f);
+
+			ret = sgetb32(f, &v_pos);
 			if (ret < 0) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
@@ -1866,7 +2025,7 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 				/* LCOV_EXCL_STOP */
 			}
 
-			ret = sgetb32(f, &v_mtime_nsec);
+			ret = sgetb32(f, &v_count);
 			if (ret < 0) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
@@ -1874,177 +2033,96 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 				/* LCOV_EXCL_STOP */
 			}
 
-			/* STAT_NSEC_INVALID is encoded as 0 */
-			if (v_mtime_nsec == 0)
-				v_mtime_nsec = STAT_NSEC_INVALID;
-			else
-				--v_mtime_nsec;
-
-			ret = sgetb64(f, &v_inode);
-			if (ret < 0) {
+			if (v_idx + v_count > file->blockmax) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
+				log_fatal("Internal inconsistency in block number!\n");
 				os_abort();
 				/* LCOV_EXCL_STOP */
 			}
 
-			ret = sgetbs(f, sub, sizeof(sub));
-			if (ret < 0) {
+			if (v_pos + v_count > blockmax) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
+				log_fatal("Internal inconsistency in block size %u/%u!\n", blockmax, v_pos + v_count);
 				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-			if (!*sub) {
 				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency for null file!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
 			}
 
-			/* allocate the file */
-			file = file_alloc(state->block_size, sub, v_size, v_mtime_sec, v_mtime_nsec, v_inode, 0);
-
-			/* insert the file in the file containers */
-			tommy_hashdyn_insert(&disk->inodeset, &file->nodeset, file, file_inode_hash(file->inode));
-			tommy_hashdyn_insert(&disk->pathset, &file->pathset, file, file_path_hash(file->sub));
-			tommy_hashdyn_insert(&disk->stampset, &file->stampset, file, file_stamp_hash(file->size, file->mtime_sec, file->mtime_nsec));
-			tommy_list_insert_tail(&disk->filelist, &file->nodelist, file);
-
-			/* read all the blocks */
-			v_idx = 0;
-			while (v_idx < file->blockmax) {
-				block_off_t v_pos;
-				uint32_t v_count;
-
-				/* get the "subcommand */
-				c = sgetc(f);
+			/* fill the blocks in the run */
+			while (v_count) {
+				struct snapraid_block scratch;
+				struct snapraid_block* block;
 
-				ret = sgetb32(f, &v_pos);
-				if (ret < 0) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
-
-				ret = sgetb32(f, &v_count);
-				if (ret < 0) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
+				/* if blocks are not loaded, decode them anyway to check the format */
+				if (state->opt.skip_load_block)
+					block = &scratch;
+				else
+					block = fs_file2block_get(file, v_idx);
 
-				if (v_idx + v_count > file->blockmax) {
+				switch (c) {
+				case 'b' :
+					block_state_set(block, BLOCK_STATE_BLK);
+					break;
+				case 'n' :
+					/* deprecated NEW blocks are converted to CHG ones */
+					block_state_set(block, BLOCK_STATE_CHG);
+					break;
+				case 'g' :
+					block_state_set(block, BLOCK_STATE_CHG);
+					break;
+				case 'p' :
+					block_state_set(block, BLOCK_STATE_REP);
+					break;
+				default :
 					/* LCOV_EXCL_START */
 					decoding_error(path, f);
-					log_fatal("Internal inconsistency in block number!\n");
+					log_fatal("Invalid block type!\n");
 					os_abort();
 					/* LCOV_EXCL_STOP */
 				}
 
-				if (v_pos + v_count > blockmax) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					log_fatal("Internal inconsistency in block size %u/%u!\n", blockmax, v_pos + v_count);
-					os_abort();
-					/* LCOV_EXCL_START */
-				}
-
-				/* fill the blocks in the run */
-				while (v_count) {
-					struct snapraid_block* block = fs_file2block_get(file, v_idx);
-
-					switch (c) {
-					case 'b' :
-						block_state_set(block, BLOCK_STATE_BLK);
-						break;
-					case 'n' :
-						/* deprecated NEW blocks are converted to CHG ones */
-						block_state_set(block, BLOCK_STATE_CHG);
-						break;
-					case 'g' :
-						block_state_set(block, BLOCK_STATE_CHG);
-						break;
-					case 'p' :
-						block_state_set(block, BLOCK_STATE_REP);
-						break;
-					default :
+				/* read the hash only for 'blk/chg/rep', and not for 'new' */
+				if (c != 'n') {
+					ret = sread(f, block->hash, BLOCK_HASH_SIZE);
+					if (ret < 0) {
 						/* LCOV_EXCL_START */
 						decoding_error(path, f);
-						log_fatal("Invalid block type!\n");
 						os_abort();
 						/* LCOV_EXCL_STOP */
 					}
+				} else {
+					/* set the ZERO hash for deprecated NEW blocks */
+					hash_zero_set(block->hash);
+				}
 
-					/* read the hash only for 'blk/chg/rep', and not for 'new' */
-					if (c != 'n') {
-						ret = sread(f, block->hash, BLOCK_HASH_SIZE);
-						if (ret < 0) {
-							/* LCOV_EXCL_START */
-							decoding_error(path, f);
-							os_abort();
-							/* LCOV_EXCL_STOP */
-						}
-					} else {
-						/* set the ZERO hash for deprecated NEW blocks */
-						hash_zero_set(block->hash);
-					}
-
-					/* if the block contains a hash of past data */
-					/* and we are clearing such indeterminate hashes */
-					if (state->clear_past_hash
-						&& block_has_past_hash(block)
-					) {
-						/* set the hash value to INVALID */
-						hash_invalid_set(block->hash);
-					}
-
-					/* if we are disabling the copy optimization */
-					/* we want also to clear any already previously stored information */
-					/* in other sync commands */
-					/* note that this is required only in sync, and we detect */
-					/* this using the clear_past_hash flag */
-					if (state->clear_past_hash
-						&& state->opt.force_nocopy
-						&& block_state_get(block) == BLOCK_STATE_REP
-					) {
-						/* set the hash value to INVALID */
-						hash_invalid_set(block->hash);
-						/* convert from REP to CHG block */
-						block_state_set(block, BLOCK_STATE_CHG);
-					}
+				/* adjust the block for the running command */
+				count->adjust += block_read_adjust(state, block);
 
-					/* if we want a full reallocation, marks block as invalid parity */
-					/* note that we do this after the force_nocopy option */
-					/* to avoid to mixup the two things */
-					if (state->opt.force_realloc
-						&& block_state_get(block) == BLOCK_STATE_BLK) {
-						/* convert from BLK to REP */
-						block_state_set(block, BLOCK_STATE_REP);
-					}
-
-					/* set the parity association */
+				/* set the parity association */
+				if (!state->opt.skip_load_extent)
 					fs_allocate(disk, v_pos, file, v_idx);
 
-					/* go to the next block */
-					++v_idx;
-					++v_pos;
-					--v_count;
-				}
+				/* go to the next block */
+				++v_idx;
+				++v_pos;
+				--v_count;
 			}
+		}
 
-			/* stat */
-			++count_file;
-		} else if (c == 'i') {
-			/* "inf" command */
-			snapraid_info info;
-			uint32_t v_pos;
-			uint32_t v_oldest;
+		/* stat */
+		++count->file;
+	} else if (c == 'h') {
+		/* hole */
+		uint32_t v_pos;
 
-			ret = sgetb32(f, &v_oldest);
+		v_pos = 0;
+		while (v_pos < blockmax) {
+			uint32_t v_idx;
+			uint32_t v_count;
+			struct snapraid_file* deleted;
+
+			ret = sgetb32(f, &v_count);
 			if (ret < 0) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
@@ -2052,247 +2130,538 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 				/* LCOV_EXCL_STOP */
 			}
 
-			v_pos = 0;
-			while (v_pos < blockmax) {
-				int bad;
-				int rehash;
-				int justsynced;
-				uint32_t t;
-				uint32_t flag;
-				uint32_t v_count;
+			if (v_pos + v_count > blockmax) {
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				log_fatal("Internal inconsistency in hole size %u/%u!\n", blockmax, v_pos + v_count);
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
 
-				ret = sgetb32(f, &v_count);
-				if (ret < 0) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
+			/* get the sub-command */
+			c = sgetc(f);
 
-				if (v_pos + v_count > blockmax) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					log_fatal("Internal inconsistency in info size %u/%u!\n", blockmax, v_pos + v_count);
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
+			switch (c) {
+			case 'o' :
+				/* if it's a run of deleted blocks */
 
-				ret = sgetb32(f, &flag);
-				if (ret < 0) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
+				/* deleted blocks are reachable only from the extents, */
+				/* so if not loaded, just skip their hashes */
+				if (state->opt.skip_load_extent) {
+					while (v_count) {
+						unsigned char hash[HASH_MAX];
 
-				/* if there is an info */
-				if ((flag & 1) != 0) {
-					/* read the time */
-					ret = sgetb32(f, &t);
-					if (ret < 0) {
-						/* LCOV_EXCL_START */
-						decoding_error(path, f);
-						os_abort();
-						/* LCOV_EXCL_STOP */
+						ret = sread(f, hash, BLOCK_HASH_SIZE);
+						if (ret < 0) {
+							/* LCOV_EXCL_START */
+							decoding_error(path, f);
+							os_abort();
+							/* LCOV_EXCL_STOP */
+						}
+
+						++v_pos;
+						--v_count;
 					}
+					break;
+				}
 
-					/* analyze the flags */
-					bad = (flag & 2) != 0;
-					rehash = (flag & 4) != 0;
-					justsynced = (flag & 8) != 0;
+				/* allocate a fake deleted file */
+				deleted = file_alloc(&disk->arena, state->block_size, "<deleted>", v_count * (data_off_t)state->block_size, 0, 0, 0, 0);
 
-					if (rehash && state->prevhash == HASH_UNDEFINED) {
+				/* mark the file as deleted */
+				file_flag_set(deleted, FILE_IS_DELETED);
+
+				/* insert it in the list of deleted files */
+				tommy_list_insert_tail(&disk->deletedlist, &deleted->nodelist, deleted);
+
+				/* process all blocks */
+				v_idx = 0;
+				while (v_count) {
+					struct snapraid_block* block = fs_file2block_get(deleted, v_idx);
+
+					/* set the block as deleted */
+					block_state_set(block, BLOCK_STATE_DELETED);
+
+					/* read the hash */
+					ret = sread(f, block->hash, BLOCK_HASH_SIZE);
+					if (ret < 0) {
 						/* LCOV_EXCL_START */
 						decoding_error(path, f);
-						log_fatal("Internal inconsistency for missing previous checksum!\n");
 						os_abort();
 						/* LCOV_EXCL_STOP */
 					}
 
-					info = info_make(t + v_oldest, bad, rehash, justsynced);
-				} else {
-					info = 0;
-				}
-
-				while (v_count) {
-					/* insert the info in the array */
-					info_set(&state->infoarr, v_pos, info);
-
-					/* ensure that an info is present only for used positions */
-					if (fs_info_is_required(state, v_pos)) {
-						if (!info) {
-							/* LCOV_EXCL_START */
-							decoding_error(path, f);
-							log_fatal("Internal inconsistency for missing info!\n");
-							os_abort();
-							/* LCOV_EXCL_STOP */
-						}
-					} else {
-						/* extra info are accepted for backward compatibility */
-						/* they are discarded at the first write */
+					/* if we are clearing indeterminate hashes */
+					if (state->clear_past_hash
+						&& !hash_is_invalid(block->hash)
+					) {
+						/* set the hash value to INVALID */
+						hash_invalid_set(block->hash);
+						++count->adjust;
 					}
 
+					/* insert the block in the block array */
+					fs_allocate(disk, v_pos, deleted, v_idx);
+
 					/* go to next block */
 					++v_pos;
+					++v_idx;
 					--v_count;
 				}
-			}
-		} else if (c == 'h') {
-			/* hole */
-			uint32_t v_pos;
-			struct snapraid_disk* disk;
-			uint32_t mapping;
-
-			ret = sgetb32(f, &mapping);
-			if (ret < 0 || mapping >= mapping_max) {
+				break;
+			case 'O' :
+				/* go to the next run */
+				v_pos += v_count;
+				break;
+			default :
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
-				log_fatal("Internal inconsistency in mapping index!\n");
+				log_fatal("Invalid hole type!\n");
 				os_abort();
 				/* LCOV_EXCL_STOP */
 			}
-			disk = tommy_array_get(&disk_mapping, mapping);
+		}
+	} else if (c == 's') {
+		/* symlink */
+		char sub[PATH_MAX];
+		char linkto[PATH_MAX];
+		struct snapraid_link* slink;
 
-			v_pos = 0;
-			while (v_pos < blockmax) {
-				uint32_t v_idx;
-				uint32_t v_count;
-				struct snapraid_file* deleted;
+		ret = sgetbs(f, sub, sizeof(sub));
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-				ret = sgetb32(f, &v_count);
-				if (ret < 0) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
+		if (!*sub) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency for null symlink!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-				if (v_pos + v_count > blockmax) {
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					log_fatal("Internal inconsistency in hole size %u/%u!\n", blockmax, v_pos + v_count);
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
+		ret = sgetbs(f, linkto, sizeof(linkto));
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-				/* get the sub-command */
-				c = sgetc(f);
+		/* allocate the link as symbolic link */
+		slink = link_alloc(&disk->arena, sub, linkto, FILE_IS_SYMLINK);
 
-				switch (c) {
-				case 'o' :
-					/* if it's a run of deleted blocks */
+		/* insert the link in the link containers */
+		tommy_hashdyn_insert(&disk->linkset, &slink->nodeset, slink, link_name_hash(slink->sub));
+		tommy_list_insert_tail(&disk->linklist, &slink->nodelist, slink);
 
-					/* allocate a fake deleted file */
-					deleted = file_alloc(state->block_size, "<deleted>", v_count * (data_off_t)state->block_size, 0, 0, 0, 0);
+		/* stat */
+		++count->symlink;
+	} else if (c == 'a') {
+		/* hardlink */
+		char sub[PATH_MAX];
+		char linkto[PATH_MAX];
+		struct snapraid_link* slink;
 
-					/* mark the file as deleted */
-					file_flag_set(deleted, FILE_IS_DELETED);
+		ret = sgetbs(f, sub, sizeof(sub));
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-					/* insert it in the list of deleted files */
-					tommy_list_insert_tail(&disk->deletedlist, &deleted->nodelist, deleted);
+		if (!*sub) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency for null hardlink!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-					/* process all blocks */
-					v_idx = 0;
-					while (v_count) {
-						struct snapraid_block* block = fs_file2block_get(deleted, v_idx);
+		ret = sgetbs(f, linkto, sizeof(linkto));
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-						/* set the block as deleted */
-						block_state_set(block, BLOCK_STATE_DELETED);
+		if (!*linkto) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency for empty hardlink '%s'!\n", sub);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-						/* read the hash */
-						ret = sread(f, block->hash, BLOCK_HASH_SIZE);
-						if (ret < 0) {
-							/* LCOV_EXCL_START */
-							decoding_error(path, f);
-							os_abort();
-							/* LCOV_EXCL_STOP */
-						}
+		/* allocate the link as hard link */
+		slink = link_alloc(&disk->arena, sub, linkto, FILE_IS_HARDLINK);
 
-						/* if we are clearing indeterminate hashes */
-						if (state->clear_past_hash) {
-							/* set the hash value to INVALID */
-							hash_invalid_set(block->hash);
-						}
+		/* insert the link in the link containers */
+		tommy_hashdyn_insert(&disk->linkset, &slink->nodeset, slink, link_name_hash(slink->sub));
+		tommy_list_insert_tail(&disk->linklist, &slink->nodelist, slink);
 
-						/* insert the block in the block array */
-						fs_allocate(disk, v_pos, deleted, v_idx);
+		/* stat */
+		++count->hardlink;
+	} else if (c == 'r') {
+		/* dir */
+		char sub[PATH_MAX];
+		struct snapraid_dir* dir;
 
-						/* go to next block */
-						++v_pos;
-						++v_idx;
-						--v_count;
-					}
-					break;
-				case 'O' :
-					/* go to the next run */
-					v_pos += v_count;
-					break;
-				default :
-					/* LCOV_EXCL_START */
-					decoding_error(path, f);
-					log_fatal("Invalid hole type!\n");
-					os_abort();
-					/* LCOV_EXCL_STOP */
-				}
-			}
-		} else if (c == 's') {
-			/* symlink */
-			char sub[PATH_MAX];
-			char linkto[PATH_MAX];
-			struct snapraid_link* slink;
-			struct snapraid_disk* disk;
-			uint32_t mapping;
+		ret = sgetbs(f, sub, sizeof(sub));
+		if (ret < 0) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-			ret = sgetb32(f, &mapping);
-			if (ret < 0 || mapping >= mapping_max) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency in mapping index!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
-			disk = tommy_array_get(&disk_mapping, mapping);
+		if (!*sub) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency for null dir!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
 
-			ret = sgetbs(f, sub, sizeof(sub));
-			if (ret < 0) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
+		/* allocate the dir */
+		dir = dir_alloc(&disk->arena, sub);
 
-			if (!*sub) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency for null symlink!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
+		/* insert the dir in the dir containers */
+		tommy_hashdyn_insert(&disk->dirset, &dir->nodeset, dir, dir_name_hash(dir->sub));
+		tommy_list_insert_tail(&disk->dirlist, &dir->nodelist, dir);
 
-			ret = sgetbs(f, linkto, sizeof(linkto));
-			if (ret < 0) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
+		/* stat */
+		++count->dir;
+	} else {
+		/* LCOV_EXCL_START */
+		decoding_error(path, f);
+		log_fatal("Invalid command '%c'!\n", (char)c);
+		os_abort();
+		/* LCOV_EXCL_STOP */
+	}
+}
 
-			/* allocate the link as symbolic link */
-			slink = link_alloc(sub, linkto, FILE_IS_SYMLINK);
+/**
+ * Size of the sections of disk entries in the content file.
+ */
+#define CONTENT_SECTION_SIZE (4 * MEBI)
 
-			/* insert the link in the link containers */
-			tommy_hashdyn_insert(&disk->linkset, &slink->nodeset, slink, link_name_hash(slink->sub));
-			tommy_list_insert_tail(&disk->linklist, &slink->nodelist, slink);
+/**
+ * Max size of the data of a disk waiting to be decoded.
+ * When reached, the reading of the content file waits for the decoding.
+ */
+#define CONTENT_SECTION_PENDING (64 * MEBI)
 
-			/* stat */
-			++count_symlink;
-		} else if (c == 'a') {
-			/* hardlink */
-			char sub[PATH_MAX];
-			char linkto[PATH_MAX];
-			struct snapraid_link* slink;
-			struct snapraid_disk* disk;
+/**
+ * Section of the content file waiting to be decoded.
+ */
+struct state_read_section {
+	unsigned char* data; /**< Data of the section, including the final CRC. */
+	unsigned size; /**< Size of the data. */
+	int64_t offset; /**< Offset of the data in the content file. */
+	tommy_node node;
+};
+
+/**
+ * Decoder of the sections of a disk.
+ *
+ * All the sections of a disk are decoded in order by the same thread,
+ * and different disks are decoded concurrently.
+ */
+struct state_read_thread_context {
+	struct snapraid_state* state;
+	const char* path;
+	struct snapraid_disk* disk;
+	uint32_t mapping;
+	block_off_t blockmax;
+#if HAVE_PTHREAD
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	tommy_list list; /**< Sections waiting to be decoded. */
+	size_t pending; /**< Size of the sections waiting to be decoded. */
+	int running; /**< If the thread was started. */
+	int done; /**< If no more sections are coming. */
+#endif
+	struct state_read_count count;
+};
+
+/**
+ * Decode a section of the content file.
+ */
+static void state_read_section(struct state_read_thread_context* context, unsigned char* data, unsigned size, int64_t offset)
+{
+	const char* path = context->path;
+	STREAM* f;
+	uint32_t crc_stored;
+	uint32_t crc_computed;
+	int64_t end;
+
+	/* check the crc before decoding anything */
+	crc_stored = data[size - 4] | (uint32_t)data[size - 3] << 8 | (uint32_t)data[size - 2] << 16 | (uint32_t)data[size - 1] << 24;
+	crc_computed = crc32c(0, data, size - 4);
+	if (crc_stored != crc_computed) {
+		/* LCOV_EXCL_START */
+		log_fatal("Mismatching CRC in '%s' for the section at offset %" PRIi64 "\n", path, offset);
+		log_fatal("This content file is damaged! Use an alternate copy.\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* the stream takes the ownership of the data */
+	f = sopen_mem_read(data, size, offset);
+
+	end = offset + size - 4;
+	while (stell(f) < end) {
+		uint32_t mapping;
+		int c;
+		int ret;
+
+		c = sgetc(f);
+
+		/* all the entries in the section must be of the same disk */
+		ret = sgetb32(f, &mapping);
+		if (ret < 0 || mapping != context->mapping) {
+			/* LCOV_EXCL_START */
+			decoding_error(path, f);
+			log_fatal("Internal inconsistency in section mapping index!\n");
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		state_read_entry(context->state, path, f, c, context->disk, context->blockmax, &context->count);
+	}
+
+	if (stell(f) != end) {
+		/* LCOV_EXCL_START */
+		decoding_error(path, f);
+		log_fatal("Internal inconsistency in section size!\n");
+		os_abort();
+		/* LCOV_EXCL_STOP */
+	}
+
+	sclose(f);
+}
+
+#if HAVE_PTHREAD
+static void* state_read_thread(void* arg)
+{
+	struct state_read_thread_context* context = arg;
+
+	thread_mutex_lock(&context->mutex);
+
+	while (1) {
+		struct state_read_section* section;
+
+		while (tommy_list_empty(&context->list) && !context->done)
+			thread_cond_wait(&context->cond, &context->mutex);
+
+		if (tommy_list_empty(&context->list))
+			break;
+
+		section = tommy_list_head(&context->list)->data;
+		tommy_list_remove_existing(&context->list, &section->node);
+
+		thread_mutex_unlock(&context->mutex);
+
+		state_read_section(context, section->data, section->size, section->offset);
+
+		thread_mutex_lock(&context->mutex);
+
+		/* wake up the reader, if waiting for free space */
+		context->pending -= section->size;
+		thread_cond_signal(&context->cond);
+
+		free(section);
+	}
+
+	thread_mutex_unlock(&context->mutex);
+
+	return 0;
+}
+#endif
+
+/**
+ * Queue a section to decode, starting the disk thread if required.
+ */
+static void state_read_section_push(struct state_read_thread_context* context, unsigned char* data, unsigned size, int64_t offset)
+{
+#if HAVE_PTHREAD
+	struct state_read_section* section;
+
+	section = malloc_nofail(sizeof(struct state_read_section));
+	section->data = data;
+	section->size = size;
+	section->offset = offset;
+
+	if (!context->running) {
+		thread_mutex_init(&context->mutex, 0);
+		thread_cond_init(&context->cond, 0);
+		tommy_list_init(&context->list);
+		context->pending = 0;
+		context->done = 0;
+		context->running = 1;
+		thread_create(&context->thread, 0, state_read_thread, context);
+	}
+
+	thread_mutex_lock(&context->mutex);
+
+	/* limit the memory used by the sections waiting to be decoded */
+	while (context->pending != 0 && context->pending + size > CONTENT_SECTION_PENDING)
+		thread_cond_wait(&context->cond, &context->mutex);
+
+	tommy_list_insert_tail(&context->list, &section->node, section);
+	context->pending += size;
+
+	thread_cond_signal_and_unlock(&context->cond, &context->mutex);
+#else
+	state_read_section(context, data, size, offset);
+#endif
+}
+
+/**
+ * Wait for the decoding of all the sections, and free the decoders.
+ */
+static void state_read_section_join(struct state_read_thread_context* context_map, unsigned context_max, struct state_read_count* count)
+{
+	unsigned i;
+
+	for (i = 0; i < context_max; ++i) {
+		struct state_read_thread_context* context = &context_map[i];
+
+#if HAVE_PTHREAD
+		if (context->running) {
+			void* retval;
+
+			thread_mutex_lock(&context->mutex);
+			context->done = 1;
+			thread_cond_signal_and_unlock(&context->cond, &context->mutex);
+
+			thread_join(context->thread, &retval);
+
+			thread_cond_destroy(&context->cond);
+			thread_mutex_destroy(&context->mutex);
+		}
+#endif
+
+		count->file += context->count.file;
+		count->hardlink += context->count.hardlink;
+		count->symlink += context->count.symlink;
+		count->dir += context->count.dir;
+		count->adjust += context->count.adjust;
+	}
+
+	free(context_map);
+}
+
+static void state_read_content(struct snapraid_state* state, const char* path, STREAM* f)
+{
+	block_off_t blockmax;
+	struct state_read_count count;
+	struct state_read_thread_context* section_map;
+	int crc_checked;
+	int has_xxh3;
+	char buffer[PATH_MAX];
+	int ret;
+	tommy_array disk_mapping;
+	uint32_t mapping_max;
+	struct stat st;
+
+	/* get the size of the file, to check the size of the sections */
+	if (fstat(shandle(f), &st) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error stating the content file '%s'. %s.\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	blockmax = 0;
+	count.file = 0;
+	count.hardlink = 0;
+	count.symlink = 0;
+	count.dir = 0;
+	count.adjust = 0;
+	section_map = 0;
+	crc_checked = 0;
+	mapping_max = 0;
+	tommy_array_init(&disk_mapping);
+
+	ret = sread(f, buffer, 12);
+	if (ret < 0) {
+		/* LCOV_EXCL_START */
+		decoding_error(path, f);
+		log_fatal("Invalid header!\n");
+		os_abort();
+		/* LCOV_EXCL_STOP */
+	}
+
+	/*
+	 * File format versions:
+	 *  - SNAPCNT1/SnapRAID 4.0 First version.
+	 *  - SNAPCNT2/SnapRAID 7.0 Adds entries 'M' and 'P', to add free_blocks support.
+	 *    The previous 'm' entry is now deprecated, but supported for importing.
+	 *    Similarly for text file, we add 'mapping' and 'parity' deprecating 'map'.
+	 *  - SNAPCNT3/SnapRAID 11.0 Adds entry 'y' for hash size.
+	 *  - SNAPCNT3/SnapRAID 11.0 Adds entry 'Q' for multi parity file.
+	 *    The previous 'P' entry is now deprecated, but supported for importing.
+	 *  - SNAPCNT4/SnapRAID 11.3 Adds entry 'S' for sections of disk entries,
+	 *    decoded concurrently for each disk, and with their own CRC.
+	 *  - SNAPCNT5/SnapRAID 11.3 Adds hash 'x' for XXH3 in entries 'c' and 'C'.
+	 *    It's written only if the XXH3 hash is present, otherwise SNAPCNT4
+	 *    is written. Both are read only by SnapRAID 11.3 and newer, but
+	 *    a version reading SNAPCNT4 without the XXH3 support reports
+	 *    SNAPCNT5 as generated by a newer version, instead of failing
+	 *    on the unknown hash.
+	 */
+	if (memcmp(buffer, "SNAPCNT1\n\3\0\0", 12) != 0
+		&& memcmp(buffer, "SNAPCNT2\n\3\0\0", 12) != 0
+		&& memcmp(buffer, "SNAPCNT3\n\3\0\0", 12) != 0
+		&& memcmp(buffer, "SNAPCNT4\n\3\0\0", 12) != 0
+		&& memcmp(buffer, "SNAPCNT5\n\3\0\0", 12) != 0
+	) {
+		/* LCOV_EXCL_START */
+		if (memcmp(buffer, "SNAPCNT", 7) != 0) {
+			decoding_error(path, f);
+			log_fatal("Invalid header!\n");
+			os_abort();
+		} else {
+			log_fatal("The content file '%s' was generated with a newer version of SnapRAID!\n", path);
+			exit(EXIT_FAILURE);
+		}
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* the XXH3 hash is allowed only from SNAPCNT5 */
+	has_xxh3 = memcmp(buffer, "SNAPCNT5", 8) == 0;
+
+	while (1) {
+		int c;
+
+		/* read the command */
+		c = sgetc(f);
+		if (c == EOF) {
+			break;
+		}
+
+		/* the following entries may depend on the disk sections, */
+		/* so wait for their decoding */
+		if (c != 'S' && section_map != 0) {
+			state_read_section_join(section_map, mapping_max, &count);
+			section_map = 0;
+		}
+
+		if (c == 'S') {
+			/* section of disk entries */
+			struct state_read_thread_context* context;
+			unsigned char* data;
 			uint32_t mapping;
+			uint32_t size;
+			int64_t offset;
 
 			ret = sgetb32(f, &mapping);
 			if (ret < 0 || mapping >= mapping_max) {
@@ -2302,53 +2671,63 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 				os_abort();
 				/* LCOV_EXCL_STOP */
 			}
-			disk = tommy_array_get(&disk_mapping, mapping);
 
-			ret = sgetbs(f, sub, sizeof(sub));
-			if (ret < 0) {
+			ret = sgetb32(f, &size);
+			if (ret < 0 || size < 4) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
+				log_fatal("Internal inconsistency in section size!\n");
 				os_abort();
 				/* LCOV_EXCL_STOP */
 			}
 
-			if (!*sub) {
+			offset = stell(f);
+
+			/* check for impossible section size to avoid to crash for a too big allocation */
+			if (size > st.st_size - offset) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
-				log_fatal("Internal inconsistency for null hardlink!\n");
+				log_fatal("Internal inconsistency in section size too big!\n");
 				os_abort();
 				/* LCOV_EXCL_STOP */
 			}
 
-			ret = sgetbs(f, linkto, sizeof(linkto));
-			if (ret < 0) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				os_abort();
-				/* LCOV_EXCL_STOP */
+			/* the disk mapping is complete at the first section */
+			if (section_map == 0) {
+				uint32_t j;
+
+				section_map = malloc_nofail(mapping_max * sizeof(struct state_read_thread_context));
+				for (j = 0; j < mapping_max; ++j) {
+					context = &section_map[j];
+					context->state = state;
+					context->path = path;
+					context->disk = tommy_array_get(&disk_mapping, j);
+					context->mapping = j;
+					context->blockmax = blockmax;
+#if HAVE_PTHREAD
+					context->running = 0;
+#endif
+					context->count.file = 0;
+					context->count.hardlink = 0;
+					context->count.symlink = 0;
+					context->count.dir = 0;
+					context->count.adjust = 0;
+				}
 			}
 
-			if (!*linkto) {
+			/* the section is read here, to compute the crc of the whole file */
+			/* and it's decoded by the thread of the disk */
+			data = malloc_nofail(size);
+			ret = sread(f, data, size);
+			if (ret < 0) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
-				log_fatal("Internal inconsistency for empty hardlink '%s'!\n", sub);
 				os_abort();
 				/* LCOV_EXCL_STOP */
 			}
 
-			/* allocate the link as hard link */
-			slink = link_alloc(sub, linkto, FILE_IS_HARDLINK);
-
-			/* insert the link in the link containers */
-			tommy_hashdyn_insert(&disk->linkset, &slink->nodeset, slink, link_name_hash(slink->sub));
-			tommy_list_insert_tail(&disk->linklist, &slink->nodelist, slink);
-
-			/* stat */
-			++count_hardlink;
-		} else if (c == 'r') {
-			/* dir */
-			char sub[PATH_MAX];
-			struct snapraid_dir* dir;
+			state_read_section_push(&section_map[mapping], data, size, offset);
+		} else if (c == 'f' || c == 'h' || c == 's' || c == 'a' || c == 'r') {
 			struct snapraid_disk* disk;
 			uint32_t mapping;
 
@@ -2362,7 +2741,14 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 			}
 			disk = tommy_array_get(&disk_mapping, mapping);
 
-			ret = sgetbs(f, sub, sizeof(sub));
+			state_read_entry(state, path, f, c, disk, blockmax, &count);
+		} else if (c == 'i') {
+			/* "inf" command */
+			snapraid_info info;
+			uint32_t v_pos;
+			uint32_t v_oldest;
+
+			ret = sgetb32(f, &v_oldest);
 			if (ret < 0) {
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
@@ -2370,40 +2756,120 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 				/* LCOV_EXCL_STOP */
 			}
 
-			if (!*sub) {
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Internal inconsistency for null dir!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
-			}
+			v_pos = 0;
+			while (v_pos < blockmax) {
+				int bad;
+				int rehash;
+				int justsynced;
+				uint32_t t;
+				uint32_t flag;
+				uint32_t v_count;
 
-			/* allocate the dir */
-			dir = dir_alloc(sub);
+				ret = sgetb32(f, &v_count);
+				if (ret < 0) {
+					/* LCOV_EXCL_START */
+					decoding_error(path, f);
+					os_abort();
+					/* LCOV_EXCL_STOP */
+				}
 
-			/* insert the dir in the dir containers */
-			tommy_hashdyn_insert(&disk->dirset, &dir->nodeset, dir, dir_name_hash(dir->sub));
-			tommy_list_insert_tail(&disk->dirlist, &dir->nodelist, dir);
+				if (v_pos + v_count > blockmax) {
+					/* LCOV_EXCL_START */
+					decoding_error(path, f);
+					log_fatal("Internal inconsistency in info size %u/%u!\n", blockmax, v_pos + v_count);
+					os_abort();
+					/* LCOV_EXCL_STOP */
+				}
 
-			/* stat */
-			++count_dir;
-		} else if (c == 'c') {
-			/* get the subcommand */
-			c = sgetc(f);
+				ret = sgetb32(f, &flag);
+				if (ret < 0) {
+					/* LCOV_EXCL_START */
+					decoding_error(path, f);
+					os_abort();
+					/* LCOV_EXCL_STOP */
+				}
 
-			switch (c) {
-			case 'u' :
-				state->hash = HASH_MURMUR3;
-				break;
-			case 'k' :
-				state->hash = HASH_SPOOKY2;
-				break;
-			default :
-				/* LCOV_EXCL_START */
-				decoding_error(path, f);
-				log_fatal("Invalid checksum!\n");
-				os_abort();
-				/* LCOV_EXCL_STOP */
+				/* if there is an info */
+				if ((flag & 1) != 0) {
+					/* read the time */
+					ret = sgetb32(f, &t);
+					if (ret < 0) {
+						/* LCOV_EXCL_START */
+						decoding_error(path, f);
+						os_abort();
+						/* LCOV_EXCL_STOP */
+					}
+
+					/* analyze the flags */
+					bad = (flag & 2) != 0;
+					rehash = (flag & 4) != 0;
+					justsynced = (flag & 8) != 0;
+
+					if (rehash && state->prevhash == HASH_UNDEFINED) {
+						/* LCOV_EXCL_START */
+						decoding_error(path, f);
+						log_fatal("Internal inconsistency for missing previous checksum!\n");
+						os_abort();
+						/* LCOV_EXCL_STOP */
+					}
+
+					info = info_make(t + v_oldest, bad, rehash, justsynced);
+				} else {
+					info = 0;
+				}
+
+				/* infos are used only with the extents */
+				if (state->opt.skip_load_extent) {
+					v_pos += v_count;
+					continue;
+				}
+
+				while (v_count) {
+					/* insert the info in the array */
+					info_set(&state->infoarr, v_pos, info);
+
+					/* ensure that an info is present only for used positions */
+					if (fs_info_is_required(state, v_pos)) {
+						if (!info) {
+							/* LCOV_EXCL_START */
+							decoding_error(path, f);
+							log_fatal("Internal inconsistency for missing info!\n");
+							os_abort();
+							/* LCOV_EXCL_STOP */
+						}
+					} else {
+						/* extra info are accepted for backward compatibility */
+						/* they are discarded at the first write */
+					}
+
+					/* go to next block */
+					++v_pos;
+					--v_count;
+				}
+			}
+		} else if (c == 'c') {
+			/* get the subcommand */
+			c = sgetc(f);
+
+			switch (c) {
+			case 'u' :
+				state->hash = HASH_MURMUR3;
+				break;
+			case 'k' :
+				state->hash = HASH_SPOOKY2;
+				break;
+			case 'x' :
+				if (has_xxh3) {
+					state->hash = HASH_XXH3;
+					break;
+				}
+				/* fallthrough */
+			default :
+				/* LCOV_EXCL_START */
+				decoding_error(path, f);
+				log_fatal("Invalid checksum!\n");
+				os_abort();
+				/* LCOV_EXCL_STOP */
 			}
 
 			/* read the seed */
@@ -2425,6 +2891,12 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 			case 'k' :
 				state->prevhash = HASH_SPOOKY2;
 				break;
+			case 'x' :
+				if (has_xxh3) {
+					state->prevhash = HASH_XXH3;
+					break;
+				}
+				/* fallthrough */
 			default :
 				/* LCOV_EXCL_START */
 				decoding_error(path, f);
@@ -2815,6 +3287,9 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 				/* LCOV_EXCL_STOP */
 			}
 
+			/* the journal refers at this crc */
+			state->journal_content_crc = crc_stored;
+
 			crc_checked = 1;
 		} else {
 			/* LCOV_EXCL_START */
@@ -2825,6 +3300,9 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 		}
 	}
 
+	if (section_map != 0)
+		state_read_section_join(section_map, mapping_max, &count);
+
 	tommy_array_done(&disk_mapping);
 
 	if (serror(f)) {
@@ -2842,26 +3320,79 @@ static void state_read_content(struct snapraid_state* state, const char* path, S
 		/* LCOV_EXCL_STOP */
 	}
 
-	/* check the file-system on all disks */
-	state_fscheck(state, "after read");
+	/* without the extents there is nothing more to check */
+	if (!state->opt.skip_load_extent) {
+		/* check the file-system on all disks */
+		state_fscheck(state, "after read");
 
-	/* check that the stored parity size matches the loaded state */
-	if (blockmax != parity_allocated_size(state)) {
-		/* LCOV_EXCL_START */
-		log_fatal("Internal inconsistency in parity size %u/%u in '%s' at offset %" PRIi64 "\n", blockmax, parity_allocated_size(state), path, stell(f));
-		if (state->opt.skip_content_check) {
-			log_fatal("Overriding.\n");
-			blockmax = parity_allocated_size(state);
-		} else {
-			exit(EXIT_FAILURE);
+		/* check that the stored parity size matches the loaded state */
+		if (blockmax != parity_allocated_size(state)) {
+			/* LCOV_EXCL_START */
+			log_fatal("Internal inconsistency in parity size %u/%u in '%s' at offset %" PRIi64 "\n", blockmax, parity_allocated_size(state), path, stell(f));
+			if (state->opt.skip_content_check) {
+				log_fatal("Overriding.\n");
+				blockmax = parity_allocated_size(state);
+			} else {
+				exit(EXIT_FAILURE);
+			}
+			/* LCOV_EXCL_STOP */
 		}
+	}
+
+	/* the blocks changed after reading are not tracked by the journal */
+	if (count.adjust != 0)
+		state->need_write = 1;
+
+	msg_verbose("%8u files\n", count.file);
+	msg_verbose("%8u hardlinks\n", count.hardlink);
+	msg_verbose("%8u symlinks\n", count.symlink);
+	msg_verbose("%8u empty dirs\n", count.dir);
+}
+
+/**
+ * Write a section of disk entries, with its own CRC.
+ *
+ * The section is written only if not empty, and the memory stream
+ * is cleared to start a new one.
+ */
+static int state_write_section(STREAM* f, STREAM* d, uint32_t mapping)
+{
+	unsigned char* data;
+	unsigned size;
+	uint32_t crc;
+
+	data = smem(d, &size);
+	if (size == 0)
+		return 0;
+
+	crc = crc32c(0, data, size);
+
+	/* compare the crc of the data in memory */
+	/* with the one of the data written to the stream */
+	if (crc != scrc_stream(d)) {
+		/* LCOV_EXCL_START */
+		log_fatal("CRC mismatch writing the content stream.\n");
+		log_fatal("DANGER! Your RAM memory is broken! DO NOT PROCEED UNTIL FIXED!\n");
+		log_fatal("Try running a memory test like http://www.memtest86.com/\n");
+		return -1;
 		/* LCOV_EXCL_STOP */
 	}
 
-	msg_verbose("%8u files\n", count_file);
-	msg_verbose("%8u hardlinks\n", count_hardlink);
-	msg_verbose("%8u symlinks\n", count_symlink);
-	msg_verbose("%8u empty dirs\n", count_dir);
+	sputc('S', f);
+	sputb32(mapping, f);
+	sputb32(size + 4, f);
+	swrite(data, size, f);
+	sputble32(crc, f);
+	if (serror(f)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	smemreset(d);
+
+	return 0;
 }
 
 struct state_write_thread_context {
@@ -2890,6 +3421,7 @@ static void* state_write_thread(void* arg)
 	time_t info_oldest = context->info_oldest;
 	int info_has_rehash = context->info_has_rehash;
 	STREAM* f = context->f;
+	STREAM* d;
 	uint32_t crc;
 	unsigned count_file;
 	unsigned count_hardlink;
@@ -2899,27 +3431,17 @@ static void* state_write_thread(void* arg)
 	block_off_t idx;
 	block_off_t begin;
 	unsigned l, s;
-	int version;
 
 	count_file = 0;
 	count_hardlink = 0;
 	count_symlink = 0;
 	count_dir = 0;
 
-	/* check what version to use */
-	version = 2;
-	for (l = 0; l < state->level; ++l) {
-		if (state->parity[l].split_mac > 1)
-			version = 3;
-	}
-	if (BLOCK_HASH_SIZE != 16)
-		version = 3;
-
-	/* write header */
-	if (version == 3)
-		swrite("SNAPCNT3\n\3\0\0", 12, f);
+	/* write header, with the XXH3 version only if required by the hash */
+	if (state->hash == HASH_XXH3 || (info_has_rehash && state->prevhash == HASH_XXH3))
+		swrite("SNAPCNT5\n\3\0\0", 12, f);
 	else
-		swrite("SNAPCNT2\n\3\0\0", 12, f);
+		swrite("SNAPCNT4\n\3\0\0", 12, f);
 
 	/* write block size and block max */
 	sputc('z', f);
@@ -2928,10 +3450,8 @@ static void* state_write_thread(void* arg)
 	sputb32(blockmax, f);
 
 	/* hash size */
-	if (version == 3) {
-		sputc('y', f);
-		sputb32(BLOCK_HASH_SIZE, f);
-	}
+	sputc('y', f);
+	sputb32(BLOCK_HASH_SIZE, f);
 
 	if (serror(f)) {
 		/* LCOV_EXCL_START */
@@ -2945,6 +3465,8 @@ static void* state_write_thread(void* arg)
 		sputc('u', f);
 	} else if (state->hash == HASH_SPOOKY2) {
 		sputc('k', f);
+	} else if (state->hash == HASH_XXH3) {
+		sputc('x', f);
 	} else {
 		/* LCOV_EXCL_START */
 		log_fatal("Unexpected hash when writing the content file '%s'.\n", serrorfile(f));
@@ -2968,6 +3490,8 @@ static void* state_write_thread(void* arg)
 				sputc('u', f);
 			} else if (state->prevhash == HASH_SPOOKY2) {
 				sputc('k', f);
+			} else if (state->prevhash == HASH_XXH3) {
+				sputc('x', f);
 			} else {
 				/* LCOV_EXCL_START */
 				log_fatal("Unexpected prevhash when writing the content file '%s'.\n", serrorfile(f));
@@ -3017,23 +3541,15 @@ static void* state_write_thread(void* arg)
 
 	/* for each parity */
 	for (l = 0; l < state->level; ++l) {
-		if (version == 3) {
-			sputc('Q', f);
-			sputb32(l, f);
-			sputb32(state->parity[l].total_blocks, f);
-			sputb32(state->parity[l].free_blocks, f);
-			sputb32(state->parity[l].split_mac, f);
-			for (s = 0; s < state->parity[l].split_mac; ++s) {
-				sputbs(state->parity[l].split_map[s].path, f);
-				sputbs(state->parity[l].split_map[s].uuid, f);
-				sputb64(state->parity[l].split_map[s].size, f);
-			}
-		} else {
-			sputc('P', f);
-			sputb32(l, f);
-			sputb32(state->parity[l].total_blocks, f);
-			sputb32(state->parity[l].free_blocks, f);
-			sputbs(state->parity[l].split_map[0].uuid, f);
+		sputc('Q', f);
+		sputb32(l, f);
+		sputb32(state->parity[l].total_blocks, f);
+		sputb32(state->parity[l].free_blocks, f);
+		sputb32(state->parity[l].split_mac, f);
+		for (s = 0; s < state->parity[l].split_mac; ++s) {
+			sputbs(state->parity[l].split_map[s].path, f);
+			sputbs(state->parity[l].split_map[s].uuid, f);
+			sputb64(state->parity[l].split_map[s].size, f);
 		}
 		if (serror(f)) {
 			/* LCOV_EXCL_START */
@@ -3043,7 +3559,9 @@ static void* state_write_thread(void* arg)
 		}
 	}
 
-	/* for each disk */
+	/* for each disk, write its entries in separated sections */
+	/* that can be decoded concurrently */
+	d = sopen_mem_write();
 	for (i = state->disklist; i != 0; i = i->next) {
 		tommy_node* j;
 		struct snapraid_disk* disk = i->data;
@@ -3065,23 +3583,17 @@ static void* state_write_thread(void* arg)
 			mtime_nsec = file->mtime_nsec;
 			inode = file->inode;
 
-			sputc('f', f);
-			sputb32(disk->mapping_idx, f);
-			sputb64(size, f);
-			sputb64(mtime_sec, f);
+			sputc('f', d);
+			sputb32(disk->mapping_idx, d);
+			sputb64(size, d);
+			sputb64(mtime_sec, d);
 			/* encode STAT_NSEC_INVALID as 0 */
 			if (mtime_nsec == STAT_NSEC_INVALID)
-				sputb32(0, f);
+				sputb32(0, d);
 			else
-				sputb32(mtime_nsec + 1, f);
-			sputb64(inode, f);
-			sputbs(file->sub, f);
-			if (serror(f)) {
-				/* LCOV_EXCL_START */
-				log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
-				return context;
-				/* LCOV_EXCL_STOP */
-			}
+				sputb32(mtime_nsec + 1, d);
+			sputb64(inode, d);
+			sputbs(file->sub, d);
 
 			/* for all the blocks of the file */
 			begin = 0;
@@ -3104,13 +3616,13 @@ static void* state_write_thread(void* arg)
 
 				switch (v_state) {
 				case BLOCK_STATE_BLK :
-					sputc('b', f);
+					sputc('b', d);
 					break;
 				case BLOCK_STATE_CHG :
-					sputc('g', f);
+					sputc('g', d);
 					break;
 				case BLOCK_STATE_REP :
-					sputc('p', f);
+					sputc('p', d);
 					break;
 				default :
 					/* LCOV_EXCL_START */
@@ -3119,23 +3631,16 @@ static void* state_write_thread(void* arg)
 					/* LCOV_EXCL_STOP */
 				}
 
-				sputb32(v_pos, f);
+				sputb32(v_pos, d);
 
 				v_count = end - begin;
-				sputb32(v_count, f);
+				sputb32(v_count, d);
 
 				/* write hashes */
 				for (idx = begin; idx < end; ++idx) {
 					struct snapraid_block* block = fs_file2block_get(file, idx);
 
-					swrite(block->hash, BLOCK_HASH_SIZE, f);
-				}
-
-				if (serror(f)) {
-					/* LCOV_EXCL_START */
-					log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
-					return context;
-					/* LCOV_EXCL_STOP */
+					swrite(block->hash, BLOCK_HASH_SIZE, d);
 				}
 
 				/* next begin position */
@@ -3143,6 +3648,10 @@ static void* state_write_thread(void* arg)
 			}
 
 			++count_file;
+
+			/* split the disk entries in sections of limited size */
+			if (stell(d) >= CONTENT_SECTION_SIZE && state_write_section(f, d, disk->mapping_idx) != 0)
+				return context;
 		}
 
 		/* for each link */
@@ -3151,52 +3660,42 @@ static void* state_write_thread(void* arg)
 
 			switch (link_flag_get(slink, FILE_IS_LINK_MASK)) {
 			case FILE_IS_HARDLINK :
-				sputc('a', f);
+				sputc('a', d);
 				++count_hardlink;
 				break;
 			case FILE_IS_SYMLINK :
-				sputc('s', f);
+				sputc('s', d);
 				++count_symlink;
 				break;
 			}
 
-			sputb32(disk->mapping_idx, f);
-			sputbs(slink->sub, f);
-			sputbs(slink->linkto, f);
-			if (serror(f)) {
-				/* LCOV_EXCL_START */
-				log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
+			sputb32(disk->mapping_idx, d);
+			sputbs(slink->sub, d);
+			sputbs(slink->linkto, d);
+
+			/* split the disk entries in sections of limited size */
+			if (stell(d) >= CONTENT_SECTION_SIZE && state_write_section(f, d, disk->mapping_idx) != 0)
 				return context;
-				/* LCOV_EXCL_STOP */
-			}
 		}
 
 		/* for each dir */
 		for (j = disk->dirlist; j != 0; j = j->next) {
 			struct snapraid_dir* dir = j->data;
 
-			sputc('r', f);
-			sputb32(disk->mapping_idx, f);
-			sputbs(dir->sub, f);
-			if (serror(f)) {
-				/* LCOV_EXCL_START */
-				log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
-				return context;
-				/* LCOV_EXCL_STOP */
-			}
+			sputc('r', d);
+			sputb32(disk->mapping_idx, d);
+			sputbs(dir->sub, d);
 
 			++count_dir;
+
+			/* split the disk entries in sections of limited size */
+			if (stell(d) >= CONTENT_SECTION_SIZE && state_write_section(f, d, disk->mapping_idx) != 0)
+				return context;
 		}
 
 		/* deleted blocks of the disk */
-		sputc('h', f);
-		sputb32(disk->mapping_idx, f);
-		if (serror(f)) {
-			/* LCOV_EXCL_START */
-			log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
-			return context;
-			/* LCOV_EXCL_STOP */
-		}
+		sputc('h', d);
+		sputb32(disk->mapping_idx, d);
 		begin = 0;
 		while (begin < blockmax) {
 			int is_deleted;
@@ -3212,38 +3711,37 @@ static void* state_write_thread(void* arg)
 				++end;
 			}
 
-			sputb32(end - begin, f);
+			sputb32(end - begin, d);
 
 			if (is_deleted) {
 				/* write the run of deleted blocks with hash */
-				sputc('o', f);
+				sputc('o', d);
 
 				/* write all the hash */
 				while (begin < end) {
 					struct snapraid_block* block = fs_par2block_get(disk, begin);
 
-					swrite(block->hash, BLOCK_HASH_SIZE, f);
+					swrite(block->hash, BLOCK_HASH_SIZE, d);
 
 					++begin;
 				}
 			} else {
 				/* write the run of blocks without hash */
 				/* they can be either used or empty blocks */
-				sputc('O', f);
+				sputc('O', d);
 
 				/* next begin position */
 				begin = end;
 			}
-
-			if (serror(f)) {
-				/* LCOV_EXCL_START */
-				log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
-				return context;
-				/* LCOV_EXCL_STOP */
-			}
 		}
+
+		/* write the last section of the disk */
+		if (state_write_section(f, d, disk->mapping_idx) != 0)
+			return context;
 	}
 
+	sclose(d);
+
 	/* write the info for each block */
 	sputc('i', f);
 	sputb32(info_oldest, f);
@@ -3278,226 +3776,1030 @@ static void* state_write_thread(void* arg)
 				flag |= 8;
 			sputb32(flag, f);
 
-			t = info_get_time(info) - info_oldest;
-			sputb32(t, f);
-		} else {
-			/* write a special 0 flag to mark missing info */
-			sputb32(0, f);
-		}
+			t = info_get_time(info) - info_oldest;
+			sputb32(t, f);
+		} else {
+			/* write a special 0 flag to mark missing info */
+			sputb32(0, f);
+		}
+
+		if (serror(f)) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
+			return context;
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* next begin position */
+		begin = end;
+	}
+
+	sputc('N', f);
+
+	/* flush data written to the disk */
+	if (sflush(f)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the content file '%s' (in flush before crc). %s.\n", serrorfile(f), strerror(errno));
+		return context;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* get the file crc */
+	crc = scrc(f);
+
+	/* compare the crc of the data written to file */
+	/* with the one of the data written to the stream */
+	if (crc != scrc_stream(f)) {
+		/* LCOV_EXCL_START */
+		log_fatal("CRC mismatch writing the content stream.\n");
+		log_fatal("DANGER! Your RAM memory is broken! DO NOT PROCEED UNTIL FIXED!\n");
+		log_fatal("Try running a memory test like http://www.memtest86.com/\n");
+		return context;
+		/* LCOV_EXCL_STOP */
+	}
+
+	sputble32(crc, f);
+	if (serror(f)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
+		return context;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* set output variables */
+	context->crc = crc;
+	context->count_file = count_file;
+	context->count_hardlink = count_hardlink;
+	context->count_symlink = count_symlink;
+	context->count_dir = count_dir;
+
+	return 0;
+}
+
+static void state_write_content(struct snapraid_state* state, uint32_t* out_crc)
+{
+#if HAVE_MT_WRITE
+	int fail;
+	int first;
+#else
+	STREAM* f;
+	unsigned count_content;
+	unsigned k;
+	struct state_write_thread_context* context;
+	void* retval;
+#endif
+	tommy_node* i;
+	block_off_t blockmax;
+	time_t info_oldest;
+	int info_has_rehash;
+	int mapping_idx;
+	block_off_t idx;
+	uint32_t crc;
+	unsigned count_file;
+	unsigned count_hardlink;
+	unsigned count_symlink;
+	unsigned count_dir;
+
+	/* a partially loaded state cannot be saved */
+	if (state_load_partial(state)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Internal inconsistency in saving a partially loaded state\n");
+		os_abort();
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* blocks of all array */
+	blockmax = parity_allocated_size(state);
+
+	/* check the file-system on all disks */
+	state_fscheck(state, "before write");
+
+	/* clear the info for unused blocks */
+	/* and get some other info */
+	info_oldest = 0; /* oldest time in info */
+	info_has_rehash = 0; /* if there is a rehash info */
+	for (idx = 0; idx < blockmax; ++idx) {
+		/* if the position is used */
+		if (fs_position_is_required(state, idx)) {
+			snapraid_info info = info_get(&state->infoarr, idx);
+
+			/* only if there is some info to store */
+			if (info) {
+				time_t info_time = info_get_time(info);
+
+				if (!info_oldest || info_time < info_oldest)
+					info_oldest = info_time;
+
+				if (info_get_rehash(info))
+					info_has_rehash = 1;
+			}
+		} else {
+			/* clear any previous info */
+			info_set(&state->infoarr, idx, 0);
+
+			/* and clear any deleted blocks */
+			fs_position_clear_deleted(state, idx);
+		}
+	}
+
+	/* map disks */
+	mapping_idx = 0;
+	for (i = state->maplist; i != 0; i = i->next) {
+		struct snapraid_map* map = i->data;
+		struct snapraid_disk* disk;
+
+		/* find the disk for this mapping */
+		disk = find_disk_by_name(state, map->name);
+		if (!disk) {
+			/* LCOV_EXCL_START */
+			log_fatal("Internal inconsistency for unmapped disk '%s'\n", map->name);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* save the mapping only for not empty disks */
+		if (!fs_is_empty(disk, blockmax)) {
+			/* assign the mapping index used to identify disks */
+			disk->mapping_idx = mapping_idx;
+			++mapping_idx;
+		} else {
+			/* mark the disk as without mapping */
+			disk->mapping_idx = -1;
+		}
+	}
+
+#if HAVE_MT_WRITE
+	/* start all writing threads */
+	i = tommy_list_head(&state->contentlist);
+	while (i) {
+		struct snapraid_content* content = i->data;
+		struct state_write_thread_context* context;
+		char tmp[PATH_MAX];
+		STREAM* f;
+
+		msg_progress("Saving state to %s...\n", content->content);
+
+		pathprint(tmp, sizeof(tmp), "%s.tmp", content->content);
+		f = sopen_write(tmp);
+		if (f == 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error opening the content file '%s'. %s.\n", tmp, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* allocate the thread context */
+		context = malloc_nofail(sizeof(struct state_write_thread_context));
+		content->context = context;
+
+		/* initialize */
+		context->state = state;
+		context->blockmax = blockmax;
+		context->info_oldest = info_oldest;
+		context->info_has_rehash = info_has_rehash;
+		context->f = f;
+
+		thread_create(&context->thread, 0, state_write_thread, context);
+
+		i = i->next;
+	}
+
+	/* join all thread */
+	fail = 0;
+	first = 1;
+	crc = 0;
+	count_file = 0;
+	count_hardlink = 0;
+	count_symlink = 0;
+	count_dir = 0;
+	i = tommy_list_head(&state->contentlist);
+	while (i) {
+		struct snapraid_content* content = i->data;
+		struct state_write_thread_context* context = content->context;
+		void* retval;
+
+		thread_join(context->thread, &retval);
+
+		if (retval) {
+			/* LCOV_EXCL_START */
+			fail = 1;
+			/* LCOV_EXCL_STOP */
+		} else {
+			STREAM* f = context->f;
+
+			/* Use the sequence fflush() -> fsync() -> fclose() -> rename() to ensure */
+			/* than even in a system crash event we have one valid copy of the file. */
+			if (sflush(f) != 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error writing the content file '%s', in flush(). %s.\n", serrorfile(f), strerror(errno));
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+#if HAVE_FSYNC
+			if (ssync(f) != 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error writing the content file '%s' in sync(). %s.\n", serrorfile(f), strerror(errno));
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+#endif
+
+			if (sclose(f) != 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error closing the content file. %s.\n", strerror(errno));
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			if (first) {
+				first = 0;
+				crc = context->crc;
+				count_file = context->count_file;
+				count_hardlink = context->count_hardlink;
+				count_symlink = context->count_symlink;
+				count_dir = context->count_dir;
+			} else {
+				if (crc != context->crc) {
+					/* LCOV_EXCL_START */
+					log_fatal("Different CRCs writing content streams.\n");
+					log_fatal("DANGER! Your RAM memory is broken! DO NOT PROCEED UNTIL FIXED!\n");
+					log_fatal("Try running a memory test like http://www.memtest86.com/\n");
+					exit(EXIT_FAILURE);
+					/* LCOV_EXCL_STOP */
+				}
+			}
+		}
+
+		free(context);
+
+		i = i->next;
+	}
+
+	/* abort on failure */
+	if (fail) {
+		/* LCOV_EXCL_START */
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+#else
+	/* count the content files */
+	count_content = 0;
+	i = tommy_list_head(&state->contentlist);
+	while (i) {
+		struct snapraid_content* content = i->data;
+		msg_progress("Saving state to %s...\n", content->content);
+		++count_content;
+		i = i->next;
+	}
+
+	/* open all the content files */
+	f = sopen_multi_write(count_content);
+	if (!f) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error opening the content files.\n");
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	k = 0;
+	i = tommy_list_head(&state->contentlist);
+	while (i) {
+		struct snapraid_content* content = i->data;
+		char tmp[PATH_MAX];
+		pathprint(tmp, sizeof(tmp), "%s.tmp", content->content);
+		if (sopen_multi_file(f, k, tmp) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error opening the content file '%s'. %s.\n", tmp, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		++k;
+		i = i->next;
+	}
+
+	/* allocate the thread context */
+	context = malloc_nofail(sizeof(struct state_write_thread_context));
+
+	/* initialize */
+	context->state = state;
+	context->blockmax = blockmax;
+	context->info_oldest = info_oldest;
+	context->info_has_rehash = info_has_rehash;
+	context->f = f;
+
+	retval = state_write_thread(context);
+
+	/* abort on failure */
+	if (retval) {
+		/* LCOV_EXCL_START */
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* Use the sequence fflush() -> fsync() -> fclose() -> rename() to ensure */
+	/* than even in a system crash event we have one valid copy of the file. */
+	if (sflush(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the content file '%s', in flush(). %s.\n", serrorfile(f), strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+#if HAVE_FSYNC
+	if (ssync(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the content file '%s' in sync(). %s.\n", serrorfile(f), strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+#endif
+
+	if (sclose(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error closing the content file. %s.\n", strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	crc = context->crc;
+	count_file = context->count_file;
+	count_hardlink = context->count_hardlink;
+	count_symlink = context->count_symlink;
+	count_dir = context->count_dir;
+
+	free(context);
+#endif
+
+	msg_verbose("%8u files\n", count_file);
+	msg_verbose("%8u hardlinks\n", count_hardlink);
+	msg_verbose("%8u symlinks\n", count_symlink);
+	msg_verbose("%8u empty dirs\n", count_dir);
+
+	*out_crc = crc;
+}
+
+/**
+ * Journal file format.
+ *
+ * The journal starts with the header "SNAPJNL1\n\3\0\0", followed by the 'J'
+ * command with the CRC of the content file it refers to.
+ * Then it contains a sequence of segments, one for each save, with the format:
+ *
+ * 'S' seq blockmax diskmax [disk name]... count
+ * [pos [kind [hash]]... flag [time]]...
+ * 'N' crc
+ *
+ * Where kind is 'b', 'g', 'p' for BLK, CHG, REP blocks, 'o' for DELETED blocks,
+ * and 'O' for EMPTY blocks. The info flag has the same meaning of the 'i' command
+ * of the content file, and the time is absolute.
+ * The CRC is the one of the whole journal file up to the 'N' command.
+ */
+
+/**
+ * Apply a block read from the journal.
+ */
+static void state_journal_apply(struct snapraid_state* state, const char* path, struct snapraid_disk* disk, block_off_t pos, int c, const unsigned char* hash)
+{
+	struct snapraid_block* block = fs_par2block_find(disk, pos);
+	unsigned block_state = block_state_get(block);
+
+	if (c == 'O') {
+		/* a deleted block removed from the parity */
+		if (block_state == BLOCK_STATE_DELETED) {
+			fs_deallocate(disk, pos);
+		} else if (block_state != BLOCK_STATE_EMPTY) {
+			/* LCOV_EXCL_START */
+			log_fatal("Internal inconsistency in journal '%s' for empty block %u in disk '%s'!\n", path, pos, disk->name);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+		return;
+	}
+
+	if (c == 'o') {
+		if (block_state != BLOCK_STATE_DELETED) {
+			/* LCOV_EXCL_START */
+			log_fatal("Internal inconsistency in journal '%s' for deleted block %u in disk '%s'!\n", path, pos, disk->name);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+	} else {
+		if (!block_has_file(block)) {
+			/* LCOV_EXCL_START */
+			log_fatal("Internal inconsistency in journal '%s' for file block %u in disk '%s'!\n", path, pos, disk->name);
+			os_abort();
+			/* LCOV_EXCL_STOP */
+		}
+
+		switch (c) {
+		case 'b' : block_state_set(block, BLOCK_STATE_BLK); break;
+		case 'g' : block_state_set(block, BLOCK_STATE_CHG); break;
+		case 'p' : block_state_set(block, BLOCK_STATE_REP); break;
+		}
+	}
+
+	memcpy(block->hash, hash, BLOCK_HASH_SIZE);
+
+	/* adjust the block for the running command */
+	/* the changes are not tracked by the journal */
+	if (block_read_adjust(state, block))
+		state->need_write = 1;
+}
+
+/**
+ * Read a segment of the journal.
+ * If apply is 0, the segment is only checked.
+ * Return 0 on success, or -1 if the segment is truncated or damaged.
+ */
+static int state_journal_segment(struct snapraid_state* state, const char* path, STREAM* f, unsigned seq, block_off_t blockmax, int apply)
+{
+	struct snapraid_disk** disk_map;
+	unsigned char hash[HASH_MAX];
+	char name[PATH_MAX];
+	uint32_t v_seq;
+	uint32_t v_blockmax;
+	uint32_t v_diskmax;
+	uint32_t v_count;
+	uint32_t crc_stored;
+	uint32_t crc_computed;
+	unsigned j;
+	int c;
+
+	c = sgetc(f);
+	if (c != 'S')
+		return -1;
+
+	if (sgetb32(f, &v_seq) < 0 || v_seq != seq)
+		return -1;
+	if (sgetb32(f, &v_blockmax) < 0 || v_blockmax != blockmax)
+		return -1;
+	if (sgetb32(f, &v_diskmax) < 0 || v_diskmax > tommy_list_count(&state->disklist))
+		return -1;
+
+	disk_map = malloc_nofail((v_diskmax + 1) * sizeof(struct snapraid_disk*));
+
+	for (j = 0; j < v_diskmax; ++j) {
+		if (sgetbs(f, name, sizeof(name)) < 0)
+			goto bail;
+
+		disk_map[j] = find_disk_by_name(state, name);
+		if (!disk_map[j])
+			goto bail;
+	}
+
+	if (sgetb32(f, &v_count) < 0)
+		goto bail;
+
+	while (v_count) {
+		uint32_t v_pos;
+		uint32_t flag;
+		uint32_t t;
+
+		if (sgetb32(f, &v_pos) < 0 || v_pos >= blockmax)
+			goto bail;
+
+		for (j = 0; j < v_diskmax; ++j) {
+			c = sgetc(f);
+			switch (c) {
+			case 'b' :
+			case 'g' :
+			case 'p' :
+			case 'o' :
+				if (sread(f, hash, BLOCK_HASH_SIZE) < 0)
+					goto bail;
+				break;
+			case 'O' :
+				break;
+			default :
+				goto bail;
+			}
+
+			if (apply)
+				state_journal_apply(state, path, disk_map[j], v_pos, c, hash);
+		}
+
+		if (sgetb32(f, &flag) < 0)
+			goto bail;
+
+		t = 0;
+		if ((flag & 1) != 0) {
+			if (sgetb32(f, &t) < 0)
+				goto bail;
+		}
+
+		if (apply) {
+			snapraid_info info = 0;
+
+			if ((flag & 1) != 0)
+				info = info_make(t, (flag & 2) != 0, (flag & 4) != 0, (flag & 8) != 0);
+
+			info_set(&state->infoarr, v_pos, info);
+		}
+
+		--v_count;
+	}
+
+	c = sgetc(f);
+	if (c != 'N')
+		goto bail;
+
+	/* get the crc before reading it from the file */
+	crc_computed = scrc(f);
+
+	if (sgetble32(f, &crc_stored) < 0 || crc_stored != crc_computed)
+		goto bail;
+
+	free(disk_map);
+	return 0;
+
+bail:
+	free(disk_map);
+	return -1;
+}
+
+/**
+ * Open the journal and read its header.
+ * Return 0 if not present or not matching the content file.
+ */
+static STREAM* state_journal_open(struct snapraid_state* state, const char* path)
+{
+	char buffer[12];
+	uint32_t crc;
+	STREAM* f;
+
+	f = sopen_read(path);
+	if (!f) {
+		if (errno != ENOENT) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error opening the journal file '%s'. %s.\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		return 0;
+	}
+
+	if (sread(f, buffer, 12) < 0
+		|| memcmp(buffer, "SNAPJNL1\n\3\0\0", 12) != 0
+		|| sgetc(f) != 'J'
+		|| sgetb32(f, &crc) < 0
+	) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Invalid journal file '%s'. Ignoring it.\n", path);
+		sclose(f);
+
+		/* ensure to overwrite it */
+		state->need_write = 1;
+		return 0;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* if the journal refers at another content file, it's a leftover */
+	/* of an interrupted write of the full content file */
+	if (crc != state->journal_content_crc) {
+		/* LCOV_EXCL_START */
+		log_fatal("WARNING! Journal file '%s' is not related to the content file. Ignoring it.\n", path);
+		sclose(f);
+
+		/* ensure to overwrite it */
+		state->need_write = 1;
+		return 0;
+		/* LCOV_EXCL_STOP */
+	}
+
+	return f;
+}
+
+/**
+ * Read and apply the journal of the content file.
+ */
+static void state_journal_read(struct snapraid_state* state, const char* content)
+{
+	char path[PATH_MAX];
+	block_off_t blockmax;
+	unsigned count;
+	unsigned i;
+	int64_t size;
+	uint32_t crc;
+	STREAM* f;
+
+	state->journal_size = 0;
+	state->journal_crc = 0;
+	state->journal_count = 0;
+
+	pathprint(path, sizeof(path), "%s.journal", content);
+
+	f = state_journal_open(state, path);
+	if (!f)
+		return;
+
+	blockmax = parity_allocated_size(state);
+
+	/* check all the segments, and stop at the first damaged one */
+	/* that happens if a save was interrupted */
+	count = 0;
+	size = stell(f);
+	crc = scrc(f);
+	while (1) {
+		int c = sgetc(f);
+		if (c == EOF)
+			break;
+		sungetc(c, f);
+
+		if (state_journal_segment(state, path, f, count, blockmax, 0) != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("WARNING! Truncated journal file '%s' at offset %" PRIi64 ". Ignoring the last save.\n", path, size);
+
+			/* ensure to rewrite all the content files */
+			state->need_write = 1;
+			break;
+			/* LCOV_EXCL_STOP */
+		}
+
+		++count;
+		size = stell(f);
+		crc = scrc(f);
+	}
+
+	if (serror(f)) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error reading the journal file '%s' at offset %" PRIi64 "\n", path, stell(f));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	sclose(f);
+
+	/* now apply the valid segments */
+	if (count != 0) {
+		msg_progress("Loading journal from %s...\n", path);
+
+		f = state_journal_open(state, path);
+		if (!f) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error reopening the journal file '%s'. %s.\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+
+		for (i = 0; i < count; ++i) {
+			if (state_journal_segment(state, path, f, i, blockmax, 1) != 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error reading the journal file '%s' at offset %" PRIi64 "\n", path, stell(f));
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+		}
+
+		sclose(f);
+
+		/* check the file-system on all disks */
+		state_fscheck(state, "after journal");
+	}
+
+	state->journal_size = size;
+	state->journal_crc = crc;
+	state->journal_count = count;
+}
+
+/**
+ * Count the disks not empty, that are the ones stored in the content file.
+ */
+static unsigned state_journal_diskmax(struct snapraid_state* state, block_off_t blockmax)
+{
+	unsigned count;
+	tommy_node* i;
+
+	count = 0;
+	for (i = state->disklist; i != 0; i = i->next) {
+		struct snapraid_disk* disk = i->data;
+
+		if (!fs_is_empty(disk, blockmax))
+			++count;
+	}
+
+	return count;
+}
+
+/**
+ * Get the size of the journal of a content file.
+ * Return 0 if not present.
+ */
+static data_off_t state_journal_size(const char* content)
+{
+	char path[PATH_MAX];
+	struct stat st;
+
+	pathprint(path, sizeof(path), "%s.journal", content);
+
+	if (stat(path, &st) != 0) {
+		if (errno != ENOENT) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error stating the journal file '%s'. %s.\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		return 0;
+	}
+
+	return st.st_size;
+}
+
+void state_read(struct snapraid_state* state)
+{
+	STREAM* f;
+	char path[PATH_MAX];
+	struct stat st;
+	data_off_t journal_size;
+	tommy_node* node;
+	int ret;
+	int c;
+
+	/* iterate over all the available content files and load the first one present */
+	f = 0;
+	node = tommy_list_head(&state->contentlist);
+	while (node) {
+		struct snapraid_content* content = node->data;
+		pathcpy(path, sizeof(path), content->content);
+
+		if (!state->no_conf) {
+			log_tag("content:%s\n", path);
+			log_flush();
+		}
+		msg_progress("Loading state from %s...\n", path);
+
+		f = sopen_read(path);
+		if (f != 0) {
+			/* if opened stop the search */
+			break;
+		} else {
+			/* if it's real error of an existing file, abort */
+			if (errno != ENOENT) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error opening the content file '%s'. %s.\n", path, strerror(errno));
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			/* otherwise continue */
+			if (node->next) {
+				log_fatal("WARNING! Content file '%s' not found, trying with another copy...\n", path);
+
+				/* ensure to rewrite all the content files */
+				state->need_write = 1;
+			}
+		}
+
+		/* next content file */
+		node = node->next;
+	}
+
+	/* if not found, assume empty */
+	if (!f) {
+		log_fatal("No content file found. Assuming empty.\n");
+
+		/* create the initial mapping */
+		state_map(state);
+		return;
+	}
+
+	/* get the stat of the content file */
+	ret = fstat(shandle(f), &st);
+	if (ret != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error stating the content file '%s'. %s.\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* get the size of the journal of the content file */
+	journal_size = state_journal_size(path);
+
+	/* go further to check other content files */
+	while (node) {
+		char other_path[PATH_MAX];
+		struct stat other_st;
+		struct snapraid_content* content = node->data;
+		pathcpy(other_path, sizeof(other_path), content->content);
+
+		ret = stat(other_path, &other_st);
+		if (ret != 0) {
+			/* allow missing content files, but not any other kind of error */
+			if (errno != ENOENT) {
+				/* LCOV_EXCL_START */
+				log_fatal("Error stating the content file '%s'. %s.\n", other_path, strerror(errno));
+				exit(EXIT_FAILURE);
+				/* LCOV_EXCL_STOP */
+			}
+
+			/* ensure to rewrite all the content files */
+			state->need_write = 1;
+		} else {
+			/* if the size is different */
+			if (other_st.st_size != st.st_size) {
+				log_fatal("WARNING! Content files '%s' and '%s' have a different size!\n", path, other_path);
+				log_fatal("Likely one of the two is broken!\n");
+
+				/* ensure to rewrite all the content files */
+				state->need_write = 1;
+			}
+
+			/* if the journal size is different */
+			if (state_journal_size(other_path) != journal_size) {
+				log_fatal("WARNING! Content files '%s' and '%s' have a different journal!\n", path, other_path);
 
-		if (serror(f)) {
-			/* LCOV_EXCL_START */
-			log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
-			return context;
-			/* LCOV_EXCL_STOP */
+				/* ensure to rewrite all the content files */
+				state->need_write = 1;
+			}
 		}
 
-		/* next begin position */
-		begin = end;
+		/* next content file */
+		node = node->next;
 	}
 
-	sputc('N', f);
+	/* start with a undefined default. */
+	/* it's for compatibility with version 1.0 where MD5 was implicit. */
+	state->hash = HASH_UNDEFINED;
 
-	/* flush data written to the disk */
-	if (sflush(f)) {
+	/* start with a zero seed, it was the default in old versions */
+	memset(state->hashseed, 0, HASH_MAX);
+
+	/* previous hash, start with an undefined value */
+	state->prevhash = HASH_UNDEFINED;
+
+	/* intentionally not set the prevhashseed, if used valgrind will warn about it */
+
+	/* get the first char to detect the file type */
+	c = sgetc(f);
+	sungetc(c, f);
+
+	/* guess the file type from the first char */
+	if (c == 'S') {
+		state_read_content(state, path, f);
+	} else {
 		/* LCOV_EXCL_START */
-		log_fatal("Error writing the content file '%s' (in flush before crc). %s.\n", serrorfile(f), strerror(errno));
-		return context;
+		log_fatal("From SnapRAID v9.0 the text content file is not supported anymore.\n");
+		log_fatal("You have first to upgrade to SnapRAID v8.1 to convert it to binary format.\n");
+		exit(EXIT_FAILURE);
 		/* LCOV_EXCL_STOP */
 	}
 
-	/* get the file crc */
-	crc = scrc(f);
+	sclose(f);
 
-	/* compare the crc of the data written to file */
-	/* with the one of the data written to the stream */
-	if (crc != scrc_stream(f)) {
-		/* LCOV_EXCL_START */
-		log_fatal("CRC mismatch writing the content stream.\n");
-		log_fatal("DANGER! Your RAM memory is broken! DO NOT PROCEED UNTIL FIXED!\n");
-		log_fatal("Try running a memory test like http://www.memtest86.com/\n");
-		return context;
-		/* LCOV_EXCL_STOP */
+	/* apply the changes saved in the journal */
+	/* they are only block and info changes, not needed if not loaded */
+	if (!state->opt.skip_load_extent && !state->opt.skip_load_block)
+		state_journal_read(state, path);
+
+	/* lay out the blocks in parity order, to visit them sequentially */
+	if (!state->opt.skip_load_extent && !state->opt.skip_load_block && !state->opt.skip_block_arena) {
+		for (node = state->disklist; node != 0; node = node->next)
+			fs_arena_build(node->data);
 	}
 
-	sputble32(crc, f);
-	if (serror(f)) {
+	if (state->hash == HASH_UNDEFINED) {
 		/* LCOV_EXCL_START */
-		log_fatal("Error writing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
-		return context;
+		log_fatal("The checksum to use is not specified.\n");
+		log_fatal("This happens because you are likely upgrading from SnapRAID 1.0.\n");
+		log_fatal("To use a new SnapRAID you must restart from scratch,\n");
+		log_fatal("deleting all the content and parity files.\n");
+		exit(EXIT_FAILURE);
 		/* LCOV_EXCL_STOP */
 	}
 
-	/* set output variables */
-	context->crc = crc;
-	context->count_file = count_file;
-	context->count_hardlink = count_hardlink;
-	context->count_symlink = count_symlink;
-	context->count_dir = count_dir;
+	/* update the mapping */
+	state_map(state);
 
-	return 0;
+	state_content_check(state, path);
+
+	/* mark that we read the content file, and it passed all the checks */
+	state->checked_read = 1;
+
+	/* the journal can be extended only if all the copies are consistent */
+	/* and if the blocks were not changed after reading them */
+	state->journal_content_size = st.st_size;
+	state->journal_blockmax = parity_allocated_size(state);
+	state->journal_diskmax = state_journal_diskmax(state, state->journal_blockmax);
+	state->journal_base = !state->need_write && !state_load_partial(state);
 }
 
-static void state_write_content(struct snapraid_state* state, uint32_t* out_crc)
-{
-#if HAVE_MT_WRITE
-	int fail;
-	int first;
+struct state_verify_thread_context {
+	struct snapraid_state* state;
+	struct snapraid_content* content;
+#if HAVE_MT_VERIFY
+	pthread_t thread;
 #else
-	STREAM* f;
-	unsigned count_content;
-	unsigned k;
-	struct state_write_thread_context* context;
 	void* retval;
 #endif
-	tommy_node* i;
-	block_off_t blockmax;
-	time_t info_oldest;
-	int info_has_rehash;
-	int mapping_idx;
-	block_off_t idx;
+	/* input */
 	uint32_t crc;
-	unsigned count_file;
-	unsigned count_hardlink;
-	unsigned count_symlink;
-	unsigned count_dir;
+	STREAM* f;
+};
 
-	/* blocks of all array */
-	blockmax = parity_allocated_size(state);
+static void* state_verify_thread(void* arg)
+{
+	struct state_verify_thread_context* context = arg;
+	STREAM* f = context->f;
+	unsigned char buf[4];
+	uint32_t crc_stored;
+	uint32_t crc_computed;
 
-	/* check the file-system on all disks */
-	state_fscheck(state, "before write");
+	if (sdeplete(f, buf) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error flushing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
+		return context;
+		/* LCOV_EXCL_STOP */
+	}
 
-	/* clear the info for unused blocks */
-	/* and get some other info */
-	info_oldest = 0; /* oldest time in info */
-	info_has_rehash = 0; /* if there is a rehash info */
-	for (idx = 0; idx < blockmax; ++idx) {
-		/* if the position is used */
-		if (fs_position_is_required(state, idx)) {
-			snapraid_info info = info_get(&state->infoarr, idx);
+	/* get the stored crc from the last four bytes */
+	crc_stored = buf[0] | (uint32_t)buf[1] << 8 | (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 24;
 
-			/* only if there is some info to store */
-			if (info) {
-				time_t info_time = info_get_time(info);
+	if (crc_stored != context->crc) {
+		/* LCOV_EXCL_START */
+		log_fatal("DANGER! Wrong stored CRC in '%s'\n", serrorfile(f));
+		return context;
+		/* LCOV_EXCL_STOP */
+	}
 
-				if (!info_oldest || info_time < info_oldest)
-					info_oldest = info_time;
+	/* get the computed crc */
+	crc_computed = scrc(f);
 
-				if (info_get_rehash(info))
-					info_has_rehash = 1;
-			}
-		} else {
-			/* clear any previous info */
-			info_set(&state->infoarr, idx, 0);
+	/* adjust the stored crc to include itself */
+	crc_stored = crc32c(crc_stored, buf, 4);
 
-			/* and clear any deleted blocks */
-			fs_position_clear_deleted(state, idx);
-		}
+	if (crc_computed != crc_stored) {
+		/* LCOV_EXCL_START */
+		log_fatal("DANGER! Wrong file CRC in '%s'\n", serrorfile(f));
+		return context;
+		/* LCOV_EXCL_STOP */
 	}
 
-	/* map disks */
-	mapping_idx = 0;
-	for (i = state->maplist; i != 0; i = i->next) {
-		struct snapraid_map* map = i->data;
-		struct snapraid_disk* disk;
-
-		/* find the disk for this mapping */
-		disk = find_disk_by_name(state, map->name);
-		if (!disk) {
-			/* LCOV_EXCL_START */
-			log_fatal("Internal inconsistency for unmapped disk '%s'\n", map->name);
-			os_abort();
-			/* LCOV_EXCL_STOP */
-		}
+	return 0;
+}
 
-		/* save the mapping only for not empty disks */
-		if (!fs_is_empty(disk, blockmax)) {
-			/* assign the mapping index used to identify disks */
-			disk->mapping_idx = mapping_idx;
-			++mapping_idx;
-		} else {
-			/* mark the disk as without mapping */
-			disk->mapping_idx = -1;
-		}
-	}
+static void state_verify_content(struct snapraid_state* state, uint32_t crc)
+{
+	tommy_node* i;
+	int fail;
 
-#if HAVE_MT_WRITE
-	/* start all writing threads */
+	/* start all reading threads */
 	i = tommy_list_head(&state->contentlist);
 	while (i) {
 		struct snapraid_content* content = i->data;
-		struct state_write_thread_context* context;
+		struct state_verify_thread_context* context;
 		char tmp[PATH_MAX];
 		STREAM* f;
 
-		msg_progress("Saving state to %s...\n", content->content);
+		msg_progress("Verifying %s...\n", content->content);
 
 		pathprint(tmp, sizeof(tmp), "%s.tmp", content->content);
-		f = sopen_write(tmp);
+
+		f = sopen_read(tmp);
 		if (f == 0) {
 			/* LCOV_EXCL_START */
-			log_fatal("Error opening the content file '%s'. %s.\n", tmp, strerror(errno));
+			log_fatal("Error reopening the content file '%s'. %s.\n", tmp, strerror(errno));
 			exit(EXIT_FAILURE);
 			/* LCOV_EXCL_STOP */
 		}
 
 		/* allocate the thread context */
-		context = malloc_nofail(sizeof(struct state_write_thread_context));
+		context = malloc_nofail(sizeof(struct state_verify_thread_context));
 		content->context = context;
 
 		/* initialize */
 		context->state = state;
-		context->blockmax = blockmax;
-		context->info_oldest = info_oldest;
-		context->info_has_rehash = info_has_rehash;
+		context->content = content;
+		context->crc = crc;
 		context->f = f;
 
-		thread_create(&context->thread, 0, state_write_thread, context);
+#if HAVE_MT_VERIFY
+		thread_create(&context->thread, 0, state_verify_thread, context);
+#else
+		context->retval = state_verify_thread(context);
+#endif
 
 		i = i->next;
 	}
 
 	/* join all thread */
 	fail = 0;
-	first = 1;
-	crc = 0;
-	count_file = 0;
-	count_hardlink = 0;
-	count_symlink = 0;
-	count_dir = 0;
 	i = tommy_list_head(&state->contentlist);
 	while (i) {
 		struct snapraid_content* content = i->data;
-		struct state_write_thread_context* context = content->context;
+		struct state_verify_thread_context* context = content->context;
 		void* retval;
 
-		thread_join(context->thread, &retval);
-
-		if (retval) {
-			/* LCOV_EXCL_START */
-			fail = 1;
-			/* LCOV_EXCL_STOP */
-		} else {
-			STREAM* f = context->f;
-
-			/* Use the sequence fflush() -> fsync() -> fclose() -> rename() to ensure */
-			/* than even in a system crash event we have one valid copy of the file. */
-			if (sflush(f) != 0) {
-				/* LCOV_EXCL_START */
-				log_fatal("Error writing the content file '%s', in flush(). %s.\n", serrorfile(f), strerror(errno));
-				exit(EXIT_FAILURE);
-				/* LCOV_EXCL_STOP */
-			}
-
-#if HAVE_FSYNC
-			if (ssync(f) != 0) {
-				/* LCOV_EXCL_START */
-				log_fatal("Error writing the content file '%s' in sync(). %s.\n", serrorfile(f), strerror(errno));
-				exit(EXIT_FAILURE);
-				/* LCOV_EXCL_STOP */
-			}
+#if HAVE_MT_VERIFY
+		thread_join(context->thread, &retval);
+#else
+		retval = context->retval;
 #endif
+		if (retval) {
+			/* LCOV_EXCL_START */
+			fail = 1;
+			/* LCOV_EXCL_STOP */
+		} else {
+			STREAM* f = context->f;
 
 			if (sclose(f) != 0) {
 				/* LCOV_EXCL_START */
@@ -3505,24 +4807,6 @@ static void state_write_content(struct snapraid_state* state, uint32_t* out_crc)
 				exit(EXIT_FAILURE);
 				/* LCOV_EXCL_STOP */
 			}
-
-			if (first) {
-				first = 0;
-				crc = context->crc;
-				count_file = context->count_file;
-				count_hardlink = context->count_hardlink;
-				count_symlink = context->count_symlink;
-				count_dir = context->count_dir;
-			} else {
-				if (crc != context->crc) {
-					/* LCOV_EXCL_START */
-					log_fatal("Different CRCs writing content streams.\n");
-					log_fatal("DANGER! Your RAM memory is broken! DO NOT PROCEED UNTIL FIXED!\n");
-					log_fatal("Try running a memory test like http://www.memtest86.com/\n");
-					exit(EXIT_FAILURE);
-					/* LCOV_EXCL_STOP */
-				}
-			}
 		}
 
 		free(context);
@@ -3536,298 +4820,376 @@ static void state_write_content(struct snapraid_state* state, uint32_t* out_crc)
 		exit(EXIT_FAILURE);
 		/* LCOV_EXCL_STOP */
 	}
-#else
-	/* count the content files */
-	count_content = 0;
-	i = tommy_list_head(&state->contentlist);
-	while (i) {
-		struct snapraid_content* content = i->data;
-		msg_progress("Saving state to %s...\n", content->content);
-		++count_content;
-		i = i->next;
-	}
+}
 
-	/* open all the content files */
-	f = sopen_multi_write(count_content);
-	if (!f) {
-		/* LCOV_EXCL_START */
-		log_fatal("Error opening the content files.\n");
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
-	}
+static void state_rename_content(struct snapraid_state* state)
+{
+	tommy_node* i;
 
-	k = 0;
 	i = tommy_list_head(&state->contentlist);
 	while (i) {
 		struct snapraid_content* content = i->data;
 		char tmp[PATH_MAX];
+
+		/* now renames the just written copy with the correct name */
 		pathprint(tmp, sizeof(tmp), "%s.tmp", content->content);
-		if (sopen_multi_file(f, k, tmp) != 0) {
+		if (rename(tmp, content->content) != 0) {
 			/* LCOV_EXCL_START */
-			log_fatal("Error opening the content file '%s'. %s.\n", tmp, strerror(errno));
+			log_fatal("Error renaming the content file '%s' to '%s' in rename(). %s.\n", tmp, content->content, strerror(errno));
 			exit(EXIT_FAILURE);
 			/* LCOV_EXCL_STOP */
 		}
-		++k;
+
 		i = i->next;
 	}
+}
 
-	/* allocate the thread context */
-	context = malloc_nofail(sizeof(struct state_write_thread_context));
+/**
+ * Remove the journals after writing a new content file.
+ */
+static void state_journal_reset(struct snapraid_state* state, uint32_t crc)
+{
+	struct snapraid_content* first;
+	struct stat st;
+	tommy_node* i;
 
-	/* initialize */
-	context->state = state;
-	context->blockmax = blockmax;
-	context->info_oldest = info_oldest;
-	context->info_has_rehash = info_has_rehash;
-	context->f = f;
+	i = tommy_list_head(&state->contentlist);
+	while (i) {
+		struct snapraid_content* content = i->data;
+		char path[PATH_MAX];
 
-	retval = state_write_thread(context);
+		pathprint(path, sizeof(path), "%s.journal", content->content);
+		if (remove(path) != 0 && errno != ENOENT) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error removing the journal file '%s'. %s.\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
 
-	/* abort on failure */
-	if (retval) {
-		/* LCOV_EXCL_START */
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
+		i = i->next;
 	}
 
-	/* Use the sequence fflush() -> fsync() -> fclose() -> rename() to ensure */
-	/* than even in a system crash event we have one valid copy of the file. */
-	if (sflush(f) != 0) {
+	first = tommy_list_head(&state->contentlist)->data;
+	if (stat(first->content, &st) != 0) {
 		/* LCOV_EXCL_START */
-		log_fatal("Error writing the content file '%s', in flush(). %s.\n", serrorfile(f), strerror(errno));
+		log_fatal("Error stating the content file '%s'. %s.\n", first->content, strerror(errno));
 		exit(EXIT_FAILURE);
 		/* LCOV_EXCL_STOP */
 	}
 
-#if HAVE_FSYNC
-	if (ssync(f) != 0) {
-		/* LCOV_EXCL_START */
-		log_fatal("Error writing the content file '%s' in sync(). %s.\n", serrorfile(f), strerror(errno));
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
+	state->journal_base = 1;
+	state->journal_content_crc = crc;
+	state->journal_content_size = st.st_size;
+	state->journal_blockmax = parity_allocated_size(state);
+	state->journal_diskmax = state_journal_diskmax(state, state->journal_blockmax);
+	state->journal_size = 0;
+	state->journal_crc = 0;
+	state->journal_count = 0;
+
+	/* if tracking, restart from a clean map */
+	if (state->journal_map) {
+		free(state->journal_map);
+		state->journal_map = malloc_nofail(state->journal_blockmax + 1);
+		memset(state->journal_map, 0, state->journal_blockmax + 1);
 	}
+}
+
+struct state_journal_context {
+	struct snapraid_state* state;
+#if HAVE_PTHREAD
+	pthread_t thread;
+#else
+	void* retval;
 #endif
+	/* input */
+	STREAM* f; /**< Journal files to write. */
+	struct snapraid_parity_handle* parity_handle; /**< Parity to sync before writing. 0 for none. */
+	block_off_t blockcur; /**< Position used to report errors. */
+	unsigned count_disk;
+	struct snapraid_disk** disk_map; /**< Disks saved. */
+	block_off_t count_pos;
+	block_off_t* pos_map; /**< Positions saved. */
+	snapraid_info* info_map; /**< Info for each position. */
+	char* kind_map; /**< Block kind for each position and disk. */
+	unsigned char* hash_map; /**< Block hash for each position and disk. */
+	/* output */
+	int parity_error; /**< If the parity sync failed. */
+};
 
-	if (sclose(f) != 0) {
+/**
+ * Take a snapshot of all the changed positions, and open the journals to write it.
+ * Return 0 if the journals are not consistent.
+ */
+static struct state_journal_context* state_journal_snapshot(struct snapraid_state* state)
+{
+	struct state_journal_context* context;
+	STREAM* f;
+	unsigned count_content;
+	block_off_t count_pos;
+	unsigned count_disk;
+	block_off_t blockmax;
+	block_off_t pos;
+	tommy_node* i;
+	unsigned j;
+	unsigned k;
+
+	blockmax = state->journal_blockmax;
+
+	/* count and check the journal files */
+	count_content = 0;
+	i = tommy_list_head(&state->contentlist);
+	while (i) {
+		struct snapraid_content* content = i->data;
+
+		/* if a journal is not as expected, rewrite everything */
+		if (state_journal_size(content->content) != state->journal_size) {
+			log_fatal("WARNING! Unexpected journal size for content file '%s'.\n", content->content);
+			return 0;
+		}
+
+		msg_progress("Saving journal to %s...\n", content->content);
+		++count_content;
+		i = i->next;
+	}
+
+	/* open all the journal files */
+	f = sopen_multi_write(count_content);
+	if (!f) {
 		/* LCOV_EXCL_START */
-		log_fatal("Error closing the content file. %s.\n", strerror(errno));
+		log_fatal("Error opening the journal files.\n");
 		exit(EXIT_FAILURE);
 		/* LCOV_EXCL_STOP */
 	}
 
-	crc = context->crc;
-	count_file = context->count_file;
-	count_hardlink = context->count_hardlink;
-	count_symlink = context->count_symlink;
-	count_dir = context->count_dir;
+	k = 0;
+	i = tommy_list_head(&state->contentlist);
+	while (i) {
+		struct snapraid_content* content = i->data;
+		char path[PATH_MAX];
+		int ret;
 
-	free(context);
-#endif
+		pathprint(path, sizeof(path), "%s.journal", content->content);
+		if (state->journal_size == 0)
+			ret = sopen_multi_file(f, k, path);
+		else
+			ret = sopen_multi_file_append(f, k, path);
+		if (ret != 0) {
+			/* LCOV_EXCL_START */
+			log_fatal("Error opening the journal file '%s'. %s.\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+			/* LCOV_EXCL_STOP */
+		}
+		++k;
+		i = i->next;
+	}
 
-	msg_verbose("%8u files\n", count_file);
-	msg_verbose("%8u hardlinks\n", count_hardlink);
-	msg_verbose("%8u symlinks\n", count_symlink);
-	msg_verbose("%8u empty dirs\n", count_dir);
+	/* count the changed positions */
+	count_pos = 0;
+	for (pos = 0; pos < blockmax; ++pos)
+		if (state->journal_map[pos])
+			++count_pos;
 
-	*out_crc = crc;
-}
+	/* count the disks */
+	count_disk = 0;
+	for (i = state->disklist; i != 0; i = i->next)
+		++count_disk;
 
-void state_read(struct snapraid_state* state)
-{
-	STREAM* f;
-	char path[PATH_MAX];
-	struct stat st;
-	tommy_node* node;
-	int ret;
-	int c;
+	context = malloc_nofail(sizeof(struct state_journal_context));
+	context->state = state;
+	context->f = f;
+	context->parity_handle = 0;
+	context->blockcur = 0;
+	context->count_disk = count_disk;
+	context->disk_map = malloc_nofail((count_disk + 1) * sizeof(struct snapraid_disk*));
+	context->count_pos = count_pos;
+	context->pos_map = malloc_nofail((count_pos + 1) * sizeof(block_off_t));
+	context->info_map = malloc_nofail((count_pos + 1) * sizeof(snapraid_info));
+	context->kind_map = malloc_nofail((size_t)count_pos * count_disk + 1);
+	context->hash_map = malloc_nofail((size_t)count_pos * count_disk * BLOCK_HASH_SIZE + 1);
+	context->parity_error = 0;
+
+	j = 0;
+	for (i = state->disklist; i != 0; i = i->next)
+		context->disk_map[j++] = i->data;
+
+	/* copy the blocks and info of the changed positions */
+	k = 0;
+	for (pos = 0; pos < blockmax; ++pos) {
+		if (!state->journal_map[pos])
+			continue;
 
-	/* iterate over all the available content files and load the first one present */
-	f = 0;
-	node = tommy_list_head(&state->contentlist);
-	while (node) {
-		struct snapraid_content* content = node->data;
-		pathcpy(path, sizeof(path), content->content);
+		context->pos_map[k] = pos;
+		context->info_map[k] = info_get(&state->infoarr, pos);
 
-		if (!state->no_conf) {
-			log_tag("content:%s\n", path);
-			log_flush();
-		}
-		msg_progress("Loading state from %s...\n", path);
+		for (j = 0; j < count_disk; ++j) {
+			struct snapraid_block* block = fs_par2block_find(context->disk_map[j], pos);
+			size_t idx = (size_t)k * count_disk + j;
+			char kind;
 
-		f = sopen_read(path);
-		if (f != 0) {
-			/* if opened stop the search */
-			break;
-		} else {
-			/* if it's real error of an existing file, abort */
-			if (errno != ENOENT) {
-				/* LCOV_EXCL_START */
-				log_fatal("Error opening the content file '%s'. %s.\n", path, strerror(errno));
-				exit(EXIT_FAILURE);
-				/* LCOV_EXCL_STOP */
+			switch (block_state_get(block)) {
+			case BLOCK_STATE_BLK : kind = 'b'; break;
+			case BLOCK_STATE_CHG : kind = 'g'; break;
+			case BLOCK_STATE_REP : kind = 'p'; break;
+			case BLOCK_STATE_DELETED : kind = 'o'; break;
+			default : kind = 'O'; break;
 			}
 
-			/* otherwise continue */
-			if (node->next) {
-				log_fatal("WARNING! Content file '%s' not found, trying with another copy...\n", path);
-
-				/* ensure to rewrite all the content files */
-				state->need_write = 1;
-			}
+			context->kind_map[idx] = kind;
+			if (kind != 'O')
+				memcpy(context->hash_map + idx * BLOCK_HASH_SIZE, block->hash, BLOCK_HASH_SIZE);
 		}
 
-		/* next content file */
-		node = node->next;
+		++k;
 	}
 
-	/* if not found, assume empty */
-	if (!f) {
-		log_fatal("No content file found. Assuming empty.\n");
-
-		/* create the initial mapping */
-		state_map(state);
-		return;
-	}
+	/* restart tracking */
+	memset(state->journal_map, 0, blockmax);
 
-	/* get the stat of the content file */
-	ret = fstat(shandle(f), &st);
-	if (ret != 0) {
-		/* LCOV_EXCL_START */
-		log_fatal("Error stating the content file '%s'. %s.\n", path, strerror(errno));
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
-	}
+	msg_verbose("%8u changed positions\n", count_pos);
 
-	/* go further to check other content files */
-	while (node) {
-		char other_path[PATH_MAX];
-		struct stat other_st;
-		struct snapraid_content* content = node->data;
-		pathcpy(other_path, sizeof(other_path), content->content);
+	return context;
+}
 
-		ret = stat(other_path, &other_st);
-		if (ret != 0) {
-			/* allow missing content files, but not any other kind of error */
-			if (errno != ENOENT) {
-				/* LCOV_EXCL_START */
-				log_fatal("Error stating the content file '%s'. %s.\n", other_path, strerror(errno));
-				exit(EXIT_FAILURE);
-				/* LCOV_EXCL_STOP */
-			}
+static void state_journal_free(struct state_journal_context* context)
+{
+	free(context->disk_map);
+	free(context->pos_map);
+	free(context->info_map);
+	free(context->kind_map);
+	free(context->hash_map);
+	free(context);
+}
 
-			/* ensure to rewrite all the content files */
-			state->need_write = 1;
-		} else {
-			/* if the size is different */
-			if (other_st.st_size != st.st_size) {
-				log_fatal("WARNING! Content files '%s' and '%s' have a different size!\n", path, other_path);
-				log_fatal("Likely one of the two is broken!\n");
+/**
+ * Append the snapshot to the journals.
+ * It can run in a thread, concurrently with the process changing the state.
+ * Return 0 on success.
+ */
+static void* state_journal_thread(void* arg)
+{
+	struct state_journal_context* context = arg;
+	struct snapraid_state* state = context->state;
+	STREAM* f = context->f;
+	block_off_t k;
+	unsigned j;
+	unsigned l;
+	uint32_t crc;
 
-				/* ensure to rewrite all the content files */
-				state->need_write = 1;
+	/* before writing the journal we ensure that */
+	/* the parity is really written flushing the disk cache */
+	if (context->parity_handle) {
+		for (l = 0; l < state->level; ++l) {
+			if (parity_sync(&context->parity_handle[l]) == -1) {
+				/* LCOV_EXCL_START */
+				const char* name = lev_config_name(l);
+				if (!name)
+					name = context->parity_handle[l].split_map[0].path;
+				log_tag("parity_error:%u:%s: Sync error\n", context->blockcur, name);
+				log_fatal("DANGER! Unexpected sync error in %s disk.\n", lev_name(l));
+				log_fatal("Ensure that disk '%s' is sane.\n", name);
+				context->parity_error = 1;
+				sclose(f);
+				return context;
+				/* LCOV_EXCL_STOP */
 			}
 		}
+	}
 
-		/* next content file */
-		node = node->next;
+	if (state->journal_size == 0) {
+		/* write the header */
+		swrite("SNAPJNL1\n\3\0\0", 12, f);
+		sputc('J', f);
+		sputb32(state->journal_content_crc, f);
+	} else {
+		/* continue the crc of the data already present */
+		scrcset(f, state->journal_crc);
 	}
 
-	/* start with a undefined default. */
-	/* it's for compatibility with version 1.0 where MD5 was implicit. */
-	state->hash = HASH_UNDEFINED;
+	sputc('S', f);
+	sputb32(state->journal_count, f);
+	sputb32(state->journal_blockmax, f);
+	sputb32(context->count_disk, f);
+	for (j = 0; j < context->count_disk; ++j)
+		sputbs(context->disk_map[j]->name, f);
+	sputb32(context->count_pos, f);
 
-	/* start with a zero seed, it was the default in old versions */
-	memset(state->hashseed, 0, HASH_MAX);
+	for (k = 0; k < context->count_pos; ++k) {
+		snapraid_info info = context->info_map[k];
 
-	/* previous hash, start with an undefined value */
-	state->prevhash = HASH_UNDEFINED;
+		sputb32(context->pos_map[k], f);
 
-	/* intentionally not set the prevhashseed, if used valgrind will warn about it */
+		for (j = 0; j < context->count_disk; ++j) {
+			size_t idx = (size_t)k * context->count_disk + j;
 
-	/* get the first char to detect the file type */
-	c = sgetc(f);
-	sungetc(c, f);
+			sputc(context->kind_map[idx], f);
+			if (context->kind_map[idx] != 'O')
+				swrite(context->hash_map + idx * BLOCK_HASH_SIZE, BLOCK_HASH_SIZE, f);
+		}
 
-	/* guess the file type from the first char */
-	if (c == 'S') {
-		state_read_content(state, path, f);
-	} else {
-		/* LCOV_EXCL_START */
-		log_fatal("From SnapRAID v9.0 the text content file is not supported anymore.\n");
-		log_fatal("You have first to upgrade to SnapRAID v8.1 to convert it to binary format.\n");
-		exit(EXIT_FAILURE);
-		/* LCOV_EXCL_STOP */
+		if (info) {
+			uint32_t flag = 1;
+			if (info_get_bad(info))
+				flag |= 2;
+			if (info_get_rehash(info))
+				flag |= 4;
+			if (info_get_justsynced(info))
+				flag |= 8;
+			sputb32(flag, f);
+			sputb32(info_get_time(info), f);
+		} else {
+			sputb32(0, f);
+		}
 	}
 
-	sclose(f);
+	sputc('N', f);
 
-	if (state->hash == HASH_UNDEFINED) {
+	/* flush data written to the disk */
+	if (sflush(f)) {
 		/* LCOV_EXCL_START */
-		log_fatal("The checksum to use is not specified.\n");
-		log_fatal("This happens because you are likely upgrading from SnapRAID 1.0.\n");
-		log_fatal("To use a new SnapRAID you must restart from scratch,\n");
-		log_fatal("deleting all the content and parity files.\n");
-		exit(EXIT_FAILURE);
+		log_fatal("Error writing the journal file '%s' (in flush before crc). %s.\n", serrorfile(f), strerror(errno));
+		return context;
 		/* LCOV_EXCL_STOP */
 	}
 
-	/* update the mapping */
-	state_map(state);
-
-	state_content_check(state, path);
-
-	/* mark that we read the content file, and it passed all the checks */
-	state->checked_read = 1;
-}
-
-struct state_verify_thread_context {
-	struct snapraid_state* state;
-	struct snapraid_content* content;
-#if HAVE_MT_VERIFY
-	pthread_t thread;
-#else
-	void* retval;
-#endif
-	/* input */
-	uint32_t crc;
-	STREAM* f;
-};
-
-static void* state_verify_thread(void* arg)
-{
-	struct state_verify_thread_context* context = arg;
-	STREAM* f = context->f;
-	unsigned char buf[4];
-	uint32_t crc_stored;
-	uint32_t crc_computed;
+	/* get the file crc */
+	crc = scrc(f);
 
-	if (sdeplete(f, buf) != 0) {
+	/* compare the crc of the data written to file */
+	/* with the one of the data written to the stream */
+	if (crc != scrc_stream(f)) {
 		/* LCOV_EXCL_START */
-		log_fatal("Error flushing the content file '%s'. %s.\n", serrorfile(f), strerror(errno));
+		log_fatal("CRC mismatch writing the journal stream.\n");
+		log_fatal("DANGER! Your RAM memory is broken! DO NOT PROCEED UNTIL FIXED!\n");
+		log_fatal("Try running a memory test like http://www.memtest86.com/\n");
 		return context;
 		/* LCOV_EXCL_STOP */
 	}
 
-	/* get the stored crc from the last four bytes */
-	crc_stored = buf[0] | (uint32_t)buf[1] << 8 | (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 24;
+	sputble32(crc, f);
 
-	if (crc_stored != context->crc) {
+	if (sflush(f) != 0) {
 		/* LCOV_EXCL_START */
-		log_fatal("DANGER! Wrong stored CRC in '%s'\n", serrorfile(f));
+		log_fatal("Error writing the journal file '%s', in flush(). %s.\n", serrorfile(f), strerror(errno));
 		return context;
 		/* LCOV_EXCL_STOP */
 	}
 
-	/* get the computed crc */
-	crc_computed = scrc(f);
+#if HAVE_FSYNC
+	if (ssync(f) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Error writing the journal file '%s' in sync(). %s.\n", serrorfile(f), strerror(errno));
+		return context;
+		/* LCOV_EXCL_STOP */
+	}
+#endif
 
-	/* adjust the stored crc to include itself */
-	crc_stored = crc32c(crc_stored, buf, 4);
+	state->journal_size += stell(f);
+	state->journal_crc = scrc(f);
+	++state->journal_count;
 
-	if (crc_computed != crc_stored) {
+	if (sclose(f) != 0) {
 		/* LCOV_EXCL_START */
-		log_fatal("DANGER! Wrong file CRC in '%s'\n", serrorfile(f));
+		log_fatal("Error closing the journal file. %s.\n", strerror(errno));
 		return context;
 		/* LCOV_EXCL_STOP */
 	}
@@ -3835,117 +5197,158 @@ static void* state_verify_thread(void* arg)
 	return 0;
 }
 
-static void state_verify_content(struct snapraid_state* state, uint32_t crc)
+/**
+ * Wait for the journal save running in background.
+ * Return -1 if the parity sync failed.
+ */
+static int state_journal_join(struct snapraid_state* state)
 {
-	tommy_node* i;
-	int fail;
+	struct state_journal_context* context = state->journal_async;
+	void* retval;
+	int ret;
 
-	/* start all reading threads */
-	i = tommy_list_head(&state->contentlist);
-	while (i) {
-		struct snapraid_content* content = i->data;
-		struct state_verify_thread_context* context;
-		char tmp[PATH_MAX];
-		STREAM* f;
+	if (!context)
+		return 0;
 
-		msg_progress("Verifying %s...\n", content->content);
+#if HAVE_PTHREAD
+	thread_join(context->thread, &retval);
+#else
+	retval = context->retval;
+#endif
 
-		pathprint(tmp, sizeof(tmp), "%s.tmp", content->content);
+	state->journal_async = 0;
 
-		f = sopen_read(tmp);
-		if (f == 0) {
+	ret = 0;
+	if (retval) {
+		if (!context->parity_error) {
 			/* LCOV_EXCL_START */
-			log_fatal("Error reopening the content file '%s'. %s.\n", tmp, strerror(errno));
 			exit(EXIT_FAILURE);
 			/* LCOV_EXCL_STOP */
 		}
 
-		/* allocate the thread context */
-		context = malloc_nofail(sizeof(struct state_verify_thread_context));
-		content->context = context;
+		/* the snapshot is lost, so the journal doesn't match the state anymore */
+		state->journal_base = 0;
+		state->need_write = 1;
+		ret = -1;
+	}
 
-		/* initialize */
-		context->state = state;
-		context->content = content;
-		context->crc = crc;
-		context->f = f;
+	state_journal_free(context);
 
-#if HAVE_MT_VERIFY
-		thread_create(&context->thread, 0, state_verify_thread, context);
-#else
-		context->retval = state_verify_thread(context);
-#endif
+	return ret;
+}
 
-		i = i->next;
-	}
+/**
+ * Check if the journal can be used to save the state.
+ */
+static int state_journal_usable(struct snapraid_state* state, int compact)
+{
+	/* the journal cannot be used if the state has changes not tracked */
+	/* or if a disk became empty and has to be removed from the content file */
+	if (!state->journal_base
+		|| !state->journal_map
+		|| state->opt.force_content_write
+		|| parity_allocated_size(state) != state->journal_blockmax
+		|| state_journal_diskmax(state, state->journal_blockmax) != state->journal_diskmax
+	)
+		return 0;
 
-	/* join all thread */
-	fail = 0;
-	i = tommy_list_head(&state->contentlist);
-	while (i) {
-		struct snapraid_content* content = i->data;
-		struct state_verify_thread_context* context = content->context;
-		void* retval;
+	/* if the journal is too big compared to the content file, compact it */
+	if (compact && state->journal_size * 4 > state->journal_content_size)
+		return 0;
 
-#if HAVE_MT_VERIFY
-		thread_join(context->thread, &retval);
-#else
-		retval = context->retval;
-#endif
-		if (retval) {
-			/* LCOV_EXCL_START */
-			fail = 1;
-			/* LCOV_EXCL_STOP */
-		} else {
-			STREAM* f = context->f;
+	return 1;
+}
 
-			if (sclose(f) != 0) {
-				/* LCOV_EXCL_START */
-				log_fatal("Error closing the content file. %s.\n", strerror(errno));
-				exit(EXIT_FAILURE);
-				/* LCOV_EXCL_STOP */
-			}
-		}
+void state_journal_begin(struct snapraid_state* state)
+{
+	/* changes done before are not tracked */
+	if (state->need_write)
+		state->journal_base = 0;
 
-		free(context);
+	if (!state->journal_base || state->journal_map)
+		return;
 
-		i = i->next;
+	state->journal_map = malloc_nofail(state->journal_blockmax + 1);
+	memset(state->journal_map, 0, state->journal_blockmax + 1);
+}
+
+void state_checkpoint(struct snapraid_state* state)
+{
+	struct state_journal_context* context;
+
+	/* wait for any save in progress */
+	state_journal_join(state);
+
+	/* write the full content file if the journal cannot be used */
+	if (!state_journal_usable(state, 1)) {
+		state_write(state);
+		return;
 	}
 
-	/* abort on failure */
-	if (fail) {
+	context = state_journal_snapshot(state);
+	if (!context) {
+		state_write(state);
+		return;
+	}
+
+	if (state_journal_thread(context) != 0) {
 		/* LCOV_EXCL_START */
 		exit(EXIT_FAILURE);
 		/* LCOV_EXCL_STOP */
 	}
+
+	state_journal_free(context);
+
+	state->need_write = 0; /* no write needed anymore */
+	state->checked_read = 0; /* what we wrote is not checked in read */
 }
 
-static void state_rename_content(struct snapraid_state* state)
+int state_checkpoint_async(struct snapraid_state* state, struct snapraid_parity_handle* parity_handle, block_off_t blockcur)
 {
-	tommy_node* i;
+	struct state_journal_context* context;
 
-	i = tommy_list_head(&state->contentlist);
-	while (i) {
-		struct snapraid_content* content = i->data;
-		char tmp[PATH_MAX];
+	/* wait for any save in progress */
+	if (state_journal_join(state) != 0)
+		return -1;
 
-		/* now renames the just written copy with the correct name */
-		pathprint(tmp, sizeof(tmp), "%s.tmp", content->content);
-		if (rename(tmp, content->content) != 0) {
-			/* LCOV_EXCL_START */
-			log_fatal("Error renaming the content file '%s' to '%s' in rename(). %s.\n", tmp, content->content, strerror(errno));
-			exit(EXIT_FAILURE);
-			/* LCOV_EXCL_STOP */
-		}
+	/* the compaction is delayed at the final save, */
+	/* as it requires to write the full content file */
+	if (!state_journal_usable(state, 0))
+		return -1;
 
-		i = i->next;
-	}
+	context = state_journal_snapshot(state);
+	if (!context)
+		return -1;
+
+	context->parity_handle = parity_handle;
+	context->blockcur = blockcur;
+
+#if HAVE_PTHREAD
+	thread_create(&context->thread, 0, state_journal_thread, context);
+#else
+	context->retval = state_journal_thread(context);
+#endif
+
+	state->journal_async = context;
+
+	state->need_write = 0; /* no write needed anymore, if the save completes */
+	state->checked_read = 0; /* what we wrote is not checked in read */
+
+	return 0;
+}
+
+int state_checkpoint_wait(struct snapraid_state* state)
+{
+	return state_journal_join(state);
 }
 
 void state_write(struct snapraid_state* state)
 {
 	uint32_t crc;
 
+	/* wait for any save in progress */
+	state_journal_join(state);
+
 	/* write all the content files */
 	state_write_content(state, &crc);
 
@@ -3955,6 +5358,9 @@ void state_write(struct snapraid_state* state)
 	/* rename the new files, over the old ones */
 	state_rename_content(state);
 
+	/* the journals are now obsolete */
+	state_journal_reset(state, crc);
+
 	state->need_write = 0; /* no write needed anymore */
 	state->checked_read = 0; /* what we wrote is not checked in read */
 }
@@ -4246,7 +5652,7 @@ static void state_progress_graph(struct snapraid_state* state, struct snapraid_i
 		bar = 30;
 
 	if (io) {
-		const char* legend = "cached blocks (instant, more is better)";
+		const char* legend = "cached blocks / read-ahead depth (instant, more is better)";
 
 		/* refresh the cached blocks info */
 		io_refresh(io);
@@ -4258,7 +5664,7 @@ static void state_progress_graph(struct snapraid_state* state, struct snapraid_i
 			struct snapraid_disk* disk = i->data;
 			v = disk->cached_blocks;
 			printr(disk->name, pad);
-			printf("%4" PRIu64 " | ", v);
+			printf("%4" PRIu64 "/%-4u| ", v, disk->cached_depth);
 
 			if (disk->progress_file && disk->progress_file->sub)
 				printf("%s", disk->progress_file->sub);
@@ -4271,19 +5677,64 @@ static void state_progress_graph(struct snapraid_state* state, struct snapraid_i
 		for (l = 0; l < state->level; ++l) {
 			v = state->parity[l].cached_blocks;
 			printr(lev_config_name(l), pad);
-			printf("%4" PRIu64 " | ", v);
-			printc('o', v * bar / io->io_max);
+			printf("%4" PRIu64 "/%-4u| ", v, state->parity[l].cached_depth);
+			printc('o', v * (bar - 5) / io->io_max);
 			printf("\n");
 		}
 
 		printc(' ', pad);
-		printf("     |_");
-		printc('_', bar);
+		printf("          |_");
+		printc('_', bar - 5);
 		printf("\n");
 
-		printc(' ', 5 + pad + 1 + bar / 2 - strlen(legend) / 2);
+		printc(' ', 10 + pad + 1 + (bar - 5) / 2 - strlen(legend) / 2);
 		printf("%s", legend);
 		printf("\n");
+	} else {
+		const char* legend = "read-ahead depth (average, more for the slower disks)";
+		uint64_t depth_max;
+
+		/* search for the deepest, if the depth was adapted at all */
+		depth_max = 0;
+		for (i = state->disklist; i != 0; i = i->next) {
+			struct snapraid_disk* disk = i->data;
+			if (disk->depth_count != 0 && depth_max < disk->depth_sum / disk->depth_count)
+				depth_max = disk->depth_sum / disk->depth_count;
+		}
+		for (l = 0; l < state->level; ++l) {
+			if (state->parity[l].depth_count != 0 && depth_max < state->parity[l].depth_sum / state->parity[l].depth_count)
+				depth_max = state->parity[l].depth_sum / state->parity[l].depth_count;
+		}
+
+		if (depth_max != 0) {
+			printf("\n");
+
+			for (i = state->disklist; i != 0; i = i->next) {
+				struct snapraid_disk* disk = i->data;
+				v = disk->depth_count != 0 ? disk->depth_sum / disk->depth_count : 0;
+				printr(disk->name, pad);
+				printf("%4" PRIu64 " | ", v);
+				printc('o', v * bar / depth_max);
+				printf("\n");
+			}
+
+			for (l = 0; l < state->level; ++l) {
+				v = state->parity[l].depth_count != 0 ? state->parity[l].depth_sum / state->parity[l].depth_count : 0;
+				printr(lev_config_name(l), pad);
+				printf("%4" PRIu64 " | ", v);
+				printc('o', v * bar / depth_max);
+				printf("\n");
+			}
+
+			printc(' ', pad);
+			printf("     |_");
+			printc('_', bar);
+			printf("\n");
+
+			printc(' ', 5 + pad + 1 + bar / 2 - strlen(legend) / 2);
+			printf("%s", legend);
+			printf("\n");
+		}
 	}
 
 	printf("\n");
@@ -4552,6 +6003,17 @@ void state_usage_hash(struct snapraid_state* state)
 	state->tick_last = now;
 }
 
+void state_usage_hash_worker(struct snapraid_state* state, uint64_t delta)
+{
+	/* with more threads hashing at the same time, the hash time */
+	/* can be more than the waiting time */
+	if (delta > state->tick_io)
+		delta = state->tick_io;
+
+	state->tick_io -= delta;
+	state->tick_hash += delta;
+}
+
 void state_usage_file(struct snapraid_state* state, struct snapraid_disk* disk, struct snapraid_file* file)
 {
 	(void)state;
@@ -22,6 +22,8 @@
 
 struct snapraid_handle;
 struct snapraid_io;
+struct snapraid_parity_handle;
+struct state_journal_context;
 
 /****************************************************************************/
 /* parity level */
@@ -97,15 +99,22 @@ struct snapraid_option {
 	int skip_parity_access; /**< Skip the parity access for commands that don't need it. */
 	int skip_disk_access; /**< Skip the data disk access for commands that don't need it. */
 	int skip_content_access; /**< Skip the content access for commands that don't need it. */
+	int skip_load_set; /**< Skip building the hash tables of files for commands that don't need them. */
+	int skip_load_extent; /**< Skip loading the parity extents, the infos and the deleted blocks for commands that don't need them. */
+	int skip_load_block; /**< Skip loading the block states and hashes for commands that don't need them. */
 	int kill_after_sync; /**< Kill the process after sync without saving the final state. */
 	int force_murmur3; /**< Force Murmur3 choice. */
 	int force_spooky2; /**< Force Spooky2 choice. */
+	int force_xxh3; /**< Force XXH3 choice. */
 	int force_order; /**< Force sorting order. One of the SORT_* defines. */
 	unsigned force_scrub_at; /**< Force scrub for the specified number of blocks. */
 	int force_scrub_even; /**< Force scrub of all the even blocks. */
 	int force_content_write; /**< Force the update of the content file. */
 	int skip_content_write; /**< Skip the update of the content file. */
 	int force_scan_winfind; /**< Force the use of FindFirst/Next in Windows to list directories. */
+	int skip_multi_scan; /**< Skip the use of threads to scan the disks. */
+	int skip_block_arena; /**< Skip the layout of the blocks in parity order. */
+	int force_full_load; /**< Load the full state also in commands that need only a part of it. */
 	int force_progress; /**< Force the use of the progress status. */
 	unsigned force_autosave_at; /**< Force autosave at the specified block. */
 	int fake_device; /**< Fake device data. */
@@ -114,7 +123,9 @@ struct snapraid_option {
 	int fake_uuid; /**< Set fakes UUID for testing. */
 	int match_first_uuid; /**< Force the matching of the first UUID. */
 	int force_parity_update; /**< Force parity update even if data is not changed. */
+	int force_sync_delta; /**< Force the parity delta update in sync when possible, even if it reads more blocks. */
 	unsigned io_cache; /**< Number of IO buffers to use. 0 for default. */
+	unsigned io_gen; /**< Number of threads for the parity computation. 0 for default. */
 	int auto_conf; /**< Allow to run without configuration file. */
 	int force_stats; /**< Force stats print during process. */
 	uint64_t parity_limit_size; /**< Test limit for parity files. */
@@ -126,6 +137,33 @@ struct snapraid_state {
 	uint64_t autosave; /**< Autosave after the specified amount of data. 0 to disable. */
 	int need_write; /**< If the state is changed. */
 	int checked_read; /**< If the state was read and checked. */
+
+	/**
+	 * Journal of the content file.
+	 *
+	 * The changes done by sync and scrub are appended in a journal file
+	 * stored beside each content file, instead of rewriting the full content file.
+	 */
+	int journal_base; /**< If the content files and their journal match the state, excluding the tracked changes. */
+	uint32_t journal_content_crc; /**< CRC of the content file the journal refers to. */
+	data_off_t journal_content_size; /**< Size of the content file the journal refers to. */
+	block_off_t journal_blockmax; /**< Number of blocks of the content file the journal refers to. */
+	unsigned journal_diskmax; /**< Number of not empty disks in the content file the journal refers to. */
+	data_off_t journal_size; /**< Size of the journal files. 0 if not present. */
+	uint32_t journal_crc; /**< CRC of the journal files. */
+	unsigned journal_count; /**< Number of segments in the journal files. */
+	unsigned char* journal_map; /**< Positions changed since the last save. Allocated only when tracking changes. */
+	struct state_journal_context* journal_async; /**< Journal save running in background. 0 if none. */
+
+	/**
+	 * Positions with invalid parity found by the scan.
+	 *
+	 * They include all the positions that sync has to update, and
+	 * allow sync to skip the others without checking all the disks.
+	 */
+	unsigned char* dirty_map; /**< Bitmap of the dirty positions. 0 if not computed. */
+	block_off_t dirty_size; /**< Number of positions in the bitmap. */
+	block_off_t dirty_max; /**< One more than the last dirty position. */
 	uint32_t block_size; /**< Block size in bytes. */
 	unsigned raid_mode; /**< Raid mode to use. RAID_MODE_DEFAULT or RAID_MODE_ALTERNATE. */
 	int file_mode; /**< File access mode. Combination of ADVISE_* flags. */
@@ -135,11 +173,13 @@ struct snapraid_state {
 	uint64_t pool_device; /**< Device identifier of the pool. */
 	unsigned char hashseed[HASH_MAX]; /**< Hash seed. Just after a uint64 to provide a minimal alignment. */
 	unsigned char prevhashseed[HASH_MAX]; /**< Previous hash seed. In case of rehash. */
+	char hashfile[PATH_MAX]; /**< Path of the memory mapped file where to store the blocks. Empty if not used. */
 	char lockfile[PATH_MAX]; /**< Path of the lock file to use. */
 	unsigned level; /**< Number of parity levels. 1 for PAR1, 2 for PAR2. */
 	unsigned hash; /**< Hash kind used. */
 	unsigned prevhash; /**< Previous hash kind used.  In case of rehash. */
 	unsigned besthash; /**< Best hash suggested. */
+	unsigned confhash; /**< Hash selected with the 'hash' option. HASH_UNDEFINED if not specified. */
 	const char* command; /**< Command running. */
 	tommy_list contentlist; /**< List of content files. */
 	tommy_list disklist; /**< List of all the disks. */
@@ -215,6 +255,90 @@ void state_read(struct snapraid_state* state);
  */
 void state_write(struct snapraid_state* state);
 
+/**
+ * Save the state.
+ * If possible only the changed positions are appended to the journal,
+ * otherwise the full content file is written like state_write().
+ */
+void state_checkpoint(struct snapraid_state* state);
+
+/**
+ * Save the state in background, continuing the process meanwhile.
+ * Only the changed positions are saved, appending them to the journal.
+ * If specified, the parity is synced before saving the state, because
+ * the state refers at parity already written.
+ * Return -1 if the journal cannot be used, and the state has to be saved
+ * with state_checkpoint().
+ */
+int state_checkpoint_async(struct snapraid_state* state, struct snapraid_parity_handle* parity_handle, block_off_t blockcur);
+
+/**
+ * Wait for the completion of the save running in background.
+ * Return -1 if the parity sync failed, and the state was not saved.
+ */
+int state_checkpoint_wait(struct snapraid_state* state);
+
+/**
+ * Start to track the changed positions to save with state_checkpoint().
+ * If the state has already some changes not tracked, the journal is not used.
+ */
+void state_journal_begin(struct snapraid_state* state);
+
+/**
+ * Mark a position as changed.
+ * All the blocks and the info at this position are saved in the journal.
+ */
+static inline void state_journal_mark(struct snapraid_state* state, block_off_t pos)
+{
+	if (state->journal_map) {
+		if (pos < state->journal_blockmax)
+			state->journal_map[pos] = 1;
+		else
+			state->journal_base = 0; /* cannot be tracked, write the full content */
+	}
+}
+
+/**
+ * Start to track the dirty positions, with space for the specified number of positions.
+ */
+void state_dirty_begin(struct snapraid_state* state, block_off_t size);
+
+/**
+ * Check if a position is dirty.
+ * Without a map of the dirty positions, all of them are considered dirty.
+ */
+static inline int state_dirty_has(struct snapraid_state* state, block_off_t pos)
+{
+	if (!state->dirty_map)
+		return 1;
+
+	if (pos >= state->dirty_max)
+		return 0;
+
+	return (state->dirty_map[pos / 8] & (1 << (pos % 8))) != 0;
+}
+
+/**
+ * Mark a position as dirty.
+ */
+static inline void state_dirty_mark(struct snapraid_state* state, block_off_t pos)
+{
+	if (!state->dirty_map)
+		return;
+
+	if (pos >= state->dirty_size) {
+		/* LCOV_EXCL_START */
+		log_fatal("Internal inconsistency for dirty position '%u' over the size '%u'\n", pos, state->dirty_size);
+		os_abort();
+		/* LCOV_EXCL_STOP */
+	}
+
+	state->dirty_map[pos / 8] |= 1 << (pos % 8);
+
+	if (state->dirty_max < pos + 1)
+		state->dirty_max = pos + 1;
+}
+
 /**
  * Diff all the disks.
  */
@@ -264,6 +388,7 @@ void state_rehash(struct snapraid_state* state);
 #define SCRUB_NEW -3 /**< Scub the new blocks. */
 #define SCRUB_FULL -4 /**< Scrub everything. */
 #define SCRUB_EVEN -5 /**< Even blocks. */
+#define SCRUB_REHASH -6 /**< Scrub the blocks scheduled for a rehash. */
 
 /**
  * Scrub the files.
@@ -347,6 +472,13 @@ void state_usage_sched(struct snapraid_state* state);
 void state_usage_raid(struct snapraid_state* state);
 void state_usage_hash(struct snapraid_state* state);
 
+/**
+ * Account the time used by the io threads to compute the hash of a task.
+ * The time is moved from the wait of the disks to the hash, as the
+ * main thread was waiting for the io threads while they were hashing.
+ */
+void state_usage_hash_worker(struct snapraid_state* state, uint64_t delta);
+
 /**
  * Set the last file used
  */
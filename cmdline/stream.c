@@ -140,6 +140,86 @@ int sopen_multi_file(STREAM* s, unsigned i, const char* file)
 	return 0;
 }
 
+int sopen_multi_file_append(STREAM* s, unsigned i, const char* file)
+{
+	int f;
+
+	pathcpy(s->handle[i].path, sizeof(s->handle[i].path), file);
+
+	f = open(file, O_WRONLY | O_APPEND | O_BINARY | O_SEQUENTIAL);
+	if (f == -1) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	s->handle[i].f = f;
+
+	return 0;
+}
+
+void scrcset(STREAM* s, uint32_t crc)
+{
+	s->crc = crc;
+	s->crc_uncached = crc;
+	s->crc_stream = crc ^ CRC_IV;
+}
+
+STREAM* sopen_mem_read(unsigned char* data, unsigned size, int64_t offset)
+{
+	STREAM* s = malloc_nofail(sizeof(STREAM));
+
+	s->handle_size = 0;
+	s->handle = 0;
+
+	s->buffer = data;
+	s->pos = s->buffer;
+	s->end = s->buffer + size;
+	s->state = STREAM_STATE_READ;
+	s->state_index = 0;
+	s->offset = offset + size;
+	s->offset_uncached = offset;
+	s->crc = crc32c(0, data, size);
+	s->crc_uncached = 0;
+	s->crc_stream = CRC_IV;
+
+	return s;
+}
+
+STREAM* sopen_mem_write(void)
+{
+	STREAM* s = malloc_nofail(sizeof(STREAM));
+
+	s->handle_size = 0;
+	s->handle = 0;
+
+	s->buffer = malloc_nofail(STREAM_SIZE);
+	s->pos = s->buffer;
+	s->end = s->buffer + STREAM_SIZE;
+	s->state = STREAM_STATE_WRITE;
+	s->state_index = 0;
+	s->offset = 0;
+	s->offset_uncached = 0;
+	s->crc = 0;
+	s->crc_uncached = 0;
+	s->crc_stream = CRC_IV;
+
+	return s;
+}
+
+unsigned char* smem(STREAM* s, unsigned* size)
+{
+	*size = s->pos - s->buffer;
+
+	return s->buffer;
+}
+
+void smemreset(STREAM* s)
+{
+	s->pos = s->buffer;
+	s->crc_stream = CRC_IV;
+}
+
 STREAM* sopen_write(const char* file)
 {
 	STREAM* s = sopen_multi_write(1);
@@ -157,7 +237,8 @@ int sclose(STREAM* s)
 	int fail = 0;
 	unsigned i;
 
-	if (s->state == STREAM_STATE_WRITE) {
+	/* memory streams have nothing to flush */
+	if (s->state == STREAM_STATE_WRITE && s->handle_size != 0) {
 		if (sflush(s) != 0) {
 			/* LCOV_EXCL_START */
 			fail = 1;
@@ -211,6 +292,12 @@ static int sfill(STREAM* s)
 		/* LCOV_EXCL_STOP */
 	}
 
+	/* memory streams have all the data already in the buffer */
+	if (s->handle_size == 0) {
+		s->state = STREAM_STATE_EOF;
+		return EOF;
+	}
+
 	ret = read(s->handle[0].f, s->buffer, STREAM_SIZE);
 
 	if (ret < 0) {
@@ -289,6 +376,21 @@ int sflush(STREAM* s)
 	}
 
 	size = s->pos - s->buffer;
+
+	/* memory streams enlarge the buffer instead of writing it */
+	if (s->handle_size == 0) {
+		ssize_t alloc = 2 * (s->end - s->buffer);
+		unsigned char* buffer = malloc_nofail(alloc);
+
+		memcpy(buffer, s->buffer, size);
+		free(s->buffer);
+
+		s->end = buffer + alloc;
+		s->buffer = buffer;
+		s->pos = buffer + size;
+		return 0;
+	}
+
 	if (!size)
 		return 0;
 
@@ -398,16 +500,25 @@ int sread(STREAM* f, void* void_data, unsigned size)
 
 		sptrset(f, pos);
 	} else {
-		/* standard version using sgetc() */
-		while (size--) {
-			int c = sgetc(f);
-			if (c == EOF) {
+		/* copy the data in the buffer, and refill it as required */
+		while (size) {
+			unsigned run;
+
+			if (f->pos == f->end && sfill(f) != 0) {
 				/* LCOV_EXCL_START */
 				return -1;
 				/* LCOV_EXCL_STOP */
 			}
 
-			*data++ = c;
+			run = f->end - f->pos;
+			if (run > size)
+				run = size;
+
+			memcpy(data, f->pos, run);
+
+			f->pos += run;
+			data += run;
+			size -= run;
 		}
 	}
 
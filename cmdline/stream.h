@@ -117,6 +117,43 @@ STREAM* sopen_multi_write(unsigned count);
  */
 int sopen_multi_file(STREAM* s, unsigned i, const char* file);
 
+/**
+ * Specify the file to open in append mode. Like fopen("a").
+ * The file must already exist.
+ */
+int sopen_multi_file_append(STREAM* s, unsigned i, const char* file);
+
+/**
+ * Set the CRC of the data already present in the files.
+ * Used when appending, to continue the CRC of the whole file.
+ * It must be called before writing anything.
+ */
+void scrcset(STREAM* s, uint32_t crc);
+
+/**
+ * Open a stream for reading the data in memory.
+ * The stream takes the ownership of the data, freeing it when closed.
+ * The offset is the position of the data in the original file, and it's
+ * used only to report the offset with stell().
+ */
+STREAM* sopen_mem_read(unsigned char* data, unsigned size, int64_t offset);
+
+/**
+ * Open a stream for writing in memory.
+ * The buffer is enlarged as required, and it's never written on disk.
+ */
+STREAM* sopen_mem_write(void);
+
+/**
+ * Get the data written in a memory stream.
+ */
+unsigned char* smem(STREAM* s, unsigned* size);
+
+/**
+ * Clear the data written in a memory stream.
+ */
+void smemreset(STREAM* s);
+
 /**
  * Close a stream. Like fclose().
  */
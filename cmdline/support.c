@@ -1400,6 +1400,103 @@ char* strdup_nofail(const char* str)
 	return ptr;
 }
 
+/****************************************************************************/
+/* arena */
+
+/**
+ * Size of the chunks of the arena.
+ */
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+
+/**
+ * Alignment of the objects allocated in the arena.
+ */
+#define ARENA_ALIGN 16
+
+/**
+ * Header of a chunk of the arena.
+ */
+struct arena_chunk {
+	struct arena_chunk* next;
+};
+
+#define ARENA_HEADER_SIZE ((sizeof(struct arena_chunk) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+void arena_init(struct snapraid_arena* arena)
+{
+	arena->chunk = 0;
+	arena->ptr = 0;
+	arena->free = 0;
+}
+
+void arena_done(struct snapraid_arena* arena)
+{
+	struct arena_chunk* chunk = arena->chunk;
+
+	while (chunk) {
+		struct arena_chunk* next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	arena_init(arena);
+}
+
+/**
+ * Get free space in the arena.
+ */
+static void* arena_get(struct snapraid_arena* arena, size_t size, size_t align)
+{
+	size_t pad;
+	void* ptr;
+
+	pad = (align - ((uintptr_t)arena->ptr & (align - 1))) & (align - 1);
+
+	if (pad + size > arena->free) {
+		struct arena_chunk* chunk;
+		size_t chunk_size;
+
+		/* big objects get their own chunk */
+		chunk_size = ARENA_HEADER_SIZE + align + size;
+		if (chunk_size < ARENA_CHUNK_SIZE)
+			chunk_size = ARENA_CHUNK_SIZE;
+
+		chunk = malloc_nofail(chunk_size);
+		chunk->next = arena->chunk;
+		arena->chunk = chunk;
+		arena->ptr = (unsigned char*)chunk + ARENA_HEADER_SIZE;
+		arena->free = chunk_size - ARENA_HEADER_SIZE;
+
+		pad = (align - ((uintptr_t)arena->ptr & (align - 1))) & (align - 1);
+	}
+
+	ptr = arena->ptr + pad;
+	arena->ptr += pad + size;
+	arena->free -= pad + size;
+
+	return ptr;
+}
+
+void* arena_alloc(struct snapraid_arena* arena, size_t size)
+{
+	return arena_get(arena, size, ARENA_ALIGN);
+}
+
+char* arena_strdup(struct snapraid_arena* arena, const char* str)
+{
+	size_t size;
+	char* ptr;
+
+	size = strlen(str) + 1;
+
+	/* strings don't need alignment */
+	ptr = arena_get(arena, size, 1);
+
+	memcpy(ptr, str, size);
+
+	return ptr;
+}
+
 /****************************************************************************/
 /* smartctl */
 
@@ -388,6 +388,45 @@ char* strdup_nofail(const char* str);
  */
 void malloc_fail(size_t size);
 
+/****************************************************************************/
+/* arena */
+
+/**
+ * Arena allocator.
+ *
+ * The memory is taken sequentially from large chunks, and it's released
+ * all together with arena_done(). Single allocations cannot be freed.
+ * The chunks are allocated with malloc_nofail(), and then counted
+ * by malloc_counter_get().
+ *
+ * It's not thread safe.
+ */
+struct snapraid_arena {
+	void* chunk; /**< List of the allocated chunks. */
+	unsigned char* ptr; /**< Free space in the last chunk. */
+	size_t free; /**< Free size in the last chunk. */
+};
+
+/**
+ * Initialize an empty arena.
+ */
+void arena_init(struct snapraid_arena* arena);
+
+/**
+ * Release all the memory of the arena.
+ */
+void arena_done(struct snapraid_arena* arena);
+
+/**
+ * Allocate memory from the arena, aligned for any object.
+ */
+void* arena_alloc(struct snapraid_arena* arena, size_t size);
+
+/**
+ * Duplicate a string in the arena.
+ */
+char* arena_strdup(struct snapraid_arena* arena, const char* str);
+
 /****************************************************************************/
 /* smartctl */
 
@@ -25,373 +25,6 @@
 #include "io.h"
 #include "raid/raid.h"
 
-/****************************************************************************/
-/* hash */
-
-static int state_hash_process(struct snapraid_state* state, block_off_t blockstart, block_off_t blockmax, int* skip_sync)
-{
-	struct snapraid_handle* handle;
-	unsigned diskmax;
-	block_off_t i;
-	unsigned j;
-	void* buffer;
-	void* buffer_alloc;
-	data_off_t countsize;
-	block_off_t countpos;
-	block_off_t countmax;
-	int ret;
-	unsigned error;
-	unsigned silent_error;
-	unsigned io_error;
-	char esc_buffer[ESC_MAX];
-
-	/* maps the disks to handles */
-	handle = handle_mapping(state, &diskmax);
-
-	/* buffer for reading */
-	buffer = malloc_nofail_direct(state->block_size, &buffer_alloc);
-	if (!state->opt.skip_self)
-		mtest_vector(1, state->block_size, &buffer);
-
-	error = 0;
-	silent_error = 0;
-	io_error = 0;
-
-	/* first count the number of blocks to process */
-	countmax = 0;
-	for (j = 0; j < diskmax; ++j) {
-		struct snapraid_disk* disk = handle[j].disk;
-
-		/* if no disk, nothing to check */
-		if (!disk)
-			continue;
-
-		for (i = blockstart; i < blockmax; ++i) {
-			struct snapraid_block* block;
-			unsigned block_state;
-
-			block = fs_par2block_find(disk, i);
-
-			/* get the state of the block */
-			block_state = block_state_get(block);
-
-			/* process REP and CHG blocks */
-			if (block_state != BLOCK_STATE_REP && block_state != BLOCK_STATE_CHG)
-				continue;
-
-			++countmax;
-		}
-	}
-
-	/* drop until now */
-	state_usage_waste(state);
-
-	countsize = 0;
-	countpos = 0;
-	if (!state_progress_begin(state, blockstart, blockmax, countmax))
-		goto end;
-
-	for (j = 0; j < diskmax; ++j) {
-		struct snapraid_disk* disk = handle[j].disk;
-
-		/* if no disk, nothing to check */
-		if (!disk)
-			continue;
-
-		for (i = blockstart; i < blockmax; ++i) {
-			snapraid_info info;
-			int rehash;
-			struct snapraid_block* block;
-			int read_size;
-			unsigned char hash[HASH_MAX];
-			unsigned block_state;
-			struct snapraid_file* file;
-			block_off_t file_pos;
-
-			block = fs_par2block_find(disk, i);
-
-			/* get the state of the block */
-			block_state = block_state_get(block);
-
-			/* process REP and CHG blocks */
-			if (block_state != BLOCK_STATE_REP && block_state != BLOCK_STATE_CHG)
-				continue;
-
-			/* get the file of this block */
-			file = fs_par2file_get(disk, i, &file_pos);
-
-			/* get block specific info */
-			info = info_get(&state->infoarr, i);
-
-			/* if we have to use the old hash */
-			rehash = info_get_rehash(info);
-
-			/* until now is misc */
-			state_usage_misc(state);
-
-			/* if the file is different than the current one, close it */
-			if (handle[j].file != 0 && handle[j].file != file) {
-				/* keep a pointer at the file we are going to close for error reporting */
-				struct snapraid_file* report = handle[j].file;
-				ret = handle_close(&handle[j]);
-				if (ret == -1) {
-					/* LCOV_EXCL_START */
-					/* This one is really an unexpected error, because we are only reading */
-					/* and closing a descriptor should never fail */
-					if (errno == EIO) {
-						log_tag("error:%u:%s:%s: Close EIO error. %s\n", i, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
-						log_fatal("DANGER! Unexpected input/output close error in a data disk, it isn't possible to sync.\n");
-						log_fatal("Ensure that disk '%s' is sane and that file '%s' can be accessed.\n", disk->dir, handle[j].path);
-						log_fatal("Stopping at block %u\n", i);
-						++io_error;
-						goto bail;
-					}
-
-					log_tag("error:%u:%s:%s: Close error. %s\n", i, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
-					log_fatal("WARNING! Unexpected close error in a data disk, it isn't possible to sync.\n");
-					log_fatal("Ensure that file '%s' can be accessed.\n", handle[j].path);
-					log_fatal("Stopping at block %u\n", i);
-					++error;
-					goto bail;
-					/* LCOV_EXCL_STOP */
-				}
-			}
-
-			ret = handle_open(&handle[j], file, state->file_mode, log_error, 0);
-			if (ret == -1) {
-				if (errno == EIO) {
-					/* LCOV_EXCL_START */
-					log_tag("error:%u:%s:%s: Open EIO error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
-					log_fatal("DANGER! Unexpected input/output open error in a data disk, it isn't possible to sync.\n");
-					log_fatal("Ensure that disk '%s' is sane and that file '%s' can be accessed.\n", disk->dir, handle[j].path);
-					log_fatal("Stopping at block %u\n", i);
-					++io_error;
-					goto bail;
-					/* LCOV_EXCL_STOP */
-				}
-
-				if (errno == ENOENT) {
-					log_tag("error:%u:%s:%s: Open ENOENT error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
-					log_error("Missing file '%s'.\n", handle[j].path);
-					log_error("WARNING! You cannot modify data disk during a sync.\n");
-					log_error("Rerun the sync command when finished.\n");
-					++error;
-					/* if the file is missing, it means that it was removed during sync */
-					/* this isn't a serious error, so we skip this block, and continue with others */
-					continue;
-				}
-
-				if (errno == EACCES) {
-					log_tag("error:%u:%s:%s: Open EACCES error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
-					log_error("No access at file '%s'.\n", handle[j].path);
-					log_error("WARNING! Please fix the access permission in the data disk.\n");
-					log_error("Rerun the sync command when finished.\n");
-					++error;
-					/* this isn't a serious error, so we skip this block, and continue with others */
-					continue;
-				}
-
-				/* LCOV_EXCL_START */
-				log_tag("error:%u:%s:%s: Open error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
-				log_fatal("WARNING! Unexpected open error in a data disk, it isn't possible to sync.\n");
-				log_fatal("Ensure that file '%s' can be accessed.\n", handle[j].path);
-				log_fatal("Stopping to allow recovery. Try with 'snapraid check -f /%s'\n", fmt_poll(disk, file->sub, esc_buffer));
-				++error;
-				goto bail;
-				/* LCOV_EXCL_STOP */
-			}
-
-			/* check if the file is changed */
-			if (handle[j].st.st_size != file->size
-				|| handle[j].st.st_mtime != file->mtime_sec
-				|| STAT_NSEC(&handle[j].st) != file->mtime_nsec
-				|| handle[j].st.st_ino != file->inode
-			) {
-				log_tag("error:%u:%s:%s: Unexpected attribute change\n", i, disk->name, esc_tag(file->sub, esc_buffer));
-				if (handle[j].st.st_size != file->size) {
-					log_error("Unexpected size change at file '%s' from %" PRIu64 " to %" PRIu64 ".\n", handle[j].path, file->size, (uint64_t)handle[j].st.st_size);
-				} else if (handle[j].st.st_mtime != file->mtime_sec
-					|| STAT_NSEC(&handle[j].st) != file->mtime_nsec) {
-					log_error("Unexpected time change at file '%s' from %" PRIu64 ".%d to %" PRIu64 ".%d.\n", handle[j].path, file->mtime_sec, file->mtime_nsec, (uint64_t)handle[j].st.st_mtime, STAT_NSEC(&handle[j].st));
-				} else {
-					log_error("Unexpected inode change from %" PRIu64 " to %" PRIu64 " at file '%s'.\n", file->inode, (uint64_t)handle[j].st.st_ino, handle[j].path);
-				}
-				log_error("WARNING! You cannot modify files during a sync.\n");
-				log_error("Rerun the sync command when finished.\n");
-				++error;
-				/* if the file is changed, it means that it was modified during sync */
-				/* this isn't a serious error, so we skip this block, and continue with others */
-				continue;
-			}
-
-			read_size = handle_read(&handle[j], file_pos, buffer, state->block_size, log_fatal, 0);
-			if (read_size == -1) {
-				/* LCOV_EXCL_START */
-				if (errno == EIO) {
-					log_tag("error:%u:%s:%s: Read EIO error at position %u. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), file_pos, strerror(errno));
-					log_fatal("DANGER! Unexpected input/output read error in a data disk, it isn't possible to sync.\n");
-					log_fatal("Ensure that disk '%s' is sane and that file '%s' can be read.\n", disk->dir, handle[j].path);
-					log_fatal("Stopping at block %u\n", i);
-					++io_error;
-					goto bail;
-				}
-
-				log_tag("error:%u:%s:%s: Read error at position %u. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), file_pos, strerror(errno));
-				log_fatal("WARNING! Unexpected read error in a data disk, it isn't possible to sync.\n");
-				log_fatal("Ensure that file '%s' can be read.\n", handle[j].path);
-				log_fatal("Stopping to allow recovery. Try with 'snapraid check -f /%s'\n", fmt_poll(disk, file->sub, esc_buffer));
-				++error;
-				goto bail;
-				/* LCOV_EXCL_STOP */
-			}
-
-			/* until now is disk */
-			state_usage_disk(state, handle, &j, 1);
-
-			state_usage_file(state, disk, file);
-
-			countsize += read_size;
-
-			/* now compute the hash */
-			if (rehash) {
-				memhash(state->prevhash, state->prevhashseed, hash, buffer, read_size);
-			} else {
-				memhash(state->hash, state->hashseed, hash, buffer, read_size);
-			}
-
-			/* until now is hash */
-			state_usage_hash(state);
-
-			if (block_state == BLOCK_STATE_REP) {
-				/* compare the hash */
-				if (memcmp(hash, block->hash, BLOCK_HASH_SIZE) != 0) {
-					log_tag("error:%u:%s:%s: Unexpected data change\n", i, disk->name, esc_tag(file->sub, esc_buffer));
-					log_error("Data change at file '%s' at position '%u'\n", handle[j].path, file_pos);
-					log_error("WARNING! Unexpected data modification of a file without parity!\n");
-
-					if (file_flag_has(file, FILE_IS_COPY)) {
-						log_error("This file was detected as a copy of another file with the same name, size,\n");
-						log_error("and timestamp, but the file data isn't matching the assumed copy.\n");
-						log_error("If this is a false positive, and the files are expected to be different,\n");
-						log_error("you can 'sync' anyway using 'snapraid --force-nocopy sync'\n");
-					} else {
-						log_error("Try removing the file from the array and rerun the 'sync' command!\n");
-					}
-
-					/* block sync to allow a recovery before overwriting */
-					/* the parity needed to make such recovery */
-					*skip_sync = 1; /* avoid to run the next sync */
-
-					++silent_error;
-					continue;
-				}
-			} else {
-				/* the only other case is BLOCK_STATE_CHG */
-				assert(block_state == BLOCK_STATE_CHG);
-
-				/* copy the hash in the block */
-				memcpy(block->hash, hash, BLOCK_HASH_SIZE);
-
-				/* and mark the block as hashed */
-				block_state_set(block, BLOCK_STATE_REP);
-
-				/* mark the state as needing write */
-				state->need_write = 1;
-			}
-
-			/* count the number of processed block */
-			++countpos;
-
-			/* progress */
-			if (state_progress(state, 0, i, countpos, countmax, countsize)) {
-				/* LCOV_EXCL_START */
-				*skip_sync = 1; /* avoid to run the next sync */
-				break;
-				/* LCOV_EXCL_STOP */
-			}
-		}
-
-		/* close the last file in the disk */
-		if (handle[j].file != 0) {
-			/* keep a pointer at the file we are going to close for error reporting */
-			struct snapraid_file* report = handle[j].file;
-			ret = handle_close(&handle[j]);
-			if (ret == -1) {
-				/* LCOV_EXCL_START */
-				/* This one is really an unexpected error, because we are only reading */
-				/* and closing a descriptor should never fail */
-				if (errno == EIO) {
-					log_tag("error:%u:%s:%s: Close EIO error. %s\n", blockmax, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
-					log_fatal("DANGER! Unexpected input/output close error in a data disk, it isn't possible to sync.\n");
-					log_fatal("Ensure that disk '%s' is sane and that file '%s' can be accessed.\n", disk->dir, handle[j].path);
-					log_fatal("Stopping at block %u\n", blockmax);
-					++io_error;
-					goto bail;
-				}
-
-				log_tag("error:%u:%s:%s: Close error. %s\n", blockmax, disk->name, esc_tag(report->sub, esc_buffer), strerror(errno));
-				log_fatal("WARNING! Unexpected close error in a data disk, it isn't possible to sync.\n");
-				log_fatal("Ensure that file '%s' can be accessed.\n", handle[j].path);
-				log_fatal("Stopping at block %u\n", blockmax);
-				++error;
-				goto bail;
-				/* LCOV_EXCL_STOP */
-			}
-		}
-	}
-
-end:
-	state_progress_end(state, countpos, countmax, countsize);
-
-	/* note that at this point no io_error is possible */
-	/* because at the first one we bail out */
-	assert(io_error == 0);
-
-	if (error || io_error || silent_error) {
-		msg_status("\n");
-		msg_status("%8u file errors\n", error);
-		msg_status("%8u io errors\n", io_error);
-		msg_status("%8u data errors\n", silent_error);
-	} else {
-		/* print the result only if processed something */
-		if (countpos != 0)
-			msg_status("Everything OK\n");
-	}
-
-	if (error)
-		log_fatal("WARNING! Unexpected file errors!\n");
-
-	log_tag("hash_summary:error_file:%u\n", error);
-
-	/* proceed without bailing out */
-	goto finish;
-
-bail:
-	/* on bail, don't run the next sync */
-	*skip_sync = 1;
-
-	/* close files left open */
-	for (j = 0; j < diskmax; ++j) {
-		struct snapraid_file* file = handle[j].file;
-		struct snapraid_disk* disk = handle[j].disk;
-		ret = handle_close(&handle[j]);
-		if (ret == -1) {
-			log_tag("error:%u:%s:%s: Close error. %s\n", i, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
-			log_fatal("DANGER! Unexpected close error in a data disk.\n");
-			++error;
-			/* continue, as we are already exiting */
-		}
-	}
-
-finish:
-	free(handle);
-	free(buffer_alloc);
-
-	if (error + io_error + silent_error != 0)
-		return -1;
-	return 0;
-}
-
 /****************************************************************************/
 /* sync */
 
@@ -399,9 +32,19 @@ finish:
  * Sync plan to use.
  */
 struct snapraid_plan {
+	struct snapraid_state* state;
 	unsigned handle_max;
 	struct snapraid_handle* handle_map;
 	int force_full;
+
+	/**
+	 * Bitmap of the positions where the parity is updated with the delta
+	 * of the changed blocks, instead of computing it from all the data.
+	 *
+	 * It's filled before starting the worker threads, and then only read.
+	 */
+	block_off_t delta_base; /**< First position in the bitmap. */
+	unsigned char* delta_map;
 };
 
 /**
@@ -447,6 +90,10 @@ static int block_is_enabled(void* void_plan, block_off_t i)
 	int one_invalid;
 	int one_valid;
 
+	/* skip the positions that the scan found without changes */
+	if (!plan->force_full && !state_dirty_has(plan->state, i))
+		return 0;
+
 	/* for each disk */
 	one_invalid = 0;
 	one_valid = 0;
@@ -474,8 +121,134 @@ static int block_is_enabled(void* void_plan, block_off_t i)
 	return 1;
 }
 
-static void sync_data_reader(struct snapraid_worker* worker, struct snapraid_task* task)
-{
+/**
+ * Check if the parity at the specified block index ::i can be updated with a delta.
+ *
+ * The delta update reads the old parity and the changed blocks, instead
+ * of all the data blocks. It's possible only if the old content of the
+ * changed blocks is known to be all zero in the parity, meaning that
+ * they are CHG blocks with the ZERO hash, and that the parity at this
+ * position was computed, meaning that at least one BLK block exists.
+ *
+ * It's used only if it reads less blocks than the full update.
+ */
+static int block_is_delta_possible(struct snapraid_plan* plan, block_off_t i)
+{
+	struct snapraid_state* state = plan->state;
+	snapraid_info info;
+	unsigned changed;
+	unsigned unchanged;
+	unsigned j;
+
+	if (plan->force_full || state->opt.force_parity_update)
+		return 0;
+
+	/* if the block is bad, the parity may be wrong */
+	/* if the block has to be rehashed, all the data has to be read */
+	info = info_get(&state->infoarr, i);
+	if (info_get_bad(info) || info_get_rehash(info))
+		return 0;
+
+	changed = 0;
+	unchanged = 0;
+	for (j = 0; j < plan->handle_max; ++j) {
+		struct snapraid_block* block;
+		struct snapraid_disk* disk = plan->handle_map[j].disk;
+
+		/* if no disk, nothing to check */
+		if (!disk)
+			continue;
+
+		block = fs_par2block_find(disk, i);
+
+		switch (block_state_get(block)) {
+		case BLOCK_STATE_EMPTY :
+			break;
+		case BLOCK_STATE_BLK :
+			++unchanged;
+			break;
+		case BLOCK_STATE_CHG :
+			/* the old content in the parity has to be all zero */
+			if (!hash_is_zero(block->hash))
+				return 0;
+			++changed;
+			break;
+		default :
+			/* REP and DELETED blocks have an unknown old content in the parity */
+			return 0;
+		}
+	}
+
+	if (changed == 0 || unchanged == 0)
+		return 0;
+
+	/* read the parity only if it's less than the unchanged blocks */
+	if (!state->opt.force_sync_delta && unchanged <= state->level)
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Check if the parity at the specified block index ::i is updated with a delta.
+ */
+static int block_is_delta(struct snapraid_plan* plan, block_off_t i)
+{
+	block_off_t bit = i - plan->delta_base;
+
+	return (plan->delta_map[bit / 8] & (1 << (bit % 8))) != 0;
+}
+
+/**
+ * Read the parity at the specified position.
+ *
+ * \return 0 on success, 1 on input/output error to skip the position, or -1 to stop.
+ */
+static int sync_parity_read(struct snapraid_state* state, struct snapraid_parity_handle* parity_handle, block_off_t blockcur, void** buffer, unsigned* error, unsigned* io_error)
+{
+	int io_error_on_this_block;
+	unsigned l;
+	int ret;
+
+	io_error_on_this_block = 0;
+	for (l = 0; l < state->level; ++l) {
+		ret = parity_read(&parity_handle[l], blockcur, buffer[l], state->block_size, log_error);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			if (errno == EIO) {
+				log_tag("parity_error:%u:%s: Read EIO error. %s\n", blockcur, lev_config_name(l), strerror(errno));
+				if (*io_error >= state->opt.io_error_limit) {
+					log_fatal("DANGER! Unexpected input/output read error in the %s disk, it isn't possible to sync.\n", lev_name(l));
+					log_fatal("Ensure that disk '%s' is sane and can be read.\n", lev_config_name(l));
+					log_fatal("Stopping at block %u\n", blockcur);
+					++*io_error;
+					return -1;
+				}
+
+				log_error("Input/Output error in parity '%s' at position '%u'\n", lev_config_name(l), blockcur);
+				++*io_error;
+				io_error_on_this_block = 1;
+				continue;
+			}
+
+			log_tag("parity_error:%u:%s: Read error. %s\n", blockcur, lev_config_name(l), strerror(errno));
+			log_fatal("WARNING! Unexpected read error in the %s disk, it isn't possible to sync.\n", lev_name(l));
+			log_fatal("Ensure that disk '%s' can be read.\n", lev_config_name(l));
+			log_fatal("Stopping at block %u\n", blockcur);
+			++*error;
+			return -1;
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* until now is parity */
+		state_usage_parity(state, &l, 1);
+	}
+
+	return io_error_on_this_block;
+}
+
+static void sync_data_reader(struct snapraid_worker* worker, struct snapraid_task* task)
+{
 	struct snapraid_io* io = worker->io;
 	struct snapraid_state* state = io->state;
 	struct snapraid_handle* handle = worker->handle;
@@ -508,6 +281,14 @@ static void sync_data_reader(struct snapraid_worker* worker, struct snapraid_tas
 	/* get the file of this block */
 	task->file = fs_par2file_get(disk, blockcur, &task->file_pos);
 
+	/* if the parity is updated with the delta, the unchanged blocks are not read */
+	if (block_state_get(task->block) == BLOCK_STATE_BLK
+		&& block_is_delta(io->block_arg, blockcur)
+	) {
+		task->state = TASK_STATE_DONE;
+		return;
+	}
+
 	/* if the file is different than the current one, close it */
 	if (handle->file != 0 && handle->file != task->file) {
 		/* keep a pointer at the file we are going to close for error reporting */
@@ -603,7 +384,10 @@ static void sync_data_reader(struct snapraid_worker* worker, struct snapraid_tas
 		return;
 	}
 
-	task->read_size = handle_read(handle, task->file_pos, buffer, state->block_size, log_error, 0);
+	/* read the block and compute the hash here, to distribute the load on all the worker threads */
+	/* note that the info array was already grown up to the end of the sync */
+	/* and at this position it's changed only after we have finished */
+	task->read_size = io_handle_read_hash(worker, task, log_error, 0);
 	if (task->read_size == -1) {
 		/* LCOV_EXCL_START */
 		if (errno == EIO) {
@@ -689,6 +473,8 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 	time_t now;
 	struct failed_struct* failed;
 	int* failed_map;
+	int* delta_id;
+	block_off_t delta_count;
 	unsigned l;
 	unsigned* waiting_map;
 	unsigned waiting_mac;
@@ -711,7 +497,7 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 	buffermax = diskmax + state->level;
 
 	/* initialize the io threads */
-	io_init(&io, state, state->opt.io_cache, buffermax, sync_data_reader, handle, diskmax, 0, sync_parity_writer, parity_handle, state->level);
+	io_init(&io, state, state->opt.io_cache, buffermax, sync_data_reader, 0, handle, 0, diskmax, 0, sync_parity_writer, parity_handle, state->level);
 
 	/* allocate the copy buffer */
 	copy = malloc_nofail_vector_align(diskmax, diskmax, state->block_size, &copy_alloc);
@@ -723,6 +509,7 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 
 	failed = malloc_nofail(diskmax * sizeof(struct failed_struct));
 	failed_map = malloc_nofail(diskmax * sizeof(unsigned));
+	delta_id = malloc_nofail(diskmax * sizeof(int));
 
 	/* possibly waiting disks */
 	waiting_mac = diskmax > RAID_PARITY_MAX ? diskmax : RAID_PARITY_MAX;
@@ -732,17 +519,41 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 	silent_error = 0;
 	io_error = 0;
 
-	/* first count the number of blocks to process */
-	countmax = 0;
+	/* allocate the info for all the positions we are going to process */
+	/* this ensures that the info array is never resized when the */
+	/* worker threads are reading it to know if a rehash is required */
+	tommy_arrayblkof_grow(&state->infoarr, blockmax);
+
+	/* track the changed positions to save them in the journal */
+	state_journal_begin(state);
+
+	/* first select the blocks to process */
+	/* and select the ones to update with the parity delta */
+	delta_count = 0;
+	plan.state = state;
 	plan.handle_max = diskmax;
 	plan.handle_map = handle;
 	plan.force_full = state->opt.force_full;
+	plan.delta_base = blockstart;
+	plan.delta_map = malloc_nofail((blockmax - blockstart) / 8 + 1);
+	memset(plan.delta_map, 0, (blockmax - blockstart) / 8 + 1);
+	countmax = io_position_map(&io, blockstart, blockmax, &block_is_enabled, &plan);
 	for (blockcur = blockstart; blockcur < blockmax; ++blockcur) {
-		if (!block_is_enabled(&plan, blockcur))
+		block_off_t bit = blockcur - blockstart;
+
+		/* skip quickly the positions not enabled */
+		if ((io.block_map[bit / 8] & (1 << (bit % 8))) == 0)
 			continue;
-		++countmax;
+
+		if (block_is_delta_possible(&plan, blockcur)) {
+			plan.delta_map[bit / 8] |= 1 << (bit % 8);
+			++delta_count;
+		}
 	}
 
+	if (delta_count != 0)
+		msg_verbose("Updating the parity with the delta of the changed blocks in %u positions.\n", delta_count);
+
 	/* compute the autosave size for all disk, even if not read */
 	/* this makes sense because the speed should be almost the same */
 	/* if the disks are read in parallel */
@@ -770,6 +581,8 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 		int fixed_error_on_this_block;
 		int parity_needs_to_be_updated;
 		int parity_going_to_be_updated;
+		int delta;
+		int delta_mac;
 		snapraid_info info;
 		int rehash;
 		void** buffer;
@@ -780,6 +593,9 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 		if (blockcur >= blockmax)
 			break;
 
+		/* this position is going to be changed */
+		state_journal_mark(state, blockcur);
+
 		/* until now is scheduling */
 		state_usage_sched(state);
 
@@ -796,6 +612,10 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 		/* keep track of the number of failed blocks */
 		failed_count = 0;
 
+		/* if the parity is updated with the delta of the changed blocks */
+		delta = block_is_delta(&plan, blockcur);
+		delta_mac = 0;
+
 		/* get block specific info */
 		info = info_get(&state->infoarr, blockcur);
 
@@ -823,7 +643,7 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 		for (j = 0; j < diskmax; ++j) {
 			struct snapraid_task* task;
 			int read_size;
-			unsigned char hash[HASH_MAX];
+			unsigned char* hash;
 			struct snapraid_block* block;
 			unsigned block_state;
 			struct snapraid_disk* disk;
@@ -886,6 +706,15 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 			if (!block_has_file(block))
 				continue;
 
+			/* if the parity is updated with the delta, the unchanged blocks are not read */
+			if (delta) {
+				if (block_state == BLOCK_STATE_BLK)
+					continue;
+
+				/* the delta of a block previously empty is the new data */
+				delta_id[delta_mac++] = diskcur;
+			}
+
 			/* handle error conditions */
 			if (task->state == TASK_STATE_IOERROR) {
 				/* LCOV_EXCL_START */
@@ -928,20 +757,16 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 
 			countsize += read_size;
 
-			/* now compute the hash */
-			if (rehash) {
-				memhash(state->prevhash, state->prevhashseed, hash, buffer[diskcur], read_size);
+			/* the hash was already computed by the worker thread */
+			hash = task->hash;
+			state_usage_hash_worker(state, task->tick_hash);
 
-				/* compute the new hash, and store it */
+			/* in case of rehash, store also the new hash */
+			if (rehash) {
 				rehandle[diskcur].block = block;
-				memhash(state->hash, state->hashseed, rehandle[diskcur].hash, buffer[diskcur], read_size);
-			} else {
-				memhash(state->hash, state->hashseed, hash, buffer[diskcur], read_size);
+				memcpy(rehandle[diskcur].hash, task->rehash, BLOCK_HASH_SIZE);
 			}
 
-			/* until now is hash */
-			state_usage_hash(state);
-
 			if (block_has_updated_hash(block)) {
 				/* compare the hash */
 				if (memcmp(hash, block->hash, BLOCK_HASH_SIZE) != 0) {
@@ -1066,38 +891,14 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 				/* read the parity */
 				/* we are sure that parity exists because */
 				/* we have at least one BLK block */
-				for (l = 0; l < state->level; ++l) {
-					ret = parity_read(&parity_handle[l], blockcur, buffer[diskmax + l], state->block_size, log_error);
-					if (ret == -1) {
-						/* LCOV_EXCL_START */
-						if (errno == EIO) {
-							log_tag("parity_error:%u:%s: Read EIO error. %s\n", blockcur, lev_config_name(l), strerror(errno));
-							if (io_error >= state->opt.io_error_limit) {
-								log_fatal("DANGER! Unexpected input/output read error in the %s disk, it isn't possible to sync.\n", lev_name(l));
-								log_fatal("Ensure that disk '%s' is sane and can be read.\n", lev_config_name(l));
-								log_fatal("Stopping at block %u\n", blockcur);
-								++io_error;
-								goto bail;
-							}
-
-							log_error("Input/Output error in parity '%s' at position '%u'\n", lev_config_name(l), blockcur);
-							++io_error;
-							io_error_on_this_block = 1;
-							continue;
-						}
-
-						log_tag("parity_error:%u:%s: Read error. %s\n", blockcur, lev_config_name(l), strerror(errno));
-						log_fatal("WARNING! Unexpected read error in the %s disk, it isn't possible to sync.\n", lev_name(l));
-						log_fatal("Ensure that disk '%s' can be read.\n", lev_config_name(l));
-						log_fatal("Stopping at block %u\n", blockcur);
-						++error;
-						goto bail;
-						/* LCOV_EXCL_STOP */
-					}
-
-					/* until now is parity */
-					state_usage_parity(state, &l, 1);
+				ret = sync_parity_read(state, parity_handle, blockcur, buffer + diskmax, &error, &io_error);
+				if (ret == -1) {
+					/* LCOV_EXCL_START */
+					goto bail;
+					/* LCOV_EXCL_STOP */
 				}
+				if (ret == 1)
+					io_error_on_this_block = 1;
 
 				/* if no error in parity read */
 				if (!io_error_on_this_block) {
@@ -1154,14 +955,38 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 			}
 		}
 
+		/* if the parity is updated with the delta, read the old parity */
+		/* we are sure that parity exists because */
+		/* we have at least one BLK block */
+		if (delta && parity_needs_to_be_updated
+			&& !error_on_this_block && !io_error_on_this_block
+		) {
+			/* until now is misc */
+			state_usage_misc(state);
+
+			ret = sync_parity_read(state, parity_handle, blockcur, buffer + diskmax, &error, &io_error);
+			if (ret == -1) {
+				/* LCOV_EXCL_START */
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
+			if (ret == 1)
+				io_error_on_this_block = 1;
+		}
+
 		/* if we have read all the data required and it's correct, proceed with the parity */
 		if (!error_on_this_block && !io_error_on_this_block
 			&& (!silent_error_on_this_block || fixed_error_on_this_block)
 		) {
 			/* update the parity only if really needed */
 			if (parity_needs_to_be_updated) {
-				/* compute the parity */
-				raid_gen(diskmax, state->level, state->block_size, buffer);
+				if (delta) {
+					/* add the delta of the changed blocks to the old parity */
+					io_raid_gen_delta(&io, delta_mac, delta_id, diskmax, state->level, state->block_size, buffer);
+				} else {
+					/* compute the parity */
+					io_raid_gen(&io, diskmax, state->level, state->block_size, buffer);
+				}
 
 				/* until now is raid */
 				state_usage_raid(state);
@@ -1308,24 +1133,36 @@ static int state_sync_process(struct snapraid_state* state, struct snapraid_pari
 
 			msg_progress("Autosaving...\n");
 
-			/* before writing the new content file we ensure that */
-			/* the parity is really written flushing the disk cache */
-			for (l = 0; l < state->level; ++l) {
-				ret = parity_sync(&parity_handle[l]);
-				if (ret == -1) {
-					/* LCOV_EXCL_START */
-					log_tag("parity_error:%u:%s: Sync error\n", blockcur, lev_config_name(l));
-					log_fatal("DANGER! Unexpected sync error in %s disk.\n", lev_name(l));
-					log_fatal("Ensure that disk '%s' is sane.\n", lev_config_name(l));
-					log_fatal("Stopping at block %u\n", blockcur);
-					++error;
-					goto bail;
-					/* LCOV_EXCL_STOP */
-				}
+			/* wait for the previous autosave */
+			if (state_checkpoint_wait(state) != 0) {
+				/* LCOV_EXCL_START */
+				log_fatal("Stopping at block %u\n", blockcur);
+				++error;
+				goto bail;
+				/* LCOV_EXCL_STOP */
 			}
 
-			/* now we can safely write the content file */
-			state_write(state);
+			/* save the changes in background, syncing the parity before */
+			if (state_checkpoint_async(state, parity_handle, blockcur) != 0) {
+				/* before writing the new content file we ensure that */
+				/* the parity is really written flushing the disk cache */
+				for (l = 0; l < state->level; ++l) {
+					ret = parity_sync(&parity_handle[l]);
+					if (ret == -1) {
+						/* LCOV_EXCL_START */
+						log_tag("parity_error:%u:%s: Sync error\n", blockcur, lev_config_name(l));
+						log_fatal("DANGER! Unexpected sync error in %s disk.\n", lev_name(l));
+						log_fatal("Ensure that disk '%s' is sane.\n", lev_config_name(l));
+						log_fatal("Stopping at block %u\n", blockcur);
+						++error;
+						goto bail;
+						/* LCOV_EXCL_STOP */
+					}
+				}
+
+				/* now we can safely write the content file */
+				state_checkpoint(state);
+			}
 
 			state_progress_restart(state);
 
@@ -1339,6 +1176,15 @@ end:
 
 	state_usage_print(state);
 
+	/* wait for the last autosave */
+	if (state_checkpoint_wait(state) != 0) {
+		/* LCOV_EXCL_START */
+		log_fatal("Stopping at block %u\n", blockcur);
+		++error;
+		goto bail;
+		/* LCOV_EXCL_STOP */
+	}
+
 	/* before returning we ensure that */
 	/* the parity is really written flushing the disk cache */
 	for (l = 0; l < state->level; ++l) {
@@ -1387,6 +1233,13 @@ end:
 	log_flush();
 
 bail:
+	/* wait for the last autosave, as it uses the parity files */
+	if (state_checkpoint_wait(state) != 0) {
+		/* LCOV_EXCL_START */
+		++error;
+		/* LCOV_EXCL_STOP */
+	}
+
 	/* stop all the worker threads */
 	io_stop(&io);
 
@@ -1411,6 +1264,8 @@ bail:
 	free(rehandle_alloc);
 	free(failed);
 	free(failed_map);
+	free(delta_id);
+	free(plan.delta_map);
 	free(waiting_map);
 	io_done(&io);
 
@@ -1424,6 +1279,348 @@ bail:
 	return 0;
 }
 
+/****************************************************************************/
+/* hash */
+
+/**
+ * Check if we have to hash the specified block index ::i.
+ */
+static int hash_block_is_enabled(void* void_plan, block_off_t i)
+{
+	struct snapraid_plan* plan = void_plan;
+	unsigned j;
+
+	for (j = 0; j < plan->handle_max; ++j) {
+		struct snapraid_block* block;
+		struct snapraid_disk* disk = plan->handle_map[j].disk;
+		unsigned block_state;
+
+		/* if no disk, nothing to check */
+		if (!disk)
+			continue;
+
+		block = fs_par2block_find(disk, i);
+
+		/* get the state of the block */
+		block_state = block_state_get(block);
+
+		/* process REP and CHG blocks */
+		if (block_state == BLOCK_STATE_REP || block_state == BLOCK_STATE_CHG)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void hash_data_reader(struct snapraid_worker* worker, struct snapraid_task* task)
+{
+	struct snapraid_io* io = worker->io;
+	struct snapraid_state* state = io->state;
+	struct snapraid_disk* disk = worker->handle->disk;
+	unsigned block_state;
+
+	/* if the disk position is not used */
+	if (!disk) {
+		/* use an empty block */
+		memset(task->buffer, 0, state->block_size);
+		task->state = TASK_STATE_DONE;
+		return;
+	}
+
+	/* get the state of the block */
+	block_state = block_state_get(fs_par2block_find(disk, task->position));
+
+	/* only REP and CHG blocks have to be hashed */
+	if (block_state != BLOCK_STATE_REP && block_state != BLOCK_STATE_CHG) {
+		/* use an empty block */
+		memset(task->buffer, 0, state->block_size);
+		task->block = BLOCK_NULL;
+		task->state = TASK_STATE_DONE;
+		return;
+	}
+
+	/* read and hash it as in a sync */
+	sync_data_reader(worker, task);
+}
+
+static int state_hash_process(struct snapraid_state* state, block_off_t blockstart, block_off_t blockmax, int* skip_sync)
+{
+	struct snapraid_io io;
+	struct snapraid_plan plan;
+	struct snapraid_handle* handle;
+	unsigned diskmax;
+	block_off_t blockcur;
+	unsigned j;
+	unsigned buffermax;
+	data_off_t countsize;
+	block_off_t countpos;
+	block_off_t countmax;
+	int ret;
+	unsigned error;
+	unsigned silent_error;
+	unsigned io_error;
+	unsigned* waiting_map;
+	unsigned waiting_mac;
+	char esc_buffer[ESC_MAX];
+
+	/* maps the disks to handles */
+	handle = handle_mapping(state, &diskmax);
+
+	/* we need 1 * data */
+	buffermax = diskmax;
+
+	/* initialize the io threads */
+	io_init(&io, state, state->opt.io_cache, buffermax, hash_data_reader, 0, handle, 0, diskmax, 0, 0, 0, 0);
+
+	/* possibly waiting disks */
+	waiting_mac = diskmax > RAID_PARITY_MAX ? diskmax : RAID_PARITY_MAX;
+	waiting_map = malloc_nofail(waiting_mac * sizeof(unsigned));
+
+	error = 0;
+	silent_error = 0;
+	io_error = 0;
+
+	/* allocate the info for all the positions we are going to process */
+	/* this ensures that the info array is never resized when the */
+	/* worker threads are reading it to know if a rehash is required */
+	tommy_arrayblkof_grow(&state->infoarr, blockmax);
+
+	/* first count the number of blocks to process */
+	countmax = 0;
+	for (j = 0; j < diskmax; ++j) {
+		struct snapraid_disk* disk = handle[j].disk;
+
+		/* if no disk, nothing to check */
+		if (!disk)
+			continue;
+
+		for (blockcur = blockstart; blockcur < blockmax; ++blockcur) {
+			struct snapraid_block* block;
+			unsigned block_state;
+
+			block = fs_par2block_find(disk, blockcur);
+
+			/* get the state of the block */
+			block_state = block_state_get(block);
+
+			/* process REP and CHG blocks */
+			if (block_state != BLOCK_STATE_REP && block_state != BLOCK_STATE_CHG)
+				continue;
+
+			++countmax;
+		}
+	}
+
+	/* drop until now */
+	state_usage_waste(state);
+
+	countsize = 0;
+	countpos = 0;
+
+	/* start all the worker threads, reading all the disks at the same time */
+	plan.state = state;
+	plan.handle_max = diskmax;
+	plan.handle_map = handle;
+	plan.force_full = 0;
+	plan.delta_base = 0;
+	plan.delta_map = 0; /* no delta update in the hash phase */
+	io_start(&io, blockstart, blockmax, &hash_block_is_enabled, &plan);
+
+	if (!state_progress_begin(state, blockstart, blockmax, countmax))
+		goto end;
+
+	while (1) {
+		void** buffer;
+
+		/* go to the next block */
+		blockcur = io_read_next(&io, &buffer);
+		if (blockcur >= blockmax)
+			break;
+
+		/* until now is scheduling */
+		state_usage_sched(state);
+
+		/* for each disk, process the block */
+		for (j = 0; j < diskmax; ++j) {
+			struct snapraid_task* task;
+			struct snapraid_block* block;
+			unsigned block_state;
+			struct snapraid_disk* disk;
+			struct snapraid_file* file;
+			unsigned diskcur;
+
+			/* until now is misc */
+			state_usage_misc(state);
+
+			task = io_data_read(&io, &diskcur, waiting_map, &waiting_mac);
+
+			/* until now is disk */
+			state_usage_disk(state, handle, waiting_map, waiting_mac);
+
+			/* get the results */
+			disk = task->disk;
+			block = task->block;
+			file = task->file;
+
+			/* if the disk position is not used */
+			if (!disk)
+				continue;
+
+			/* get the state of the block */
+			block_state = block_state_get(block);
+
+			/* process REP and CHG blocks */
+			if (block_state != BLOCK_STATE_REP && block_state != BLOCK_STATE_CHG)
+				continue;
+
+			/* handle error conditions */
+			if (task->state == TASK_STATE_IOERROR) {
+				/* LCOV_EXCL_START */
+				++io_error;
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
+			if (task->state == TASK_STATE_ERROR) {
+				/* LCOV_EXCL_START */
+				++error;
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
+			if (task->state == TASK_STATE_ERROR_CONTINUE) {
+				++error;
+				continue;
+			}
+			if (task->state == TASK_STATE_IOERROR_CONTINUE) {
+				/* LCOV_EXCL_START */
+				/* any io error stops the hashing, as the following sync would fail anyway */
+				log_fatal("DANGER! Unexpected input/output read error in a data disk, it isn't possible to sync.\n");
+				log_fatal("Ensure that disk '%s' is sane and that file '%s' can be read.\n", disk->dir, task->path);
+				log_fatal("Stopping at block %u\n", blockcur);
+				++io_error;
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
+			if (task->state != TASK_STATE_DONE) {
+				/* LCOV_EXCL_START */
+				log_fatal("Internal inconsistency in task state\n");
+				os_abort();
+				/* LCOV_EXCL_STOP */
+			}
+
+			state_usage_file(state, disk, file);
+
+			countsize += task->read_size;
+
+			/* the hash was already computed by the worker thread */
+			state_usage_hash_worker(state, task->tick_hash);
+			if (block_state == BLOCK_STATE_REP) {
+				/* compare the hash */
+				if (memcmp(task->hash, block->hash, BLOCK_HASH_SIZE) != 0) {
+					log_tag("error:%u:%s:%s: Unexpected data change\n", blockcur, disk->name, esc_tag(file->sub, esc_buffer));
+					log_error("Data change at file '%s' at position '%u'\n", task->path, task->file_pos);
+					log_error("WARNING! Unexpected data modification of a file without parity!\n");
+
+					if (file_flag_has(file, FILE_IS_COPY)) {
+						log_error("This file was detected as a copy of another file with the same name, size,\n");
+						log_error("and timestamp, but the file data isn't matching the assumed copy.\n");
+						log_error("If this is a false positive, and the files are expected to be different,\n");
+						log_error("you can 'sync' anyway using 'snapraid --force-nocopy sync'\n");
+					} else {
+						log_error("Try removing the file from the array and rerun the 'sync' command!\n");
+					}
+
+					/* block sync to allow a recovery before overwriting */
+					/* the parity needed to make such recovery */
+					*skip_sync = 1; /* avoid to run the next sync */
+
+					++silent_error;
+					continue;
+				}
+			} else {
+				/* the only other case is BLOCK_STATE_CHG */
+				assert(block_state == BLOCK_STATE_CHG);
+
+				/* copy the hash in the block */
+				memcpy(block->hash, task->hash, BLOCK_HASH_SIZE);
+
+				/* and mark the block as hashed */
+				block_state_set(block, BLOCK_STATE_REP);
+
+				/* mark the state as needing write */
+				state->need_write = 1;
+			}
+
+			/* count the number of processed block */
+			++countpos;
+		}
+
+		/* progress */
+		if (state_progress(state, &io, blockcur, countpos, countmax, countsize)) {
+			/* LCOV_EXCL_START */
+			*skip_sync = 1; /* avoid to run the next sync */
+			break;
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+end:
+	state_progress_end(state, countpos, countmax, countsize);
+
+	/* note that at this point no io_error is possible */
+	/* because at the first one we bail out */
+	assert(io_error == 0);
+
+	if (error || io_error || silent_error) {
+		msg_status("\n");
+		msg_status("%8u file errors\n", error);
+		msg_status("%8u io errors\n", io_error);
+		msg_status("%8u data errors\n", silent_error);
+	} else {
+		/* print the result only if processed something */
+		if (countpos != 0)
+			msg_status("Everything OK\n");
+	}
+
+	if (error)
+		log_fatal("WARNING! Unexpected file errors!\n");
+
+	log_tag("hash_summary:error_file:%u\n", error);
+
+	/* proceed without bailing out */
+	goto finish;
+
+bail:
+	/* on bail, don't run the next sync */
+	*skip_sync = 1;
+
+finish:
+	/* stop all the worker threads */
+	io_stop(&io);
+
+	/* close files left open */
+	for (j = 0; j < diskmax; ++j) {
+		struct snapraid_file* file = handle[j].file;
+		struct snapraid_disk* disk = handle[j].disk;
+		ret = handle_close(&handle[j]);
+		if (ret == -1) {
+			/* LCOV_EXCL_START */
+			log_tag("error:%u:%s:%s: Close error. %s\n", blockmax, disk->name, esc_tag(file->sub, esc_buffer), strerror(errno));
+			log_fatal("DANGER! Unexpected close error in a data disk.\n");
+			++error;
+			/* continue, as we are already exiting */
+			/* LCOV_EXCL_STOP */
+		}
+	}
+
+	free(handle);
+	free(waiting_map);
+	io_done(&io);
+
+	if (error + io_error + silent_error != 0)
+		return -1;
+	return 0;
+}
+
 int state_sync(struct snapraid_state* state, block_off_t blockstart, block_off_t blockcount)
 {
 	block_off_t blockmax;
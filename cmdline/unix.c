@@ -1561,5 +1561,17 @@ size_t direct_size(void)
 	return size;
 }
 
+unsigned cpu_count(void)
+{
+	long count;
+
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (count < 1)
+		return 1;
+
+	return count;
+}
+
 #endif
 
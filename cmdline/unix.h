@@ -63,5 +63,10 @@ const char* stat_desc(struct stat* st);
  */
 size_t direct_size(void);
 
+/**
+ * Return the number of processors available.
+ */
+unsigned cpu_count(void);
+
 #endif
 
@@ -20,6 +20,7 @@
 #include "support.h"
 #include "util.h"
 #include "raid/cpu.h"
+#include "raid/internal.h"
 #include "raid/memory.h"
 
 /****************************************************************************/
@@ -543,6 +544,7 @@ static inline void util_write64(void* ptr, uint64_t v)
 
 #include "murmur3.c"
 #include "spooky2.c"
+#include "xxh3.c"
 
 void memhash(unsigned kind, const unsigned char* seed, void* digest, const void* src, size_t size)
 {
@@ -553,6 +555,9 @@ void memhash(unsigned kind, const unsigned char* seed, void* digest, const void*
 	case HASH_SPOOKY2 :
 		SpookyHash128(src, size, seed, digest);
 		break;
+	case HASH_XXH3 :
+		XXH3_128(src, size, seed, digest);
+		break;
 	default :
 		/* LCOV_EXCL_START */
 		log_fatal("Internal inconsistency in hash function %u\n", kind);
@@ -562,12 +567,39 @@ void memhash(unsigned kind, const unsigned char* seed, void* digest, const void*
 	}
 }
 
+void memhash_multi(unsigned kind, const unsigned char* seed, unsigned char** digest_map, unsigned char** src_map, unsigned count, size_t size)
+{
+	unsigned i;
+
+	i = 0;
+
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX2)
+	if (raid_cpu_has_avx2()) {
+		switch (kind) {
+		case HASH_MURMUR3 :
+			for (; i + 8 <= count; i += 8)
+				MurmurHash3_x86_128_avx2x8((const uint8_t**)src_map + i, size, seed, digest_map + i);
+			break;
+		case HASH_SPOOKY2 :
+			for (; i + 4 <= count; i += 4)
+				SpookyHash128_avx2x4((const uint8_t**)src_map + i, size, seed, digest_map + i);
+			break;
+		}
+	}
+#endif
+
+	/* the remaining ones, one at time */
+	for (; i < count; ++i)
+		memhash(kind, seed, digest_map[i], src_map[i], size);
+}
+
 const char* hash_config_name(unsigned kind)
 {
 	switch (kind) {
 	case HASH_UNDEFINED : return "undefined";
 	case HASH_MURMUR3 : return "murmur3";
 	case HASH_SPOOKY2 : return "spooky2";
+	case HASH_XXH3 : return "xxh3";
 	default :
 		/* LCOV_EXCL_START */
 		return "unknown";
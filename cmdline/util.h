@@ -188,6 +188,7 @@ void crc32c_init(void);
 #define HASH_UNDEFINED 0
 #define HASH_MURMUR3 1
 #define HASH_SPOOKY2 2
+#define HASH_XXH3 3
 
 /**
  * Compute the HASH of a memory block.
@@ -195,6 +196,13 @@ void crc32c_init(void);
  */
 void memhash(unsigned kind, const unsigned char* seed, void* digest, const void* src, size_t size);
 
+/**
+ * Compute the HASH of multiple memory blocks of the same size.
+ * The result is the same of calling memhash() for each block, but
+ * if the CPU supports it, more blocks are processed at the same time.
+ */
+void memhash_multi(unsigned kind, const unsigned char* seed, unsigned char** digest_map, unsigned char** src_map, unsigned count, size_t size);
+
 /**
  * Return the hash name.
  */
@@ -0,0 +1,515 @@
+/*
+ * Copyright (C) 2018 Andrea Mazzoleni
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Derivative work from xxhash.h version 0.8.2
+ *
+ * xxHash - Extremely Fast Hash algorithm
+ * https://github.com/Cyan4973/xxHash
+ *
+ * This is the XXH3_128bits_withSeed() function, with the 64 bits seed
+ * obtained from the 128 bits seed of SnapRAID as the xor of its two halves.
+ *
+ * WARNING!!!! Note that the digest is stored as the low 64 bits followed by
+ * the high 64 bits, both in little endian format. This is different than
+ * the canonical representation of XXH128, that is big endian.
+ */
+
+/*
+ * xxHash - Extremely Fast Hash algorithm
+ * Header File
+ * Copyright (C) 2012-2023 Yann Collet
+ *
+ * BSD 2-Clause License (https://www.opensource.org/licenses/bsd-license.php)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define XXH_PRIME32_1 0x9E3779B1U
+#define XXH_PRIME32_2 0x85EBCA77U
+#define XXH_PRIME32_3 0xC2B2AE3DU
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define XXH_PRIME_MX1 0x165667919E3779F9ULL
+#define XXH_PRIME_MX2 0x9FB21C651E98DF25ULL
+
+#define XXH_SECRET_SIZE 192 /**< Size of the default secret. */
+#define XXH_SECRET_SIZE_MIN 136
+#define XXH_STRIPE_LEN 64 /**< Bytes processed by each accumulation. */
+#define XXH_SECRET_CONSUME_RATE 8 /**< Secret bytes consumed at each stripe. */
+#define XXH_STRIPES_PER_BLOCK ((XXH_SECRET_SIZE - XXH_STRIPE_LEN) / XXH_SECRET_CONSUME_RATE)
+#define XXH_BLOCK_LEN (XXH_STRIPE_LEN * XXH_STRIPES_PER_BLOCK)
+#define XXH_SECRET_MERGEACCS_START 11
+#define XXH_SECRET_LASTACC_START 7
+#define XXH_MIDSIZE_STARTOFFSET 3
+#define XXH_MIDSIZE_LASTOFFSET 17
+
+static const uint8_t XXH3_kSecret[XXH_SECRET_SIZE] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+/*
+ * Initial value of the accumulators.
+ * Aligned to allow a direct load in vector registers.
+ */
+static const uint64_t XXH3_init_acc[8] __aligned(32) = {
+	XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+	XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+};
+
+/* 64x64 -> 128 multiplication */
+static inline void XXH_mult64to128(uint64_t lhs, uint64_t rhs, uint64_t* lo, uint64_t* hi)
+{
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 product = (unsigned __int128)lhs * rhs;
+
+	*lo = (uint64_t)product;
+	*hi = (uint64_t)(product >> 64);
+#else
+	uint64_t lo_lo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+	uint64_t hi_lo = (lhs >> 32) * (rhs & 0xFFFFFFFF);
+	uint64_t lo_hi = (lhs & 0xFFFFFFFF) * (rhs >> 32);
+	uint64_t hi_hi = (lhs >> 32) * (rhs >> 32);
+	uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+
+	*hi = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	*lo = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+#endif
+}
+
+/* 64x64 -> 128 multiplication, folded to 64 bits with a xor */
+static inline uint64_t XXH_mul128_fold64(uint64_t lhs, uint64_t rhs)
+{
+	uint64_t lo, hi;
+
+	XXH_mult64to128(lhs, rhs, &lo, &hi);
+
+	return lo ^ hi;
+}
+
+static inline uint64_t XXH64_avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64_t XXH3_avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= XXH_PRIME_MX1;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline void XXH3_len_1to3_128b(const uint8_t* input, size_t len, const uint8_t* secret, uint64_t seed, uint64_t* h)
+{
+	uint8_t b1 = input[0];
+	uint8_t b2 = input[len >> 1];
+	uint8_t b3 = input[len - 1];
+	uint32_t combinedl = ((uint32_t)b1 << 16) | ((uint32_t)b2 << 24) | ((uint32_t)b3 << 0) | ((uint32_t)len << 8);
+	uint32_t combinedh = util_rotl32(util_swap32(combinedl), 13);
+	uint64_t bitflipl = (util_read32(secret) ^ util_read32(secret + 4)) + seed;
+	uint64_t bitfliph = (util_read32(secret + 8) ^ util_read32(secret + 12)) - seed;
+
+	h[0] = XXH64_avalanche((uint64_t)combinedl ^ bitflipl);
+	h[1] = XXH64_avalanche((uint64_t)combinedh ^ bitfliph);
+}
+
+static inline void XXH3_len_4to8_128b(const uint8_t* input, size_t len, const uint8_t* secret, uint64_t seed, uint64_t* h)
+{
+	uint64_t input_lo;
+	uint64_t input_hi;
+	uint64_t bitflip;
+	uint64_t lo, hi;
+
+	seed ^= (uint64_t)util_swap32((uint32_t)seed) << 32;
+
+	input_lo = util_read32(input);
+	input_hi = util_read32(input + len - 4);
+	bitflip = (util_read64(secret + 16) ^ util_read64(secret + 24)) + seed;
+
+	XXH_mult64to128((input_lo + (input_hi << 32)) ^ bitflip, XXH_PRIME64_1 + (len << 2), &lo, &hi);
+
+	hi += lo << 1;
+	lo ^= hi >> 3;
+
+	lo ^= lo >> 35;
+	lo *= XXH_PRIME_MX2;
+	lo ^= lo >> 28;
+
+	h[0] = lo;
+	h[1] = XXH3_avalanche(hi);
+}
+
+static inline void XXH3_len_9to16_128b(const uint8_t* input, size_t len, const uint8_t* secret, uint64_t seed, uint64_t* h)
+{
+	uint64_t bitflipl = (util_read64(secret + 32) ^ util_read64(secret + 40)) - seed;
+	uint64_t bitfliph = (util_read64(secret + 48) ^ util_read64(secret + 56)) + seed;
+	uint64_t input_lo = util_read64(input);
+	uint64_t input_hi = util_read64(input + len - 8);
+	uint64_t m_lo, m_hi;
+	uint64_t lo, hi;
+
+	XXH_mult64to128(input_lo ^ input_hi ^ bitflipl, XXH_PRIME64_1, &m_lo, &m_hi);
+
+	m_lo += (uint64_t)(len - 1) << 54;
+	input_hi ^= bitfliph;
+	m_hi += input_hi + (uint64_t)(uint32_t)input_hi * (XXH_PRIME32_2 - 1);
+	m_lo ^= util_swap64(m_hi);
+
+	XXH_mult64to128(m_lo, XXH_PRIME64_2, &lo, &hi);
+	hi += m_hi * XXH_PRIME64_2;
+
+	h[0] = XXH3_avalanche(lo);
+	h[1] = XXH3_avalanche(hi);
+}
+
+static inline void XXH3_len_0to16_128b(const uint8_t* input, size_t len, const uint8_t* secret, uint64_t seed, uint64_t* h)
+{
+	if (len > 8) {
+		XXH3_len_9to16_128b(input, len, secret, seed, h);
+	} else if (len >= 4) {
+		XXH3_len_4to8_128b(input, len, secret, seed, h);
+	} else if (len != 0) {
+		XXH3_len_1to3_128b(input, len, secret, seed, h);
+	} else {
+		h[0] = XXH64_avalanche(seed ^ util_read64(secret + 64) ^ util_read64(secret + 72));
+		h[1] = XXH64_avalanche(seed ^ util_read64(secret + 80) ^ util_read64(secret + 88));
+	}
+}
+
+static inline uint64_t XXH3_mix16B(const uint8_t* input, const uint8_t* secret, uint64_t seed)
+{
+	return XXH_mul128_fold64(
+		util_read64(input) ^ (util_read64(secret) + seed),
+		util_read64(input + 8) ^ (util_read64(secret + 8) - seed)
+	);
+}
+
+static inline void XXH128_mix32B(uint64_t* acc, const uint8_t* input_1, const uint8_t* input_2, const uint8_t* secret, uint64_t seed)
+{
+	acc[0] += XXH3_mix16B(input_1, secret + 0, seed);
+	acc[0] ^= util_read64(input_2) + util_read64(input_2 + 8);
+	acc[1] += XXH3_mix16B(input_2, secret + 16, seed);
+	acc[1] ^= util_read64(input_1) + util_read64(input_1 + 8);
+}
+
+static inline void XXH3_mid_end(const uint64_t* acc, size_t len, uint64_t seed, uint64_t* h)
+{
+	uint64_t lo = acc[0] + acc[1];
+	uint64_t hi = acc[0] * XXH_PRIME64_1 + acc[1] * XXH_PRIME64_4 + (len - seed) * XXH_PRIME64_2;
+
+	h[0] = XXH3_avalanche(lo);
+	h[1] = (uint64_t)0 - XXH3_avalanche(hi);
+}
+
+static inline void XXH3_len_17to128_128b(const uint8_t* input, size_t len, const uint8_t* secret, uint64_t seed, uint64_t* h)
+{
+	uint64_t acc[2];
+
+	acc[0] = len * XXH_PRIME64_1;
+	acc[1] = 0;
+
+	if (len > 32) {
+		if (len > 64) {
+			if (len > 96)
+				XXH128_mix32B(acc, input + 48, input + len - 64, secret + 96, seed);
+			XXH128_mix32B(acc, input + 32, input + len - 48, secret + 64, seed);
+		}
+		XXH128_mix32B(acc, input + 16, input + len - 32, secret + 32, seed);
+	}
+	XXH128_mix32B(acc, input, input + len - 16, secret, seed);
+
+	XXH3_mid_end(acc, len, seed, h);
+}
+
+static inline void XXH3_len_129to240_128b(const uint8_t* input, size_t len, const uint8_t* secret, uint64_t seed, uint64_t* h)
+{
+	uint64_t acc[2];
+	size_t i;
+
+	acc[0] = len * XXH_PRIME64_1;
+	acc[1] = 0;
+
+	for (i = 32; i < 160; i += 32)
+		XXH128_mix32B(acc, input + i - 32, input + i - 16, secret + i - 32, seed);
+
+	acc[0] = XXH3_avalanche(acc[0]);
+	acc[1] = XXH3_avalanche(acc[1]);
+
+	for (i = 160; i <= len; i += 32)
+		XXH128_mix32B(acc, input + i - 32, input + i - 16, secret + XXH_MIDSIZE_STARTOFFSET + i - 160, seed);
+
+	/* last bytes */
+	XXH128_mix32B(acc, input + len - 16, input + len - 32, secret + XXH_SECRET_SIZE_MIN - XXH_MIDSIZE_LASTOFFSET - 16, (uint64_t)0 - seed);
+
+	XXH3_mid_end(acc, len, seed, h);
+}
+
+static inline void XXH3_accumulate_512(uint64_t* acc, const uint8_t* input, const uint8_t* secret)
+{
+	unsigned i;
+
+	for (i = 0; i < 8; ++i) {
+		uint64_t data_val = util_read64(input + 8 * i);
+		uint64_t data_key = data_val ^ util_read64(secret + 8 * i);
+
+		acc[i ^ 1] += data_val;
+		acc[i] += (uint32_t)data_key * (data_key >> 32);
+	}
+}
+
+static inline void XXH3_accumulate(uint64_t* acc, const uint8_t* input, const uint8_t* secret, size_t nbStripes)
+{
+	size_t n;
+
+	for (n = 0; n < nbStripes; ++n)
+		XXH3_accumulate_512(acc, input + n * XXH_STRIPE_LEN, secret + n * XXH_SECRET_CONSUME_RATE);
+}
+
+static inline void XXH3_scramble(uint64_t* acc, const uint8_t* secret)
+{
+	unsigned i;
+
+	for (i = 0; i < 8; ++i) {
+		uint64_t acc64 = acc[i];
+
+		acc64 ^= acc64 >> 47;
+		acc64 ^= util_read64(secret + 8 * i);
+		acc64 *= XXH_PRIME32_1;
+
+		acc[i] = acc64;
+	}
+}
+
+static void XXH3_hashLong(uint64_t* acc, const uint8_t* input, size_t len, const uint8_t* secret)
+{
+	size_t nb_blocks = (len - 1) / XXH_BLOCK_LEN;
+	size_t n;
+
+	memcpy(acc, XXH3_init_acc, sizeof(XXH3_init_acc));
+
+	for (n = 0; n < nb_blocks; ++n) {
+		XXH3_accumulate(acc, input + n * XXH_BLOCK_LEN, secret, XXH_STRIPES_PER_BLOCK);
+		XXH3_scramble(acc, secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN);
+	}
+
+	/* last partial block */
+	XXH3_accumulate(acc, input + nb_blocks * XXH_BLOCK_LEN, secret, ((len - 1) - XXH_BLOCK_LEN * nb_blocks) / XXH_STRIPE_LEN);
+
+	/* last stripe */
+	XXH3_accumulate_512(acc, input + len - XXH_STRIPE_LEN, secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - XXH_SECRET_LASTACC_START);
+}
+
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX2)
+/*
+ * Constant for the AVX2 implementation.
+ */
+static const uint32_t xxh3_avx2_prime32 __aligned(4) = XXH_PRIME32_1;
+
+/*
+ * AVX2 implementation of XXH3_accumulate().
+ *
+ * The registers ymm0-ymm1 contain the accumulators, and ymm7 the prime
+ * used by the scrambling.
+ */
+static inline void XXH3_accumulate_avx2(const uint8_t* input, const uint8_t* secret, size_t nbStripes)
+{
+	size_t n;
+
+	for (n = 0; n < nbStripes; ++n) {
+		const uint8_t* in = input + n * XXH_STRIPE_LEN;
+		const uint8_t* key = secret + n * XXH_SECRET_CONSUME_RATE;
+
+		/* data_key = data ^ key */
+		asm volatile ("vmovdqu %0,%%ymm2" : : "m" (in[0]));
+		asm volatile ("vmovdqu %0,%%ymm3" : : "m" (in[32]));
+		asm volatile ("vpxor %0,%%ymm2,%%ymm4" : : "m" (key[0]));
+		asm volatile ("vpxor %0,%%ymm3,%%ymm5" : : "m" (key[32]));
+
+		/* product = (uint32_t)data_key * (data_key >> 32) */
+		asm volatile ("vpsrlq $32,%ymm4,%ymm8");
+		asm volatile ("vpsrlq $32,%ymm5,%ymm9");
+		asm volatile ("vpmuludq %ymm8,%ymm4,%ymm4");
+		asm volatile ("vpmuludq %ymm9,%ymm5,%ymm5");
+
+		/* acc[i ^ 1] += data */
+		asm volatile ("vpshufd $0x4e,%ymm2,%ymm2");
+		asm volatile ("vpshufd $0x4e,%ymm3,%ymm3");
+		asm volatile ("vpaddq %ymm2,%ymm0,%ymm0");
+		asm volatile ("vpaddq %ymm3,%ymm1,%ymm1");
+
+		/* acc[i] += product */
+		asm volatile ("vpaddq %ymm4,%ymm0,%ymm0");
+		asm volatile ("vpaddq %ymm5,%ymm1,%ymm1");
+	}
+}
+
+/*
+ * AVX2 implementation of XXH3_scramble().
+ */
+static inline void XXH3_scramble_avx2(const uint8_t* secret)
+{
+	/* acc ^= acc >> 47 */
+	asm volatile ("vpsrlq $47,%ymm0,%ymm2");
+	asm volatile ("vpsrlq $47,%ymm1,%ymm3");
+	asm volatile ("vpxor %ymm2,%ymm0,%ymm0");
+	asm volatile ("vpxor %ymm3,%ymm1,%ymm1");
+
+	/* acc ^= key */
+	asm volatile ("vpxor %0,%%ymm0,%%ymm0" : : "m" (secret[0]));
+	asm volatile ("vpxor %0,%%ymm1,%%ymm1" : : "m" (secret[32]));
+
+	/* acc *= XXH_PRIME32_1, with two 32x32 -> 64 multiplications */
+	asm volatile ("vpsrlq $32,%ymm0,%ymm2");
+	asm volatile ("vpsrlq $32,%ymm1,%ymm3");
+	asm volatile ("vpmuludq %ymm7,%ymm0,%ymm0");
+	asm volatile ("vpmuludq %ymm7,%ymm1,%ymm1");
+	asm volatile ("vpmuludq %ymm7,%ymm2,%ymm2");
+	asm volatile ("vpmuludq %ymm7,%ymm3,%ymm3");
+	asm volatile ("vpsllq $32,%ymm2,%ymm2");
+	asm volatile ("vpsllq $32,%ymm3,%ymm3");
+	asm volatile ("vpaddq %ymm2,%ymm0,%ymm0");
+	asm volatile ("vpaddq %ymm3,%ymm1,%ymm1");
+}
+
+/*
+ * AVX2 implementation of XXH3_hashLong().
+ */
+static void XXH3_hashLong_avx2(uint64_t* acc, const uint8_t* input, size_t len, const uint8_t* secret)
+{
+	uint64_t v[2][4] __aligned(32);
+	size_t nb_blocks = (len - 1) / XXH_BLOCK_LEN;
+	size_t n;
+
+	raid_avx_begin();
+
+	asm volatile ("vmovdqa %0,%%ymm0" : : "m" (XXH3_init_acc[0]));
+	asm volatile ("vmovdqa %0,%%ymm1" : : "m" (XXH3_init_acc[4]));
+	asm volatile ("vpbroadcastd %0,%%ymm7" : : "m" (xxh3_avx2_prime32));
+
+	for (n = 0; n < nb_blocks; ++n) {
+		XXH3_accumulate_avx2(input + n * XXH_BLOCK_LEN, secret, XXH_STRIPES_PER_BLOCK);
+		XXH3_scramble_avx2(secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN);
+	}
+
+	/* last partial block */
+	XXH3_accumulate_avx2(input + nb_blocks * XXH_BLOCK_LEN, secret, ((len - 1) - XXH_BLOCK_LEN * nb_blocks) / XXH_STRIPE_LEN);
+
+	/* last stripe */
+	XXH3_accumulate_avx2(input + len - XXH_STRIPE_LEN, secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - XXH_SECRET_LASTACC_START, 1);
+
+	asm volatile ("vmovdqa %%ymm0,%0" : "=m" (v[0]));
+	asm volatile ("vmovdqa %%ymm1,%0" : "=m" (v[1]));
+
+	raid_avx_end();
+
+	memcpy(acc, v, sizeof(v));
+}
+#endif
+
+static inline uint64_t XXH3_mergeAccs(const uint64_t* acc, const uint8_t* secret, uint64_t start)
+{
+	uint64_t result = start;
+	unsigned i;
+
+	for (i = 0; i < 4; ++i)
+		result += XXH_mul128_fold64(acc[2 * i] ^ util_read64(secret + 16 * i), acc[2 * i + 1] ^ util_read64(secret + 16 * i + 8));
+
+	return XXH3_avalanche(result);
+}
+
+void XXH3_128(const void* data, size_t size, const uint8_t* seed, uint8_t* digest)
+{
+	const uint8_t* input = data;
+	uint64_t seed64;
+	uint64_t h[2];
+
+	seed64 = util_read64(seed + 0) ^ util_read64(seed + 8);
+
+	if (size <= 16) {
+		XXH3_len_0to16_128b(input, size, XXH3_kSecret, seed64, h);
+	} else if (size <= 128) {
+		XXH3_len_17to128_128b(input, size, XXH3_kSecret, seed64, h);
+	} else if (size <= 240) {
+		XXH3_len_129to240_128b(input, size, XXH3_kSecret, seed64, h);
+	} else {
+		uint8_t secret[XXH_SECRET_SIZE];
+		uint64_t acc[8];
+		unsigned i;
+
+		/* derive the secret from the seed */
+		for (i = 0; i < XXH_SECRET_SIZE; i += 16) {
+			util_write64(secret + i, util_read64(XXH3_kSecret + i) + seed64);
+			util_write64(secret + i + 8, util_read64(XXH3_kSecret + i + 8) - seed64);
+		}
+
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX2)
+		if (raid_cpu_has_avx2())
+			XXH3_hashLong_avx2(acc, input, size, secret);
+		else
+#endif
+		XXH3_hashLong(acc, input, size, secret);
+
+		h[0] = XXH3_mergeAccs(acc, secret + XXH_SECRET_MERGEACCS_START, (uint64_t)size * XXH_PRIME64_1);
+		h[1] = XXH3_mergeAccs(acc, secret + XXH_SECRET_SIZE - sizeof(acc) - XXH_SECRET_MERGEACCS_START, ~((uint64_t)size * XXH_PRIME64_2));
+	}
+
+	util_write64(digest + 0, h[0]);
+	util_write64(digest + 8, h[1]);
+}
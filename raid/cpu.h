@@ -212,6 +212,26 @@ static inline int raid_cpu_has_avx512bw(void)
 		(3 << 1) | (7 << 5)); /* OS saves XMM, YMM and ZMM registers */
 }
 
+static inline int raid_cpu_has_gfni(void)
+{
+	uint32_t reg[4];
+
+	/*
+	 * GFNI is reported by CPUID.0x7.0:ECX.GFNI[bit 8] = 1.
+	 *
+	 * We use it only with the 512-bit encoding, so we also require
+	 * the AVX512BW support with the ZMM state saved by the OS.
+	 */
+	if (!raid_cpu_has_avx512bw())
+		return 0;
+
+	raid_cpuid(7, 0, reg);
+	if ((reg[2] & (1 << 8)) == 0)
+		return 0;
+
+	return 1;
+}
+
 /**
  * Check if it's an Intel Atom CPU.
  */
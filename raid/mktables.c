@@ -14,6 +14,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 
 /**
  * Multiplication a*b in GF(2^8).
@@ -204,6 +205,32 @@ static void set_power(uint8_t *matrix)
 /**
  * Next power of 2.
  */
+/**
+ * Compute the GF2P8AFFINEQB matrix of the multiplication by a constant.
+ *
+ * The bit 'i' of the result is the parity of the byte '7 - i' of the
+ * matrix and'ed with the input. So, the byte '7 - i' has the bit 'k' set
+ * if the multiplication of the constant by '2^k' has the bit 'i' set.
+ */
+static uint64_t affine(uint8_t c)
+{
+	uint64_t m = 0;
+	unsigned i, k;
+
+	for (i = 0; i < 8; ++i) {
+		uint8_t row = 0;
+
+		for (k = 0; k < 8; ++k) {
+			if (gfmul(c, 1 << k) & (1 << i))
+				row |= 1 << k;
+		}
+
+		m |= (uint64_t)row << (8 * (7 - i));
+	}
+
+	return m;
+}
+
 static unsigned np(unsigned v)
 {
 	--v;
@@ -423,6 +450,51 @@ int main(void)
 	printf("};\n");
 	printf("#endif\n\n");
 
+	printf("#ifdef CONFIG_X86\n");
+	printf("/**\n");
+	printf(" * GFNI affine matrices for the Cauchy matrix.\n");
+	printf(" *\n");
+	printf(" * Each entry is the 8x8 bit matrix of the multiplication by the\n");
+	printf(" * coefficient, in the format used by the GF2P8AFFINEQB instruction.\n");
+	printf(" *\n");
+	printf(" * Indexes are [DISK][PARITY - 2].\n");
+	printf(" * Where DISK is from 0 to %u, PARITY from 2 to %u.\n", DISK - 1, PARITY - 1);
+	printf(" */\n");
+	printf("const uint64_t __aligned(256) raid_gfcauchygfni[%u][%u] =\n", DISK, np(PARITY - 2));
+	printf("{\n");
+	for (i = 0; i < DISK; ++i) {
+		printf("\t{ ");
+		for (p = 2; p < PARITY; ++p) {
+			printf("0x%016" PRIx64 "ULL", affine(matrix[p * DISK + i]));
+			if (p != PARITY - 1)
+				printf(", ");
+		}
+		printf(" },\n");
+	}
+	printf("};\n");
+	printf("#endif\n\n");
+
+	printf("#ifdef CONFIG_X86\n");
+	printf("/**\n");
+	printf(" * GFNI affine matrices for generic multiplication.\n");
+	printf(" *\n");
+	printf(" * Indexes are [MULTIPLER].\n");
+	printf(" * Where MULTIPLER is from 0 to 255.\n");
+	printf(" */\n");
+	printf("const uint64_t __aligned(256) raid_gfmulgfni[256] =\n");
+	printf("{\n");
+	for (i = 0; i < 256; ++i) {
+		if (i % 4 == 0)
+			printf("\t");
+		printf("0x%016" PRIx64 "ULL,", affine(i));
+		if (i % 4 == 3)
+			printf("\n");
+		else
+			printf(" ");
+	}
+	printf("};\n");
+	printf("#endif\n\n");
+
 	return 0;
 }
 
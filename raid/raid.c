@@ -232,6 +232,144 @@ void raid_gen(int nd, int np, size_t size, void **v)
 	raid_gen_ptr[np - 1](nd, size, v);
 }
 
+/*
+ * Size of the slices processed by raid_syndrome() and raid_gen_delta().
+ *
+ * The parity of a slice, for all the parity levels, is computed in the
+ * scratch buffer that stays in the L1/L2 cache, and it's never stored in
+ * memory. Smaller slices are slower, because the generation functions have
+ * a setup cost at every call.
+ */
+#define RAID_SLICE_SIZE (RAID_SCRATCH_SIZE / RAID_PARITY_MAX)
+
+/**
+ * Counts the different bits in two blocks.
+ */
+static unsigned raid_diff_bits(const uint8_t *a, const uint8_t *b, size_t size)
+{
+	unsigned count = 0;
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		uint8_t x = a[i] ^ b[i];
+
+		while (x) {
+			++count;
+			x &= x - 1;
+		}
+	}
+
+	return count;
+}
+
+int raid_syndrome(int nd, int np, size_t size, void **vv, void **pp, unsigned *diff, void *scratch)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t **p = (uint8_t **)pp;
+	uint8_t *pd = scratch;
+	uint8_t *s[RAID_DATA_MAX + RAID_PARITY_MAX];
+	size_t offset;
+	size_t slice;
+	int i, l;
+	int mask;
+
+	/* enforce limit on size */
+	BUG_ON(size % 64 != 0);
+
+	/* enforce limit on number of failures */
+	BUG_ON(np < 1);
+	BUG_ON(np > RAID_PARITY_MAX);
+
+	/* enforce limit on number of data blocks */
+	BUG_ON(nd > RAID_DATA_MAX);
+
+	/* enforce limit on the scratch buffer alignment */
+	BUG_ON(((uintptr_t)pd & 63) != 0);
+
+	/* the computed parity of the slice is put in the scratch buffer */
+	for (l = 0; l < np; ++l)
+		s[nd + l] = pd + l * RAID_SLICE_SIZE;
+
+	if (diff) {
+		for (l = 0; l < np; ++l)
+			diff[l] = 0;
+	}
+
+	mask = 0;
+	for (offset = 0; offset < size; offset += slice) {
+		slice = size - offset;
+		if (slice > RAID_SLICE_SIZE)
+			slice = RAID_SLICE_SIZE;
+
+		for (i = 0; i < nd; ++i)
+			s[i] = v[i] + offset;
+
+		raid_gen_ptr[np - 1](nd, slice, (void **)s);
+
+		/* the syndrome is the xor of the computed and provided parity */
+		for (l = 0; l < np; ++l) {
+			if (p[l] != 0 && memcmp(s[nd + l], p[l] + offset, slice) != 0) {
+				mask |= 1 << l;
+				if (diff)
+					diff[l] += raid_diff_bits(s[nd + l], p[l] + offset, slice);
+			}
+		}
+	}
+
+	return mask;
+}
+
+void raid_gen_delta(int nr, int *id, int nd, int np, size_t size, void **vv, void *scratch)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *pd = scratch;
+	uint8_t *s[RAID_DATA_MAX + RAID_PARITY_MAX];
+	size_t offset;
+	size_t slice;
+	size_t i;
+	int j, l;
+
+	/* enforce limit on size */
+	BUG_ON(size % 64 != 0);
+
+	/* enforce limit on number of failures */
+	BUG_ON(np < 1);
+	BUG_ON(np > RAID_PARITY_MAX);
+
+	/* enforce limit on number of data blocks */
+	BUG_ON(nd > RAID_DATA_MAX);
+
+	/* enforce limit on the scratch buffer alignment */
+	BUG_ON(((uintptr_t)pd & 63) != 0);
+
+	/* the parity of the changed blocks is put in the scratch buffer */
+	for (l = 0; l < np; ++l)
+		s[nd + l] = pd + l * RAID_SLICE_SIZE;
+
+	for (offset = 0; offset < size; offset += slice) {
+		slice = size - offset;
+		if (slice > RAID_SLICE_SIZE)
+			slice = RAID_SLICE_SIZE;
+
+		/* the not changed blocks don't contribute to the delta */
+		for (j = 0; j < nd; ++j)
+			s[j] = raid_zero_block;
+		for (j = 0; j < nr; ++j)
+			s[id[j]] = v[id[j]] + offset;
+
+		raid_gen_ptr[np - 1](nd, slice, (void **)s);
+
+		/* add the delta to the parity */
+		for (l = 0; l < np; ++l) {
+			uint8_t *p = v[nd + l] + offset;
+			uint8_t *d = s[nd + l];
+
+			for (i = 0; i < slice; i += sizeof(uintptr_t))
+				*(uintptr_t *)(p + i) ^= *(uintptr_t *)(d + i);
+		}
+	}
+}
+
 /**
  * Inverts the square matrix M of size nxn into V.
  *
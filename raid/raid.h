@@ -44,6 +44,11 @@
  */
 #define RAID_DATA_MAX 251
 
+/**
+ * Size of the scratch buffer used by raid_syndrome() and raid_gen_delta().
+ */
+#define RAID_SCRATCH_SIZE (RAID_PARITY_MAX * 16 * 1024)
+
 /**
  * Initializes the RAID system.
  *
@@ -103,6 +108,65 @@ void raid_zero(void *zero);
  */
 void raid_gen(int nd, int np, size_t size, void **v);
 
+/**
+ * Checks parity blocks computing their syndromes.
+ *
+ * This function verifies that the provided parity blocks, like the parity
+ * read from disk, match the data blocks. The syndrome of each parity is the
+ * xor of the provided parity with the parity computed from the data, and
+ * it's zero if they match.
+ *
+ * The blocks are processed in slices small enough to stay in the cache,
+ * and the computed parity of each slice is kept in the @scratch buffer
+ * that is never stored in memory. No caller buffer of the block size for
+ * the computed parity is needed, and no block is modified.
+ *
+ * @nd Number of data blocks.
+ * @np Number of parities blocks to check.
+ * @size Size of the blocks pointed by @v and @p. It must be a multiplier of 64.
+ * @v Vector of @nd pointers to the blocks of data.
+ * @p Vector of @np pointers to the parity blocks to check.
+ *   A 0 pointer means that the corresponding parity is not checked.
+ * @diff Vector of @np elements filled with the number of bits set in the
+ *   syndrome of each parity, that is the number of bits not matching.
+ *   It can be 0 if not needed.
+ * @scratch Buffer of RAID_SCRATCH_SIZE bytes, aligned at 64 bytes.
+ *   Its content is overwritten. Concurrent calls need different buffers.
+ * @return Bitmask of the parities not matching. Bit 0 is the first parity.
+ *   0 if all the checked parities are matching.
+ */
+int raid_syndrome(int nd, int np, size_t size, void **v, void **p, unsigned *diff, void *scratch);
+
+/**
+ * Updates parity blocks with the change of some data blocks.
+ *
+ * This function adds to the parity blocks the parity computed over only
+ * the changed data blocks, without reading the not changed ones.
+ *
+ * Each changed data block has to contain the difference (xor) between the
+ * new and the old data. If the old data was all zero, like for new data
+ * written in an empty space, it's the new data itself.
+ *
+ * The blocks are processed in slices small enough to stay in the cache,
+ * and the parity of the changed blocks is kept in the @scratch buffer.
+ *
+ * @nr Number of changed data blocks.
+ * @id[] Vector of @nr indexes of the changed data blocks.
+ *   The indexes start from 0.
+ * @nd Number of data blocks.
+ * @np Number of parities blocks to update.
+ * @size Size of the blocks pointed by @v. It must be a multiplier of 64.
+ * @v Vector of pointers to the blocks of data and parity, like in raid_gen().
+ *   Only the data blocks in @id[] are read, and the other data pointers
+ *   are ignored. The parity blocks contain the old parity, and they
+ *   are updated with the new one.
+ * @scratch Buffer of RAID_SCRATCH_SIZE bytes, aligned at 64 bytes.
+ *   Its content is overwritten. Concurrent calls need different buffers.
+ *
+ * The zero block must be set with raid_zero().
+ */
+void raid_gen_delta(int nr, int *id, int nd, int np, size_t size, void **v, void *scratch);
+
 /**
  * Recovers failures in data and parity blocks.
  *
@@ -54,6 +54,18 @@ static struct raid_func {
 	{ "avx2", raid_rec2_avx2 },
 	{ "avx2", raid_recX_avx2 },
 #endif
+#ifdef CONFIG_AVX512BW
+	{ "avx512", raid_gen1_avx512bw },
+	{ "avx512", raid_gen2_avx512bw },
+	{ "avx512", raid_rec1_avx512bw },
+	{ "avx512", raid_rec2_avx512bw },
+	{ "avx512", raid_recX_avx512bw },
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+	{ "gfni", raid_rec1_gfni },
+	{ "gfni", raid_rec2_gfni },
+	{ "gfni", raid_recX_gfni },
+#endif
 #endif
 
 #ifdef CONFIG_X86_64
@@ -74,6 +86,19 @@ static struct raid_func {
 	{ "avx2e", raid_gen5_avx2ext },
 	{ "avx2e", raid_gen6_avx2ext },
 #endif
+#ifdef CONFIG_AVX512BW
+	{ "avx512", raid_gen3_avx512bw },
+	{ "avx512", raid_genz_avx512bw },
+	{ "avx512", raid_gen4_avx512bw },
+	{ "avx512", raid_gen5_avx512bw },
+	{ "avx512", raid_gen6_avx512bw },
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+	{ "gfni", raid_gen3_gfni },
+	{ "gfni", raid_gen4_gfni },
+	{ "gfni", raid_gen5_gfni },
+	{ "gfni", raid_gen6_gfni },
+#endif
 #endif
 	{ 0, 0 }
 };
@@ -145,7 +145,7 @@ int raid_test_sort(void)
 
 int raid_test_rec(int mode, int nd, size_t size)
 {
-	void (*f[RAID_PARITY_MAX][4])(
+	void (*f[RAID_PARITY_MAX][8])(
 		int nr, int *id, int *ip, int nd, size_t size, void **vbuf);
 	void *v_alloc;
 	void **v;
@@ -208,6 +208,14 @@ int raid_test_rec(int mode, int nd, size_t size)
 			if (raid_cpu_has_avx2())
 				f[i][nf[i]++] = raid_rec1_avx2;
 #endif
+#ifdef CONFIG_AVX512BW
+			if (raid_cpu_has_avx512bw())
+				f[i][nf[i]++] = raid_rec1_avx512bw;
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+			if (raid_cpu_has_gfni())
+				f[i][nf[i]++] = raid_rec1_gfni;
+#endif
 #endif
 		} else if (i == 1) {
 			f[i][nf[i]++] = raid_rec2_int8;
@@ -220,6 +228,14 @@ int raid_test_rec(int mode, int nd, size_t size)
 			if (raid_cpu_has_avx2())
 				f[i][nf[i]++] = raid_rec2_avx2;
 #endif
+#ifdef CONFIG_AVX512BW
+			if (raid_cpu_has_avx512bw())
+				f[i][nf[i]++] = raid_rec2_avx512bw;
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+			if (raid_cpu_has_gfni())
+				f[i][nf[i]++] = raid_rec2_gfni;
+#endif
 #endif
 		} else {
 			f[i][nf[i]++] = raid_recX_int8;
@@ -232,6 +248,14 @@ int raid_test_rec(int mode, int nd, size_t size)
 			if (raid_cpu_has_avx2())
 				f[i][nf[i]++] = raid_recX_avx2;
 #endif
+#ifdef CONFIG_AVX512BW
+			if (raid_cpu_has_avx512bw())
+				f[i][nf[i]++] = raid_recX_avx512bw;
+#endif
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+			if (raid_cpu_has_gfni())
+				f[i][nf[i]++] = raid_recX_gfni;
+#endif
 #endif
 		}
 	}
@@ -365,6 +389,13 @@ int raid_test_par(int mode, int nd, size_t size)
 		f[nf++] = raid_gen2_avx2;
 	}
 #endif
+
+#ifdef CONFIG_AVX512BW
+	if (raid_cpu_has_avx512bw()) {
+		f[nf++] = raid_gen1_avx512bw;
+		f[nf++] = raid_gen2_avx512bw;
+	}
+#endif
 #endif /* CONFIG_X86 */
 
 	if (mode == RAID_MODE_CAUCHY) {
@@ -399,6 +430,28 @@ int raid_test_par(int mode, int nd, size_t size)
 		}
 #endif
 #endif
+
+#ifdef CONFIG_AVX512BW
+#ifdef CONFIG_X86_64
+		if (raid_cpu_has_avx512bw()) {
+			f[nf++] = raid_gen3_avx512bw;
+			f[nf++] = raid_gen4_avx512bw;
+			f[nf++] = raid_gen5_avx512bw;
+			f[nf++] = raid_gen6_avx512bw;
+		}
+#endif
+#endif
+
+#if defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+#ifdef CONFIG_X86_64
+		if (raid_cpu_has_gfni()) {
+			f[nf++] = raid_gen3_gfni;
+			f[nf++] = raid_gen4_gfni;
+			f[nf++] = raid_gen5_gfni;
+			f[nf++] = raid_gen6_gfni;
+		}
+#endif
+#endif
 #endif /* CONFIG_X86 */
 	} else {
 		f[nf++] = raid_genz_int32;
@@ -420,6 +473,13 @@ int raid_test_par(int mode, int nd, size_t size)
 			f[nf++] = raid_genz_avx2ext;
 #endif
 #endif
+
+#ifdef CONFIG_AVX512BW
+#ifdef CONFIG_X86_64
+		if (raid_cpu_has_avx512bw())
+			f[nf++] = raid_genz_avx512bw;
+#endif
+#endif
 #endif /* CONFIG_X86 */
 	}
 
@@ -450,3 +510,215 @@ bail:
 	/* LCOV_EXCL_STOP */
 }
 
+
+int raid_test_syndrome(int mode, int nd, size_t size)
+{
+	void *v_alloc;
+	void **v;
+	void *scratch_alloc;
+	void *scratch;
+	uint8_t *p[RAID_PARITY_MAX];
+	unsigned diff[RAID_PARITY_MAX];
+	int nv;
+	int l;
+	int np;
+	int np_max;
+
+	raid_mode(mode);
+	if (mode == RAID_MODE_CAUCHY)
+		np_max = RAID_PARITY_MAX;
+	else
+		np_max = 3;
+
+	nv = nd + np_max;
+
+	v = raid_malloc_vector(nd, nv, size, &v_alloc);
+	if (!v) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	scratch = raid_malloc(RAID_SCRATCH_SIZE, &scratch_alloc);
+	if (!scratch) {
+		/* LCOV_EXCL_START */
+		free(v_alloc);
+		free(v);
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* fill with pseudo-random data with the arbitrary seed "3" */
+	raid_mrand_vector(3, nv, size, v);
+
+	/* compute the parity to check */
+	raid_gen_ref(nd, np_max, size, v);
+	for (l = 0; l < np_max; ++l)
+		p[l] = v[nd + l];
+
+	for (np = 1; np <= np_max; ++np) {
+		/* all matching */
+		if (raid_syndrome(nd, np, size, v, (void **)p, diff, scratch) != 0) {
+			/* LCOV_EXCL_START */
+			goto bail;
+			/* LCOV_EXCL_STOP */
+		}
+		for (l = 0; l < np; ++l) {
+			if (diff[l] != 0) {
+				/* LCOV_EXCL_START */
+				goto bail;
+				/* LCOV_EXCL_STOP */
+			}
+		}
+
+		/* one wrong bit in the first byte of the first parity */
+		p[0][0] ^= 1;
+		if (raid_syndrome(nd, np, size, v, (void **)p, diff, scratch) != 1 || diff[0] != 1) {
+			/* LCOV_EXCL_START */
+			goto bail;
+			/* LCOV_EXCL_STOP */
+		}
+		p[0][0] ^= 1;
+
+		/* eight wrong bits in the last byte of the last parity */
+		p[np - 1][size - 1] ^= 0xFF;
+		if (raid_syndrome(nd, np, size, v, (void **)p, diff, scratch) != 1 << (np - 1) || diff[np - 1] != 8) {
+			/* LCOV_EXCL_START */
+			goto bail;
+			/* LCOV_EXCL_STOP */
+		}
+
+		/* the wrong parity is not checked */
+		p[np - 1] = 0;
+		if (raid_syndrome(nd, np, size, v, (void **)p, 0, scratch) != 0) {
+			/* LCOV_EXCL_START */
+			goto bail;
+			/* LCOV_EXCL_STOP */
+		}
+		p[np - 1] = v[nd + np - 1];
+		p[np - 1][size - 1] ^= 0xFF;
+	}
+
+	free(scratch_alloc);
+	free(v_alloc);
+	free(v);
+	return 0;
+
+bail:
+	/* LCOV_EXCL_START */
+	free(scratch_alloc);
+	free(v_alloc);
+	free(v);
+	return -1;
+	/* LCOV_EXCL_STOP */
+}
+
+int raid_test_delta(int mode, int nd, size_t size)
+{
+	void *v_alloc;
+	void **v;
+	void *scratch_alloc;
+	void *scratch;
+	void *w[RAID_DATA_MAX + RAID_PARITY_MAX];
+	uint8_t **n;
+	uint8_t **d;
+	uint8_t **e;
+	int id[RAID_PARITY_MAX];
+	int nv;
+	int nr;
+	int np;
+	int np_max;
+	int j, l;
+	size_t i;
+
+	raid_mode(mode);
+	if (mode == RAID_MODE_CAUCHY)
+		np_max = RAID_PARITY_MAX;
+	else
+		np_max = 3;
+
+	/* data, parity, new data, delta, expected parity and zero */
+	nv = nd + np_max + RAID_PARITY_MAX * 2 + np_max + 1;
+
+	v = raid_malloc_vector(nd, nv, size, &v_alloc);
+	if (!v) {
+		/* LCOV_EXCL_START */
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	scratch = raid_malloc(RAID_SCRATCH_SIZE, &scratch_alloc);
+	if (!scratch) {
+		/* LCOV_EXCL_START */
+		free(v_alloc);
+		free(v);
+		return -1;
+		/* LCOV_EXCL_STOP */
+	}
+
+	/* fill with pseudo-random data with the arbitrary seed "4" */
+	raid_mrand_vector(4, nv, size, v);
+
+	n = (uint8_t **)v + nd + np_max;
+	d = n + RAID_PARITY_MAX;
+	e = d + RAID_PARITY_MAX;
+
+	memset(v[nv - 1], 0, size);
+	raid_zero(v[nv - 1]);
+
+	for (np = 1; np <= np_max; ++np) {
+		for (nr = 1; nr <= np && nr <= nd; ++nr) {
+			/* compute the old parity */
+			raid_gen(nd, np, size, v);
+
+			/* change the last data blocks, computing the delta */
+			for (j = 0; j < nr; ++j) {
+				uint8_t *old = v[nd - nr + j];
+
+				for (i = 0; i < size; ++i)
+					d[j][i] = old[i] ^ n[j][i];
+
+				id[j] = nd - nr + j;
+			}
+
+			/* update the old parity with the delta */
+			for (j = 0; j < nd; ++j)
+				w[j] = 0;
+			for (j = 0; j < nr; ++j)
+				w[id[j]] = d[j];
+			for (l = 0; l < np; ++l)
+				w[nd + l] = v[nd + l];
+			raid_gen_delta(nr, id, nd, np, size, w, scratch);
+
+			/* compute the expected parity from the new data */
+			for (j = 0; j < nd; ++j)
+				w[j] = v[j];
+			for (j = 0; j < nr; ++j)
+				w[id[j]] = n[j];
+			for (l = 0; l < np; ++l)
+				w[nd + l] = e[l];
+			raid_gen(nd, np, size, w);
+
+			for (l = 0; l < np; ++l) {
+				if (memcmp(v[nd + l], e[l], size) != 0) {
+					/* LCOV_EXCL_START */
+					goto bail;
+					/* LCOV_EXCL_STOP */
+				}
+			}
+		}
+	}
+
+	free(scratch_alloc);
+	free(v_alloc);
+	free(v);
+	return 0;
+
+bail:
+	/* LCOV_EXCL_START */
+	free(scratch_alloc);
+	free(v_alloc);
+	free(v);
+	return -1;
+	/* LCOV_EXCL_STOP */
+}
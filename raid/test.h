@@ -64,5 +64,30 @@ int raid_test_rec(unsigned mode, int nd, size_t size);
  */
 int raid_test_par(unsigned mode, int nd, size_t size);
 
+/**
+ * Tests the parity check function.
+ *
+ * The raid_syndrome() function is tested with all the parity levels,
+ * with wrong bits at the start and at the end of the parity to check.
+ *
+ * Use a size of more slices to test also the slicing.
+ *
+ * Returns 0 on success.
+ */
+int raid_test_syndrome(unsigned mode, int nd, size_t size);
+
+/**
+ * Tests the parity delta update function.
+ *
+ * The raid_gen_delta() function is tested with all the parity levels,
+ * and with all the numbers of changed blocks up to the parity level,
+ * comparing the updated parity with the one computed from the new data.
+ *
+ * Use a size of more slices to test also the slicing.
+ *
+ * Returns 0 on success.
+ */
+int raid_test_delta(unsigned mode, int nd, size_t size);
+
 #endif
 
@@ -101,6 +101,35 @@ void raid_gen1_avx2(int nd, size_t size, void **vv)
 }
 #endif
 
+#if defined(CONFIG_X86) && defined(CONFIG_AVX512BW)
+/*
+ * GEN1 (RAID5 with xor) AVX512BW implementation
+ *
+ * A single zmm register covers the whole 64 bytes cache block.
+ */
+void raid_gen1_avx512bw(int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	int d, l;
+	size_t i;
+
+	l = nd - 1;
+	p = v[nd];
+
+	raid_avx_begin();
+
+	for (i = 0; i < size; i += 64) {
+		asm volatile ("vmovdqa64 %0,%%zmm0" : : "m" (v[l][i]));
+		for (d = l - 1; d >= 0; --d)
+			asm volatile ("vpxorq %0,%%zmm0,%%zmm0" : : "m" (v[d][i]));
+		asm volatile ("vmovntdq %%zmm0,%0" : "=m" (p[i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
 #if defined(CONFIG_X86) && defined(CONFIG_SSE2)
 static const struct gfconst16 {
 	uint8_t poly[16];
@@ -224,6 +253,48 @@ void raid_gen2_avx2(int nd, size_t size, void **vv)
 }
 #endif
 
+#if defined(CONFIG_X86) && defined(CONFIG_AVX512BW)
+/*
+ * GEN2 (RAID6 with powers of 2) AVX512BW implementation
+ *
+ * The byte mask of VPMOVB2M replaces the comparison with zero used
+ * to select the bytes to reduce with the polynomial.
+ */
+void raid_gen2_avx512bw(int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	uint8_t *q;
+	int d, l;
+	size_t i;
+
+	l = nd - 1;
+	p = v[nd];
+	q = v[nd + 1];
+
+	raid_avx_begin();
+
+	asm volatile ("vbroadcasti32x4 %0,%%zmm7" : : "m" (gfconst16.poly[0]));
+
+	for (i = 0; i < size; i += 64) {
+		asm volatile ("vmovdqa64 %0,%%zmm0" : : "m" (v[l][i]));
+		asm volatile ("vmovdqa64 %zmm0,%zmm1");
+		for (d = l - 1; d >= 0; --d) {
+			asm volatile ("vmovdqa64 %0,%%zmm4" : : "m" (v[d][i]));
+			asm volatile ("vpmovb2m %zmm1,%k1");
+			asm volatile ("vpaddb %zmm1,%zmm1,%zmm1");
+			asm volatile ("vmovdqu8 %zmm7,%zmm5{%k1}{z}");
+			asm volatile ("vpxorq %zmm4,%zmm0,%zmm0");
+			asm volatile ("vpternlogq $0x96,%zmm4,%zmm5,%zmm1");
+		}
+		asm volatile ("vmovntdq %%zmm0,%0" : "=m" (p[i]));
+		asm volatile ("vmovntdq %%zmm1,%0" : "=m" (q[i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
 #if defined(CONFIG_X86_64) && defined(CONFIG_SSE2)
 /*
  * GEN2 (RAID6 with powers of 2) SSE2 implementation
@@ -675,6 +746,166 @@ void raid_gen3_avx2ext(int nd, size_t size, void **vv)
 }
 #endif
 
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512BW)
+/*
+ * GEN3 (triple parity with Cauchy matrix) AVX512BW implementation
+ *
+ * Note that it uses 16 registers, meaning that x64 is required.
+ */
+void raid_gen3_avx512bw(int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	uint8_t *q;
+	uint8_t *r;
+	int d, l;
+	size_t i;
+
+	l = nd - 1;
+	p = v[nd];
+	q = v[nd + 1];
+	r = v[nd + 2];
+
+	/* special case with only one data disk */
+	if (l == 0) {
+		for (i = 0; i < 3; ++i)
+			memcpy(v[1 + i], v[0], size);
+		return;
+	}
+
+	raid_avx_begin();
+
+	/* generic case with at least two data disks */
+	asm volatile ("vbroadcasti32x4 %0,%%zmm14" : : "m" (gfconst16.poly[0]));
+	asm volatile ("vbroadcasti32x4 %0,%%zmm15" : : "m" (gfconst16.low4[0]));
+
+	for (i = 0; i < size; i += 64) {
+		/* last disk without the by two multiplication */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[l][i]));
+
+		asm volatile ("vmovdqa64 %zmm10,%zmm0");
+		asm volatile ("vmovdqa64 %zmm10,%zmm1");
+
+		asm volatile ("vpsrlw  $4,%zmm10,%zmm11");
+		asm volatile ("vpandq  %zmm15,%zmm10,%zmm10");
+		asm volatile ("vpandq  %zmm15,%zmm11,%zmm11");
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[l][0][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[l][0][1][0]));
+		asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+		asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+		asm volatile ("vpxorq  %zmm13,%zmm12,%zmm2");
+
+		/* intermediate disks */
+		for (d = l - 1; d > 0; --d) {
+			asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[d][i]));
+
+			asm volatile ("vpmovb2m %zmm1,%k1");
+			asm volatile ("vpaddb %zmm1,%zmm1,%zmm1");
+			asm volatile ("vmovdqu8 %zmm14,%zmm11{%k1}{z}");
+			asm volatile ("vpternlogq $0x96,%zmm10,%zmm11,%zmm1");
+			asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+
+			asm volatile ("vpsrlw  $4,%zmm10,%zmm11");
+			asm volatile ("vpandq  %zmm15,%zmm10,%zmm10");
+			asm volatile ("vpandq  %zmm15,%zmm11,%zmm11");
+
+			asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[d][0][0][0]));
+			asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[d][0][1][0]));
+			asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+			asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+			asm volatile ("vpternlogq $0x96,%zmm12,%zmm13,%zmm2");
+		}
+
+		/* first disk with all coefficients at 1 */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[0][i]));
+
+		asm volatile ("vpmovb2m %zmm1,%k1");
+		asm volatile ("vpaddb %zmm1,%zmm1,%zmm1");
+		asm volatile ("vmovdqu8 %zmm14,%zmm11{%k1}{z}");
+		asm volatile ("vpternlogq $0x96,%zmm10,%zmm11,%zmm1");
+		asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+		asm volatile ("vpxorq %zmm10,%zmm2,%zmm2");
+
+		asm volatile ("vmovntdq %%zmm0,%0" : "=m" (p[i]));
+		asm volatile ("vmovntdq %%zmm1,%0" : "=m" (q[i]));
+		asm volatile ("vmovntdq %%zmm2,%0" : "=m" (r[i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+/*
+ * GEN3 (triple parity with Cauchy matrix) GFNI implementation
+ *
+ * Note that it uses 16 registers, meaning that x64 is required.
+ */
+void raid_gen3_gfni(int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	uint8_t *q;
+	uint8_t *r;
+	int d, l;
+	size_t i;
+
+	l = nd - 1;
+	p = v[nd];
+	q = v[nd + 1];
+	r = v[nd + 2];
+
+	/* special case with only one data disk */
+	if (l == 0) {
+		for (i = 0; i < 3; ++i)
+			memcpy(v[1 + i], v[0], size);
+		return;
+	}
+
+	raid_avx_begin();
+
+	/* generic case with at least two data disks */
+	asm volatile ("vpbroadcastq %0,%%zmm14" : : "m" (gfmulgfni[2]));
+
+	for (i = 0; i < size; i += 64) {
+		/* last disk without the by two multiplication */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[l][i]));
+
+		asm volatile ("vmovdqa64 %zmm10,%zmm0");
+		asm volatile ("vmovdqa64 %zmm10,%zmm1");
+
+		asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm2" : : "m" (gfgengfni[l][0]));
+
+		/* intermediate disks */
+		for (d = l - 1; d > 0; --d) {
+			asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[d][i]));
+
+			asm volatile ("vgf2p8affineqb $0,%zmm14,%zmm1,%zmm1");
+			asm volatile ("vpxorq %zmm10,%zmm1,%zmm1");
+			asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm11" : : "m" (gfgengfni[d][0]));
+			asm volatile ("vpxorq %zmm11,%zmm2,%zmm2");
+		}
+
+		/* first disk with all coefficients at 1 */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[0][i]));
+
+		asm volatile ("vgf2p8affineqb $0,%zmm14,%zmm1,%zmm1");
+		asm volatile ("vpxorq %zmm10,%zmm1,%zmm1");
+		asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+		asm volatile ("vpxorq %zmm10,%zmm2,%zmm2");
+
+		asm volatile ("vmovntdq %%zmm0,%0" : "=m" (p[i]));
+		asm volatile ("vmovntdq %%zmm1,%0" : "=m" (q[i]));
+		asm volatile ("vmovntdq %%zmm2,%0" : "=m" (r[i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
 #if defined(CONFIG_X86) && defined(CONFIG_SSSE3)
 /*
  * GEN4 (quad parity with Cauchy matrix) SSSE3 implementation
@@ -1125,6 +1356,189 @@ void raid_gen4_avx2ext(int nd, size_t size, void **vv)
 }
 #endif
 
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512BW)
+/*
+ * GEN4 (quad parity with Cauchy matrix) AVX512BW implementation
+ *
+ * Note that it uses 16 registers, meaning that x64 is required.
+ */
+void raid_gen4_avx512bw(int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	uint8_t *q;
+	uint8_t *r;
+	uint8_t *s;
+	int d, l;
+	size_t i;
+
+	l = nd - 1;
+	p = v[nd];
+	q = v[nd + 1];
+	r = v[nd + 2];
+	s = v[nd + 3];
+
+	/* special case with only one data disk */
+	if (l == 0) {
+		for (i = 0; i < 4; ++i)
+			memcpy(v[1 + i], v[0], size);
+		return;
+	}
+
+	raid_avx_begin();
+
+	/* generic case with at least two data disks */
+	asm volatile ("vbroadcasti32x4 %0,%%zmm14" : : "m" (gfconst16.poly[0]));
+	asm volatile ("vbroadcasti32x4 %0,%%zmm15" : : "m" (gfconst16.low4[0]));
+
+	for (i = 0; i < size; i += 64) {
+		/* last disk without the by two multiplication */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[l][i]));
+
+		asm volatile ("vmovdqa64 %zmm10,%zmm0");
+		asm volatile ("vmovdqa64 %zmm10,%zmm1");
+
+		asm volatile ("vpsrlw  $4,%zmm10,%zmm11");
+		asm volatile ("vpandq  %zmm15,%zmm10,%zmm10");
+		asm volatile ("vpandq  %zmm15,%zmm11,%zmm11");
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[l][0][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[l][0][1][0]));
+		asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+		asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+		asm volatile ("vpxorq  %zmm13,%zmm12,%zmm2");
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[l][1][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[l][1][1][0]));
+		asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+		asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+		asm volatile ("vpxorq  %zmm13,%zmm12,%zmm3");
+
+		/* intermediate disks */
+		for (d = l - 1; d > 0; --d) {
+			asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[d][i]));
+
+			asm volatile ("vpmovb2m %zmm1,%k1");
+			asm volatile ("vpaddb %zmm1,%zmm1,%zmm1");
+			asm volatile ("vmovdqu8 %zmm14,%zmm11{%k1}{z}");
+			asm volatile ("vpternlogq $0x96,%zmm10,%zmm11,%zmm1");
+			asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+
+			asm volatile ("vpsrlw  $4,%zmm10,%zmm11");
+			asm volatile ("vpandq  %zmm15,%zmm10,%zmm10");
+			asm volatile ("vpandq  %zmm15,%zmm11,%zmm11");
+
+			asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[d][0][0][0]));
+			asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[d][0][1][0]));
+			asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+			asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+			asm volatile ("vpternlogq $0x96,%zmm12,%zmm13,%zmm2");
+
+			asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[d][1][0][0]));
+			asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[d][1][1][0]));
+			asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+			asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+			asm volatile ("vpternlogq $0x96,%zmm12,%zmm13,%zmm3");
+		}
+
+		/* first disk with all coefficients at 1 */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[0][i]));
+
+		asm volatile ("vpmovb2m %zmm1,%k1");
+		asm volatile ("vpaddb %zmm1,%zmm1,%zmm1");
+		asm volatile ("vmovdqu8 %zmm14,%zmm11{%k1}{z}");
+		asm volatile ("vpternlogq $0x96,%zmm10,%zmm11,%zmm1");
+		asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+		asm volatile ("vpxorq %zmm10,%zmm2,%zmm2");
+		asm volatile ("vpxorq %zmm10,%zmm3,%zmm3");
+
+		asm volatile ("vmovntdq %%zmm0,%0" : "=m" (p[i]));
+		asm volatile ("vmovntdq %%zmm1,%0" : "=m" (q[i]));
+		asm volatile ("vmovntdq %%zmm2,%0" : "=m" (r[i]));
+		asm volatile ("vmovntdq %%zmm3,%0" : "=m" (s[i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+/*
+ * GEN4 (quad parity with Cauchy matrix) GFNI implementation
+ *
+ * Note that it uses 16 registers, meaning that x64 is required.
+ */
+void raid_gen4_gfni(int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	uint8_t *q;
+	uint8_t *r;
+	uint8_t *s;
+	int d, l;
+	size_t i;
+
+	l = nd - 1;
+	p = v[nd];
+	q = v[nd + 1];
+	r = v[nd + 2];
+	s = v[nd + 3];
+
+	/* special case with only one data disk */
+	if (l == 0) {
+		for (i = 0; i < 4; ++i)
+			memcpy(v[1 + i], v[0], size);
+		return;
+	}
+
+	raid_avx_begin();
+
+	/* generic case with at least two data disks */
+	asm volatile ("vpbroadcastq %0,%%zmm14" : : "m" (gfmulgfni[2]));
+
+	for (i = 0; i < size; i += 64) {
+		/* last disk without the by two multiplication */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[l][i]));
+
+		asm volatile ("vmovdqa64 %zmm10,%zmm0");
+		asm volatile ("vmovdqa64 %zmm10,%zmm1");
+
+		asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm2" : : "m" (gfgengfni[l][0]));
+		asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm3" : : "m" (gfgengfni[l][1]));
+
+		/* intermediate disks */
+		for (d = l - 1; d > 0; --d) {
+			asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[d][i]));
+
+			asm volatile ("vgf2p8affineqb $0,%zmm14,%zmm1,%zmm1");
+			asm volatile ("vpxorq %zmm10,%zmm1,%zmm1");
+			asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm11" : : "m" (gfgengfni[d][0]));
+			asm volatile ("vpxorq %zmm11,%zmm2,%zmm2");
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm11" : : "m" (gfgengfni[d][1]));
+			asm volatile ("vpxorq %zmm11,%zmm3,%zmm3");
+		}
+
+		/* first disk with all coefficients at 1 */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[0][i]));
+
+		asm volatile ("vgf2p8affineqb $0,%zmm14,%zmm1,%zmm1");
+		asm volatile ("vpxorq %zmm10,%zmm1,%zmm1");
+		asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+		asm volatile ("vpxorq %zmm10,%zmm2,%zmm2");
+		asm volatile ("vpxorq %zmm10,%zmm3,%zmm3");
+
+		asm volatile ("vmovntdq %%zmm0,%0" : "=m" (p[i]));
+		asm volatile ("vmovntdq %%zmm1,%0" : "=m" (q[i]));
+		asm volatile ("vmovntdq %%zmm2,%0" : "=m" (r[i]));
+		asm volatile ("vmovntdq %%zmm3,%0" : "=m" (s[i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
 #if defined(CONFIG_X86) && defined(CONFIG_SSSE3)
 /*
  * GEN5 (penta parity with Cauchy matrix) SSSE3 implementation
@@ -1525,11 +1939,13 @@ void raid_gen5_avx2ext(int nd, size_t size, void **vv)
 }
 #endif
 
-#if defined(CONFIG_X86) && defined(CONFIG_SSSE3)
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512BW)
 /*
- * GEN6 (hexa parity with Cauchy matrix) SSSE3 implementation
+ * GEN5 (penta parity with Cauchy matrix) AVX512BW implementation
+ *
+ * Note that it uses 16 registers, meaning that x64 is required.
  */
-void raid_gen6_ssse3(int nd, size_t size, void **vv)
+void raid_gen5_avx512bw(int nd, size_t size, void **vv)
 {
 	uint8_t **v = (uint8_t **)vv;
 	uint8_t *p;
@@ -1537,11 +1953,8 @@ void raid_gen6_ssse3(int nd, size_t size, void **vv)
 	uint8_t *r;
 	uint8_t *s;
 	uint8_t *t;
-	uint8_t *u;
 	int d, l;
 	size_t i;
-	uint8_t buffer[2*16+16];
-	uint8_t *pd = __align_ptr(buffer, 16);
 
 	l = nd - 1;
 	p = v[nd];
@@ -1549,26 +1962,233 @@ void raid_gen6_ssse3(int nd, size_t size, void **vv)
 	r = v[nd + 2];
 	s = v[nd + 3];
 	t = v[nd + 4];
-	u = v[nd + 5];
 
 	/* special case with only one data disk */
 	if (l == 0) {
-		for (i = 0; i < 6; ++i)
+		for (i = 0; i < 5; ++i)
 			memcpy(v[1 + i], v[0], size);
 		return;
 	}
 
-	raid_sse_begin();
+	raid_avx_begin();
 
 	/* generic case with at least two data disks */
-	for (i = 0; i < size; i += 16) {
+	asm volatile ("vbroadcasti32x4 %0,%%zmm14" : : "m" (gfconst16.poly[0]));
+	asm volatile ("vbroadcasti32x4 %0,%%zmm15" : : "m" (gfconst16.low4[0]));
+
+	for (i = 0; i < size; i += 64) {
 		/* last disk without the by two multiplication */
-		asm volatile ("movdqa %0,%%xmm4" : : "m" (v[l][i]));
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[l][i]));
 
-		asm volatile ("movdqa %%xmm4,%0" : "=m" (pd[0]));
-		asm volatile ("movdqa %%xmm4,%0" : "=m" (pd[16]));
+		asm volatile ("vmovdqa64 %zmm10,%zmm0");
+		asm volatile ("vmovdqa64 %zmm10,%zmm1");
 
-		asm volatile ("movdqa %0,%%xmm7" : : "m" (gfconst16.low4[0]));
+		asm volatile ("vpsrlw  $4,%zmm10,%zmm11");
+		asm volatile ("vpandq  %zmm15,%zmm10,%zmm10");
+		asm volatile ("vpandq  %zmm15,%zmm11,%zmm11");
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[l][0][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[l][0][1][0]));
+		asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+		asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+		asm volatile ("vpxorq  %zmm13,%zmm12,%zmm2");
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[l][1][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[l][1][1][0]));
+		asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+		asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+		asm volatile ("vpxorq  %zmm13,%zmm12,%zmm3");
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[l][2][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[l][2][1][0]));
+		asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+		asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+		asm volatile ("vpxorq  %zmm13,%zmm12,%zmm4");
+
+		/* intermediate disks */
+		for (d = l - 1; d > 0; --d) {
+			asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[d][i]));
+
+			asm volatile ("vpmovb2m %zmm1,%k1");
+			asm volatile ("vpaddb %zmm1,%zmm1,%zmm1");
+			asm volatile ("vmovdqu8 %zmm14,%zmm11{%k1}{z}");
+			asm volatile ("vpternlogq $0x96,%zmm10,%zmm11,%zmm1");
+			asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+
+			asm volatile ("vpsrlw  $4,%zmm10,%zmm11");
+			asm volatile ("vpandq  %zmm15,%zmm10,%zmm10");
+			asm volatile ("vpandq  %zmm15,%zmm11,%zmm11");
+
+			asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[d][0][0][0]));
+			asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[d][0][1][0]));
+			asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+			asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+			asm volatile ("vpternlogq $0x96,%zmm12,%zmm13,%zmm2");
+
+			asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[d][1][0][0]));
+			asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[d][1][1][0]));
+			asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+			asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+			asm volatile ("vpternlogq $0x96,%zmm12,%zmm13,%zmm3");
+
+			asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[d][2][0][0]));
+			asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[d][2][1][0]));
+			asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+			asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+			asm volatile ("vpternlogq $0x96,%zmm12,%zmm13,%zmm4");
+		}
+
+		/* first disk with all coefficients at 1 */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[0][i]));
+
+		asm volatile ("vpmovb2m %zmm1,%k1");
+		asm volatile ("vpaddb %zmm1,%zmm1,%zmm1");
+		asm volatile ("vmovdqu8 %zmm14,%zmm11{%k1}{z}");
+		asm volatile ("vpternlogq $0x96,%zmm10,%zmm11,%zmm1");
+		asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+		asm volatile ("vpxorq %zmm10,%zmm2,%zmm2");
+		asm volatile ("vpxorq %zmm10,%zmm3,%zmm3");
+		asm volatile ("vpxorq %zmm10,%zmm4,%zmm4");
+
+		asm volatile ("vmovntdq %%zmm0,%0" : "=m" (p[i]));
+		asm volatile ("vmovntdq %%zmm1,%0" : "=m" (q[i]));
+		asm volatile ("vmovntdq %%zmm2,%0" : "=m" (r[i]));
+		asm volatile ("vmovntdq %%zmm3,%0" : "=m" (s[i]));
+		asm volatile ("vmovntdq %%zmm4,%0" : "=m" (t[i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+/*
+ * GEN5 (penta parity with Cauchy matrix) GFNI implementation
+ *
+ * Note that it uses 16 registers, meaning that x64 is required.
+ */
+void raid_gen5_gfni(int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	uint8_t *q;
+	uint8_t *r;
+	uint8_t *s;
+	uint8_t *t;
+	int d, l;
+	size_t i;
+
+	l = nd - 1;
+	p = v[nd];
+	q = v[nd + 1];
+	r = v[nd + 2];
+	s = v[nd + 3];
+	t = v[nd + 4];
+
+	/* special case with only one data disk */
+	if (l == 0) {
+		for (i = 0; i < 5; ++i)
+			memcpy(v[1 + i], v[0], size);
+		return;
+	}
+
+	raid_avx_begin();
+
+	/* generic case with at least two data disks */
+	asm volatile ("vpbroadcastq %0,%%zmm14" : : "m" (gfmulgfni[2]));
+
+	for (i = 0; i < size; i += 64) {
+		/* last disk without the by two multiplication */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[l][i]));
+
+		asm volatile ("vmovdqa64 %zmm10,%zmm0");
+		asm volatile ("vmovdqa64 %zmm10,%zmm1");
+
+		asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm2" : : "m" (gfgengfni[l][0]));
+		asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm3" : : "m" (gfgengfni[l][1]));
+		asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm4" : : "m" (gfgengfni[l][2]));
+
+		/* intermediate disks */
+		for (d = l - 1; d > 0; --d) {
+			asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[d][i]));
+
+			asm volatile ("vgf2p8affineqb $0,%zmm14,%zmm1,%zmm1");
+			asm volatile ("vpxorq %zmm10,%zmm1,%zmm1");
+			asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm11" : : "m" (gfgengfni[d][0]));
+			asm volatile ("vpxorq %zmm11,%zmm2,%zmm2");
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm11" : : "m" (gfgengfni[d][1]));
+			asm volatile ("vpxorq %zmm11,%zmm3,%zmm3");
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm11" : : "m" (gfgengfni[d][2]));
+			asm volatile ("vpxorq %zmm11,%zmm4,%zmm4");
+		}
+
+		/* first disk with all coefficients at 1 */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[0][i]));
+
+		asm volatile ("vgf2p8affineqb $0,%zmm14,%zmm1,%zmm1");
+		asm volatile ("vpxorq %zmm10,%zmm1,%zmm1");
+		asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+		asm volatile ("vpxorq %zmm10,%zmm2,%zmm2");
+		asm volatile ("vpxorq %zmm10,%zmm3,%zmm3");
+		asm volatile ("vpxorq %zmm10,%zmm4,%zmm4");
+
+		asm volatile ("vmovntdq %%zmm0,%0" : "=m" (p[i]));
+		asm volatile ("vmovntdq %%zmm1,%0" : "=m" (q[i]));
+		asm volatile ("vmovntdq %%zmm2,%0" : "=m" (r[i]));
+		asm volatile ("vmovntdq %%zmm3,%0" : "=m" (s[i]));
+		asm volatile ("vmovntdq %%zmm4,%0" : "=m" (t[i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
+#if defined(CONFIG_X86) && defined(CONFIG_SSSE3)
+/*
+ * GEN6 (hexa parity with Cauchy matrix) SSSE3 implementation
+ */
+void raid_gen6_ssse3(int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	uint8_t *q;
+	uint8_t *r;
+	uint8_t *s;
+	uint8_t *t;
+	uint8_t *u;
+	int d, l;
+	size_t i;
+	uint8_t buffer[2*16+16];
+	uint8_t *pd = __align_ptr(buffer, 16);
+
+	l = nd - 1;
+	p = v[nd];
+	q = v[nd + 1];
+	r = v[nd + 2];
+	s = v[nd + 3];
+	t = v[nd + 4];
+	u = v[nd + 5];
+
+	/* special case with only one data disk */
+	if (l == 0) {
+		for (i = 0; i < 6; ++i)
+			memcpy(v[1 + i], v[0], size);
+		return;
+	}
+
+	raid_sse_begin();
+
+	/* generic case with at least two data disks */
+	for (i = 0; i < size; i += 16) {
+		/* last disk without the by two multiplication */
+		asm volatile ("movdqa %0,%%xmm4" : : "m" (v[l][i]));
+
+		asm volatile ("movdqa %%xmm4,%0" : "=m" (pd[0]));
+		asm volatile ("movdqa %%xmm4,%0" : "=m" (pd[16]));
+
+		asm volatile ("movdqa %0,%%xmm7" : : "m" (gfconst16.low4[0]));
 		asm volatile ("movdqa %xmm4,%xmm5");
 		asm volatile ("psrlw  $4,%xmm5");
 		asm volatile ("pand   %xmm7,%xmm4");
@@ -1980,6 +2600,235 @@ void raid_gen6_avx2ext(int nd, size_t size, void **vv)
 }
 #endif
 
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512BW)
+/*
+ * GEN6 (hexa parity with Cauchy matrix) AVX512BW implementation
+ *
+ * Note that it uses 16 registers, meaning that x64 is required.
+ */
+void raid_gen6_avx512bw(int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	uint8_t *q;
+	uint8_t *r;
+	uint8_t *s;
+	uint8_t *t;
+	uint8_t *u;
+	int d, l;
+	size_t i;
+
+	l = nd - 1;
+	p = v[nd];
+	q = v[nd + 1];
+	r = v[nd + 2];
+	s = v[nd + 3];
+	t = v[nd + 4];
+	u = v[nd + 5];
+
+	/* special case with only one data disk */
+	if (l == 0) {
+		for (i = 0; i < 6; ++i)
+			memcpy(v[1 + i], v[0], size);
+		return;
+	}
+
+	raid_avx_begin();
+
+	/* generic case with at least two data disks */
+	asm volatile ("vbroadcasti32x4 %0,%%zmm14" : : "m" (gfconst16.poly[0]));
+	asm volatile ("vbroadcasti32x4 %0,%%zmm15" : : "m" (gfconst16.low4[0]));
+
+	for (i = 0; i < size; i += 64) {
+		/* last disk without the by two multiplication */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[l][i]));
+
+		asm volatile ("vmovdqa64 %zmm10,%zmm0");
+		asm volatile ("vmovdqa64 %zmm10,%zmm1");
+
+		asm volatile ("vpsrlw  $4,%zmm10,%zmm11");
+		asm volatile ("vpandq  %zmm15,%zmm10,%zmm10");
+		asm volatile ("vpandq  %zmm15,%zmm11,%zmm11");
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[l][0][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[l][0][1][0]));
+		asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+		asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+		asm volatile ("vpxorq  %zmm13,%zmm12,%zmm2");
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[l][1][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[l][1][1][0]));
+		asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+		asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+		asm volatile ("vpxorq  %zmm13,%zmm12,%zmm3");
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[l][2][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[l][2][1][0]));
+		asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+		asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+		asm volatile ("vpxorq  %zmm13,%zmm12,%zmm4");
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[l][3][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[l][3][1][0]));
+		asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+		asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+		asm volatile ("vpxorq  %zmm13,%zmm12,%zmm5");
+
+		/* intermediate disks */
+		for (d = l - 1; d > 0; --d) {
+			asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[d][i]));
+
+			asm volatile ("vpmovb2m %zmm1,%k1");
+			asm volatile ("vpaddb %zmm1,%zmm1,%zmm1");
+			asm volatile ("vmovdqu8 %zmm14,%zmm11{%k1}{z}");
+			asm volatile ("vpternlogq $0x96,%zmm10,%zmm11,%zmm1");
+			asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+
+			asm volatile ("vpsrlw  $4,%zmm10,%zmm11");
+			asm volatile ("vpandq  %zmm15,%zmm10,%zmm10");
+			asm volatile ("vpandq  %zmm15,%zmm11,%zmm11");
+
+			asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[d][0][0][0]));
+			asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[d][0][1][0]));
+			asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+			asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+			asm volatile ("vpternlogq $0x96,%zmm12,%zmm13,%zmm2");
+
+			asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[d][1][0][0]));
+			asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[d][1][1][0]));
+			asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+			asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+			asm volatile ("vpternlogq $0x96,%zmm12,%zmm13,%zmm3");
+
+			asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[d][2][0][0]));
+			asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[d][2][1][0]));
+			asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+			asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+			asm volatile ("vpternlogq $0x96,%zmm12,%zmm13,%zmm4");
+
+			asm volatile ("vbroadcasti32x4 %0,%%zmm12" : : "m" (gfgenpshufb[d][3][0][0]));
+			asm volatile ("vbroadcasti32x4 %0,%%zmm13" : : "m" (gfgenpshufb[d][3][1][0]));
+			asm volatile ("vpshufb %zmm10,%zmm12,%zmm12");
+			asm volatile ("vpshufb %zmm11,%zmm13,%zmm13");
+			asm volatile ("vpternlogq $0x96,%zmm12,%zmm13,%zmm5");
+		}
+
+		/* first disk with all coefficients at 1 */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[0][i]));
+
+		asm volatile ("vpmovb2m %zmm1,%k1");
+		asm volatile ("vpaddb %zmm1,%zmm1,%zmm1");
+		asm volatile ("vmovdqu8 %zmm14,%zmm11{%k1}{z}");
+		asm volatile ("vpternlogq $0x96,%zmm10,%zmm11,%zmm1");
+		asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+		asm volatile ("vpxorq %zmm10,%zmm2,%zmm2");
+		asm volatile ("vpxorq %zmm10,%zmm3,%zmm3");
+		asm volatile ("vpxorq %zmm10,%zmm4,%zmm4");
+		asm volatile ("vpxorq %zmm10,%zmm5,%zmm5");
+
+		asm volatile ("vmovntdq %%zmm0,%0" : "=m" (p[i]));
+		asm volatile ("vmovntdq %%zmm1,%0" : "=m" (q[i]));
+		asm volatile ("vmovntdq %%zmm2,%0" : "=m" (r[i]));
+		asm volatile ("vmovntdq %%zmm3,%0" : "=m" (s[i]));
+		asm volatile ("vmovntdq %%zmm4,%0" : "=m" (t[i]));
+		asm volatile ("vmovntdq %%zmm5,%0" : "=m" (u[i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+/*
+ * GEN6 (hexa parity with Cauchy matrix) GFNI implementation
+ *
+ * Note that it uses 16 registers, meaning that x64 is required.
+ */
+void raid_gen6_gfni(int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	uint8_t *q;
+	uint8_t *r;
+	uint8_t *s;
+	uint8_t *t;
+	uint8_t *u;
+	int d, l;
+	size_t i;
+
+	l = nd - 1;
+	p = v[nd];
+	q = v[nd + 1];
+	r = v[nd + 2];
+	s = v[nd + 3];
+	t = v[nd + 4];
+	u = v[nd + 5];
+
+	/* special case with only one data disk */
+	if (l == 0) {
+		for (i = 0; i < 6; ++i)
+			memcpy(v[1 + i], v[0], size);
+		return;
+	}
+
+	raid_avx_begin();
+
+	/* generic case with at least two data disks */
+	asm volatile ("vpbroadcastq %0,%%zmm14" : : "m" (gfmulgfni[2]));
+
+	for (i = 0; i < size; i += 64) {
+		/* last disk without the by two multiplication */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[l][i]));
+
+		asm volatile ("vmovdqa64 %zmm10,%zmm0");
+		asm volatile ("vmovdqa64 %zmm10,%zmm1");
+
+		asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm2" : : "m" (gfgengfni[l][0]));
+		asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm3" : : "m" (gfgengfni[l][1]));
+		asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm4" : : "m" (gfgengfni[l][2]));
+		asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm5" : : "m" (gfgengfni[l][3]));
+
+		/* intermediate disks */
+		for (d = l - 1; d > 0; --d) {
+			asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[d][i]));
+
+			asm volatile ("vgf2p8affineqb $0,%zmm14,%zmm1,%zmm1");
+			asm volatile ("vpxorq %zmm10,%zmm1,%zmm1");
+			asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm11" : : "m" (gfgengfni[d][0]));
+			asm volatile ("vpxorq %zmm11,%zmm2,%zmm2");
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm11" : : "m" (gfgengfni[d][1]));
+			asm volatile ("vpxorq %zmm11,%zmm3,%zmm3");
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm11" : : "m" (gfgengfni[d][2]));
+			asm volatile ("vpxorq %zmm11,%zmm4,%zmm4");
+			asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm10,%%zmm11" : : "m" (gfgengfni[d][3]));
+			asm volatile ("vpxorq %zmm11,%zmm5,%zmm5");
+		}
+
+		/* first disk with all coefficients at 1 */
+		asm volatile ("vmovdqa64 %0,%%zmm10" : : "m" (v[0][i]));
+
+		asm volatile ("vgf2p8affineqb $0,%zmm14,%zmm1,%zmm1");
+		asm volatile ("vpxorq %zmm10,%zmm1,%zmm1");
+		asm volatile ("vpxorq %zmm10,%zmm0,%zmm0");
+		asm volatile ("vpxorq %zmm10,%zmm2,%zmm2");
+		asm volatile ("vpxorq %zmm10,%zmm3,%zmm3");
+		asm volatile ("vpxorq %zmm10,%zmm4,%zmm4");
+		asm volatile ("vpxorq %zmm10,%zmm5,%zmm5");
+
+		asm volatile ("vmovntdq %%zmm0,%0" : "=m" (p[i]));
+		asm volatile ("vmovntdq %%zmm1,%0" : "=m" (q[i]));
+		asm volatile ("vmovntdq %%zmm2,%0" : "=m" (r[i]));
+		asm volatile ("vmovntdq %%zmm3,%0" : "=m" (s[i]));
+		asm volatile ("vmovntdq %%zmm4,%0" : "=m" (t[i]));
+		asm volatile ("vmovntdq %%zmm5,%0" : "=m" (u[i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
 #if defined(CONFIG_X86) && defined(CONFIG_SSSE3)
 /*
  * RAID recovering for one disk SSSE3 implementation
@@ -2450,3 +3299,389 @@ void raid_recX_avx2(int nr, int *id, int *ip, int nd, size_t size, void **vv)
 }
 #endif
 
+#if defined(CONFIG_X86) && defined(CONFIG_AVX512BW)
+/*
+ * RAID recovering for one disk AVX512BW implementation
+ */
+void raid_rec1_avx512bw(int nr, int *id, int *ip, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	uint8_t *pa;
+	uint8_t G;
+	uint8_t V;
+	size_t i;
+
+	(void)nr; /* unused, it's always 1 */
+
+	/* if it's RAID5 uses the faster function */
+	if (ip[0] == 0) {
+		raid_rec1of1(id, nd, size, vv);
+		return;
+	}
+
+	/* setup the coefficients matrix */
+	G = A(ip[0], id[0]);
+
+	/* invert it to solve the system of linear equations */
+	V = inv(G);
+
+	/* compute delta parity */
+	raid_delta_gen(1, id, ip, nd, size, vv);
+
+	p = v[nd + ip[0]];
+	pa = v[id[0]];
+
+	raid_avx_begin();
+
+	asm volatile ("vbroadcasti32x4 %0,%%zmm7" : : "m" (gfconst16.low4[0]));
+	asm volatile ("vbroadcasti32x4 %0,%%zmm4" : : "m" (gfmulpshufb[V][0][0]));
+	asm volatile ("vbroadcasti32x4 %0,%%zmm5" : : "m" (gfmulpshufb[V][1][0]));
+
+	for (i = 0; i < size; i += 64) {
+		asm volatile ("vmovdqa64 %0,%%zmm0" : : "m" (p[i]));
+		asm volatile ("vpxorq  %0,%%zmm0,%%zmm0" : : "m" (pa[i]));
+		asm volatile ("vpsrlw  $4,%zmm0,%zmm1");
+		asm volatile ("vpandq  %zmm7,%zmm0,%zmm0");
+		asm volatile ("vpandq  %zmm7,%zmm1,%zmm1");
+		asm volatile ("vpshufb %zmm0,%zmm4,%zmm2");
+		asm volatile ("vpshufb %zmm1,%zmm5,%zmm3");
+		asm volatile ("vpxorq  %zmm3,%zmm2,%zmm2");
+		asm volatile ("vmovdqa64 %%zmm2,%0" : "=m" (pa[i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
+#if defined(CONFIG_X86) && defined(CONFIG_AVX512BW)
+/*
+ * RAID recovering for two disks AVX512BW implementation
+ */
+void raid_rec2_avx512bw(int nr, int *id, int *ip, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	const int N = 2;
+	uint8_t *p[N];
+	uint8_t *pa[N];
+	uint8_t G[N * N];
+	uint8_t V[N * N];
+	size_t i;
+	int j, k;
+
+	(void)nr; /* unused, it's always 2 */
+
+	/* setup the coefficients matrix */
+	for (j = 0; j < N; ++j)
+		for (k = 0; k < N; ++k)
+			G[j * N + k] = A(ip[j], id[k]);
+
+	/* invert it to solve the system of linear equations */
+	raid_invert(G, V, N);
+
+	/* compute delta parity */
+	raid_delta_gen(N, id, ip, nd, size, vv);
+
+	for (j = 0; j < N; ++j) {
+		p[j] = v[nd + ip[j]];
+		pa[j] = v[id[j]];
+	}
+
+	raid_avx_begin();
+
+	asm volatile ("vbroadcasti32x4 %0,%%zmm7" : : "m" (gfconst16.low4[0]));
+
+	for (i = 0; i < size; i += 64) {
+		asm volatile ("vmovdqa64 %0,%%zmm0" : : "m" (p[0][i]));
+		asm volatile ("vmovdqa64 %0,%%zmm1" : : "m" (p[1][i]));
+		asm volatile ("vpxorq  %0,%%zmm0,%%zmm0" : : "m" (pa[0][i]));
+		asm volatile ("vpxorq  %0,%%zmm1,%%zmm1" : : "m" (pa[1][i]));
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm2" : : "m" (gfmulpshufb[V[0]][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm3" : : "m" (gfmulpshufb[V[0]][1][0]));
+		asm volatile ("vpsrlw  $4,%zmm0,%zmm5");
+		asm volatile ("vpandq  %zmm7,%zmm0,%zmm4");
+		asm volatile ("vpandq  %zmm7,%zmm5,%zmm5");
+		asm volatile ("vpshufb %zmm4,%zmm2,%zmm2");
+		asm volatile ("vpshufb %zmm5,%zmm3,%zmm3");
+		asm volatile ("vpxorq  %zmm3,%zmm2,%zmm6");
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm2" : : "m" (gfmulpshufb[V[1]][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm3" : : "m" (gfmulpshufb[V[1]][1][0]));
+		asm volatile ("vpsrlw  $4,%zmm1,%zmm5");
+		asm volatile ("vpandq  %zmm7,%zmm1,%zmm4");
+		asm volatile ("vpandq  %zmm7,%zmm5,%zmm5");
+		asm volatile ("vpshufb %zmm4,%zmm2,%zmm2");
+		asm volatile ("vpshufb %zmm5,%zmm3,%zmm3");
+		asm volatile ("vpternlogq $0x96,%zmm2,%zmm3,%zmm6");
+
+		asm volatile ("vmovdqa64 %%zmm6,%0" : "=m" (pa[0][i]));
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm2" : : "m" (gfmulpshufb[V[2]][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm3" : : "m" (gfmulpshufb[V[2]][1][0]));
+		asm volatile ("vpsrlw  $4,%zmm0,%zmm5");
+		asm volatile ("vpandq  %zmm7,%zmm0,%zmm4");
+		asm volatile ("vpandq  %zmm7,%zmm5,%zmm5");
+		asm volatile ("vpshufb %zmm4,%zmm2,%zmm2");
+		asm volatile ("vpshufb %zmm5,%zmm3,%zmm3");
+		asm volatile ("vpxorq  %zmm3,%zmm2,%zmm6");
+
+		asm volatile ("vbroadcasti32x4 %0,%%zmm2" : : "m" (gfmulpshufb[V[3]][0][0]));
+		asm volatile ("vbroadcasti32x4 %0,%%zmm3" : : "m" (gfmulpshufb[V[3]][1][0]));
+		asm volatile ("vpsrlw  $4,%zmm1,%zmm5");
+		asm volatile ("vpandq  %zmm7,%zmm1,%zmm4");
+		asm volatile ("vpandq  %zmm7,%zmm5,%zmm5");
+		asm volatile ("vpshufb %zmm4,%zmm2,%zmm2");
+		asm volatile ("vpshufb %zmm5,%zmm3,%zmm3");
+		asm volatile ("vpternlogq $0x96,%zmm2,%zmm3,%zmm6");
+
+		asm volatile ("vmovdqa64 %%zmm6,%0" : "=m" (pa[1][i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
+#if defined(CONFIG_X86) && defined(CONFIG_AVX512BW)
+/*
+ * RAID recovering AVX512BW implementation
+ */
+void raid_recX_avx512bw(int nr, int *id, int *ip, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	int N = nr;
+	uint8_t *p[RAID_PARITY_MAX];
+	uint8_t *pa[RAID_PARITY_MAX];
+	uint8_t G[RAID_PARITY_MAX * RAID_PARITY_MAX];
+	uint8_t V[RAID_PARITY_MAX * RAID_PARITY_MAX];
+	uint8_t buffer[RAID_PARITY_MAX*64+64];
+	uint8_t *pd = __align_ptr(buffer, 64);
+	size_t i;
+	int j, k;
+
+	/* setup the coefficients matrix */
+	for (j = 0; j < N; ++j)
+		for (k = 0; k < N; ++k)
+			G[j * N + k] = A(ip[j], id[k]);
+
+	/* invert it to solve the system of linear equations */
+	raid_invert(G, V, N);
+
+	/* compute delta parity */
+	raid_delta_gen(N, id, ip, nd, size, vv);
+
+	for (j = 0; j < N; ++j) {
+		p[j] = v[nd + ip[j]];
+		pa[j] = v[id[j]];
+	}
+
+	raid_avx_begin();
+
+	asm volatile ("vbroadcasti32x4 %0,%%zmm7" : : "m" (gfconst16.low4[0]));
+
+	for (i = 0; i < size; i += 64) {
+		/* delta */
+		for (j = 0; j < N; ++j) {
+			asm volatile ("vmovdqa64 %0,%%zmm0" : : "m" (p[j][i]));
+			asm volatile ("vpxorq  %0,%%zmm0,%%zmm0" : : "m" (pa[j][i]));
+			asm volatile ("vmovdqa64 %%zmm0,%0" : "=m" (pd[j*64]));
+		}
+
+		/* reconstruct */
+		for (j = 0; j < N; ++j) {
+			asm volatile ("vpxorq %zmm0,%zmm0,%zmm0");
+
+			for (k = 0; k < N; ++k) {
+				uint8_t m = V[j * N + k];
+
+				asm volatile ("vbroadcasti32x4 %0,%%zmm2" : : "m" (gfmulpshufb[m][0][0]));
+				asm volatile ("vbroadcasti32x4 %0,%%zmm3" : : "m" (gfmulpshufb[m][1][0]));
+				asm volatile ("vmovdqa64 %0,%%zmm4" : : "m" (pd[k*64]));
+				asm volatile ("vpsrlw  $4,%zmm4,%zmm5");
+				asm volatile ("vpandq  %zmm7,%zmm4,%zmm4");
+				asm volatile ("vpandq  %zmm7,%zmm5,%zmm5");
+				asm volatile ("vpshufb %zmm4,%zmm2,%zmm2");
+				asm volatile ("vpshufb %zmm5,%zmm3,%zmm3");
+				asm volatile ("vpternlogq $0x96,%zmm2,%zmm3,%zmm0");
+			}
+
+			asm volatile ("vmovdqa64 %%zmm0,%0" : "=m" (pa[j][i]));
+		}
+	}
+
+	raid_avx_end();
+}
+#endif
+
+#if defined(CONFIG_X86) && defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+/*
+ * RAID recovering for one disk GFNI implementation
+ */
+void raid_rec1_gfni(int nr, int *id, int *ip, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	uint8_t *p;
+	uint8_t *pa;
+	uint8_t G;
+	uint8_t V;
+	size_t i;
+
+	(void)nr; /* unused, it's always 1 */
+
+	/* if it's RAID5 uses the faster function */
+	if (ip[0] == 0) {
+		raid_rec1of1(id, nd, size, vv);
+		return;
+	}
+
+	/* setup the coefficients matrix */
+	G = A(ip[0], id[0]);
+
+	/* invert it to solve the system of linear equations */
+	V = inv(G);
+
+	/* compute delta parity */
+	raid_delta_gen(1, id, ip, nd, size, vv);
+
+	p = v[nd + ip[0]];
+	pa = v[id[0]];
+
+	raid_avx_begin();
+
+	asm volatile ("vpbroadcastq %0,%%zmm7" : : "m" (gfmulgfni[V]));
+
+	for (i = 0; i < size; i += 64) {
+		asm volatile ("vmovdqa64 %0,%%zmm0" : : "m" (p[i]));
+		asm volatile ("vpxorq  %0,%%zmm0,%%zmm0" : : "m" (pa[i]));
+		asm volatile ("vgf2p8affineqb $0,%zmm7,%zmm0,%zmm0");
+		asm volatile ("vmovdqa64 %%zmm0,%0" : "=m" (pa[i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
+#if defined(CONFIG_X86) && defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+/*
+ * RAID recovering for two disks GFNI implementation
+ */
+void raid_rec2_gfni(int nr, int *id, int *ip, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	const int N = 2;
+	uint8_t *p[N];
+	uint8_t *pa[N];
+	uint8_t G[N * N];
+	uint8_t V[N * N];
+	size_t i;
+	int j, k;
+
+	(void)nr; /* unused, it's always 2 */
+
+	/* setup the coefficients matrix */
+	for (j = 0; j < N; ++j)
+		for (k = 0; k < N; ++k)
+			G[j * N + k] = A(ip[j], id[k]);
+
+	/* invert it to solve the system of linear equations */
+	raid_invert(G, V, N);
+
+	/* compute delta parity */
+	raid_delta_gen(N, id, ip, nd, size, vv);
+
+	for (j = 0; j < N; ++j) {
+		p[j] = v[nd + ip[j]];
+		pa[j] = v[id[j]];
+	}
+
+	raid_avx_begin();
+
+	asm volatile ("vpbroadcastq %0,%%zmm4" : : "m" (gfmulgfni[V[0]]));
+	asm volatile ("vpbroadcastq %0,%%zmm5" : : "m" (gfmulgfni[V[1]]));
+	asm volatile ("vpbroadcastq %0,%%zmm6" : : "m" (gfmulgfni[V[2]]));
+	asm volatile ("vpbroadcastq %0,%%zmm7" : : "m" (gfmulgfni[V[3]]));
+
+	for (i = 0; i < size; i += 64) {
+		asm volatile ("vmovdqa64 %0,%%zmm0" : : "m" (p[0][i]));
+		asm volatile ("vmovdqa64 %0,%%zmm1" : : "m" (p[1][i]));
+		asm volatile ("vpxorq  %0,%%zmm0,%%zmm0" : : "m" (pa[0][i]));
+		asm volatile ("vpxorq  %0,%%zmm1,%%zmm1" : : "m" (pa[1][i]));
+
+		asm volatile ("vgf2p8affineqb $0,%zmm4,%zmm0,%zmm2");
+		asm volatile ("vgf2p8affineqb $0,%zmm5,%zmm1,%zmm3");
+		asm volatile ("vpxorq  %zmm3,%zmm2,%zmm2");
+		asm volatile ("vmovdqa64 %%zmm2,%0" : "=m" (pa[0][i]));
+
+		asm volatile ("vgf2p8affineqb $0,%zmm6,%zmm0,%zmm2");
+		asm volatile ("vgf2p8affineqb $0,%zmm7,%zmm1,%zmm3");
+		asm volatile ("vpxorq  %zmm3,%zmm2,%zmm2");
+		asm volatile ("vmovdqa64 %%zmm2,%0" : "=m" (pa[1][i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+
+#if defined(CONFIG_X86) && defined(CONFIG_AVX512BW) && defined(CONFIG_GFNI)
+/*
+ * RAID recovering GFNI implementation
+ */
+void raid_recX_gfni(int nr, int *id, int *ip, int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t **)vv;
+	int N = nr;
+	uint8_t *p[RAID_PARITY_MAX];
+	uint8_t *pa[RAID_PARITY_MAX];
+	uint8_t G[RAID_PARITY_MAX * RAID_PARITY_MAX];
+	uint8_t V[RAID_PARITY_MAX * RAID_PARITY_MAX];
+	uint8_t buffer[RAID_PARITY_MAX*64+64];
+	uint8_t *pd = __align_ptr(buffer, 64);
+	size_t i;
+	int j, k;
+
+	/* setup the coefficients matrix */
+	for (j = 0; j < N; ++j)
+		for (k = 0; k < N; ++k)
+			G[j * N + k] = A(ip[j], id[k]);
+
+	/* invert it to solve the system of linear equations */
+	raid_invert(G, V, N);
+
+	/* compute delta parity */
+	raid_delta_gen(N, id, ip, nd, size, vv);
+
+	for (j = 0; j < N; ++j) {
+		p[j] = v[nd + ip[j]];
+		pa[j] = v[id[j]];
+	}
+
+	raid_avx_begin();
+
+	for (i = 0; i < size; i += 64) {
+		/* delta */
+		for (j = 0; j < N; ++j) {
+			asm volatile ("vmovdqa64 %0,%%zmm0" : : "m" (p[j][i]));
+			asm volatile ("vpxorq  %0,%%zmm0,%%zmm0" : : "m" (pa[j][i]));
+			asm volatile ("vmovdqa64 %%zmm0,%0" : "=m" (pd[j*64]));
+		}
+
+		/* reconstruct */
+		for (j = 0; j < N; ++j) {
+			asm volatile ("vpxorq %zmm0,%zmm0,%zmm0");
+
+			for (k = 0; k < N; ++k) {
+				uint8_t m = V[j * N + k];
+
+				asm volatile ("vmovdqa64 %0,%%zmm1" : : "m" (pd[k*64]));
+				asm volatile ("vgf2p8affineqb $0,%0%{1to8%},%%zmm1,%%zmm1" : : "m" (gfmulgfni[m]));
+				asm volatile ("vpxorq %zmm1,%zmm0,%zmm0");
+			}
+
+			asm volatile ("vmovdqa64 %%zmm0,%0" : "=m" (pa[j][i]));
+		}
+	}
+
+	raid_avx_end();
+}
+#endif
+
@@ -253,3 +253,57 @@ void raid_genz_avx2ext(int nd, size_t size, void **vv)
 }
 #endif
 
+#if defined(CONFIG_X86_64) && defined(CONFIG_AVX512BW)
+/*
+ * GENz (triple parity with powers of 2^-1) AVX512BW implementation
+ *
+ * Note that it uses more than 8 registers, meaning that x64 is required.
+ */
+void raid_genz_avx512bw(int nd, size_t size, void **vv)
+{
+	uint8_t **v = (uint8_t**)vv;
+	uint8_t *p;
+	uint8_t *q;
+	uint8_t *r;
+	int d, l;
+	size_t i;
+
+	l = nd - 1;
+	p = v[nd];
+	q = v[nd + 1];
+	r = v[nd + 2];
+
+	raid_avx_begin();
+
+	asm volatile ("vbroadcasti32x4 %0,%%zmm7" : : "m" (gfzconst16.poly[0]));
+	asm volatile ("vbroadcasti32x4 %0,%%zmm3" : : "m" (gfzconst16.half[0]));
+	asm volatile ("vbroadcasti32x4 %0,%%zmm6" : : "m" (gfzconst16.low7[0]));
+
+	for (i = 0; i < size; i += 64) {
+		asm volatile ("vmovdqa64 %0,%%zmm0" : : "m" (v[l][i]));
+		asm volatile ("vmovdqa64 %zmm0,%zmm1");
+		asm volatile ("vmovdqa64 %zmm0,%zmm2");
+		for (d = l - 1; d >= 0; --d) {
+			asm volatile ("vpsllw $7,%zmm2,%zmm5");
+			asm volatile ("vpsrlw $1,%zmm2,%zmm2");
+			asm volatile ("vpmovb2m %zmm1,%k1");
+			asm volatile ("vpmovb2m %zmm5,%k2");
+			asm volatile ("vpaddb %zmm1,%zmm1,%zmm1");
+			asm volatile ("vpandq %zmm6,%zmm2,%zmm2");
+			asm volatile ("vmovdqu8 %zmm7,%zmm4{%k1}{z}");
+			asm volatile ("vmovdqu8 %zmm3,%zmm5{%k2}{z}");
+
+			asm volatile ("vmovdqa64 %0,%%zmm8" : : "m" (v[d][i]));
+			asm volatile ("vpxorq %zmm8,%zmm0,%zmm0");
+			asm volatile ("vpternlogq $0x96,%zmm8,%zmm4,%zmm1");
+			asm volatile ("vpternlogq $0x96,%zmm8,%zmm5,%zmm2");
+		}
+		asm volatile ("vmovntdq %%zmm0,%0" : "=m" (p[i]));
+		asm volatile ("vmovntdq %%zmm1,%0" : "=m" (q[i]));
+		asm volatile ("vmovntdq %%zmm2,%0" : "=m" (r[i]));
+	}
+
+	raid_avx_end();
+}
+#endif
+